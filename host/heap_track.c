@@ -0,0 +1,114 @@
+#include "heap_track.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define HEAP_TRACK_ASAN 1
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define HEAP_TRACK_ASAN 1
+#endif
+
+static atomic_uint_fast64_t _allocations;
+static atomic_int_fast64_t _in_use;
+
+#if HEAP_TRACK_ASAN
+// From sanitizer/allocator_interface.h, which GCC doesn't install
+int __sanitizer_install_malloc_and_free_hooks(void (*malloc_hook)(const volatile void *, size_t),
+                                              void (*free_hook)(const volatile void *));
+size_t __sanitizer_get_allocated_size(const volatile void *p);
+
+static void on_malloc(const volatile void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&_allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_in_use, size, memory_order_relaxed);
+}
+
+static void on_free(const volatile void *ptr) {
+    atomic_fetch_sub_explicit(&_in_use, __sanitizer_get_allocated_size(ptr),
+                              memory_order_relaxed);
+}
+
+void heap_track_start(void) {
+    __sanitizer_install_malloc_and_free_hooks(on_malloc, on_free);
+}
+#else
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+// glibc's own calls come through here too, so everything is seen: sizes are
+// what the allocator actually handed out
+static void *allocated(void *ptr) {
+    if (ptr != NULL) {
+        atomic_fetch_add_explicit(&_allocations, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&_in_use, malloc_usable_size(ptr), memory_order_relaxed);
+    }
+    return ptr;
+}
+
+static void freeing(void *ptr) {
+    if (ptr != NULL) {
+        atomic_fetch_sub_explicit(&_in_use, malloc_usable_size(ptr), memory_order_relaxed);
+    }
+}
+
+void *malloc(size_t size) {
+    return allocated(__libc_malloc(size));
+}
+
+void *calloc(size_t n, size_t size) {
+    return allocated(__libc_calloc(n, size));
+}
+
+void *realloc(void *ptr, size_t size) {
+    size_t old = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    void *moved = __libc_realloc(ptr, size);
+    if (moved == NULL) {
+        // Freed with size 0, or failed and left alone
+        if (size == 0) {
+            atomic_fetch_sub_explicit(&_in_use, old, memory_order_relaxed);
+        }
+        return NULL;
+    }
+    atomic_fetch_sub_explicit(&_in_use, old, memory_order_relaxed);
+    return allocated(moved);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    return allocated(__libc_memalign(alignment, size));
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return allocated(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    void *ptr = allocated(__libc_memalign(alignment, size));
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void free(void *ptr) {
+    freeing(ptr);
+    __libc_free(ptr);
+}
+
+void heap_track_start(void) {
+}
+#endif
+
+void heap_track_get(heap_track_t *out) {
+    out->allocations = atomic_load_explicit(&_allocations, memory_order_relaxed);
+    out->in_use = atomic_load_explicit(&_in_use, memory_order_relaxed);
+}
@@ -0,0 +1,21 @@
+#ifndef HEAP_TRACK_H
+#define HEAP_TRACK_H
+
+#include <stdint.h>
+
+// Counts heap allocations and the bytes in use across the whole process, by
+// wrapping malloc() and friends, or under AddressSanitizer with its hooks.
+// Compile heap_track.c into the executable itself rather than a library, so
+// the wrappers are always the ones linked.
+typedef struct {
+    uint64_t allocations;   // malloc, calloc, realloc and aligned allocations
+    int64_t in_use;         // bytes allocated and not yet freed
+} heap_track_t;
+
+// Installs the hooks under AddressSanitizer; the wrappers count from the start
+void heap_track_start(void);
+
+// Totals so far; the difference of two snapshots is what happened in between
+void heap_track_get(heap_track_t *out);
+
+#endif // HEAP_TRACK_H
@@ -0,0 +1,74 @@
+#include "host_sender.h"
+
+#include <time.h>
+
+#include "esp_timer.h"
+#include "key_log.h"
+
+void host_sender_init(host_sender_t *sender) {
+    sender->pipeline = NULL;
+    pthread_mutex_init(&sender->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sender->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    sender->notified = false;
+    sender->stopping = false;
+}
+
+void host_sender_notify(void *arg) {
+    host_sender_t *sender = arg;
+    pthread_mutex_lock(&sender->lock);
+    sender->notified = true;
+    pthread_cond_signal(&sender->cond);
+    pthread_mutex_unlock(&sender->lock);
+}
+
+static void *host_sender_thread(void *arg) {
+    host_sender_t *sender = arg;
+    key_pipeline_t *pipeline = sender->pipeline;
+
+    for (;;) {
+        int64_t due_us = key_pipeline_due_in(pipeline, esp_timer_get_time());
+
+        pthread_mutex_lock(&sender->lock);
+        if (!sender->notified && due_us >= 0) {
+            // Wake up in time to send a batch that's still waiting for company
+            int64_t deadline = esp_timer_get_time() + due_us;
+            struct timespec ts = {
+                .tv_sec = deadline / 1000000,
+                .tv_nsec = (deadline % 1000000) * 1000,
+            };
+            pthread_cond_timedwait(&sender->cond, &sender->lock, &ts);
+        }
+        while (!sender->notified && !sender->stopping && due_us < 0) {
+            pthread_cond_wait(&sender->cond, &sender->lock);
+        }
+        sender->notified = false;
+        bool stopping = sender->stopping;
+        pthread_mutex_unlock(&sender->lock);
+
+        key_pipeline_process(pipeline);
+        // Stands in for the device's log task
+        key_log_drain();
+
+        // Clock pings would keep it going forever
+        if (stopping && key_pipeline_idle(pipeline)) {
+            return NULL;
+        }
+    }
+}
+
+void host_sender_start(host_sender_t *sender, key_pipeline_t *pipeline) {
+    sender->pipeline = pipeline;
+    pthread_create(&sender->thread, NULL, host_sender_thread, sender);
+}
+
+void host_sender_stop(host_sender_t *sender) {
+    pthread_mutex_lock(&sender->lock);
+    sender->stopping = true;
+    pthread_cond_signal(&sender->cond);
+    pthread_mutex_unlock(&sender->lock);
+    pthread_join(sender->thread, NULL);
+}
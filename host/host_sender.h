@@ -0,0 +1,30 @@
+#ifndef HOST_SENDER_H
+#define HOST_SENDER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "key_pipeline.h"
+
+// A pthread playing the part of sender_task in main.c: sleeps until notified
+// or until a pending batch is due, then runs key_pipeline_process().
+typedef struct {
+    key_pipeline_t *pipeline;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool notified;
+    bool stopping;
+} host_sender_t;
+
+void host_sender_init(host_sender_t *sender);
+
+// Pass as the `notify` callback to key_pipeline_init(), with the sender as arg
+void host_sender_notify(void *arg);
+
+void host_sender_start(host_sender_t *sender, key_pipeline_t *pipeline);
+
+// Sends whatever is still queued or batched, then stops the thread
+void host_sender_stop(host_sender_t *sender);
+
+#endif // HOST_SENDER_H
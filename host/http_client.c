@@ -0,0 +1,200 @@
+#include "http_client.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+void http_client_init(http_client_t *client, const char *host, uint16_t port) {
+    memset(client, 0, sizeof(*client));
+    snprintf(client->host, sizeof(client->host), "%s", host);
+    client->port = port;
+    client->timeout_ms = CONFIG_KEY_HTTP_TIMEOUT_MS;
+    client->fd = -1;
+}
+
+void http_client_close(http_client_t *client) {
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+}
+
+static esp_err_t http_client_connect(http_client_t *client) {
+    const char *TAG = "http_client_connect";
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    char port[8];
+    snprintf(port, sizeof(port), "%u", client->port);
+    if (getaddrinfo(client->host, port, &hints, &res) != 0) {
+        ESP_LOGE(TAG, "Can't resolve %s", client->host);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(res);
+        return ESP_FAIL;
+    }
+    struct timeval tv = {
+        .tv_sec = client->timeout_ms / 1000,
+        .tv_usec = (client->timeout_ms % 1000) * 1000,
+    };
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int rc = connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Connecting to %s:%u failed: %s", client->host, client->port, strerror(errno));
+        close(fd);
+        return ESP_FAIL;
+    }
+
+    client->fd = fd;
+    client->stats.connects++;
+    return ESP_OK;
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads one response, leaving the socket positioned at the next one
+static esp_err_t read_response(http_client_t *client, int *status, bool *keep_alive) {
+    size_t used = 0;
+    char *end = NULL;
+    while (end == NULL) {
+        if (used == sizeof(client->buf) - 1) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        ssize_t n = recv(client->fd, client->buf + used, sizeof(client->buf) - 1 - used, 0);
+        if (n <= 0) {
+            return n == 0 ? ESP_FAIL : ESP_ERR_TIMEOUT;
+        }
+        used += n;
+        client->buf[used] = '\0';
+        end = strstr(client->buf, "\r\n\r\n");
+    }
+
+    if (sscanf(client->buf, "HTTP/1.%*d %d", status) != 1) {
+        return ESP_FAIL;
+    }
+
+    long content_length = 0;
+    *keep_alive = true;
+    for (char *line = strstr(client->buf, "\r\n"); line != NULL && line < end;
+         line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            content_length = strtol(line + 17, NULL, 10);
+        } else if (strncasecmp(line + 2, "Connection: close", 17) == 0) {
+            *keep_alive = false;
+        }
+    }
+
+    // Discard the body
+    long remaining = content_length - (long)(client->buf + used - (end + 4));
+    while (remaining > 0) {
+        size_t chunk = remaining < (long)sizeof(client->buf) ? (size_t)remaining : sizeof(client->buf);
+        ssize_t n = recv(client->fd, client->buf, chunk, 0);
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        remaining -= n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t http_client_request(http_client_t *client, const char *method, const char *path,
+                              const char *content_type, const char *body, int body_len,
+                              int *status) {
+    char head[512];
+    int head_len;
+    if (body != NULL) {
+        head_len = snprintf(head, sizeof(head),
+                            "%s %s HTTP/1.1\r\nHost: %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+                            method, path, client->host, content_type, body_len);
+    } else {
+        head_len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s\r\n\r\n",
+                            method, path, client->host);
+    }
+    if (head_len < 0 || head_len >= (int)sizeof(head)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    client->stats.requests++;
+    esp_err_t ret = ESP_FAIL;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = client->fd >= 0;
+        if (!reused && (ret = http_client_connect(client)) != ESP_OK) {
+            break;
+        }
+
+        bool keep_alive = true;
+        if (write_all(client->fd, head, head_len) &&
+            (body == NULL || write_all(client->fd, body, body_len)) &&
+            (ret = read_response(client, status, &keep_alive)) == ESP_OK) {
+            if (reused) {
+                client->stats.reuses++;
+            }
+            if (!keep_alive) {
+                http_client_close(client);
+            }
+            return ESP_OK;
+        }
+        if (ret == ESP_OK) {
+            ret = ESP_FAIL;
+        }
+
+        http_client_close(client);
+        if (!reused) {
+            break;
+        }
+        client->stats.reconnects++;
+    }
+
+    client->stats.failures++;
+    *status = 0;
+    return ret;
+}
+
+static esp_err_t transport_get(void *ctx, const char *path, int *status) {
+    return http_client_request(ctx, "GET", path, NULL, NULL, 0, status);
+}
+
+static esp_err_t transport_post(void *ctx, const char *path, const char *content_type,
+                                const char *body, int body_len, int *status) {
+    return http_client_request(ctx, "POST", path, content_type, body, body_len, status);
+}
+
+key_transport_t http_client_transport(http_client_t *client) {
+    key_transport_t transport = {
+        .get = transport_get,
+        .post = transport_post,
+        .ctx = client,
+    };
+    return transport;
+}
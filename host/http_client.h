@@ -0,0 +1,40 @@
+#ifndef HOST_HTTP_CLIENT_H
+#define HOST_HTTP_CLIENT_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "key_transport.h"
+
+// Minimal blocking HTTP/1.1 client over one keep-alive socket; the host
+// build's counterpart of http_conn. Counters mirror http_conn_stats_t.
+typedef struct {
+    uint32_t requests;
+    uint32_t connects;
+    uint32_t reuses;
+    uint32_t reconnects;
+    uint32_t failures;
+} http_client_stats_t;
+
+typedef struct {
+    char host[64];
+    uint16_t port;
+    int timeout_ms;
+    int fd;
+    http_client_stats_t stats;
+    char buf[2048];
+} http_client_t;
+
+void http_client_init(http_client_t *client, const char *host, uint16_t port);
+
+// Sends one request and reads the whole response. `body` may be NULL.
+esp_err_t http_client_request(http_client_t *client, const char *method, const char *path,
+                              const char *content_type, const char *body, int body_len,
+                              int *status);
+
+void http_client_close(http_client_t *client);
+
+// A transport for key_pipeline_init() backed by `client`
+key_transport_t http_client_transport(http_client_t *client);
+
+#endif // HOST_HTTP_CLIENT_H
@@ -0,0 +1,98 @@
+#include "http_pool.h"
+
+#include <string.h>
+
+void http_pool_init(http_pool_t *pool, const char *host, uint16_t port, uint32_t workers) {
+    memset(pool, 0, sizeof(*pool));
+    if (workers > HTTP_POOL_MAX_WORKERS) {
+        workers = HTTP_POOL_MAX_WORKERS;
+    }
+    pool->workers = workers;
+    for (uint32_t i = 0; i < workers; i++) {
+        http_client_init(&pool->clients[i], host, port);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+}
+
+static void *http_pool_worker(void *arg) {
+    http_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    http_client_t *client = &pool->clients[pool->started++];
+    pthread_mutex_unlock(&pool->lock);
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->count == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->count == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        key_request_t *request = pool->requests[pool->head];
+        pool->head = (pool->head + 1) % HTTP_POOL_MAX_WORKERS;
+        pool->count--;
+        pthread_mutex_unlock(&pool->lock);
+
+        request->ret = http_client_request(client, request->content_type ? "POST" : "GET",
+                                           request->path, request->content_type,
+                                           request->body, request->body_len, &request->status);
+        request->done(request);
+    }
+}
+
+void http_pool_start(http_pool_t *pool) {
+    for (uint32_t i = 0; i < pool->workers; i++) {
+        pthread_create(&pool->threads[i], NULL, http_pool_worker, pool);
+    }
+}
+
+void http_pool_stop(http_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < pool->workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+        http_client_close(&pool->clients[i]);
+    }
+}
+
+void http_pool_get_stats(const http_pool_t *pool, http_client_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t i = 0; i < pool->workers; i++) {
+        const http_client_stats_t *s = &pool->clients[i].stats;
+        stats->requests += s->requests;
+        stats->connects += s->connects;
+        stats->reuses += s->reuses;
+        stats->reconnects += s->reconnects;
+        stats->failures += s->failures;
+    }
+}
+
+static esp_err_t transport_start(void *ctx, key_request_t *request) {
+    http_pool_t *pool = ctx;
+    esp_err_t ret = ESP_OK;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count == HTTP_POOL_MAX_WORKERS || pool->stopping) {
+        ret = ESP_ERR_NO_MEM;
+    } else {
+        pool->requests[(pool->head + pool->count) % HTTP_POOL_MAX_WORKERS] = request;
+        pool->count++;
+        pthread_cond_signal(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return ret;
+}
+
+key_transport_t http_pool_transport(http_pool_t *pool) {
+    key_transport_t transport = {
+        .start = transport_start,
+        .max_inflight = pool->workers,
+        .ctx = pool,
+    };
+    return transport;
+}
@@ -0,0 +1,43 @@
+#ifndef HOST_HTTP_POOL_H
+#define HOST_HTTP_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "http_client.h"
+#include "key_transport.h"
+
+#define HTTP_POOL_MAX_WORKERS 16
+
+// Asynchronous transport: a fixed set of worker threads, each with its own
+// keep-alive http_client, taking requests from a shared FIFO. The host
+// build's counterpart of main/http_pool.c.
+typedef struct {
+    http_client_t clients[HTTP_POOL_MAX_WORKERS];
+    pthread_t threads[HTTP_POOL_MAX_WORKERS];
+    uint32_t workers;
+    uint32_t started;       // workers that have picked their client
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    key_request_t *requests[HTTP_POOL_MAX_WORKERS];
+    uint32_t head;
+    uint32_t count;
+    bool stopping;
+} http_pool_t;
+
+void http_pool_init(http_pool_t *pool, const char *host, uint16_t port, uint32_t workers);
+
+void http_pool_start(http_pool_t *pool);
+
+// Finishes the requests already started, then stops the workers
+void http_pool_stop(http_pool_t *pool);
+
+// Sums the workers' connection counters
+void http_pool_get_stats(const http_pool_t *pool, http_client_stats_t *stats);
+
+// A transport for key_pipeline_init() that runs up to `workers` requests at once
+key_transport_t http_pool_transport(http_pool_t *pool);
+
+#endif // HOST_HTTP_POOL_H
@@ -0,0 +1,214 @@
+#include "http_sink.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define HTTP_SINK_MAX_CONNECTIONS 64
+#define HTTP_SINK_BUF_LEN 16384
+
+struct http_sink {
+    http_sink_config_t config;
+    int listen_fd;
+    uint16_t port;
+    pthread_t accept_thread;
+    pthread_mutex_t lock;
+    http_sink_stats_t stats;
+    int fds[HTTP_SINK_MAX_CONNECTIONS];
+    pthread_t threads[HTTP_SINK_MAX_CONNECTIONS];
+    int count;
+};
+
+typedef struct {
+    http_sink_t *sink;
+    int fd;
+    int index;
+} http_sink_conn_t;
+
+static void *http_sink_conn_thread(void *arg) {
+    http_sink_conn_t *conn = arg;
+    http_sink_t *sink = conn->sink;
+    int fd = conn->fd;
+    int index = conn->index;
+    free(conn);
+
+    char *buf = malloc(HTTP_SINK_BUF_LEN + 1);
+    buf[0] = '\0';
+    size_t used = 0;
+    for (;;) {
+        char *end;
+        while ((end = strstr(buf, "\r\n\r\n")) == NULL || used == 0) {
+            if (used == HTTP_SINK_BUF_LEN) {
+                goto done;
+            }
+            ssize_t n = recv(fd, buf + used, HTTP_SINK_BUF_LEN - used, 0);
+            if (n <= 0) {
+                goto done;
+            }
+            used += n;
+            buf[used] = '\0';
+        }
+
+        char method[8], path[256];
+        if (sscanf(buf, "%7s %255s", method, path) != 2) {
+            goto done;
+        }
+        long content_length = 0;
+        for (char *line = strstr(buf, "\r\n"); line != NULL && line < end;
+             line = strstr(line + 2, "\r\n")) {
+            if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+                content_length = strtol(line + 17, NULL, 10);
+            }
+        }
+
+        size_t head_len = end + 4 - buf;
+        if (content_length < 0 || head_len + content_length > HTTP_SINK_BUF_LEN) {
+            goto done;
+        }
+        while (used < head_len + content_length) {
+            ssize_t n = recv(fd, buf + used, HTTP_SINK_BUF_LEN - used, 0);
+            if (n <= 0) {
+                goto done;
+            }
+            used += n;
+        }
+        buf[used] = '\0';
+
+        if (sink->config.delay_us) {
+            usleep(sink->config.delay_us);
+        }
+        if (sink->config.on_request != NULL) {
+            sink->config.on_request(sink->config.on_request_arg, method, path,
+                                    buf + head_len, (int)content_length);
+        }
+
+        pthread_mutex_lock(&sink->lock);
+        sink->stats.requests++;
+        if (strcmp(method, "GET") == 0) {
+            sink->stats.gets++;
+        } else if (strcmp(method, "POST") == 0) {
+            sink->stats.posts++;
+        }
+        sink->stats.bytes_received += head_len + content_length;
+        pthread_mutex_unlock(&sink->lock);
+
+        bool rejected = sink->config.reject_path != NULL &&
+                        strcmp(path, sink->config.reject_path) == 0;
+        const char *response = rejected
+            ? "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"
+            : "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+        if (send(fd, response, strlen(response), MSG_NOSIGNAL) < 0) {
+            goto done;
+        }
+
+        // Keep whatever belongs to the next request
+        size_t consumed = head_len + content_length;
+        memmove(buf, buf + consumed, used - consumed);
+        used -= consumed;
+        buf[used] = '\0';
+    }
+
+done:
+    free(buf);
+    pthread_mutex_lock(&sink->lock);
+    sink->fds[index] = -1;
+    close(fd);
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+static void *http_sink_accept_thread(void *arg) {
+    http_sink_t *sink = arg;
+    for (;;) {
+        int fd = accept(sink->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return NULL;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        pthread_mutex_lock(&sink->lock);
+        if (sink->count == HTTP_SINK_MAX_CONNECTIONS) {
+            pthread_mutex_unlock(&sink->lock);
+            close(fd);
+            continue;
+        }
+        http_sink_conn_t *conn = malloc(sizeof(*conn));
+        conn->sink = sink;
+        conn->fd = fd;
+        conn->index = sink->count;
+        sink->fds[sink->count] = fd;
+        pthread_create(&sink->threads[sink->count], NULL, http_sink_conn_thread, conn);
+        sink->count++;
+        sink->stats.connections++;
+        pthread_mutex_unlock(&sink->lock);
+    }
+}
+
+http_sink_t *http_sink_start(const http_sink_config_t *config) {
+    http_sink_t *sink = calloc(1, sizeof(*sink));
+    sink->config = *config;
+    pthread_mutex_init(&sink->lock, NULL);
+
+    sink->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(sink->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(config->port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    if (sink->listen_fd < 0 ||
+        bind(sink->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(sink->listen_fd, 16) != 0 ||
+        getsockname(sink->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        perror("http_sink_start");
+        if (sink->listen_fd >= 0) {
+            close(sink->listen_fd);
+        }
+        free(sink);
+        return NULL;
+    }
+    sink->port = ntohs(addr.sin_port);
+
+    pthread_create(&sink->accept_thread, NULL, http_sink_accept_thread, sink);
+    return sink;
+}
+
+uint16_t http_sink_port(const http_sink_t *sink) {
+    return sink->port;
+}
+
+void http_sink_get_stats(http_sink_t *sink, http_sink_stats_t *stats) {
+    pthread_mutex_lock(&sink->lock);
+    *stats = sink->stats;
+    pthread_mutex_unlock(&sink->lock);
+}
+
+void http_sink_stop(http_sink_t *sink) {
+    shutdown(sink->listen_fd, SHUT_RDWR);
+    close(sink->listen_fd);
+    pthread_join(sink->accept_thread, NULL);
+
+    pthread_mutex_lock(&sink->lock);
+    for (int i = 0; i < sink->count; i++) {
+        if (sink->fds[i] >= 0) {
+            shutdown(sink->fds[i], SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&sink->lock);
+    for (int i = 0; i < sink->count; i++) {
+        pthread_join(sink->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&sink->lock);
+    free(sink);
+}
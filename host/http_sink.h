@@ -0,0 +1,41 @@
+#ifndef HOST_HTTP_SINK_H
+#define HOST_HTTP_SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Loopback stand-in for the server at SERVER_IP. Accepts keep-alive
+// connections, answers every request with an empty 200 and counts what it
+// saw. Each connection is served by its own thread.
+
+typedef struct {
+    uint16_t port;              // 0 picks a free port
+    uint32_t delay_us;          // simulated server processing time per request
+    const char *reject_path;    // requests to this path get a 404, e.g. to
+                                // exercise the batch fallback
+    // Called for every request, from the connection's thread
+    void (*on_request)(void *arg, const char *method, const char *path,
+                       const char *body, int body_len);
+    void *on_request_arg;
+} http_sink_config_t;
+
+typedef struct {
+    uint32_t connections;
+    uint32_t requests;
+    uint32_t gets;
+    uint32_t posts;
+    uint64_t bytes_received;
+} http_sink_stats_t;
+
+typedef struct http_sink http_sink_t;
+
+// Returns NULL if the socket can't be set up
+http_sink_t *http_sink_start(const http_sink_config_t *config);
+
+uint16_t http_sink_port(const http_sink_t *sink);
+
+void http_sink_get_stats(http_sink_t *sink, http_sink_stats_t *stats);
+
+void http_sink_stop(http_sink_t *sink);
+
+#endif // HOST_HTTP_SINK_H
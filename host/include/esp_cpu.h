@@ -0,0 +1,10 @@
+#ifndef HOST_ESP_CPU_H
+#define HOST_ESP_CPU_H
+
+#include <stdint.h>
+
+// Stands in for the CPU cycle counter. Counts nanoseconds, which is why the
+// host sdkconfig.h claims a 1000MHz CPU.
+uint32_t esp_cpu_get_cycle_count(void);
+
+#endif // HOST_ESP_CPU_H
@@ -0,0 +1,146 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// Stand-in for the sdkconfig.h that the IDF build generates from Kconfig.
+// Defaults match main/Kconfig.projbuild; any of these can be overridden from
+// the host CMake command line, e.g. -DCONFIG_KEY_QUEUE_DEPTH=64.
+
+#ifndef CONFIG_KEY_QUEUE_DEPTH
+#define CONFIG_KEY_QUEUE_DEPTH 32
+#endif
+
+#if !defined(CONFIG_KEY_QUEUE_OVERFLOW_DROP_OLDEST) && \
+    !defined(CONFIG_KEY_QUEUE_OVERFLOW_DROP_NEWEST) && \
+    !defined(CONFIG_KEY_QUEUE_OVERFLOW_COALESCE)
+#define CONFIG_KEY_QUEUE_OVERFLOW_DROP_OLDEST 1
+#endif
+
+#ifndef CONFIG_KEY_REPEAT_ENABLE
+#define CONFIG_KEY_REPEAT_ENABLE 0
+#endif
+
+#if CONFIG_KEY_REPEAT_ENABLE
+#ifndef CONFIG_KEY_REPEAT_DELAY_MS
+#define CONFIG_KEY_REPEAT_DELAY_MS 500
+#endif
+#ifndef CONFIG_KEY_REPEAT_INTERVAL_MS
+#define CONFIG_KEY_REPEAT_INTERVAL_MS 100
+#endif
+#endif
+
+#ifndef CONFIG_KEY_COALESCE_RUNS
+#define CONFIG_KEY_COALESCE_RUNS 0
+#endif
+
+#ifndef CONFIG_KEY_PRIORITY_ENABLE
+#define CONFIG_KEY_PRIORITY_ENABLE 1
+#endif
+
+#if CONFIG_KEY_PRIORITY_ENABLE
+#ifndef CONFIG_KEY_PRIORITY_QUEUE_DEPTH
+#define CONFIG_KEY_PRIORITY_QUEUE_DEPTH 8
+#endif
+#ifndef CONFIG_KEY_PRIORITY_HIGH_DEADLINE_MS
+#define CONFIG_KEY_PRIORITY_HIGH_DEADLINE_MS 0
+#endif
+#ifndef CONFIG_KEY_PRIORITY_NORMAL_DEADLINE_MS
+#define CONFIG_KEY_PRIORITY_NORMAL_DEADLINE_MS 0
+#endif
+#endif
+
+// esp_cpu_get_cycle_count() counts nanoseconds on the host
+#ifndef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 1000
+#endif
+
+#ifndef CONFIG_KEY_LOG_RING_DEPTH
+#define CONFIG_KEY_LOG_RING_DEPTH 64
+#endif
+
+#ifndef CONFIG_KEY_LOG_RATE_LIMIT
+#define CONFIG_KEY_LOG_RATE_LIMIT 10
+#endif
+
+// The Kconfig maximum rather than its default, so kb_bench -k can compare
+// one keyboard against several
+#ifndef CONFIG_KEY_MAX_DEVICES
+#define CONFIG_KEY_MAX_DEVICES 4
+#endif
+
+#ifndef CONFIG_KEY_HTTP_INFLIGHT
+#define CONFIG_KEY_HTTP_INFLIGHT 4
+#endif
+
+#ifndef CONFIG_KEY_HTTP_TIMEOUT_MS
+#define CONFIG_KEY_HTTP_TIMEOUT_MS 2000
+#endif
+
+// Defaults for kb_bench -u
+#ifndef CONFIG_KEY_UDP_RETRANSMIT_MS
+#define CONFIG_KEY_UDP_RETRANSMIT_MS 20
+#endif
+
+#ifndef CONFIG_KEY_UDP_MAX_ATTEMPTS
+#define CONFIG_KEY_UDP_MAX_ATTEMPTS 5
+#endif
+
+#ifndef CONFIG_KEY_STORE_ENABLE
+#define CONFIG_KEY_STORE_ENABLE 1
+#endif
+
+#if CONFIG_KEY_STORE_ENABLE
+#ifndef CONFIG_KEY_STORE_DEPTH
+#define CONFIG_KEY_STORE_DEPTH 256
+#endif
+#ifndef CONFIG_KEY_STORE_MAX_AGE_S
+#define CONFIG_KEY_STORE_MAX_AGE_S 300
+#endif
+#ifndef CONFIG_KEY_STORE_RETRY_MS
+#define CONFIG_KEY_STORE_RETRY_MS 1000
+#endif
+#endif
+
+#ifndef CONFIG_KEY_BINDINGS_ENABLE
+#define CONFIG_KEY_BINDINGS_ENABLE 1
+#endif
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+#ifndef CONFIG_KEY_BINDING_MAX
+#define CONFIG_KEY_BINDING_MAX 64
+#endif
+#ifndef CONFIG_KEY_BINDING_STRINGS
+#define CONFIG_KEY_BINDING_STRINGS 2048
+#endif
+#ifndef CONFIG_KEY_BINDING_SEQUENCE_MS
+#define CONFIG_KEY_BINDING_SEQUENCE_MS 500
+#endif
+#endif
+
+#if CONFIG_KEY_BATCH_ENABLE
+#ifndef CONFIG_KEY_BATCH_PATH
+#define CONFIG_KEY_BATCH_PATH "/remote/batch"
+#endif
+#ifndef CONFIG_KEY_BATCH_MAX_EVENTS
+#define CONFIG_KEY_BATCH_MAX_EVENTS 16
+#endif
+#ifndef CONFIG_KEY_BATCH_MAX_DELAY_MS
+#define CONFIG_KEY_BATCH_MAX_DELAY_MS 20
+#endif
+#endif
+
+#ifndef CONFIG_KEY_EVENT_TIMING
+#define CONFIG_KEY_EVENT_TIMING 0
+#endif
+#if CONFIG_KEY_EVENT_TIMING
+#ifndef CONFIG_KEY_CLOCK_PATH
+#define CONFIG_KEY_CLOCK_PATH "/remote/clock"
+#endif
+#ifndef CONFIG_KEY_CLOCK_SYNC_INTERVAL_S
+#define CONFIG_KEY_CLOCK_SYNC_INTERVAL_S 60
+#endif
+#ifndef CONFIG_KEY_CLOCK_SYNC_PINGS
+#define CONFIG_KEY_CLOCK_SYNC_PINGS 4
+#endif
+#endif
+
+#endif // HOST_SDKCONFIG_H
@@ -0,0 +1,323 @@
+// End-to-end latency benchmark: replays a synthetic scenario or a recorded
+// trace through the key pipeline against the loopback sink and reports the
+// time from a report arriving to the request carrying its event completing.
+// With -k each simulated keyboard types the scenario independently (with its
+// own seed), so throughput and latency can be compared as keyboards are added.
+// With -u presses go over the UDP transport to a loopback UDP sink instead,
+// so bytes per key and latency can be compared with HTTP. With -o the link
+// goes down a third of the way through for that long, to see what the store
+// holds and how fast it drains afterwards.
+//
+// Results are printed for humans and, with -j, appended as one JSON object
+// per run so builds can be compared over time.
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host_sender.h"
+#include "http_client.h"
+#include "http_pool.h"
+#include "http_sink.h"
+#include "key_log.h"
+#include "key_pipeline.h"
+#include "latency.h"
+#include "replay.h"
+#include "scenario.h"
+#include "udp_client.h"
+#include "udp_sink.h"
+
+#if CONFIG_KEY_BATCH_ENABLE
+#define BENCH_BATCH 1
+#else
+#define BENCH_BATCH 0
+#endif
+
+static key_pipeline_t _pipeline;
+static latency_recorder_t _latency;
+static atomic_uint _failed;
+// Presses that reached the server, counting each one folded into another's
+// request
+static atomic_uint _presses;
+
+// Simulated outage, relative to the start of the trace
+static int64_t _outage_start_us;
+static int64_t _outage_end_us;
+static bool _link_down;
+
+static void deliver(void *arg, const replay_report_t *report) {
+    const int64_t *start = arg;
+    int64_t now = esp_timer_get_time();
+    bool down = now - *start >= _outage_start_us && now - *start < _outage_end_us;
+    if (down != _link_down) {
+        key_pipeline_set_link(&_pipeline, !down);
+        _link_down = down;
+    }
+    key_pipeline_report(&_pipeline, report->device, report->data, report->len, now);
+}
+
+static void on_delivered(void *arg, const key_event_t *event, esp_err_t ret) {
+    if (ret == ESP_OK) {
+        latency_record(&_latency, esp_timer_get_time() - event->timestamp_us);
+        if (event->type == KEY_EVENT_PRESS) {
+            atomic_fetch_add(&_presses, event->count);
+        }
+    } else {
+        atomic_fetch_add(&_failed, 1);
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-s scenario | -t trace] [-r rate] [-n keys] [-b burst] [-H hold_ms]\n"
+            "          [-d delay_ms] [-a inflight] [-k keyboards] [-u] [-L n] [-o outage_ms]\n"
+            "          [-x speed] [-l label] [-j file]\n"
+            "  -s  steady, burst, repeat or chord (default steady)\n"
+            "  -t  replay a recorded trace instead\n"
+            "  -r  presses, repeats or chords per second (default 10)\n"
+            "  -n  number of presses, holds or chords (default 200)\n"
+            "  -b  keys per burst (default 8)\n"
+            "  -H  how long each key is held in the repeat scenario (default 500)\n"
+            "  -d  simulated server delay per request (default 0)\n"
+            "  -a  requests in flight over pooled connections (default 1, blocking)\n"
+            "  -k  keyboards typing the scenario at once (default 1)\n"
+            "  -u  send over the UDP transport instead of HTTP\n"
+            "  -L  with -u, have the sink ignore every nth datagram (default 0, none)\n"
+            "  -o  take the link down this long, a third of the way through\n"
+            "  -x  playback speed for -t (default 1)\n"
+            "  -l  label for this build in the JSON output\n"
+            "  -j  append results as JSON to this file, - for stdout\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    key_log_init();
+    const char *scenario = "steady";
+    const char *trace_path = NULL;
+    const char *label = "";
+    const char *json_path = NULL;
+    scenario_params_t params = { .rate = 10, .keys = 200, .burst = 8, .hold_ms = 500,
+                                 .seed = 1 };
+    http_sink_config_t sink_config = { 0 };
+    udp_sink_config_t udp_sink_config = { 0 };
+    bool use_udp = false;
+    double speed = 1.0;
+    int inflight = 1;
+    int keyboards = 1;
+    int outage_ms = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:r:n:b:H:d:a:k:uL:o:x:l:j:")) != -1) {
+        switch (opt) {
+            case 's': scenario = optarg; break;
+            case 't': trace_path = optarg; break;
+            case 'r': params.rate = atof(optarg); break;
+            case 'n': params.keys = atoi(optarg); break;
+            case 'b': params.burst = atoi(optarg); break;
+            case 'H': params.hold_ms = atoi(optarg); break;
+            case 'd': sink_config.delay_us = atoi(optarg) * 1000; break;
+            case 'a': inflight = atoi(optarg); break;
+            case 'k': keyboards = atoi(optarg); break;
+            case 'u': use_udp = true; break;
+            case 'L': udp_sink_config.drop_every = atoi(optarg); break;
+            case 'o': outage_ms = atoi(optarg); break;
+            case 'x': speed = atof(optarg); break;
+            case 'l': label = optarg; break;
+            case 'j': json_path = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (optind != argc || params.rate <= 0 || inflight < 1 ||
+        inflight > CONFIG_KEY_HTTP_INFLIGHT || keyboards < 1 ||
+        keyboards > CONFIG_KEY_MAX_DEVICES || (trace_path != NULL && keyboards > 1) ||
+        outage_ms < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Per-request logging would dominate the measurement
+    esp_log_level_set("*", ESP_LOG_ERROR);
+
+    replay_trace_t trace;
+    if (trace_path != NULL) {
+        if (!replay_load(trace_path, &trace)) {
+            return 1;
+        }
+        scenario = trace_path;
+    } else {
+        replay_trace_t traces[CONFIG_KEY_MAX_DEVICES];
+        for (int i = 0; i < keyboards; i++) {
+            scenario_params_t device_params = params;
+            device_params.seed = params.seed + i;
+            if (!scenario_build(scenario, &device_params, &traces[i])) {
+                fprintf(stderr, "unknown scenario %s\n", scenario);
+                return 2;
+            }
+        }
+        replay_merge(traces, keyboards, &trace);
+        for (int i = 0; i < keyboards; i++) {
+            replay_free(&traces[i]);
+        }
+        speed = 1.0;
+    }
+
+    udp_sink_config.delay_us = sink_config.delay_us;
+    http_sink_t *sink = NULL;
+    udp_sink_t *udp_sink = NULL;
+    if (use_udp) {
+        udp_sink = udp_sink_start(&udp_sink_config);
+    } else {
+        sink = http_sink_start(&sink_config);
+    }
+    if (sink == NULL && udp_sink == NULL) {
+        return 1;
+    }
+    // Blocking client for one request at a time, like the original sender
+    static http_client_t client;
+    static http_pool_t pool;
+    static udp_client_t udp_client;
+    key_transport_t transport;
+    if (use_udp) {
+        if (!udp_client_start(&udp_client, "127.0.0.1", udp_sink_port(udp_sink),
+                              CONFIG_KEY_UDP_RETRANSMIT_MS, CONFIG_KEY_UDP_MAX_ATTEMPTS)) {
+            return 1;
+        }
+        transport = udp_client_transport(&udp_client);
+        transport.max_inflight = inflight;
+    } else if (inflight > 1) {
+        http_pool_init(&pool, "127.0.0.1", http_sink_port(sink), inflight);
+        http_pool_start(&pool);
+        transport = http_pool_transport(&pool);
+    } else {
+        http_client_init(&client, "127.0.0.1", http_sink_port(sink));
+        transport = http_client_transport(&client);
+    }
+
+    latency_init(&_latency);
+    host_sender_t sender;
+    host_sender_init(&sender);
+    if (!key_pipeline_init(&_pipeline, &transport, host_sender_notify, &sender)) {
+        return 1;
+    }
+    // As the keyboard would send it on connecting
+    if (trace.descriptor_len > 0 &&
+        !key_pipeline_set_descriptor(&_pipeline, 0, trace.descriptor, trace.descriptor_len)) {
+        return 1;
+    }
+    _pipeline.on_delivered = on_delivered;
+    host_sender_start(&sender, &_pipeline);
+
+    if (outage_ms > 0 && trace.count > 0) {
+        _outage_start_us = (int64_t)(trace.reports[trace.count - 1].t_us / speed / 3);
+        _outage_end_us = _outage_start_us + (int64_t)outage_ms * 1000;
+    }
+    int64_t start = esp_timer_get_time();
+    replay_run(&trace, speed, deliver, &start);
+    if (_link_down) {
+        // The trace ended during the outage
+        usleep(_outage_end_us - (esp_timer_get_time() - start));
+        key_pipeline_set_link(&_pipeline, true);
+    }
+    host_sender_stop(&sender);
+    key_log_drain();
+    double elapsed_s = (esp_timer_get_time() - start) / 1e6;
+
+    key_queue_stats_t queue_stats;
+    key_pipeline_queue_stats(&_pipeline, &queue_stats);
+    // What reached the server, as requests (HTTP) or datagrams (UDP)
+    uint32_t requests;
+    uint64_t bytes;
+    udp_sink_stats_t udp_stats = { 0 };
+    if (use_udp) {
+        udp_sink_get_stats(udp_sink, &udp_stats);
+        requests = udp_stats.datagrams;
+        bytes = udp_stats.bytes_received;
+    } else {
+        http_sink_stats_t sink_stats;
+        http_sink_get_stats(sink, &sink_stats);
+        requests = sink_stats.requests;
+        bytes = sink_stats.bytes_received;
+    }
+    latency_summary_t lat;
+    latency_summarize(&_latency, &lat);
+    double rps = requests / elapsed_s;
+    double bytes_per_key = lat.count ? (double)bytes / lat.count : 0;
+    unsigned failed = atomic_load(&_failed);
+
+    printf("scenario:  %s (%zu reports, %.1f s), %d keyboard%s, %d in flight, %s\n", scenario,
+           trace.count, elapsed_s, keyboards, keyboards > 1 ? "s" : "", inflight,
+           use_udp ? "udp" : "http");
+    printf("events:    %u enqueued, %u dropped, %u coalesced, %zu delivered (%.1f/s), %u failed\n",
+           queue_stats.enqueued, queue_stats.dropped, queue_stats.coalesced, lat.count,
+           lat.count / elapsed_s, failed);
+    printf("%s %u (%.1f/s), %llu bytes, %.1f bytes/key\n",
+           use_udp ? "datagrams:" : "requests: ", requests, rps, (unsigned long long)bytes,
+           bytes_per_key);
+    if (use_udp) {
+        printf("udp:       %u retransmits, %u duplicates, %u ignored by the sink\n",
+               udp_client.udp.stats.retransmits, udp_stats.duplicates, udp_stats.dropped);
+    }
+#if CONFIG_KEY_STORE_ENABLE
+    const key_store_t *store = &_pipeline.store;
+    if (outage_ms > 0 || atomic_load(&store->buffered) > 0) {
+        printf("store:     %u buffered, %u replayed, %u expired, %u dropped, max depth %u, "
+               "drained %u at %u/s\n",
+               atomic_load(&store->buffered), atomic_load(&store->replayed),
+               atomic_load(&store->expired), atomic_load(&store->dropped),
+               atomic_load(&store->max_depth), atomic_load(&_pipeline.last_drain_events),
+               atomic_load(&_pipeline.last_drain_per_s));
+    }
+#endif
+#if KEY_PIPELINE_RUN_STATS
+    uint32_t repeats, merged;
+    key_run_stats_totals(&_pipeline.runs, &repeats, &merged);
+    printf("runs:      %u presses delivered, %u of them repeats, %u folded into another's "
+           "request\n", atomic_load(&_presses), repeats, merged);
+#endif
+    printf("latency:   p50 %" PRId64 " us, p95 %" PRId64 " us, p99 %" PRId64 " us, max %" PRId64 " us\n",
+           lat.p50_us, lat.p95_us, lat.p99_us, lat.max_us);
+
+    if (json_path != NULL) {
+        FILE *f = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "a");
+        if (f == NULL) {
+            perror(json_path);
+            return 1;
+        }
+        fprintf(f,
+                "{\"label\":\"%s\",\"scenario\":\"%s\",\"transport\":\"%s\",\"rate\":%g,"
+                "\"server_delay_us\":%u,"
+                "\"queue_depth\":%d,\"batch\":%d,\"inflight\":%d,\"keyboards\":%d,"
+                "\"reports\":%zu,\"elapsed_s\":%.3f,\"enqueued\":%u,\"dropped\":%u,"
+                "\"coalesced\":%u,\"delivered\":%zu,\"delivered_per_s\":%.1f,\"failed\":%u,"
+                "\"requests\":%u,\"requests_per_s\":%.1f,\"bytes\":%llu,\"bytes_per_key\":%.1f,"
+                "\"p50_us\":%" PRId64 ",\"p95_us\":%" PRId64 ",\"p99_us\":%" PRId64 ","
+                "\"max_us\":%" PRId64 ",\"mean_us\":%" PRId64 "}\n",
+                label, scenario, use_udp ? "udp" : "http", params.rate, sink_config.delay_us,
+                CONFIG_KEY_QUEUE_DEPTH, BENCH_BATCH, inflight, keyboards, trace.count, elapsed_s,
+                queue_stats.enqueued, queue_stats.dropped, queue_stats.coalesced, lat.count,
+                lat.count / elapsed_s, failed, requests, rps, (unsigned long long)bytes,
+                bytes_per_key, lat.p50_us, lat.p95_us, lat.p99_us, lat.max_us, lat.mean_us);
+        if (f != stdout) {
+            fclose(f);
+        }
+    }
+
+    if (use_udp) {
+        udp_client_stop(&udp_client);
+        udp_sink_stop(udp_sink);
+    } else {
+        if (inflight > 1) {
+            http_pool_stop(&pool);
+        } else {
+            http_client_close(&client);
+        }
+        http_sink_stop(sink);
+    }
+    latency_free(&_latency);
+    replay_free(&trace);
+    return 0;
+}
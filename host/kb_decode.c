@@ -0,0 +1,132 @@
+// Decode throughput benchmark: runs the reports of recorded traces through
+// the device's plan (hid_plan_extract) and the diff against the previous
+// report, the producer's share of the work for every report, over and over
+// without the rest of the pipeline. Traces without a descriptor are read with
+// the boot plan, and also with the fixed boot layout it replaced
+// (hid_report_diff) for comparison.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+#include "hid_descriptor.h"
+#include "hid_report.h"
+#include "replay.h"
+
+typedef struct {
+    hid_report_state_t states[HID_PLAN_MAX_REPORTS];
+    uint8_t mods;
+} decode_state_t;
+
+// One pass over the trace, as key_pipeline_report() reads it. Returns the
+// number of events.
+static uint32_t decode_plan(const hid_plan_t *plan, decode_state_t *state,
+                            const replay_trace_t *trace, uint32_t *bad) {
+    key_event_t events[HID_REPORT_MAX_EVENTS];
+    uint32_t n = 0;
+    for (size_t i = 0; i < trace->count; i++) {
+        const replay_report_t *report = &trace->reports[i];
+        hid_keys_t keys;
+        int r = hid_plan_extract(plan, report->data, report->len, &keys);
+        if (r < 0) {
+            (*bad)++;
+            continue;
+        }
+        if (!plan->reports[r].mods) {
+            keys.mods = state->mods;
+        }
+        state->states[r].mods = state->mods;
+        n += hid_report_diff_keys(&state->states[r], &keys, report->t_us, events);
+        state->mods = state->states[r].mods;
+    }
+    return n;
+}
+
+static uint32_t decode_boot(hid_report_state_t *state, const replay_trace_t *trace,
+                            uint32_t *bad) {
+    key_event_t events[HID_REPORT_MAX_EVENTS];
+    uint32_t n = 0;
+    for (size_t i = 0; i < trace->count; i++) {
+        const replay_report_t *report = &trace->reports[i];
+        if (report->len != 1 + HID_REPORT_LEN) {
+            (*bad)++;
+            continue;
+        }
+        n += hid_report_diff(state, report->data + 1, report->t_us, events);
+    }
+    return n;
+}
+
+static void print_rate(const char *name, int64_t elapsed_us, uint64_t reports, uint32_t events,
+                       uint32_t bad) {
+    double ns = elapsed_us * 1000.0 / (reports ? reports : 1);
+    printf("%-9s%.1f ns/report, %.2fM reports/s, %u events and %u bad reports per pass\n",
+           name, ns, ns > 0 ? 1000.0 / ns : 0, events, bad);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-n passes] trace...\n"
+            "  -n  times to decode each trace (default 100000)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    int passes = 100000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': passes = atoi(optarg); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (optind == argc || passes < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    static replay_trace_t trace;
+    for (int t = optind; t < argc; t++) {
+        if (!replay_load(argv[t], &trace)) {
+            return 1;
+        }
+        static hid_plan_t plan;
+        char err[48];
+        if (trace.descriptor_len == 0) {
+            hid_plan_boot(&plan);
+        } else if (!hid_plan_compile(&plan, trace.descriptor, trace.descriptor_len, err,
+                                     sizeof(err))) {
+            fprintf(stderr, "%s: bad descriptor: %s\n", argv[t], err);
+            return 1;
+        }
+        printf("trace:   %s (%zu reports, %s)\n", argv[t], trace.count,
+               trace.descriptor_len ? "descriptor" : "boot reports");
+        printf("plan:    %u reports, %u fields, %u codes\n", plan.report_count,
+               plan.field_count, plan.code_count);
+
+        uint64_t reports = (uint64_t)passes * trace.count;
+        decode_state_t state = { 0 };
+        uint32_t events = 0;
+        uint32_t bad = 0;
+        int64_t start = esp_timer_get_time();
+        for (int p = 0; p < passes; p++) {
+            bad = 0;
+            events = decode_plan(&plan, &state, &trace, &bad);
+        }
+        print_rate("decode:", esp_timer_get_time() - start, reports, events, bad);
+
+        if (trace.descriptor_len == 0) {
+            hid_report_state_t boot;
+            hid_report_state_init(&boot);
+            start = esp_timer_get_time();
+            for (int p = 0; p < passes; p++) {
+                bad = 0;
+                events = decode_boot(&boot, &trace, &bad);
+            }
+            print_rate("fixed:", esp_timer_get_time() - start, reports, events, bad);
+        }
+        replay_free(&trace);
+    }
+    return 0;
+}
@@ -0,0 +1,398 @@
+// Fuzz target and stress test for the key pipeline, with a stand-in server
+// that answers every request on the spot.
+//
+// The fuzz input is a series of records, each an op byte, a length byte and
+// that many bytes of payload (fewer if the input ends first). The low three
+// bits of the op say what to do, the rest pick the device:
+//
+//   0-2  input report, as delivered with ESP_HIDH_DATA_IND_EVT
+//   3    report descriptor, as delivered with ESP_HIDH_GET_DSCP_EVT
+//   4    the keyboard disconnects and its keys are released
+//   5    the link goes down (first payload byte odd) or up
+//   6    key bindings source, as PUT to /bindings
+//   7    how the server answers from now on, one byte per request in turn:
+//        200, 404, 500 or no response at all
+//
+// The consumer runs after every record, and the status JSON is formatted
+// into a buffer of the size the input ends with. Built with libFuzzer
+// (KB_FUZZ=ON, clang), LLVMFuzzerTestOneInput() is the entry point; otherwise
+// a main() runs saved inputs or random ones, best built with KB_SANITIZE=ON,
+// after checking that a descriptor whose report is too long for a plan is
+// turned away.
+//
+// With -S it instead measures how many reports per second the producer and
+// consumer get through back to back, with the same stand-in server, and
+// fails if the heap is touched at all while they do.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "heap_track.h"
+#include "key_log.h"
+#include "key_pipeline.h"
+#include "usb_hid_codes.h"
+
+#define FUZZ_OP_DESCRIPTOR 3
+#define FUZZ_OP_RELEASE    4
+#define FUZZ_OP_LINK       5
+#define FUZZ_OP_BINDINGS   6
+#define FUZZ_OP_ANSWERS    7
+
+static key_pipeline_t _pipeline;
+
+// How the stand-in server answers, in turn
+static uint8_t _answers[255];
+static size_t _answer_count;
+static size_t _next_answer;
+static uint32_t _requests;
+
+static esp_err_t answer(int *status) {
+    _requests++;
+    uint8_t a = _answer_count > 0 ? _answers[_next_answer++ % _answer_count] : 0;
+    static const int statuses[] = { 200, 404, 500 };
+    if ((a & 3) == 3) {
+        return ESP_ERR_TIMEOUT;
+    }
+    *status = statuses[a & 3];
+    return ESP_OK;
+}
+
+// Every byte of the path and body is read, so a request built past the end
+// of its buffer shows up under AddressSanitizer
+static void check_path(const char *path) {
+    if (path[0] != '/' || strlen(path) == 0) {
+        abort();
+    }
+}
+
+static esp_err_t stub_get(void *ctx, const char *path, int *status) {
+    check_path(path);
+    return answer(status);
+}
+
+static esp_err_t stub_post(void *ctx, const char *path, const char *content_type,
+                           const char *body, int body_len, int *status) {
+    check_path(path);
+    if (body_len < 0) {
+        abort();
+    }
+    volatile uint8_t sum = 0;
+    for (int i = 0; i < body_len; i++) {
+        sum += body[i];
+    }
+    return answer(status);
+}
+
+static const key_transport_t _transport = {
+    .get = stub_get,
+    .post = stub_post,
+    .ctx = NULL,
+};
+
+static void setup(void) {
+    static bool done;
+    if (!done) {
+        key_log_init();
+        // Reports that don't parse and queues that overflow are the point
+        esp_log_level_set("*", ESP_LOG_NONE);
+        done = true;
+    }
+    _answer_count = 0;
+    _next_answer = 0;
+    if (!key_pipeline_init(&_pipeline, &_transport, NULL, NULL)) {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    setup();
+    size_t pos = 0;
+    while (pos + 2 <= size) {
+        uint8_t op = data[pos];
+        size_t len = data[pos + 1];
+        pos += 2;
+        if (len > size - pos) {
+            len = size - pos;
+        }
+        const uint8_t *payload = data + pos;
+        pos += len;
+
+        uint8_t device = (op >> 3) % (CONFIG_KEY_MAX_DEVICES + 1);
+        int64_t now = esp_timer_get_time();
+        switch (op & 7) {
+            case FUZZ_OP_DESCRIPTOR:
+                key_pipeline_set_descriptor(&_pipeline, device, payload, len);
+                break;
+            case FUZZ_OP_RELEASE:
+                key_pipeline_release_all(&_pipeline, device, now);
+                break;
+            case FUZZ_OP_LINK:
+                key_pipeline_set_link(&_pipeline, len == 0 || !(payload[0] & 1));
+                break;
+            case FUZZ_OP_BINDINGS: {
+#if CONFIG_KEY_BINDINGS_ENABLE
+                key_binding_table_t *table = key_pipeline_edit_bindings(&_pipeline);
+                char err[96];
+                if (table != NULL &&
+                    key_binding_table_compile(table, (const char *)payload, len, err,
+                                              sizeof(err))) {
+                    key_pipeline_publish_bindings(&_pipeline);
+                }
+#endif
+                break;
+            }
+            case FUZZ_OP_ANSWERS:
+                memcpy(_answers, payload, len);
+                _answer_count = len;
+                _next_answer = 0;
+                break;
+            default:
+                // One past the last device is passed on too, to check it's
+                // turned away
+                key_pipeline_report(&_pipeline, device, payload, len, now);
+                break;
+        }
+        key_pipeline_process(&_pipeline);
+    }
+
+    static char status[4096];
+    size_t status_len = size > 0 ? (data[size - 1] * 16) % sizeof(status) : sizeof(status);
+    key_pipeline_format_status(&_pipeline, status, status_len);
+    return 0;
+}
+
+#ifndef KB_LIBFUZZER
+
+// Boot reports typing mapped keypad keys, two at a time with rollover
+// between them, with the occasional phantom-key report
+static size_t boot_reports(uint8_t reports[][1 + HID_REPORT_LEN], size_t n) {
+    static const uint8_t keys[] = { 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x57, 0x58 };
+    for (size_t i = 0; i < n; i++) {
+        uint8_t *r = reports[i];
+        memset(r, 0, 1 + HID_REPORT_LEN);
+        r[0] = 1;
+        switch (i % 4) {
+            case 0: r[3] = keys[i / 4 % 8]; break;
+            case 1: r[3] = keys[i / 4 % 8]; r[4] = keys[(i / 4 + 3) % 8]; break;
+            case 2: r[3] = keys[(i / 4 + 3) % 8]; break;
+            case 3: break;
+        }
+        if (i % 64 == 63) {
+            memset(r + 3, KEY_ERR_OVF, HID_REPORT_KEYS);
+        }
+    }
+    return n;
+}
+
+static int stress(int reports) {
+    enum { STRESS_PATTERN = 256 };
+    static uint8_t pattern[STRESS_PATTERN][1 + HID_REPORT_LEN];
+    boot_reports(pattern, STRESS_PATTERN);
+    setup();
+    heap_track_start();
+
+    // Warm up: anything allocated once, on first use, isn't per event
+    for (int i = 0; i < STRESS_PATTERN; i++) {
+        key_pipeline_report(&_pipeline, i % CONFIG_KEY_MAX_DEVICES, pattern[i],
+                            sizeof(pattern[i]), esp_timer_get_time());
+        key_pipeline_process(&_pipeline);
+    }
+
+    key_queue_stats_t before;
+    key_pipeline_queue_stats(&_pipeline, &before);
+    uint32_t requests = _requests;
+    heap_track_t heap_before;
+    heap_track_get(&heap_before);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < reports; i++) {
+        key_pipeline_report(&_pipeline, i % CONFIG_KEY_MAX_DEVICES, pattern[i % STRESS_PATTERN],
+                            sizeof(pattern[0]), esp_timer_get_time());
+        key_pipeline_process(&_pipeline);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    heap_track_t heap_after;
+    heap_track_get(&heap_after);
+
+    key_queue_stats_t after;
+    key_pipeline_queue_stats(&_pipeline, &after);
+    uint32_t events = after.enqueued - before.enqueued;
+    uint64_t allocations = heap_after.allocations - heap_before.allocations;
+    double s = elapsed / 1e6;
+    printf("reports:     %d in %.1f ms, %.0f/s\n", reports, elapsed / 1e3, reports / s);
+    printf("events:      %" PRIu32 " (%.0f/s), %" PRIu32 " dropped\n", events, events / s,
+           after.dropped - before.dropped);
+    printf("requests:    %" PRIu32 " (%.0f/s)\n", _requests - requests, (_requests - requests) / s);
+    printf("allocations: %" PRIu64 " (%.3f per event)\n", allocations,
+           events ? (double)allocations / events : 0);
+    return allocations == 0 ? 0 : 1;
+}
+
+static bool run_file(const char *path) {
+    static uint8_t input[1 << 16];
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    size_t len = fread(input, 1, sizeof(input), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(input, len);
+    return true;
+}
+
+// Keyboard plus consumer report descriptor (host/traces/nkro.trace), for
+// random inputs to start from
+static const uint8_t _nkro_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01, 0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7,
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08,
+    0x81, 0x01, 0x05, 0x07, 0x19, 0x00, 0x29, 0x67, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x68, 0x81, 0x02, 0xc0, 0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x02, 0x15,
+    0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x04, 0x09, 0xe9, 0x09, 0xea, 0x09, 0xe2, 0x09,
+    0xcd, 0x81, 0x02, 0x95, 0x04, 0x81, 0x01, 0xc0,
+};
+
+// Constant padding of 32 x 1024 bits, the most one Input item can take
+static const uint8_t _big_pad[] = { 0x75, 0x20, 0x96, 0x00, 0x04, 0x81, 0x01 };
+
+// A descriptor whose report adds up to more bits than its 16-bit length can
+// hold: a key array after one big pad and before fifteen more. If the total
+// were allowed to wrap, the report would look 6 bytes long and reading one
+// would go kilobytes past it. It has to be turned away.
+static void check_long_report(void) {
+    static const uint8_t keys[] = {
+        0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x15, 0x00, 0x25, 0x65,
+        0x75, 0x08, 0x95, 0x06, 0x81, 0x00,
+    };
+    static uint8_t desc[sizeof(keys) + 16 * sizeof(_big_pad)];
+    size_t len = 0;
+    memcpy(desc + len, _big_pad, sizeof(_big_pad));
+    len += sizeof(_big_pad);
+    memcpy(desc + len, keys, sizeof(keys));
+    len += sizeof(keys);
+    for (int i = 0; i < 15; i++) {
+        memcpy(desc + len, _big_pad, sizeof(_big_pad));
+        len += sizeof(_big_pad);
+    }
+    static hid_plan_t plan;
+    char err[64];
+    if (hid_plan_compile(&plan, desc, len, err, sizeof(err))) {
+        fprintf(stderr, "descriptor with a %zu-byte report wasn't rejected\n",
+                (size_t)(16 * 32 * 1024 + 48) / 8);
+        abort();
+    }
+    // One report short of the limit still compiles, and a report of that
+    // length reads fine
+    len -= sizeof(_big_pad);
+    if (!hid_plan_compile(&plan, desc, len, err, sizeof(err))) {
+        fprintf(stderr, "descriptor with 15 pads rejected: %s\n", err);
+        abort();
+    }
+    static uint8_t report[15 * 32 * 1024 / 8 + 6];
+    hid_keys_t found;
+    if (hid_plan_extract(&plan, report, sizeof(report), &found) < 0 ||
+        hid_plan_extract(&plan, report, 6, &found) >= 0) {
+        fprintf(stderr, "long report read with the wrong length\n");
+        abort();
+    }
+}
+
+// Random records, biased towards ones that parse: mostly reports of the
+// lengths the plans expect, starting with a known report ID and holding
+// mapped keys, and descriptors that are the one above with a few bytes
+// changed, some with big pads added to push reports towards the length limit
+static void run_random(unsigned seed, int iterations) {
+    static uint8_t input[2048];
+    for (int it = 0; it < iterations; it++) {
+        size_t len = 0;
+        int records = 1 + rand_r(&seed) % 32;
+        for (int r = 0; r < records && len + 2 + 255 <= sizeof(input); r++) {
+            uint8_t op = rand_r(&seed);
+            uint8_t *payload = input + len + 2;
+            uint8_t n;
+            if ((op & 7) == FUZZ_OP_DESCRIPTOR && rand_r(&seed) % 2 == 0) {
+                n = sizeof(_nkro_descriptor);
+                memcpy(payload, _nkro_descriptor, n);
+                for (int flips = rand_r(&seed) % 4; flips > 0; flips--) {
+                    payload[rand_r(&seed) % n] = rand_r(&seed);
+                }
+                for (int pads = rand_r(&seed) % 24; pads > 0 && n + sizeof(_big_pad) <= 255;
+                     pads--) {
+                    memcpy(payload + n, _big_pad, sizeof(_big_pad));
+                    n += sizeof(_big_pad);
+                }
+            } else {
+                int lens[] = { 1 + HID_REPORT_LEN, 16, 2, rand_r(&seed) % 256 };
+                n = lens[rand_r(&seed) % 4];
+                for (int i = 0; i < n; i++) {
+                    // Keypad keys, which are mapped, or anything
+                    int pick = rand_r(&seed) % 6;
+                    payload[i] = pick == 0 ? KEY_KPSLASH + rand_r(&seed) % 16
+                                 : pick == 1 ? rand_r(&seed) : 0;
+                }
+                if (n > 0) {
+                    payload[0] = 1 + rand_r(&seed) % 3;
+                }
+            }
+            input[len++] = op;
+            input[len++] = n;
+            len += n;
+        }
+        LLVMFuzzerTestOneInput(input, len);
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-n iterations] [-r seed] [input...]\n"
+            "       %s -S [-n reports]\n"
+            "  -n  random inputs to run, or reports for -S (default 100000)\n"
+            "  -r  seed for the random inputs (default 1)\n"
+            "  -S  measure reports per second and check nothing is allocated\n"
+            "Given inputs, e.g. crashes saved by libFuzzer, runs those instead.\n",
+            argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 100000;
+    unsigned seed = 1;
+    bool stress_mode = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:S")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'r': seed = strtoul(optarg, NULL, 0); break;
+            case 'S': stress_mode = true; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (iterations < 1 || (stress_mode && optind != argc)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (stress_mode) {
+        return stress(iterations);
+    }
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            if (!run_file(argv[i])) {
+                return 1;
+            }
+        }
+        printf("%d inputs ran\n", argc - optind);
+        return 0;
+    }
+    check_long_report();
+    int64_t start = esp_timer_get_time();
+    run_random(seed, iterations);
+    printf("%d random inputs ran in %.1f s, %" PRIu32 " requests\n", iterations,
+           (esp_timer_get_time() - start) / 1e6, _requests);
+    return 0;
+}
+
+#endif // KB_LIBFUZZER
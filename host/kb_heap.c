@@ -0,0 +1,215 @@
+// Heap regression check: types a large number of key presses from virtual
+// keyboards (key_loadgen) through the pipeline, the sender thread and a
+// transport to a loopback server, as kb_load does but paced so nothing is
+// dropped, and watches the process's heap while it does. After a warm-up,
+// anything allocated once on first use is in place; from there to the end
+// the bytes in use must not grow. Prints the heap at intervals, and exits 1
+// if it grew.
+//
+// The count covers the whole process, the stand-in server included, so a
+// leak anywhere on the path shows.
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "heap_track.h"
+#include "host_sender.h"
+#include "http_client.h"
+#include "http_pool.h"
+#include "http_sink.h"
+#include "key_loadgen.h"
+#include "key_log.h"
+#include "key_pipeline.h"
+#include "udp_client.h"
+#include "udp_sink.h"
+
+#define HEAP_CHECKPOINTS 10
+#define HEAP_DRAIN_TIMEOUT_US (5 * 1000 * 1000)
+
+static key_pipeline_t _pipeline;
+static atomic_uint _delivered;
+static atomic_uint _failed;
+
+static void on_delivered(void *arg, const key_event_t *event, esp_err_t ret) {
+    if (ret != ESP_OK) {
+        atomic_fetch_add(&_failed, 1);
+    } else if (event->type == KEY_EVENT_PRESS) {
+        atomic_fetch_add(&_delivered, event->count);
+    }
+}
+
+static void sleep_us(long us) {
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+// Until everything queued has been answered, so the heap is compared at rest
+static bool drain(void) {
+    int64_t deadline = esp_timer_get_time() + HEAP_DRAIN_TIMEOUT_US;
+    while (key_pipeline_queued(&_pipeline) > 0 || key_pipeline_inflight(&_pipeline) > 0) {
+        if (esp_timer_get_time() > deadline) {
+            fprintf(stderr, "pipeline didn't drain\n");
+            return false;
+        }
+        sleep_us(1000);
+    }
+    return true;
+}
+
+// Generates reports until `presses` in all, keeping the queues no more than
+// half full so every press goes through
+static void type(key_loadgen_t *gen, uint32_t presses) {
+    uint8_t report[1 + HID_REPORT_LEN];
+    while (gen->presses < presses) {
+        while (key_pipeline_queued(&_pipeline) > CONFIG_KEY_QUEUE_DEPTH / 2) {
+            sleep_us(50);
+        }
+        // The generator's clock only orders the reports; they carry real time
+        int64_t t = key_loadgen_next_us(gen);
+        int device = key_loadgen_next(gen, t, report);
+        key_pipeline_report(&_pipeline, device, report, sizeof(report), esp_timer_get_time());
+    }
+}
+
+static void print_row(uint32_t presses, const heap_track_t *heap, const heap_track_t *base) {
+    printf("%8" PRIu32 "  %9u  %11" PRId64 "  %+7" PRId64 "  %11" PRIu64 "\n", presses,
+           atomic_load(&_delivered), heap->in_use, heap->in_use - base->in_use,
+           heap->allocations - base->allocations);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-n presses] [-w warmup] [-k keyboards] [-a inflight] [-u]\n"
+            "  -n  presses to check over (default 100000)\n"
+            "  -w  presses to warm up with first (default 1000)\n"
+            "  -k  virtual keyboards typing at once (default 4)\n"
+            "  -a  requests in flight over pooled connections (default 1, blocking)\n"
+            "  -u  send over the UDP transport instead of HTTP\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    heap_track_start();
+    key_log_init();
+    uint32_t presses = 100000;
+    uint32_t warmup = 1000;
+    uint32_t keyboards = 4;
+    int inflight = 1;
+    bool use_udp = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:k:a:u")) != -1) {
+        switch (opt) {
+            case 'n': presses = strtoul(optarg, NULL, 0); break;
+            case 'w': warmup = strtoul(optarg, NULL, 0); break;
+            case 'k': keyboards = strtoul(optarg, NULL, 0); break;
+            case 'a': inflight = atoi(optarg); break;
+            case 'u': use_udp = true; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (optind != argc || presses == 0 || keyboards == 0 ||
+        keyboards > KEY_LOADGEN_MAX_SOURCES || inflight < 1 ||
+        inflight > CONFIG_KEY_HTTP_INFLIGHT) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    http_sink_config_t sink_config = { 0 };
+    udp_sink_config_t udp_sink_config = { 0 };
+    http_sink_t *sink = NULL;
+    udp_sink_t *udp_sink = NULL;
+    static http_client_t client;
+    static http_pool_t pool;
+    static udp_client_t udp_client;
+    key_transport_t transport;
+    if (use_udp) {
+        udp_sink = udp_sink_start(&udp_sink_config);
+        if (udp_sink == NULL ||
+            !udp_client_start(&udp_client, "127.0.0.1", udp_sink_port(udp_sink),
+                              CONFIG_KEY_UDP_RETRANSMIT_MS, CONFIG_KEY_UDP_MAX_ATTEMPTS)) {
+            return 1;
+        }
+        transport = udp_client_transport(&udp_client);
+    } else {
+        sink = http_sink_start(&sink_config);
+        if (sink == NULL) {
+            return 1;
+        }
+        if (inflight > 1) {
+            http_pool_init(&pool, "127.0.0.1", http_sink_port(sink), inflight);
+            http_pool_start(&pool);
+            transport = http_pool_transport(&pool);
+        } else {
+            http_client_init(&client, "127.0.0.1", http_sink_port(sink));
+            transport = http_client_transport(&client);
+        }
+    }
+
+    host_sender_t sender;
+    host_sender_init(&sender);
+    if (!key_pipeline_init(&_pipeline, &transport, host_sender_notify, &sender)) {
+        return 1;
+    }
+    _pipeline.on_delivered = on_delivered;
+    host_sender_start(&sender, &_pipeline);
+
+    static key_loadgen_t gen;
+    key_loadgen_config_t config = {
+        .sources = keyboards,
+        .devices = keyboards < CONFIG_KEY_MAX_DEVICES ? keyboards : CONFIG_KEY_MAX_DEVICES,
+        .rate = 20,
+        .dist = KEY_LOADGEN_POISSON,
+        .hold_ms = 30,
+        .seed = 1,
+    };
+    key_loadgen_init(&gen, &config, 0);
+
+    printf("%s, %u keyboards, %d in flight, %u presses after %u to warm up\n",
+           use_udp ? "udp" : "http", keyboards, inflight, presses, warmup);
+    printf(" presses  delivered  heap in use   growth  allocations\n");
+    type(&gen, warmup);
+    if (!drain()) {
+        return 1;
+    }
+    heap_track_t base;
+    heap_track_get(&base);
+    print_row(gen.presses, &base, &base);
+
+    heap_track_t heap;
+    for (int c = 1; c <= HEAP_CHECKPOINTS; c++) {
+        type(&gen, warmup + (uint64_t)presses * c / HEAP_CHECKPOINTS);
+        if (!drain()) {
+            return 1;
+        }
+        heap_track_get(&heap);
+        print_row(gen.presses, &heap, &base);
+    }
+
+    for (uint32_t d = 0; d < config.devices; d++) {
+        key_pipeline_release_all(&_pipeline, d, esp_timer_get_time());
+    }
+    host_sender_stop(&sender);
+    if (use_udp) {
+        udp_client_stop(&udp_client);
+        udp_sink_stop(udp_sink);
+    } else {
+        if (inflight > 1) {
+            http_pool_stop(&pool);
+        } else {
+            http_client_close(&client);
+        }
+        http_sink_stop(sink);
+    }
+
+    int64_t growth = heap.in_use - base.in_use;
+    printf("heap:    %+" PRId64 " bytes over %u presses, %" PRIu64 " allocations, %u failed\n",
+           growth, presses, heap.allocations - base.allocations, atomic_load(&_failed));
+    return growth > 0 ? 1 : 0;
+}
@@ -0,0 +1,303 @@
+// Load generator: virtual keyboards (key_loadgen) inject reports into the key
+// pipeline as the HID callback would, against the loopback sink, while the
+// number of sources and their rate are stepped up. Each step prints offered
+// and delivered presses per second, queue drops and depth, and latency, so
+// the point where the sender stops keeping up shows as delivered falling
+// behind offered, the queue filling and latency climbing. At the end it
+// names the first saturated step and the highest throughput seen.
+//
+// Results are printed for humans and, with -j, appended as one JSON object
+// per step, like kb_bench.
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host_sender.h"
+#include "http_client.h"
+#include "http_pool.h"
+#include "http_sink.h"
+#include "key_loadgen.h"
+#include "key_log.h"
+#include "key_pipeline.h"
+#include "latency.h"
+
+#define LOAD_MAX_STEPS 16
+
+static key_pipeline_t _pipeline;
+static latency_recorder_t _latency;
+static atomic_uint _presses;
+static atomic_uint _failed;
+
+static void on_delivered(void *arg, const key_event_t *event, esp_err_t ret) {
+    if (ret != ESP_OK) {
+        atomic_fetch_add(&_failed, 1);
+    } else if (event->type == KEY_EVENT_PRESS) {
+        latency_record(&_latency, esp_timer_get_time() - event->timestamp_us);
+        atomic_fetch_add(&_presses, event->count);
+    }
+}
+
+typedef struct {
+    uint32_t sources;
+    float rate;
+    double offered_per_s;
+    double delivered_per_s;
+    uint32_t dropped;
+    uint32_t max_depth;
+    uint32_t failed;
+    latency_summary_t latency;
+} load_step_t;
+
+// Comma separated list of numbers into `out`; returns how many
+static int parse_list(const char *arg, float *out) {
+    int n = 0;
+    char *end;
+    for (const char *p = arg; *p != '\0' && n < LOAD_MAX_STEPS; p = end + (*end == ',')) {
+        out[n] = strtof(p, &end);
+        if (end == p || out[n] <= 0) {
+            return 0;
+        }
+        n++;
+    }
+    return n;
+}
+
+static void sleep_until(int64_t deadline_us) {
+    int64_t remaining = deadline_us - esp_timer_get_time();
+    if (remaining > 0) {
+        struct timespec ts = {
+            .tv_sec = remaining / 1000000,
+            .tv_nsec = (remaining % 1000000) * 1000,
+        };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static bool run_step(const key_loadgen_config_t *config, double step_s, uint16_t port,
+                     int inflight, load_step_t *step) {
+    static http_client_t client;
+    static http_pool_t pool;
+    key_transport_t transport;
+    if (inflight > 1) {
+        http_pool_init(&pool, "127.0.0.1", port, inflight);
+        http_pool_start(&pool);
+        transport = http_pool_transport(&pool);
+    } else {
+        http_client_init(&client, "127.0.0.1", port);
+        transport = http_client_transport(&client);
+    }
+
+    latency_init(&_latency);
+    atomic_store(&_presses, 0);
+    atomic_store(&_failed, 0);
+    host_sender_t sender;
+    host_sender_init(&sender);
+    if (!key_pipeline_init(&_pipeline, &transport, host_sender_notify, &sender)) {
+        return false;
+    }
+    _pipeline.on_delivered = on_delivered;
+    host_sender_start(&sender, &_pipeline);
+
+    // The producer: this thread plays the HID callback for every keyboard
+    static key_loadgen_t gen;
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + (int64_t)(step_s * 1e6);
+    if (!key_loadgen_init(&gen, config, start)) {
+        return false;
+    }
+    uint8_t report[1 + HID_REPORT_LEN];
+    for (;;) {
+        int64_t next = key_loadgen_next_us(&gen);
+        if (next >= end) {
+            break;
+        }
+        sleep_until(next);
+        int64_t now = esp_timer_get_time();
+        int device;
+        while ((device = key_loadgen_next(&gen, now, report)) >= 0) {
+            key_pipeline_report(&_pipeline, device, report, sizeof(report), now);
+        }
+    }
+    // Release whatever is still held, then let the sender drain
+    for (uint32_t d = 0; d < config->devices; d++) {
+        key_pipeline_release_all(&_pipeline, d, esp_timer_get_time());
+    }
+    host_sender_stop(&sender);
+    double elapsed_s = (esp_timer_get_time() - start) / 1e6;
+    if (inflight > 1) {
+        http_pool_stop(&pool);
+    } else {
+        http_client_close(&client);
+    }
+
+    key_queue_stats_t queue_stats;
+    key_pipeline_queue_stats(&_pipeline, &queue_stats);
+    step->sources = config->sources;
+    step->rate = config->rate;
+    step->offered_per_s = gen.presses / step_s;
+    step->delivered_per_s = atomic_load(&_presses) / elapsed_s;
+    step->dropped = queue_stats.dropped;
+    step->max_depth = queue_stats.max_depth;
+    step->failed = atomic_load(&_failed);
+    latency_summarize(&_latency, &step->latency);
+    latency_free(&_latency);
+    return true;
+}
+
+// Falling behind: losing events, or delivering under 95% of what's offered
+static bool saturated(const load_step_t *step) {
+    return step->dropped > 0 || step->failed > 0 ||
+           step->delivered_per_s < 0.95 * step->offered_per_s;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-k sources,...] [-r rates,...] [-D dist] [-b burst] [-H hold_ms]\n"
+            "          [-t step_s] [-d delay_ms] [-a inflight] [-s seed] [-l label] [-j file]\n"
+            "  -k  virtual keyboard sources to step through (default 1,2,4,8,16)\n"
+            "  -r  presses per second per source to step through (default 5,10,20)\n"
+            "  -D  fixed, poisson or burst (default poisson)\n"
+            "  -b  presses per burst for -D burst (default 8)\n"
+            "  -H  how long each key is held (default 30)\n"
+            "  -t  seconds per step (default 2)\n"
+            "  -d  simulated server delay per request (default 0)\n"
+            "  -a  requests in flight over pooled connections (default 1, blocking)\n"
+            "  -s  random seed (default 1)\n"
+            "  -l  label for this build in the JSON output\n"
+            "  -j  append one JSON line per step to this file, - for stdout\n"
+            "Sources are spread over up to CONFIG_KEY_MAX_DEVICES (%d) keyboards.\n",
+            argv0, CONFIG_KEY_MAX_DEVICES);
+}
+
+int main(int argc, char **argv) {
+    key_log_init();
+    float sources[LOAD_MAX_STEPS] = { 1, 2, 4, 8, 16 };
+    float rates[LOAD_MAX_STEPS] = { 5, 10, 20 };
+    int source_steps = 5;
+    int rate_steps = 3;
+    key_loadgen_config_t config = { .dist = KEY_LOADGEN_POISSON, .burst = 8, .hold_ms = 30,
+                                    .seed = 1 };
+    const char *dist = "poisson";
+    const char *label = "";
+    const char *json_path = NULL;
+    http_sink_config_t sink_config = { 0 };
+    double step_s = 2;
+    int inflight = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:r:D:b:H:t:d:a:s:l:j:")) != -1) {
+        switch (opt) {
+            case 'k': source_steps = parse_list(optarg, sources); break;
+            case 'r': rate_steps = parse_list(optarg, rates); break;
+            case 'D': dist = optarg; break;
+            case 'b': config.burst = atoi(optarg); break;
+            case 'H': config.hold_ms = atoi(optarg); break;
+            case 't': step_s = atof(optarg); break;
+            case 'd': sink_config.delay_us = atoi(optarg) * 1000; break;
+            case 'a': inflight = atoi(optarg); break;
+            case 's': config.seed = strtoul(optarg, NULL, 0); break;
+            case 'l': label = optarg; break;
+            case 'j': json_path = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (strcmp(dist, "fixed") == 0) {
+        config.dist = KEY_LOADGEN_FIXED;
+    } else if (strcmp(dist, "poisson") == 0) {
+        config.dist = KEY_LOADGEN_POISSON;
+    } else if (strcmp(dist, "burst") == 0) {
+        config.dist = KEY_LOADGEN_BURST;
+    } else {
+        source_steps = 0;
+    }
+    if (optind != argc || source_steps == 0 || rate_steps == 0 || step_s <= 0 ||
+        inflight < 1 || inflight > CONFIG_KEY_HTTP_INFLIGHT) {
+        usage(argv[0]);
+        return 2;
+    }
+    for (int i = 0; i < source_steps; i++) {
+        if (sources[i] > KEY_LOADGEN_MAX_SOURCES) {
+            fprintf(stderr, "at most %d sources\n", KEY_LOADGEN_MAX_SOURCES);
+            return 2;
+        }
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    http_sink_t *sink = http_sink_start(&sink_config);
+    if (sink == NULL) {
+        return 1;
+    }
+    FILE *json = NULL;
+    if (json_path != NULL) {
+        json = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "a");
+        if (json == NULL) {
+            perror(json_path);
+            return 1;
+        }
+    }
+
+    printf("%s, %u ms holds, %.1f s steps, %d in flight, server delay %u ms\n", dist,
+           config.hold_ms, step_s, inflight, sink_config.delay_us / 1000);
+    printf("sources  rate/s  offered/s  delivered/s  dropped  depth   p50 us   p99 us   max us\n");
+    load_step_t first_saturated = { 0 };
+    load_step_t best = { 0 };
+    for (int s = 0; s < source_steps; s++) {
+        for (int r = 0; r < rate_steps; r++) {
+            config.sources = (uint32_t)sources[s];
+            config.devices = config.sources < CONFIG_KEY_MAX_DEVICES ? config.sources
+                                                                      : CONFIG_KEY_MAX_DEVICES;
+            config.rate = rates[r];
+            load_step_t step;
+            if (!run_step(&config, step_s, http_sink_port(sink), inflight, &step)) {
+                return 1;
+            }
+            printf("%7u  %6g  %9.1f  %11.1f  %7u  %5u  %7" PRId64 "  %7" PRId64 "  %7" PRId64
+                   "%s\n",
+                   step.sources, step.rate, step.offered_per_s, step.delivered_per_s,
+                   step.dropped, step.max_depth, step.latency.p50_us, step.latency.p99_us,
+                   step.latency.max_us, saturated(&step) ? "  saturated" : "");
+            fflush(stdout);
+            if (saturated(&step) && first_saturated.sources == 0) {
+                first_saturated = step;
+            }
+            if (step.delivered_per_s > best.delivered_per_s) {
+                best = step;
+            }
+            if (json != NULL) {
+                fprintf(json,
+                        "{\"label\":\"%s\",\"dist\":\"%s\",\"sources\":%u,\"devices\":%u,"
+                        "\"rate\":%g,\"hold_ms\":%u,\"server_delay_us\":%u,\"inflight\":%d,"
+                        "\"queue_depth\":%d,\"offered_per_s\":%.1f,\"delivered_per_s\":%.1f,"
+                        "\"dropped\":%u,\"max_depth\":%u,\"failed\":%u,\"p50_us\":%" PRId64 ","
+                        "\"p95_us\":%" PRId64 ",\"p99_us\":%" PRId64 ",\"max_us\":%" PRId64 "}\n",
+                        label, dist, config.sources, config.devices, config.rate,
+                        config.hold_ms, sink_config.delay_us, inflight, CONFIG_KEY_QUEUE_DEPTH,
+                        step.offered_per_s, step.delivered_per_s, step.dropped, step.max_depth,
+                        step.failed, step.latency.p50_us, step.latency.p95_us,
+                        step.latency.p99_us, step.latency.max_us);
+                fflush(json);
+            }
+        }
+    }
+
+    printf("ceiling: %.1f presses/s delivered, at %u sources x %g/s\n", best.delivered_per_s,
+           best.sources, best.rate);
+    if (first_saturated.sources > 0) {
+        printf("knee:    saturated from %u sources x %g/s (%.1f/s offered, %.1f/s delivered)\n",
+               first_saturated.sources, first_saturated.rate, first_saturated.offered_per_s,
+               first_saturated.delivered_per_s);
+    } else {
+        printf("knee:    not reached\n");
+    }
+    if (json != NULL && json != stdout) {
+        fclose(json);
+    }
+    http_sink_stop(sink);
+    return 0;
+}
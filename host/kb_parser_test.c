@@ -0,0 +1,299 @@
+// Checks the report descriptor parser (main/hid_descriptor.c): the plans it
+// compiles for the layouts keyboards actually send, the keys read with them,
+// and the descriptors it has to turn away. Run by ctest; prints each failed
+// check and exits non-zero if there were any.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hid_descriptor.h"
+#include "usb_hid_codes.h"
+
+static int _checks;
+static int _failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+#define CHECK_EQ(a, b) check_eq((long)(a), (long)(b), #a, #b, __LINE__)
+
+static void check(bool ok, const char *what, int line) {
+    _checks++;
+    if (!ok) {
+        fprintf(stderr, "kb_parser_test.c:%d: %s\n", line, what);
+        _failures++;
+    }
+}
+
+static void check_eq(long a, long b, const char *what_a, const char *what_b, int line) {
+    _checks++;
+    if (a != b) {
+        fprintf(stderr, "kb_parser_test.c:%d: %s is %ld, not %s (%ld)\n", line, what_a, a,
+                what_b, b);
+        _failures++;
+    }
+}
+
+static void check_field(const hid_field_t *field, hid_field_kind_t kind, uint8_t size,
+                        uint16_t count, uint16_t offset, uint16_t first, int line) {
+    check_eq(field->kind, kind, "kind", "expected", line);
+    check_eq(field->size, size, "size", "expected", line);
+    check_eq(field->count, count, "count", "expected", line);
+    check_eq(field->offset, offset, "offset", "expected", line);
+    check_eq(field->first, first, "first", "expected", line);
+}
+
+static void check_report(const hid_plan_report_t *report, uint8_t id, bool mods,
+                         uint8_t first_field, uint8_t field_count, uint16_t len, int line) {
+    check_eq(report->id, id, "id", "expected", line);
+    check_eq(report->mods, mods, "mods", "expected", line);
+    check_eq(report->first_field, first_field, "first_field", "expected", line);
+    check_eq(report->field_count, field_count, "field_count", "expected", line);
+    check_eq(report->len, len, "len", "expected", line);
+}
+
+static void check_keys(const hid_keys_t *keys, uint8_t mods, const uint8_t *codes, uint8_t count,
+                       int line) {
+    check_eq(keys->mods, mods, "mods", "expected", line);
+    check_eq(keys->rollover, false, "rollover", "false", line);
+    check_eq(keys->count, count, "key count", "expected", line);
+    check(keys->count == count && memcmp(keys->keys, codes, count) == 0, "keys", line);
+}
+
+static bool compile(hid_plan_t *plan, const uint8_t *desc, size_t len) {
+    char err[64];
+    if (!hid_plan_compile(plan, desc, len, err, sizeof(err))) {
+        fprintf(stderr, "compile failed: %s\n", err);
+        return false;
+    }
+    return true;
+}
+
+// Compiling has to fail with `reason`, leaving the plan alone
+static void check_rejected(const uint8_t *desc, size_t len, const char *reason, int line) {
+    hid_plan_t plan;
+    hid_plan_boot(&plan);
+    hid_plan_t before = plan;
+    char err[64];
+    bool ok = hid_plan_compile(&plan, desc, len, err, sizeof(err));
+    check(!ok, "descriptor rejected", line);
+    check(ok || strstr(err, reason) != NULL, reason, line);
+    check(memcmp(&plan, &before, sizeof(plan)) == 0, "plan left as it was", line);
+}
+
+static void test_boot(void) {
+    hid_plan_t plan;
+    hid_plan_boot(&plan);
+    CHECK(plan.ids && plan.any_id);
+    CHECK_EQ(plan.report_count, 1);
+    check_report(&plan.reports[0], 0, true, 0, 2, HID_REPORT_LEN, __LINE__);
+    check_field(&plan.fields[0], HID_FIELD_BITS, 1, 8, 0, KEY_LEFTCTRL, __LINE__);
+    check_field(&plan.fields[1], HID_FIELD_KEYS, 8, HID_REPORT_KEYS, 16, 0, __LINE__);
+
+    // Whatever the ID
+    static const uint8_t report[] = { 0x07, 0x22, 0x00, KEY_A, KEY_KPPLUS, 0, 0, 0, 0 };
+    static const uint8_t codes[] = { KEY_A, KEY_KPPLUS };
+    hid_keys_t keys;
+    CHECK_EQ(hid_plan_extract(&plan, report, sizeof(report), &keys), 0);
+    check_keys(&keys, KEY_MOD_LSHIFT | KEY_MOD_RSHIFT, codes, 2, __LINE__);
+    CHECK_EQ(hid_plan_extract(&plan, report, sizeof(report) - 1, &keys), -1);
+
+    static const uint8_t rollover[] = { 0x01, 0x00, 0x00, 1, 1, 1, 1, 1, 1 };
+    CHECK_EQ(hid_plan_extract(&plan, rollover, sizeof(rollover), &keys), 0);
+    CHECK(keys.rollover);
+}
+
+// A keyboard report and a Consumer page report, told apart by ID
+static void test_report_ids(void) {
+    static const uint8_t desc[] = {
+        0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01,
+        0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08,
+        0x81, 0x02,
+        0x95, 0x01, 0x75, 0x08, 0x81, 0x01,
+        0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0xff, 0x05, 0x07, 0x19, 0x00, 0x29, 0xff,
+        0x81, 0x00,
+        0xc0,
+        0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x02,
+        0x15, 0x00, 0x26, 0xff, 0x03, 0x19, 0x00, 0x2a, 0xff, 0x03, 0x75, 0x10, 0x95, 0x01,
+        0x81, 0x00,
+        0xc0,
+    };
+    hid_plan_t plan;
+    if (!compile(&plan, desc, sizeof(desc))) {
+        CHECK(false);
+        return;
+    }
+    CHECK(plan.ids && !plan.any_id);
+    CHECK_EQ(plan.report_count, 2);
+    CHECK_EQ(plan.field_count, 3);
+    check_report(&plan.reports[0], 1, true, 0, 2, 8, __LINE__);
+    check_report(&plan.reports[1], 2, false, 2, 1, 2, __LINE__);
+    check_field(&plan.fields[0], HID_FIELD_BITS, 1, 8, 0, KEY_LEFTCTRL, __LINE__);
+    check_field(&plan.fields[1], HID_FIELD_KEYS, 8, 6, 16, 0, __LINE__);
+    CHECK_EQ(plan.fields[1].logical_max, 0xff);
+    check_field(&plan.fields[2], HID_FIELD_CONSUMER, 16, 1, 0, 0, __LINE__);
+    CHECK_EQ(plan.fields[2].logical_max, 0x3ff);
+
+    static const uint8_t keyboard[] = { 0x01, 0x02, 0x00, KEY_B, 0, 0, 0, 0, 0 };
+    static const uint8_t keyboard_codes[] = { KEY_B };
+    hid_keys_t keys;
+    CHECK_EQ(hid_plan_extract(&plan, keyboard, sizeof(keyboard), &keys), 0);
+    check_keys(&keys, KEY_MOD_LSHIFT, keyboard_codes, 1, __LINE__);
+
+    static const uint8_t media[] = { 0x02, 0xe9, 0x00 };
+    static const uint8_t media_codes[] = { KEY_MEDIA_VOLUMEUP };
+    CHECK_EQ(hid_plan_extract(&plan, media, sizeof(media), &keys), 1);
+    check_keys(&keys, 0, media_codes, 1, __LINE__);
+
+    static const uint8_t unknown_id[] = { 0x03, 0xe9, 0x00 };
+    CHECK_EQ(hid_plan_extract(&plan, unknown_id, sizeof(unknown_id), &keys), -1);
+    CHECK_EQ(hid_plan_extract(&plan, keyboard, sizeof(keyboard) - 1, &keys), -1);
+}
+
+// Modifiers, then a bit for every key code: Usage Minimum 0, Usage Maximum
+// 0xff, Report Count 256
+static void test_nkro_bitmap(void) {
+    static const uint8_t desc[] = {
+        0x05, 0x01, 0x09, 0x06, 0xa1, 0x01,
+        0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08,
+        0x81, 0x02,
+        0x19, 0x00, 0x29, 0xff, 0x96, 0x00, 0x01, 0x81, 0x02,
+        0xc0,
+    };
+    hid_plan_t plan;
+    if (!compile(&plan, desc, sizeof(desc))) {
+        CHECK(false);
+        return;
+    }
+    CHECK(!plan.ids);
+    CHECK_EQ(plan.report_count, 1);
+    check_report(&plan.reports[0], 0, true, 0, 2, 33, __LINE__);
+    check_field(&plan.fields[0], HID_FIELD_BITS, 1, 8, 0, KEY_LEFTCTRL, __LINE__);
+    check_field(&plan.fields[1], HID_FIELD_BITS, 1, 256, 8, 0, __LINE__);
+
+    // Error codes below KEY_A are ignored; the modifiers' bits in the bitmap
+    // are modifiers too
+    uint8_t report[33] = { 0 };
+    static const uint8_t bits[] = { 1, KEY_A, KEY_KPPLUS, KEY_RIGHTMETA };
+    for (size_t i = 0; i < sizeof(bits); i++) {
+        report[1 + bits[i] / 8] |= 1u << (bits[i] % 8);
+    }
+    static const uint8_t codes[] = { KEY_A, KEY_KPPLUS };
+    hid_keys_t keys;
+    CHECK_EQ(hid_plan_extract(&plan, report, sizeof(report), &keys), 0);
+    check_keys(&keys, KEY_MOD_RMETA, codes, 2, __LINE__);
+}
+
+// Media keys as a bit per listed usage
+static void test_consumer_bits(void) {
+    static const uint8_t desc[] = {
+        0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x03,
+        0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x04,
+        0x09, 0xe9, 0x09, 0xea, 0x09, 0xe2, 0x09, 0xcd, 0x81, 0x02,
+        0x95, 0x04, 0x81, 0x01,
+        0xc0,
+    };
+    hid_plan_t plan;
+    if (!compile(&plan, desc, sizeof(desc))) {
+        CHECK(false);
+        return;
+    }
+    CHECK_EQ(plan.report_count, 1);
+    check_report(&plan.reports[0], 3, false, 0, 1, 1, __LINE__);
+    check_field(&plan.fields[0], HID_FIELD_BITS, 1, 4, 0, 0, __LINE__);
+    CHECK_EQ(plan.fields[0].codes, 1);
+    static const uint8_t expected[] = {
+        KEY_MEDIA_VOLUMEUP, KEY_MEDIA_VOLUMEDOWN, KEY_MEDIA_MUTE, KEY_MEDIA_PLAYPAUSE,
+    };
+    CHECK_EQ(plan.code_count, sizeof(expected));
+    CHECK(memcmp(plan.codes, expected, sizeof(expected)) == 0);
+
+    static const uint8_t report[] = { 0x03, 0x05 };
+    static const uint8_t codes[] = { KEY_MEDIA_VOLUMEUP, KEY_MEDIA_MUTE };
+    hid_keys_t keys;
+    CHECK_EQ(hid_plan_extract(&plan, report, sizeof(report), &keys), 0);
+    check_keys(&keys, 0, codes, 2, __LINE__);
+}
+
+// 6KRO key slots
+static const uint8_t _key_slots[] = {
+    0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x15, 0x00, 0x25, 0x65, 0x75, 0x08, 0x95, 0x06, 0x81, 0x00,
+};
+// Constant padding of 32 x 1024 bits, the most one Input item can take
+static const uint8_t _big_pad[] = { 0x75, 0x20, 0x96, 0x00, 0x04, 0x81, 0x01 };
+
+static void test_rejected(void) {
+    static const uint8_t truncated[] = { 0x05, 0x01, 0x09, 0x06, 0x15 };
+    check_rejected(truncated, sizeof(truncated), "truncated item", __LINE__);
+    static const uint8_t truncated_long[] = { 0x05, 0x01, 0xfe };
+    check_rejected(truncated_long, sizeof(truncated_long), "truncated long item", __LINE__);
+    static const uint8_t big_count[] = { 0x96, 0x01, 0x04 };
+    check_rejected(big_count, sizeof(big_count), "report count too large", __LINE__);
+    static const uint8_t pop[] = { 0xb4 };
+    check_rejected(pop, sizeof(pop), "pop without push", __LINE__);
+    // A mouse
+    static const uint8_t mouse[] = {
+        0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00,
+        0x25, 0x01, 0x75, 0x01, 0x95, 0x03, 0x81, 0x02, 0xc0,
+    };
+    check_rejected(mouse, sizeof(mouse), "no keys", __LINE__);
+
+    // Keys, then more padding than the 16-bit report length can hold: the
+    // sixteenth pad goes past HID_REPORT_MAX_BITS, fifteen don't
+    static uint8_t desc[sizeof(_key_slots) + 16 * sizeof(_big_pad)];
+    size_t len = 0;
+    memcpy(desc, _key_slots, sizeof(_key_slots));
+    len += sizeof(_key_slots);
+    for (int i = 0; i < 16; i++) {
+        memcpy(desc + len, _big_pad, sizeof(_big_pad));
+        len += sizeof(_big_pad);
+    }
+    check_rejected(desc, len, "report too long", __LINE__);
+    hid_plan_t plan;
+    CHECK(compile(&plan, desc, len - sizeof(_big_pad)));
+    CHECK_EQ(plan.reports[0].len, (15 * 32 * 1024 + 48) / 8);
+
+    // More report IDs than the parser keeps track of
+    static uint8_t ids[17 * 6];
+    for (int i = 0; i < 17; i++) {
+        uint8_t item[] = { 0x85, (uint8_t)(i + 1), 0x75, 0x08, 0x81, 0x01 };
+        memcpy(ids + i * sizeof(item), item, sizeof(item));
+    }
+    check_rejected(ids, sizeof(ids), "too many reports", __LINE__);
+}
+
+// Key fields past HID_PLAN_MAX_FIELDS are left out rather than failing the
+// keyboard; the ones before still work
+static void test_too_many_fields(void) {
+    static uint8_t desc[(HID_PLAN_MAX_FIELDS + 1) * sizeof(_key_slots)];
+    for (int i = 0; i <= HID_PLAN_MAX_FIELDS; i++) {
+        memcpy(desc + i * sizeof(_key_slots), _key_slots, sizeof(_key_slots));
+    }
+    hid_plan_t plan;
+    if (!compile(&plan, desc, sizeof(desc))) {
+        CHECK(false);
+        return;
+    }
+    CHECK_EQ(plan.field_count, HID_PLAN_MAX_FIELDS);
+    check_report(&plan.reports[0], 0, true, 0, HID_PLAN_MAX_FIELDS,
+                 (HID_PLAN_MAX_FIELDS + 1) * 6, __LINE__);
+    check_field(&plan.fields[HID_PLAN_MAX_FIELDS - 1], HID_FIELD_KEYS, 8, 6,
+                (HID_PLAN_MAX_FIELDS - 1) * 48, 0, __LINE__);
+
+    uint8_t report[(HID_PLAN_MAX_FIELDS + 1) * 6] = { 0 };
+    report[0] = KEY_A;
+    report[HID_PLAN_MAX_FIELDS * 6] = KEY_B;
+    static const uint8_t codes[] = { KEY_A };
+    hid_keys_t keys;
+    CHECK_EQ(hid_plan_extract(&plan, report, sizeof(report), &keys), 0);
+    check_keys(&keys, 0, codes, 1, __LINE__);
+}
+
+int main(void) {
+    test_boot();
+    test_report_ids();
+    test_nkro_bitmap();
+    test_consumer_bits();
+    test_rejected();
+    test_too_many_fields();
+    printf("%d checks, %d failed\n", _checks, _failures);
+    return _failures ? 1 : 0;
+}
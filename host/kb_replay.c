@@ -0,0 +1,204 @@
+// Replays a recorded HID trace through the key pipeline against a loopback
+// HTTP sink (or a real server with -c) and prints what happened.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host_sender.h"
+#include "http_client.h"
+#include "http_pool.h"
+#include "http_sink.h"
+#include "key_log.h"
+#include "key_pipeline.h"
+#include "replay.h"
+
+static key_pipeline_t _pipeline;
+
+static void deliver(void *arg, const replay_report_t *report) {
+    key_pipeline_report(&_pipeline, report->device, report->data, report->len,
+                        esp_timer_get_time());
+}
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+static bool load_bindings(const char *path) {
+    static char src[16384];
+    char err[96];
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    size_t len = fread(src, 1, sizeof(src), f);
+    fclose(f);
+    if (!key_binding_table_compile(key_pipeline_edit_bindings(&_pipeline), src, len, err,
+                                   sizeof(err))) {
+        fprintf(stderr, "%s: %s\n", path, err);
+        return false;
+    }
+    key_pipeline_publish_bindings(&_pipeline);
+    return true;
+}
+#endif
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-s speed] [-d delay_ms] [-r reject_path] [-c host:port]\n"
+            "          [-a inflight] [-m bindings] [-S] [-v] trace\n"
+            "  -s  playback speed, 0 for back to back (default 1)\n"
+            "  -d  simulated server delay per request (default 0)\n"
+            "  -r  path the sink answers with 404, e.g. /remote/batch\n"
+            "  -c  send to this server instead of the built-in sink\n"
+            "  -a  requests in flight over pooled connections (default 1, blocking)\n"
+            "  -m  key bindings to map presses with, as PUT to /bindings on the device\n"
+            "  -S  print the pipeline status and per-key JSON served on the device at\n"
+            "      /status and /keys\n"
+            "  -v  log at INFO level and trace every report and request\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    key_log_init();
+    double speed = 1.0;
+    http_sink_config_t sink_config = { 0 };
+    char *server = NULL;
+    bool status = false;
+    int inflight = 1;
+    const char *bindings = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:r:c:a:m:Sv")) != -1) {
+        switch (opt) {
+            case 's': speed = atof(optarg); break;
+            case 'd': sink_config.delay_us = atoi(optarg) * 1000; break;
+            case 'r': sink_config.reject_path = optarg; break;
+            case 'c': server = optarg; break;
+            case 'a': inflight = atoi(optarg); break;
+            case 'm': bindings = optarg; break;
+            case 'S': status = true; break;
+            case 'v':
+                esp_log_level_set("*", ESP_LOG_INFO);
+                key_log_set_verbose(true);
+                break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (optind != argc - 1 || inflight < 1 || inflight > CONFIG_KEY_HTTP_INFLIGHT) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    replay_trace_t trace;
+    if (!replay_load(argv[optind], &trace)) {
+        return 1;
+    }
+
+    http_sink_t *sink = NULL;
+    const char *host = "127.0.0.1";
+    uint16_t port;
+    if (server != NULL) {
+        char *colon = strrchr(server, ':');
+        port = 80;
+        if (colon != NULL) {
+            *colon = '\0';
+            port = atoi(colon + 1);
+        }
+        host = server;
+    } else {
+        if ((sink = http_sink_start(&sink_config)) == NULL) {
+            return 1;
+        }
+        port = http_sink_port(sink);
+    }
+
+    static http_client_t client;
+    static http_pool_t pool;
+    key_transport_t transport;
+    if (inflight > 1) {
+        http_pool_init(&pool, host, port, inflight);
+        http_pool_start(&pool);
+        transport = http_pool_transport(&pool);
+    } else {
+        http_client_init(&client, host, port);
+        transport = http_client_transport(&client);
+    }
+
+    host_sender_t sender;
+    host_sender_init(&sender);
+    if (!key_pipeline_init(&_pipeline, &transport, host_sender_notify, &sender)) {
+        return 1;
+    }
+    // As the keyboard would send it on connecting
+    if (trace.descriptor_len > 0 &&
+        !key_pipeline_set_descriptor(&_pipeline, 0, trace.descriptor, trace.descriptor_len)) {
+        return 1;
+    }
+    if (bindings != NULL) {
+#if CONFIG_KEY_BINDINGS_ENABLE
+        if (!load_bindings(bindings)) {
+            return 1;
+        }
+#else
+        fprintf(stderr, "built without CONFIG_KEY_BINDINGS_ENABLE\n");
+        return 2;
+#endif
+    }
+    host_sender_start(&sender, &_pipeline);
+
+    int64_t start = esp_timer_get_time();
+    replay_run(&trace, speed, deliver, NULL);
+    host_sender_stop(&sender);
+    key_log_drain();
+    http_client_stats_t client_stats = client.stats;
+    if (inflight > 1) {
+        http_pool_stop(&pool);
+        http_pool_get_stats(&pool, &client_stats);
+    } else {
+        http_client_close(&client);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    key_queue_stats_t queue_stats;
+    key_pipeline_queue_stats(&_pipeline, &queue_stats);
+    uint32_t max_enqueue_us = 0;
+    for (int d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        if (_pipeline.devices[d].max_enqueue_us > max_enqueue_us) {
+            max_enqueue_us = _pipeline.devices[d].max_enqueue_us;
+        }
+    }
+    printf("trace:   %s (%zu reports)\n", argv[optind], trace.count);
+    printf("elapsed: %.1f ms\n", elapsed / 1000.0);
+    printf("events:  %u enqueued, %u dropped, %u coalesced, max depth %u, max enqueue %u us\n",
+           queue_stats.enqueued, queue_stats.dropped, queue_stats.coalesced,
+           queue_stats.max_depth, max_enqueue_us);
+    printf("client:  %u requests, %u connects, %u reuses, %u reconnects, %u failures\n",
+           client_stats.requests, client_stats.connects, client_stats.reuses,
+           client_stats.reconnects, client_stats.failures);
+    if (sink != NULL) {
+        http_sink_stats_t sink_stats;
+        http_sink_get_stats(sink, &sink_stats);
+        printf("sink:    %u requests (%u GET, %u POST), %llu bytes\n",
+               sink_stats.requests, sink_stats.gets, sink_stats.posts,
+               (unsigned long long)sink_stats.bytes_received);
+    }
+    if (status) {
+        static char status_body[4096];
+        if (key_pipeline_format_status(&_pipeline, status_body, sizeof(status_body)) >= 0) {
+            printf("status:  %s\n", status_body);
+        }
+#if KEY_PIPELINE_RUN_STATS
+        if (key_pipeline_format_runs(&_pipeline, status_body, sizeof(status_body)) >= 0) {
+            printf("keys:    %s\n", status_body);
+        }
+#endif
+    }
+
+    if (sink != NULL) {
+        http_sink_stop(sink);
+    }
+    replay_free(&trace);
+    return client_stats.failures ? 1 : 0;
+}
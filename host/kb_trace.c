@@ -0,0 +1,214 @@
+// Reads HID captures (main/hid_trace.h) on the host. A dump of the hidtrace
+// partition, e.g. from
+//
+//   parttool.py read_partition --partition-name hidtrace --output dump.bin
+//
+// is turned into a replay trace for one keyboard, ready for kb_replay,
+// kb_bench or kb_decode. With -c it goes the other way, capturing replay
+// traces into a partition image through the device's code, which is how the
+// format is checked end to end without hardware.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hid_trace.h"
+#include "replay.h"
+
+// Flash in RAM: erased bytes are 0xff, and writes can only clear bits
+typedef struct {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t bad_writes;
+} image_t;
+
+static bool image_read(void *ctx, uint32_t offset, void *buf, uint32_t len) {
+    image_t *image = ctx;
+    if (offset + len > image->size) {
+        return false;
+    }
+    memcpy(buf, image->data + offset, len);
+    return true;
+}
+
+static bool image_write(void *ctx, uint32_t offset, const void *buf, uint32_t len) {
+    image_t *image = ctx;
+    const uint8_t *p = buf;
+    if (offset + len > image->size) {
+        return false;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if ((image->data[offset + i] & p[i]) != p[i]) {
+            image->bad_writes++;
+        }
+        image->data[offset + i] &= p[i];
+    }
+    return true;
+}
+
+static bool image_erase(void *ctx, uint32_t offset) {
+    image_t *image = ctx;
+    if (offset % HID_TRACE_SECTOR_SIZE != 0 || offset + HID_TRACE_SECTOR_SIZE > image->size) {
+        return false;
+    }
+    memset(image->data + offset, 0xff, HID_TRACE_SECTOR_SIZE);
+    return true;
+}
+
+static hid_trace_storage_t image_storage(image_t *image) {
+    hid_trace_storage_t storage = {
+        .read = image_read,
+        .write = image_write,
+        .erase = image_erase,
+        .size = image->size / HID_TRACE_SECTOR_SIZE * HID_TRACE_SECTOR_SIZE,
+        .ctx = image,
+    };
+    return storage;
+}
+
+static bool write_stdout(void *arg, const char *text, size_t len) {
+    return fwrite(text, 1, len, stdout) == len;
+}
+
+static int format_image(const char *path, uint8_t device) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    image_t image = { .data = malloc(size > 0 ? size : 1), .size = size };
+    bool ok = size > 0 && fread(image.data, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "%s: can't read\n", path);
+        free(image.data);
+        return 1;
+    }
+    if (image.size < 2 * HID_TRACE_SECTOR_SIZE) {
+        fprintf(stderr, "%s: too small for a capture\n", path);
+        free(image.data);
+        return 1;
+    }
+    hid_trace_storage_t storage = image_storage(&image);
+    static uint8_t block[HID_TRACE_BLOCK_SIZE];
+    ok = hid_trace_format(&storage, device, block, write_stdout, NULL);
+    free(image.data);
+    return ok ? 0 : 1;
+}
+
+// Records the traces as the HID callback would, each as its own keyboard,
+// with the log task's writes in between
+static int capture_traces(const char *path, uint32_t size, char **files, int n,
+                          uint32_t write_every) {
+    image_t image = { .data = malloc(size), .size = size };
+    memset(image.data, 0xff, size);
+    hid_trace_storage_t storage = image_storage(&image);
+    static hid_trace_t trace;
+    if (!hid_trace_init(&trace, &storage)) {
+        fprintf(stderr, "-s %u is too small for a capture\n", (unsigned)size);
+        free(image.data);
+        return 2;
+    }
+    hid_trace_record(&trace, HID_TRACE_BOOT, 0, 0, NULL, 0);
+
+    replay_trace_t *traces = calloc(n, sizeof(*traces));
+    for (int i = 0; i < n; i++) {
+        if (!replay_load(files[i], &traces[i])) {
+            return 1;
+        }
+        uint8_t addr[6] = { 0x24, 0x0a, 0xc4, 0, 0, (uint8_t)i };
+        hid_trace_record(&trace, HID_TRACE_OPEN, i, 0, addr, sizeof(addr));
+        if (traces[i].descriptor_len > 0) {
+            hid_trace_record(&trace, HID_TRACE_DESCRIPTOR, i, 0, traces[i].descriptor,
+                             traces[i].descriptor_len);
+        }
+    }
+    replay_trace_t merged;
+    replay_merge(traces, n, &merged);
+    int64_t end_us = 0;
+    for (size_t i = 0; i < merged.count; i++) {
+        const replay_report_t *report = &merged.reports[i];
+        hid_trace_record(&trace, HID_TRACE_REPORT, report->device, report->t_us, report->data,
+                         report->len);
+        if ((i + 1) % write_every == 0) {
+            hid_trace_write(&trace);
+        }
+        end_us = report->t_us;
+    }
+    for (int i = 0; i < n; i++) {
+        hid_trace_record(&trace, HID_TRACE_CLOSE, i, end_us, NULL, 0);
+    }
+    hid_trace_write(&trace);
+
+    fprintf(stderr, "%u records, %u dropped, %u blocks written, %u write failures\n",
+            (unsigned)trace.records, (unsigned)trace.dropped, (unsigned)trace.blocks_written,
+            (unsigned)trace.write_failures);
+    int status = 0;
+    if (image.bad_writes > 0) {
+        fprintf(stderr, "%u bytes written without an erase\n", (unsigned)image.bad_writes);
+        status = 1;
+    }
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(image.data, 1, size, f) != size) {
+        perror(path);
+        status = 1;
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    replay_free(&merged);
+    for (int i = 0; i < n; i++) {
+        replay_free(&traces[i]);
+    }
+    free(traces);
+    free(image.data);
+    return status;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-d device] dump.bin\n"
+            "       %s -c image.bin [-s size] [-w reports] trace...\n"
+            "  -d  keyboard to write the trace of, by position (default 0)\n"
+            "  -c  capture the traces into a partition image instead\n"
+            "  -s  size of the image in bytes (default 262144, as partitions.csv)\n"
+            "  -w  reports between writes, as the log task would (default 16)\n",
+            argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+    int device = 0;
+    const char *capture = NULL;
+    long size = 0x40000;
+    long write_every = 16;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:c:s:w:")) != -1) {
+        switch (opt) {
+            case 'd': device = atoi(optarg); break;
+            case 'c': capture = optarg; break;
+            case 's': size = strtol(optarg, NULL, 0); break;
+            case 'w': write_every = atol(optarg); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (device < 0 || device > UINT8_MAX || size <= 0 || write_every < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (capture != NULL) {
+        if (optind == argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        return capture_traces(capture, size, argv + optind, argc - optind, write_every);
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    return format_image(argv[optind], device);
+}
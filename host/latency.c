@@ -0,0 +1,61 @@
+#include "latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void latency_init(latency_recorder_t *recorder) {
+    pthread_mutex_init(&recorder->lock, NULL);
+    recorder->capacity = 1024;
+    recorder->samples = malloc(recorder->capacity * sizeof(*recorder->samples));
+    recorder->count = 0;
+}
+
+void latency_record(latency_recorder_t *recorder, int64_t latency_us) {
+    pthread_mutex_lock(&recorder->lock);
+    if (recorder->count == recorder->capacity) {
+        recorder->capacity *= 2;
+        recorder->samples = realloc(recorder->samples,
+                                    recorder->capacity * sizeof(*recorder->samples));
+    }
+    recorder->samples[recorder->count++] = latency_us;
+    pthread_mutex_unlock(&recorder->lock);
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static int64_t percentile(const int64_t *sorted, size_t count, int pct) {
+    size_t rank = (count * pct + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+void latency_summarize(latency_recorder_t *recorder, latency_summary_t *summary) {
+    memset(summary, 0, sizeof(*summary));
+    pthread_mutex_lock(&recorder->lock);
+    size_t count = recorder->count;
+    if (count > 0) {
+        qsort(recorder->samples, count, sizeof(*recorder->samples), compare_int64);
+        int64_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            total += recorder->samples[i];
+        }
+        summary->count = count;
+        summary->min_us = recorder->samples[0];
+        summary->mean_us = total / (int64_t)count;
+        summary->p50_us = percentile(recorder->samples, count, 50);
+        summary->p95_us = percentile(recorder->samples, count, 95);
+        summary->p99_us = percentile(recorder->samples, count, 99);
+        summary->max_us = recorder->samples[count - 1];
+    }
+    pthread_mutex_unlock(&recorder->lock);
+}
+
+void latency_free(latency_recorder_t *recorder) {
+    free(recorder->samples);
+    recorder->samples = NULL;
+    pthread_mutex_destroy(&recorder->lock);
+}
@@ -0,0 +1,35 @@
+#ifndef HOST_LATENCY_H
+#define HOST_LATENCY_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Collects latency samples and summarizes them. Thread safe.
+typedef struct {
+    pthread_mutex_t lock;
+    int64_t *samples;
+    size_t count;
+    size_t capacity;
+} latency_recorder_t;
+
+typedef struct {
+    size_t count;
+    int64_t min_us;
+    int64_t mean_us;
+    int64_t p50_us;
+    int64_t p95_us;
+    int64_t p99_us;
+    int64_t max_us;
+} latency_summary_t;
+
+void latency_init(latency_recorder_t *recorder);
+
+void latency_record(latency_recorder_t *recorder, int64_t latency_us);
+
+// Sorts the samples; all fields are 0 if there are none
+void latency_summarize(latency_recorder_t *recorder, latency_summary_t *summary);
+
+void latency_free(latency_recorder_t *recorder);
+
+#endif // HOST_LATENCY_H
@@ -0,0 +1,154 @@
+#include "replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_timer.h"
+
+static bool parse_line(char *line, replay_report_t *report) {
+    char *end;
+    report->t_us = strtoll(line, &end, 10);
+    report->device = 0;
+    if (end == line) {
+        return false;
+    }
+
+    report->len = 0;
+    for (char *p = end;;) {
+        unsigned long byte = strtoul(p, &end, 16);
+        if (end == p) {
+            break;
+        }
+        if (byte > 0xff || report->len == REPLAY_MAX_REPORT_LEN) {
+            return false;
+        }
+        report->data[report->len++] = (uint8_t)byte;
+        p = end;
+    }
+    // Anything left over must be whitespace
+    return strspn(end, " \t\r\n") == strlen(end) && report->len > 0;
+}
+
+// Appends the hex bytes after "descriptor" to the trace's descriptor
+static bool parse_descriptor(char *line, replay_trace_t *trace) {
+    char *end = line;
+    for (char *p = line;;) {
+        unsigned long byte = strtoul(p, &end, 16);
+        if (end == p) {
+            break;
+        }
+        if (byte > 0xff || trace->descriptor_len == REPLAY_MAX_DESCRIPTOR_LEN) {
+            return false;
+        }
+        trace->descriptor[trace->descriptor_len++] = (uint8_t)byte;
+        p = end;
+    }
+    return strspn(end, " \t\r\n") == strlen(end);
+}
+
+bool replay_load(const char *path, replay_trace_t *trace) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    size_t capacity = 256;
+    trace->reports = malloc(capacity * sizeof(*trace->reports));
+    trace->count = 0;
+    trace->descriptor_len = 0;
+
+    char line[512];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+        if (strncmp(p, "descriptor", 10) == 0) {
+            if (!parse_descriptor(p + 10, trace)) {
+                fprintf(stderr, "%s:%d: malformed descriptor: %s", path, lineno, line);
+                fclose(f);
+                replay_free(trace);
+                return false;
+            }
+            continue;
+        }
+        if (trace->count == capacity) {
+            capacity *= 2;
+            trace->reports = realloc(trace->reports, capacity * sizeof(*trace->reports));
+        }
+        if (!parse_line(p, &trace->reports[trace->count])) {
+            fprintf(stderr, "%s:%d: malformed report: %s", path, lineno, line);
+            fclose(f);
+            replay_free(trace);
+            return false;
+        }
+        trace->count++;
+    }
+
+    fclose(f);
+    return true;
+}
+
+void replay_free(replay_trace_t *trace) {
+    free(trace->reports);
+    trace->reports = NULL;
+    trace->count = 0;
+}
+
+void replay_merge(const replay_trace_t *traces, size_t n, replay_trace_t *out) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += traces[i].count;
+    }
+    out->reports = malloc((total ? total : 1) * sizeof(*out->reports));
+    out->count = 0;
+    out->descriptor_len = n > 0 ? traces[0].descriptor_len : 0;
+    if (out->descriptor_len > 0) {
+        memcpy(out->descriptor, traces[0].descriptor, out->descriptor_len);
+    }
+
+    size_t next[n];
+    memset(next, 0, sizeof(next));
+    while (out->count < total) {
+        // Few traces, so a linear scan for the earliest is fine
+        size_t earliest = n;
+        for (size_t i = 0; i < n; i++) {
+            if (next[i] < traces[i].count &&
+                (earliest == n ||
+                 traces[i].reports[next[i]].t_us < traces[earliest].reports[next[earliest]].t_us)) {
+                earliest = i;
+            }
+        }
+        replay_report_t *report = &out->reports[out->count++];
+        *report = traces[earliest].reports[next[earliest]++];
+        report->device = (uint8_t)earliest;
+    }
+}
+
+static void sleep_until(int64_t deadline_us) {
+    int64_t remaining = deadline_us - esp_timer_get_time();
+    if (remaining > 0) {
+        struct timespec ts = {
+            .tv_sec = remaining / 1000000,
+            .tv_nsec = (remaining % 1000000) * 1000,
+        };
+        nanosleep(&ts, NULL);
+    }
+}
+
+void replay_run(const replay_trace_t *trace, double speed,
+                void (*deliver)(void *arg, const replay_report_t *report), void *arg) {
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < trace->count; i++) {
+        const replay_report_t *report = &trace->reports[i];
+        if (speed > 0) {
+            sleep_until(start + (int64_t)(report->t_us / speed));
+        }
+        deliver(arg, report);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef HOST_REPLAY_H
+#define HOST_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Recorded HID input reports, as delivered with ESP_HIDH_DATA_IND_EVT.
+//
+// Trace files are text, one report per line: the time in microseconds since
+// the start of the trace followed by the report bytes in hex, report ID
+// first. Blank lines and lines starting with '#' are ignored:
+//
+//   # t_us   id mods rsvd keys...
+//   0        01 00 00 59 00 00 00 00 00
+//   80000    01 00 00 00 00 00 00 00 00
+//
+// A trace from a keyboard that isn't a boot keyboard starts with its report
+// descriptor, as delivered with ESP_HIDH_GET_DSCP_EVT, in hex on lines
+// starting with "descriptor". Consecutive lines are joined:
+//
+//   descriptor 05 01 09 06 a1 01 85 01 05 07 19 e0 29 e7 15 00 25 01
+//   descriptor 75 01 95 08 81 02 ...
+
+#define REPLAY_MAX_REPORT_LEN 64
+#define REPLAY_MAX_DESCRIPTOR_LEN 512
+
+typedef struct {
+    int64_t t_us;
+    uint8_t device;     // keyboard the report came from; 0 when loaded from a file
+    uint16_t len;
+    uint8_t data[REPLAY_MAX_REPORT_LEN];
+} replay_report_t;
+
+typedef struct {
+    replay_report_t *reports;
+    size_t count;
+    // Report descriptor to compile before the first report; none if 0
+    uint16_t descriptor_len;
+    uint8_t descriptor[REPLAY_MAX_DESCRIPTOR_LEN];
+} replay_trace_t;
+
+// Prints the offending line and returns false on a parse error
+bool replay_load(const char *path, replay_trace_t *trace);
+
+void replay_free(replay_trace_t *trace);
+
+// Interleaves `n` traces by time into `out`, tagging each report with the
+// index of the trace it came from as its device. The first trace's
+// descriptor is kept.
+void replay_merge(const replay_trace_t *traces, size_t n, replay_trace_t *out);
+
+// Feeds the trace to `deliver` in real time, scaled by `speed` (2.0 plays
+// twice as fast). A speed of 0 delivers back to back.
+void replay_run(const replay_trace_t *trace, double speed,
+                void (*deliver)(void *arg, const replay_report_t *report), void *arg);
+
+#endif // HOST_REPLAY_H
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Runs the standard benchmark matrix and appends one JSON line per run to
+# $2 (default bench.jsonl), labelled with $1 (default: current git commit).
+#
+#   host/run_bench.sh "$(git describe --always)" results.jsonl
+set -e
+
+BENCH=${KB_BENCH:-build-host/kb_bench}
+LABEL=${1:-$(git rev-parse --short HEAD 2>/dev/null || echo unknown)}
+OUT=${2:-bench.jsonl}
+
+for delay in 0 5 20; do
+    "$BENCH" -l "$LABEL" -j "$OUT" -d $delay -s steady -r 10 -n 200
+    "$BENCH" -l "$LABEL" -j "$OUT" -d $delay -s steady -r 50 -n 500
+    "$BENCH" -l "$LABEL" -j "$OUT" -d $delay -s burst -r 100 -b 8 -n 200
+    "$BENCH" -l "$LABEL" -j "$OUT" -d $delay -s repeat -r 30 -n 20
+    "$BENCH" -l "$LABEL" -j "$OUT" -d $delay -s chord -r 5 -n 50
+done
+
+# Aggregate throughput and latency as keyboards are added
+for keyboards in 1 2 4; do
+    "$BENCH" -l "$LABEL" -j "$OUT" -d 5 -a 4 -k $keyboards -s steady -r 50 -n 500
+done
+
+# Bytes per key and latency, HTTP against the UDP transport
+for transport in "" -u; do
+    "$BENCH" -l "$LABEL" -j "$OUT" -d 0 -a 4 $transport -s burst -r 100 -b 8 -n 200
+done
+
+# Throughput ceiling and saturation point as virtual keyboards are added
+"${KB_LOAD:-build-host/kb_load}" -l "$LABEL" -j "$OUT" -d 5 -a 4 -k 1,4,16,32 -r 10,25 -t 2
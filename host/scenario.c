@@ -0,0 +1,83 @@
+#include "scenario.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "usb_hid_codes.h"
+
+// Keys that key_mappings.txt forwards, so every press turns into a request
+static const uint8_t _keys[] = {
+    KEY_KP0, KEY_KP1, KEY_KP2, KEY_KP3, KEY_KP4, KEY_KP5, KEY_KP6, KEY_KP7,
+    KEY_KP8, KEY_KP9, KEY_KPDOT, KEY_KPPLUS, KEY_KPMINUS, KEY_KPENTER,
+};
+#define NUM_KEYS (sizeof(_keys) / sizeof(_keys[0]))
+
+typedef struct {
+    replay_trace_t *trace;
+    size_t capacity;
+} builder_t;
+
+static void add_report(builder_t *b, int64_t t_us, uint8_t mods, uint8_t k0, uint8_t k1) {
+    if (b->trace->count == b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 256;
+        b->trace->reports = realloc(b->trace->reports, b->capacity * sizeof(replay_report_t));
+    }
+    replay_report_t *report = &b->trace->reports[b->trace->count++];
+    memset(report, 0, sizeof(*report));
+    report->t_us = t_us;
+    report->len = 9;
+    report->data[0] = 0x01;
+    report->data[1] = mods;
+    report->data[3] = k0;
+    report->data[4] = k1;
+}
+
+static int64_t jitter(unsigned *seed, int64_t interval) {
+    return interval * 4 / 5 + (int64_t)(rand_r(seed) % 1000) * interval * 2 / 5 / 1000;
+}
+
+bool scenario_build(const char *name, const scenario_params_t *params, replay_trace_t *trace) {
+    builder_t b = { .trace = trace, .capacity = 0 };
+    trace->reports = NULL;
+    trace->count = 0;
+    trace->descriptor_len = 0;
+    unsigned seed = params->seed;
+    int64_t interval = (int64_t)(1000000 / params->rate);
+    int64_t t = 0;
+
+    if (strcmp(name, "steady") == 0) {
+        for (int i = 0; i < params->keys; i++) {
+            add_report(&b, t, 0, _keys[i % NUM_KEYS], 0);
+            add_report(&b, t + interval / 2, 0, 0, 0);
+            t += jitter(&seed, interval);
+        }
+    } else if (strcmp(name, "burst") == 0) {
+        int burst = params->burst > 0 ? params->burst : 1;
+        for (int i = 0; i < params->keys; i++) {
+            add_report(&b, t, 0, _keys[i % NUM_KEYS], 0);
+            add_report(&b, t + interval / 2, 0, 0, 0);
+            t += (i + 1) % burst == 0 ? 1000000 : interval;
+        }
+    } else if (strcmp(name, "repeat") == 0) {
+        for (int i = 0; i < params->keys; i++) {
+            uint8_t key = _keys[i % NUM_KEYS];
+            int64_t end = t + (int64_t)params->hold_ms * 1000;
+            for (; t < end; t += interval) {
+                add_report(&b, t, 0, key, 0);
+            }
+            add_report(&b, t, 0, 0, 0);
+            t += 200000;
+        }
+    } else if (strcmp(name, "chord") == 0) {
+        for (int i = 0; i < params->keys; i++) {
+            add_report(&b, t, KEY_MOD_LSHIFT, 0, 0);
+            add_report(&b, t + 20000, KEY_MOD_LSHIFT, _keys[i % NUM_KEYS], _keys[(i + 1) % NUM_KEYS]);
+            add_report(&b, t + interval / 2, 0, 0, 0);
+            t += interval;
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
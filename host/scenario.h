@@ -0,0 +1,26 @@
+#ifndef HOST_SCENARIO_H
+#define HOST_SCENARIO_H
+
+#include <stdbool.h>
+
+#include "replay.h"
+
+// Synthetic typing traces for benchmarking:
+//
+//   steady  one key at a time at `rate` presses/s, with +-20% jitter
+//   burst   groups of `burst` keys at `rate` presses/s, one second apart
+//   repeat  keys held for `hold_ms` while the keyboard repeats the report
+//           at `rate` reports/s
+//   chord   a modifier plus two keys pressed together, at `rate` chords/s
+typedef struct {
+    double rate;
+    int keys;           // presses (or holds, or chords) to generate
+    int burst;
+    int hold_ms;        // repeat only
+    unsigned seed;
+} scenario_params_t;
+
+// Returns false for an unknown scenario name
+bool scenario_build(const char *name, const scenario_params_t *params, replay_trace_t *trace);
+
+#endif // HOST_SCENARIO_H
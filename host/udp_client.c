@@ -0,0 +1,30 @@
+#include "udp_client.h"
+
+static void *udp_client_thread(void *arg) {
+    udp_client_t *client = arg;
+    while (!atomic_load(&client->stopping)) {
+        key_udp_poll(&client->udp);
+    }
+    return NULL;
+}
+
+bool udp_client_start(udp_client_t *client, const char *host, uint16_t port,
+                      uint32_t retransmit_ms, uint32_t max_attempts) {
+    if (!key_udp_init(&client->udp, host, port, retransmit_ms, max_attempts) ||
+        !key_udp_open(&client->udp)) {
+        return false;
+    }
+    atomic_init(&client->stopping, false);
+    pthread_create(&client->thread, NULL, udp_client_thread, client);
+    return true;
+}
+
+void udp_client_stop(udp_client_t *client) {
+    atomic_store(&client->stopping, true);
+    pthread_join(client->thread, NULL);
+    key_udp_close(&client->udp);
+}
+
+key_transport_t udp_client_transport(udp_client_t *client) {
+    return key_udp_transport(&client->udp);
+}
@@ -0,0 +1,28 @@
+#ifndef HOST_UDP_CLIENT_H
+#define HOST_UDP_CLIENT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "key_udp.h"
+
+// key_udp with a pthread in place of the device's key_udp task, polling for
+// acks and retransmitting
+typedef struct {
+    key_udp_t udp;
+    pthread_t thread;
+    atomic_bool stopping;
+} udp_client_t;
+
+// Opens the socket and starts the thread
+bool udp_client_start(udp_client_t *client, const char *host, uint16_t port,
+                      uint32_t retransmit_ms, uint32_t max_attempts);
+
+// Once every request has completed
+void udp_client_stop(udp_client_t *client);
+
+key_transport_t udp_client_transport(udp_client_t *client);
+
+#endif // HOST_UDP_CLIENT_H
@@ -0,0 +1,119 @@
+#include "udp_sink.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "key_wire.h"
+
+struct udp_sink {
+    udp_sink_config_t config;
+    int fd;
+    uint16_t port;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    udp_sink_stats_t stats;
+    // One bit per sequence number, for spotting retransmits
+    uint8_t seen[65536 / 8];
+};
+
+static void *udp_sink_thread(void *arg) {
+    udp_sink_t *sink = arg;
+    uint8_t buf[64];
+
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(sink->fd, buf, sizeof(buf), 0, (struct sockaddr *)&from,
+                             &from_len);
+        if (n <= 0) {
+            return NULL;
+        }
+
+        uint16_t seq;
+        key_event_t event;
+        bool valid = key_wire_decode_event(buf, n, &seq, &event);
+        pthread_mutex_lock(&sink->lock);
+        udp_sink_stats_t *stats = &sink->stats;
+        stats->datagrams++;
+        stats->bytes_received += n;
+        bool drop = sink->config.drop_every && stats->datagrams % sink->config.drop_every == 0;
+        if (!valid) {
+            stats->invalid++;
+        } else if (drop) {
+            stats->dropped++;
+        } else if (sink->seen[seq / 8] & (1 << (seq % 8))) {
+            stats->duplicates++;
+        } else {
+            sink->seen[seq / 8] |= 1 << (seq % 8);
+            // Forget the sequence number half the space ahead, so it counts
+            // as new again once the sender wraps round to it
+            uint16_t stale = seq + 32768;
+            sink->seen[stale / 8] &= ~(1 << (stale % 8));
+            stats->events++;
+        }
+        pthread_mutex_unlock(&sink->lock);
+        if (!valid || drop) {
+            continue;
+        }
+
+        if (sink->config.delay_us) {
+            usleep(sink->config.delay_us);
+        }
+        // Acked again if it's a duplicate: the first ack may have been lost
+        uint8_t ack[KEY_WIRE_ACK_LEN];
+        key_wire_encode_ack(ack, seq);
+        sendto(sink->fd, ack, sizeof(ack), 0, (struct sockaddr *)&from, from_len);
+    }
+}
+
+udp_sink_t *udp_sink_start(const udp_sink_config_t *config) {
+    udp_sink_t *sink = calloc(1, sizeof(*sink));
+    sink->config = *config;
+    pthread_mutex_init(&sink->lock, NULL);
+
+    sink->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(config->port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    if (sink->fd < 0 || bind(sink->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(sink->fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        perror("udp_sink_start");
+        if (sink->fd >= 0) {
+            close(sink->fd);
+        }
+        free(sink);
+        return NULL;
+    }
+    sink->port = ntohs(addr.sin_port);
+
+    pthread_create(&sink->thread, NULL, udp_sink_thread, sink);
+    return sink;
+}
+
+uint16_t udp_sink_port(const udp_sink_t *sink) {
+    return sink->port;
+}
+
+void udp_sink_get_stats(udp_sink_t *sink, udp_sink_stats_t *stats) {
+    pthread_mutex_lock(&sink->lock);
+    *stats = sink->stats;
+    pthread_mutex_unlock(&sink->lock);
+}
+
+void udp_sink_stop(udp_sink_t *sink) {
+    // Wakes the thread's recvfrom() with an error
+    shutdown(sink->fd, SHUT_RDWR);
+    pthread_join(sink->thread, NULL);
+    close(sink->fd);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink);
+}
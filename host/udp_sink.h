@@ -0,0 +1,38 @@
+#ifndef HOST_UDP_SINK_H
+#define HOST_UDP_SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Loopback stand-in for a server speaking the UDP transport: acks every
+// key_wire event and counts what it saw, ignoring sequence numbers it has
+// already acknowledged. One thread serves every datagram in turn.
+
+typedef struct {
+    uint16_t port;              // 0 picks a free port
+    uint32_t delay_us;          // simulated processing time per datagram
+    uint32_t drop_every;        // ignore every Nth datagram, 0 for none, to
+                                // exercise retransmits
+} udp_sink_config_t;
+
+typedef struct {
+    uint32_t datagrams;
+    uint32_t events;            // distinct events
+    uint32_t duplicates;        // retransmits of events already seen
+    uint32_t dropped;           // ignored on purpose (drop_every)
+    uint32_t invalid;
+    uint64_t bytes_received;
+} udp_sink_stats_t;
+
+typedef struct udp_sink udp_sink_t;
+
+// Returns NULL if the socket can't be set up
+udp_sink_t *udp_sink_start(const udp_sink_config_t *config);
+
+uint16_t udp_sink_port(const udp_sink_t *sink);
+
+void udp_sink_get_stats(udp_sink_t *sink, udp_sink_stats_t *stats);
+
+void udp_sink_stop(udp_sink_t *sink);
+
+#endif // HOST_UDP_SINK_H
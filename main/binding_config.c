@@ -0,0 +1,90 @@
+#include "binding_config.h"
+
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#define BINDING_CONFIG_NAMESPACE "kb_bindings"
+#define BINDING_CONFIG_KEY "src"
+
+static key_pipeline_t *_pipeline = NULL;
+
+// Only needed at boot, but kept off the caller's stack
+static char _src[BINDING_CONFIG_MAX_LEN];
+
+void binding_config_init(key_pipeline_t *pipeline) {
+    const char *TAG = "binding_config_init";
+    char err[80];
+
+    _pipeline = pipeline;
+    int len = binding_config_get(_src, sizeof(_src));
+    if (len <= 0) {
+        return;
+    }
+    // Nothing has been published yet, so the table is free
+    key_binding_table_t *table = key_pipeline_edit_bindings(pipeline);
+    if (!key_binding_table_compile(table, _src, len, err, sizeof(err))) {
+        ESP_LOGE(TAG, "Saved bindings don't compile, ignoring them: %s", err);
+        return;
+    }
+    key_pipeline_publish_bindings(pipeline);
+    ESP_LOGI(TAG, "Loaded %u key bindings", table->count);
+}
+
+static esp_err_t _save(const char *src, size_t len) {
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(BINDING_CONFIG_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (len > 0) {
+        ret = nvs_set_blob(nvs, BINDING_CONFIG_KEY, src, len);
+    } else {
+        nvs_erase_key(nvs, BINDING_CONFIG_KEY);
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return ret;
+}
+
+esp_err_t binding_config_set(const char *src, size_t len, char *err, size_t err_len) {
+    const char *TAG = "binding_config_set";
+
+    key_binding_table_t *table = key_pipeline_edit_bindings(_pipeline);
+    if (table == NULL) {
+        snprintf(err, err_len, "the last update hasn't taken effect yet");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len > BINDING_CONFIG_MAX_LEN) {
+        snprintf(err, err_len, "longer than %d bytes", BINDING_CONFIG_MAX_LEN);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!key_binding_table_compile(table, src, len, err, err_len)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = _save(src, len);
+    if (ret != ESP_OK) {
+        snprintf(err, err_len, "failed to save: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    key_pipeline_publish_bindings(_pipeline);
+    ESP_LOGI(TAG, "%u key bindings saved", table->count);
+    return ESP_OK;
+}
+
+int binding_config_get(char *buf, size_t len) {
+    nvs_handle_t nvs;
+    if (nvs_open(BINDING_CONFIG_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return 0;
+    }
+    size_t size = len;
+    esp_err_t ret = nvs_get_blob(nvs, BINDING_CONFIG_KEY, buf, &size);
+    nvs_close(nvs);
+    if (ret == ESP_ERR_NVS_INVALID_LENGTH) {
+        return -1;
+    }
+    return ret == ESP_OK ? (int)size : 0;
+}
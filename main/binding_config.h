@@ -0,0 +1,31 @@
+#ifndef BINDING_CONFIG_H
+#define BINDING_CONFIG_H
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "key_pipeline.h"
+
+// Longest binding source accepted
+#define BINDING_CONFIG_MAX_LEN 2048
+
+// The pipeline's key bindings, kept in NVS as the text they were compiled
+// from (see key_binding_table_compile()) so they survive a reboot and read
+// back as they were written.
+
+// Compiles and applies whatever was saved. Call once, after
+// key_pipeline_init() and with NVS up; the pipeline must outlive it.
+void binding_config_init(key_pipeline_t *pipeline);
+
+// Compiles `src` and, if it compiles, saves it and hands it to the pipeline;
+// an empty `src` removes every binding. Returns ESP_ERR_INVALID_ARG with the
+// reason in `err` if it doesn't compile, or ESP_ERR_INVALID_STATE while the
+// last update is still waiting to take effect. One caller at a time.
+esp_err_t binding_config_set(const char *src, size_t len, char *err, size_t err_len);
+
+// Copies the saved source into `buf`. Returns its length, 0 if nothing is
+// saved, or -1 if it doesn't fit.
+int binding_config_get(char *buf, size_t len);
+
+#endif // BINDING_CONFIG_H
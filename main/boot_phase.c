@@ -0,0 +1,85 @@
+#include "boot_phase.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *const _names[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_NVS] = "nvs",
+    [BOOT_PHASE_BT] = "bt",
+    [BOOT_PHASE_WIFI_START] = "wifi_start",
+    [BOOT_PHASE_WIFI_CONNECT] = "wifi_connect",
+    [BOOT_PHASE_WIFI_IP] = "wifi_ip",
+    [BOOT_PHASE_KEYBOARD] = "keyboard",
+    [BOOT_PHASE_FIRST_REPORT] = "first_report",
+    [BOOT_PHASE_FIRST_KEY] = "first_key",
+};
+
+// 64-bit stores aren't atomic on the ESP32, so the first caller claims the
+// phase, writes its time and then publishes it
+static _Atomic bool _claimed[BOOT_PHASE_COUNT];
+static _Atomic bool _ready[BOOT_PHASE_COUNT];
+static int64_t _times[BOOT_PHASE_COUNT];
+// Only touched by the log task
+static bool _reported[BOOT_PHASE_COUNT];
+
+void boot_phase_mark(boot_phase_t phase) {
+    if (atomic_load_explicit(&_ready[phase], memory_order_relaxed) ||
+        atomic_exchange_explicit(&_claimed[phase], true, memory_order_relaxed)) {
+        return;
+    }
+    _times[phase] = esp_timer_get_time();
+    atomic_store_explicit(&_ready[phase], true, memory_order_release);
+}
+
+// Time the phase was reached, or -1 if it hasn't been yet
+static int64_t _time(int phase) {
+    if (!atomic_load_explicit(&_ready[phase], memory_order_acquire)) {
+        return -1;
+    }
+    return _times[phase];
+}
+
+void boot_phase_report(void) {
+    const char *TAG = "boot_phase";
+    for (int p = 0; p < BOOT_PHASE_COUNT; p++) {
+        int64_t t = _time(p);
+        if (t >= 0 && !_reported[p]) {
+            ESP_LOGI(TAG, "%s at %lld.%03d ms", _names[p], (long long)(t / 1000),
+                     (int)(t % 1000));
+            _reported[p] = true;
+        }
+    }
+}
+
+int boot_phase_format(char *buf, size_t len) {
+    size_t pos = 0;
+    bool first = true;
+    int n = snprintf(buf, len, "{");
+    if (n < 0 || (size_t)n >= len) {
+        return -1;
+    }
+    pos += n;
+    for (int p = 0; p < BOOT_PHASE_COUNT; p++) {
+        int64_t t = _time(p);
+        if (t < 0) {
+            continue;
+        }
+        n = snprintf(buf + pos, len - pos, "%s\"%s\":%lld", first ? "" : ",", _names[p],
+                     (long long)t);
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+        first = false;
+    }
+    n = snprintf(buf + pos, len - pos, "}");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    return pos + n;
+}
@@ -0,0 +1,33 @@
+#ifndef BOOT_PHASE_H
+#define BOOT_PHASE_H
+
+#include <stddef.h>
+
+// Milestones between power-on and the first key reaching the server. Each is
+// stamped once, with esp_timer_get_time(), by whichever task gets there, so
+// boot latency can be compared between builds.
+typedef enum {
+    BOOT_PHASE_NVS,             // NVS ready; both stacks start after this
+    BOOT_PHASE_BT,              // HID host running
+    BOOT_PHASE_WIFI_START,      // Wi-Fi station started
+    BOOT_PHASE_WIFI_CONNECT,    // associated with the access point
+    BOOT_PHASE_WIFI_IP,         // has an IP address; requests can go out
+    BOOT_PHASE_KEYBOARD,        // first keyboard connected
+    BOOT_PHASE_FIRST_REPORT,    // first HID report received
+    BOOT_PHASE_FIRST_KEY,       // first key event delivered to the server
+    BOOT_PHASE_COUNT,
+} boot_phase_t;
+
+// Any task, including the HID callback; only the first call per phase counts
+void boot_phase_mark(boot_phase_t phase);
+
+// Logs phases stamped since the last call. Called from the log task, so
+// marking a phase never writes to the console itself.
+void boot_phase_report(void);
+
+// Writes the phases reached so far as a JSON object of microseconds since
+// the timer started, e.g. {"nvs":31020,"bt":412800,...}. Returns the length
+// written, or -1 if it doesn't fit.
+int boot_phase_format(char *buf, size_t len);
+
+#endif // BOOT_PHASE_H
@@ -0,0 +1,175 @@
+#include "device_table.h"
+
+#include <string.h>
+
+#include "esp_gap_bt_api.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#define DEVICE_TABLE_NAMESPACE "kb_devices"
+#define DEVICE_TABLE_KEY "addrs"
+#define DEVICE_TABLE_LAST_GOOD_KEY "last"
+
+static device_table_entry_t _devices[CONFIG_KEY_MAX_DEVICES];
+static int _last_good = DEVICE_TABLE_NONE;
+
+// Stored as the packed addresses of the used entries, in device ID order
+static void _save(void) {
+    const char *TAG = "device_table";
+    esp_bd_addr_t addrs[CONFIG_KEY_MAX_DEVICES];
+    size_t n = 0;
+    for (int i = 0; i < CONFIG_KEY_MAX_DEVICES && _devices[i].used; i++) {
+        memcpy(addrs[n++], _devices[i].addr, sizeof(esp_bd_addr_t));
+    }
+
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(DEVICE_TABLE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(nvs, DEVICE_TABLE_KEY, addrs, n * sizeof(esp_bd_addr_t));
+        if (ret == ESP_OK) {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save device table: %s", esp_err_to_name(ret));
+    }
+}
+
+int device_table_find(const esp_bd_addr_t addr) {
+    for (int i = 0; i < CONFIG_KEY_MAX_DEVICES && _devices[i].used; i++) {
+        if (memcmp(_devices[i].addr, addr, sizeof(esp_bd_addr_t)) == 0) {
+            return i;
+        }
+    }
+    return DEVICE_TABLE_NONE;
+}
+
+static int _add(const esp_bd_addr_t addr) {
+    const char *TAG = "device_table";
+    int device = device_table_find(addr);
+    if (device != DEVICE_TABLE_NONE) {
+        return device;
+    }
+    for (int i = 0; i < CONFIG_KEY_MAX_DEVICES; i++) {
+        if (!_devices[i].used) {
+            memcpy(_devices[i].addr, addr, sizeof(esp_bd_addr_t));
+            _devices[i].used = true;
+            ESP_LOGI(TAG, "Keyboard " ESP_BD_ADDR_STR " is device %d", ESP_BD_ADDR_HEX(addr), i);
+            return i;
+        }
+    }
+    ESP_LOGW(TAG, "No room for keyboard " ESP_BD_ADDR_STR " (KEY_MAX_DEVICES is %d)",
+             ESP_BD_ADDR_HEX(addr), CONFIG_KEY_MAX_DEVICES);
+    return DEVICE_TABLE_NONE;
+}
+
+void device_table_load(const esp_bd_addr_t fallback) {
+    const char *TAG = "device_table";
+    for (int i = 0; i < CONFIG_KEY_MAX_DEVICES; i++) {
+        _devices[i].used = false;
+        _devices[i].handle = DEVICE_TABLE_NONE;
+    }
+
+    esp_bd_addr_t addrs[CONFIG_KEY_MAX_DEVICES];
+    size_t size = sizeof(addrs);
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(DEVICE_TABLE_NAMESPACE, NVS_READONLY, &nvs);
+    uint8_t last_good = UINT8_MAX;
+    if (ret == ESP_OK) {
+        if (nvs_get_u8(nvs, DEVICE_TABLE_LAST_GOOD_KEY, &last_good) != ESP_OK) {
+            last_good = UINT8_MAX;
+        }
+        ret = nvs_get_blob(nvs, DEVICE_TABLE_KEY, addrs, &size);
+        nvs_close(nvs);
+    }
+    if (ret == ESP_OK) {
+        for (size_t i = 0; i < size / sizeof(esp_bd_addr_t); i++) {
+            _add(addrs[i]);
+        }
+    } else if (ret != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "Failed to load device table: %s", esp_err_to_name(ret));
+    }
+
+    // Keyboards paired before the table existed, or bonded while it was full
+    bool changed = false;
+    int bonded = esp_bt_gap_get_bond_device_num();
+    if (bonded > CONFIG_KEY_MAX_DEVICES) {
+        bonded = CONFIG_KEY_MAX_DEVICES;
+    }
+    if (bonded > 0 && esp_bt_gap_get_bond_device_list(&bonded, addrs) == ESP_OK) {
+        for (int i = 0; i < bonded; i++) {
+            if (device_table_find(addrs[i]) == DEVICE_TABLE_NONE &&
+                _add(addrs[i]) != DEVICE_TABLE_NONE) {
+                changed = true;
+            }
+        }
+    }
+    if (!_devices[0].used) {
+        _add(fallback);
+        changed = true;
+    }
+    if (changed) {
+        _save();
+    }
+    _last_good = last_good < CONFIG_KEY_MAX_DEVICES && _devices[last_good].used
+                     ? last_good : DEVICE_TABLE_NONE;
+}
+
+int device_table_add(const esp_bd_addr_t addr) {
+    int device = device_table_find(addr);
+    if (device == DEVICE_TABLE_NONE) {
+        device = _add(addr);
+        if (device != DEVICE_TABLE_NONE) {
+            _save();
+        }
+    }
+    return device;
+}
+
+int device_table_by_handle(uint8_t handle) {
+    for (int i = 0; i < CONFIG_KEY_MAX_DEVICES; i++) {
+        if (_devices[i].used && _devices[i].handle == handle) {
+            return i;
+        }
+    }
+    return DEVICE_TABLE_NONE;
+}
+
+void device_table_set_handle(int device, int handle) {
+    if (device >= 0 && device < CONFIG_KEY_MAX_DEVICES) {
+        _devices[device].handle = handle;
+    }
+}
+
+int device_table_last_good(void) {
+    return _last_good;
+}
+
+void device_table_set_last_good(int device) {
+    const char *TAG = "device_table";
+    if (device == _last_good || device < 0 || device >= CONFIG_KEY_MAX_DEVICES) {
+        return;
+    }
+    _last_good = device;
+
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(DEVICE_TABLE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret == ESP_OK) {
+        ret = nvs_set_u8(nvs, DEVICE_TABLE_LAST_GOOD_KEY, (uint8_t)device);
+        if (ret == ESP_OK) {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save last connected device: %s", esp_err_to_name(ret));
+    }
+}
+
+const device_table_entry_t *device_table_get(int device) {
+    if (device < 0 || device >= CONFIG_KEY_MAX_DEVICES || !_devices[device].used) {
+        return NULL;
+    }
+    return &_devices[device];
+}
@@ -0,0 +1,52 @@
+#ifndef DEVICE_TABLE_H
+#define DEVICE_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_bt_defs.h"
+#include "sdkconfig.h"
+
+// Keyboards the receiver accepts reports from. A keyboard's index in the
+// table is its device ID: it picks the pipeline's report state and queue and
+// is sent with each of its events. Addresses are kept in NVS so IDs stay the
+// same across reboots. Entries are only added, and handles only change, from
+// app_main before the HID host is running and from the HID callback
+// afterwards, so there's no locking. An entry's address never changes once
+// it's in the table.
+
+#define DEVICE_TABLE_NONE (-1)
+
+typedef struct {
+    esp_bd_addr_t addr;
+    bool used;
+    int handle;         // HID connection handle, DEVICE_TABLE_NONE while closed
+} device_table_entry_t;
+
+// Loads the table from NVS and adds any keyboards bonded with the Bluetooth
+// stack that it doesn't know yet, then `fallback` if the table is still
+// empty. Call after nvs_flash_init() and esp_bluedroid_enable().
+void device_table_load(const esp_bd_addr_t fallback);
+
+// Returns the device ID for `addr`, or DEVICE_TABLE_NONE if it isn't known
+int device_table_find(const esp_bd_addr_t addr);
+
+// Returns the device ID for `addr`, adding and saving it if there's room.
+// Returns DEVICE_TABLE_NONE if the table is full.
+int device_table_add(const esp_bd_addr_t addr);
+
+// Device ID of the keyboard connected on `handle`, or DEVICE_TABLE_NONE
+int device_table_by_handle(uint8_t handle);
+
+void device_table_set_handle(int device, int handle);
+
+// The keyboard that connected most recently, kept in NVS so the reconnect
+// supervisor can try it first after a reboot. DEVICE_TABLE_NONE if none has
+// connected yet.
+int device_table_last_good(void);
+void device_table_set_last_good(int device);
+
+// Entry for a device ID, or NULL if that slot is unused
+const device_table_entry_t *device_table_get(int device);
+
+#endif // DEVICE_TABLE_H
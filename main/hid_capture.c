@@ -0,0 +1,100 @@
+#include "hid_capture.h"
+
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+
+static const esp_partition_t *_partition = NULL;
+static hid_trace_t _trace;
+// Scratch for hid_capture_format()
+static uint8_t _block[HID_TRACE_BLOCK_SIZE];
+static uint32_t _reported_drops = 0;
+
+static bool partition_read(void *ctx, uint32_t offset, void *buf, uint32_t len) {
+    return esp_partition_read(ctx, offset, buf, len) == ESP_OK;
+}
+
+static bool partition_write(void *ctx, uint32_t offset, const void *buf, uint32_t len) {
+    return esp_partition_write(ctx, offset, buf, len) == ESP_OK;
+}
+
+static bool partition_erase(void *ctx, uint32_t offset) {
+    return esp_partition_erase_range(ctx, offset, HID_TRACE_SECTOR_SIZE) == ESP_OK;
+}
+
+static hid_trace_storage_t partition_storage(const esp_partition_t *partition) {
+    hid_trace_storage_t storage = {
+        .read = partition_read,
+        .write = partition_write,
+        .erase = partition_erase,
+        .size = partition->size / HID_TRACE_SECTOR_SIZE * HID_TRACE_SECTOR_SIZE,
+        .ctx = (void *)partition,
+    };
+    return storage;
+}
+
+bool hid_capture_init(void) {
+    const char *TAG = "hid_capture_init";
+
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, HID_CAPTURE_PARTITION_SUBTYPE, HID_CAPTURE_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No %s partition", HID_CAPTURE_PARTITION_LABEL);
+        return false;
+    }
+    hid_trace_storage_t storage = partition_storage(partition);
+    if (!hid_trace_init(&_trace, &storage)) {
+        ESP_LOGE(TAG, "%s partition is too small", HID_CAPTURE_PARTITION_LABEL);
+        return false;
+    }
+    ESP_LOGI(TAG, "Capturing HID reports to %s from block %u", HID_CAPTURE_PARTITION_LABEL,
+             (unsigned)_trace.next_seq);
+    _partition = partition;
+    hid_trace_record(&_trace, HID_TRACE_BOOT, 0, esp_timer_get_time(), NULL, 0);
+    return true;
+}
+
+void hid_capture_record(uint8_t type, uint8_t device, int64_t t_us, const void *payload,
+                        uint16_t len) {
+    if (_partition != NULL) {
+        hid_trace_record(&_trace, type, device, t_us, payload, len);
+    }
+}
+
+void hid_capture_flush(void) {
+    const char *TAG = "hid_capture_flush";
+
+    if (_partition == NULL) {
+        return;
+    }
+    if (!hid_trace_write(&_trace)) {
+        ESP_LOGW(TAG, "Failed to write to %s", HID_CAPTURE_PARTITION_LABEL);
+    }
+    uint32_t dropped = atomic_load_explicit(&_trace.dropped, memory_order_relaxed);
+    if (dropped != _reported_drops) {
+        ESP_LOGW(TAG, "%u HID reports dropped from the capture", (unsigned)dropped);
+        _reported_drops = dropped;
+    }
+}
+
+bool hid_capture_format(uint8_t device, bool (*out)(void *arg, const char *text, size_t len),
+                        void *arg) {
+    if (_partition == NULL) {
+        return true;
+    }
+    char header[160];
+    int n = snprintf(header, sizeof(header),
+                     "# HID capture of device %u: %u records, %u dropped, %u blocks written, "
+                     "%u write failures since boot\n",
+                     device, (unsigned)atomic_load(&_trace.records),
+                     (unsigned)atomic_load(&_trace.dropped),
+                     (unsigned)atomic_load(&_trace.blocks_written),
+                     (unsigned)atomic_load(&_trace.write_failures));
+    if (!out(arg, header, n)) {
+        return false;
+    }
+    hid_trace_storage_t storage = partition_storage(_partition);
+    return hid_trace_format(&storage, device, _block, out, arg);
+}
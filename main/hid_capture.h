@@ -0,0 +1,35 @@
+#ifndef HID_CAPTURE_H
+#define HID_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hid_trace.h"
+
+// Data partition the capture goes to, from partitions.csv
+#define HID_CAPTURE_PARTITION_LABEL "hidtrace"
+#define HID_CAPTURE_PARTITION_SUBTYPE 0x41
+
+// CONFIG_KEY_TRACE_CAPTURE: a hid_trace in the hidtrace partition, carrying
+// on from where the last boot left off.
+
+// Returns false if there's no usable hidtrace partition, after which
+// nothing is recorded
+bool hid_capture_init(void);
+
+// From the HID callback only; never waits. `device` is the keyboard's
+// position in the device table. Does nothing without a partition.
+void hid_capture_record(uint8_t type, uint8_t device, int64_t t_us, const void *payload,
+                        uint16_t len);
+
+// From the log task only. Writes out what's been recorded since last time.
+void hid_capture_flush(void);
+
+// Any one task at a time, e.g. the status server's. Writes a comment with the
+// capture's counters, then hid_trace_format()'s trace of `device`. What was
+// recorded since the last flush isn't in it yet.
+bool hid_capture_format(uint8_t device, bool (*out)(void *arg, const char *text, size_t len),
+                        void *arg);
+
+#endif // HID_CAPTURE_H
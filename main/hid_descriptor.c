@@ -0,0 +1,637 @@
+#include "hid_descriptor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "usb_hid_codes.h"
+
+#define HID_PAGE_KEYBOARD 0x07
+#define HID_PAGE_CONSUMER 0x0c
+
+// Short item types and the tags the parser cares about
+#define HID_ITEM_MAIN   0
+#define HID_ITEM_GLOBAL 1
+#define HID_ITEM_LOCAL  2
+#define HID_ITEM_LONG   0xfe
+
+#define HID_MAIN_INPUT          0x8
+#define HID_MAIN_COLLECTION     0xa
+#define HID_MAIN_END_COLLECTION 0xc
+
+#define HID_GLOBAL_USAGE_PAGE   0x0
+#define HID_GLOBAL_LOGICAL_MIN  0x1
+#define HID_GLOBAL_LOGICAL_MAX  0x2
+#define HID_GLOBAL_REPORT_SIZE  0x7
+#define HID_GLOBAL_REPORT_ID    0x8
+#define HID_GLOBAL_REPORT_COUNT 0x9
+#define HID_GLOBAL_PUSH         0xa
+#define HID_GLOBAL_POP          0xb
+
+#define HID_LOCAL_USAGE     0x0
+#define HID_LOCAL_USAGE_MIN 0x1
+#define HID_LOCAL_USAGE_MAX 0x2
+
+#define HID_INPUT_CONSTANT 0x01
+#define HID_INPUT_VARIABLE 0x02
+
+// Codes below this in a key slot are error states (rollover, POST fail,
+// undefined) rather than keys
+#define HID_FIRST_KEY KEY_A
+
+// Consumer page usages with a KEY_MEDIA_* code, by usage
+static const struct {
+    uint16_t usage;
+    uint8_t code;
+} _consumer_codes[] = {
+    { 0x0032, KEY_MEDIA_SLEEP },
+    { 0x00b5, KEY_MEDIA_NEXTSONG },
+    { 0x00b6, KEY_MEDIA_PREVIOUSSONG },
+    { 0x00b7, KEY_MEDIA_STOPCD },
+    { 0x00b8, KEY_MEDIA_EJECTCD },
+    { 0x00cd, KEY_MEDIA_PLAYPAUSE },
+    { 0x00e2, KEY_MEDIA_MUTE },
+    { 0x00e9, KEY_MEDIA_VOLUMEUP },
+    { 0x00ea, KEY_MEDIA_VOLUMEDOWN },
+    { 0x0192, KEY_MEDIA_CALC },
+    { 0x0196, KEY_MEDIA_WWW },
+    { 0x019e, KEY_MEDIA_COFFEE },
+    { 0x0221, KEY_MEDIA_FIND },
+    { 0x0224, KEY_MEDIA_BACK },
+    { 0x0225, KEY_MEDIA_FORWARD },
+    { 0x0226, KEY_MEDIA_STOP },
+    { 0x0227, KEY_MEDIA_REFRESH },
+    { 0x0233, KEY_MEDIA_SCROLLUP },
+    { 0x0234, KEY_MEDIA_SCROLLDOWN },
+};
+
+// KEY_NONE for usages without a code
+static uint8_t _consumer_code(uint32_t usage) {
+    for (size_t i = 0; i < sizeof(_consumer_codes) / sizeof(_consumer_codes[0]); i++) {
+        if (_consumer_codes[i].usage == usage) {
+            return _consumer_codes[i].code;
+        }
+    }
+    return KEY_NONE;
+}
+
+void hid_plan_boot(hid_plan_t *plan) {
+    memset(plan, 0, sizeof(*plan));
+    plan->ids = true;
+    plan->any_id = true;
+    plan->report_count = 1;
+    plan->reports[0] = (hid_plan_report_t){
+        .mods = true,
+        .first_field = 0,
+        .field_count = 2,
+        .len = HID_REPORT_LEN,
+    };
+    plan->field_count = 2;
+    plan->fields[0] = (hid_field_t){
+        .kind = HID_FIELD_BITS,
+        .size = 1,
+        .count = 8,
+        .offset = 0,
+        .first = KEY_LEFTCTRL,
+    };
+    plan->fields[1] = (hid_field_t){
+        .kind = HID_FIELD_KEYS,
+        .size = 8,
+        .count = HID_REPORT_KEYS,
+        .offset = 16,
+        .first = 0,
+        .logical_min = 0,
+        .logical_max = 0xff,
+    };
+}
+
+// Compiling
+
+#define HID_PARSE_STACK  4
+#define HID_PARSE_USAGES 16
+#define HID_PARSE_IDS    16
+// Longest input report a plan can describe, in bits
+#define HID_REPORT_MAX_BITS (8 * (uint32_t)UINT16_MAX)
+
+typedef struct {
+    uint32_t page;
+    int32_t logical_min;
+    int32_t logical_max;
+    uint32_t size;
+    uint32_t count;
+    uint8_t id;
+} _globals_t;
+
+// A field found so far, with the report it belongs to
+typedef struct {
+    hid_field_t field;
+    uint8_t id;
+    bool keyboard;      // on the Keyboard page, so its report has the modifiers
+} _found_t;
+
+typedef struct {
+    const uint8_t *desc;
+    size_t pos;
+    char *err;
+    size_t err_len;
+
+    _globals_t globals;
+    _globals_t stack[HID_PARSE_STACK];
+    uint32_t depth;
+    bool ids;
+
+    // Locals, reset after every main item. A usage given in 32 bits carries
+    // its page; a shorter one takes the page in effect at the main item.
+    uint32_t usages[HID_PARSE_USAGES];
+    bool usage_has_page[HID_PARSE_USAGES];
+    uint32_t usage_count;
+    uint32_t usage_min;
+    uint32_t usage_max;
+    bool min_has_page;
+    bool has_min;
+    bool has_max;
+
+    // Bits given so far to each report ID's input report
+    uint8_t ids_seen[HID_PARSE_IDS];
+    uint32_t bits[HID_PARSE_IDS];
+    uint32_t id_count;
+
+    _found_t found[HID_PLAN_MAX_FIELDS];
+    uint32_t found_count;
+    uint8_t codes[HID_PLAN_MAX_CODES];
+    uint32_t code_count;
+} _parser_t;
+
+static bool _fail(_parser_t *p, const char *message) {
+    if (p->err_len > 0) {
+        snprintf(p->err, p->err_len, "offset %u: %s", (unsigned)p->pos, message);
+    }
+    return false;
+}
+
+static void _clear_locals(_parser_t *p) {
+    p->usage_count = 0;
+    p->has_min = false;
+    p->has_max = false;
+}
+
+static uint32_t _resolve(const _parser_t *p, uint32_t usage, bool has_page) {
+    return has_page ? usage : (p->globals.page << 16) | (usage & 0xffff);
+}
+
+static uint32_t *_bits_for(_parser_t *p, uint8_t id) {
+    for (uint32_t i = 0; i < p->id_count; i++) {
+        if (p->ids_seen[i] == id) {
+            return &p->bits[i];
+        }
+    }
+    if (p->id_count == HID_PARSE_IDS) {
+        return NULL;
+    }
+    p->ids_seen[p->id_count] = id;
+    p->bits[p->id_count] = 0;
+    return &p->bits[p->id_count++];
+}
+
+// The usage of bit or slot `i`: from the usage list (the last one repeating
+// if there are fewer than slots) or the range
+static uint32_t _usage(const _parser_t *p, uint32_t i) {
+    if (p->usage_count > 0) {
+        uint32_t u = i < p->usage_count ? i : p->usage_count - 1;
+        return _resolve(p, p->usages[u], p->usage_has_page[u]);
+    }
+    return _resolve(p, p->usage_min + i, p->min_has_page);
+}
+
+// Turns an Input item that isn't padding into a field, if it's one that
+// carries keys. Anything else only takes up room in its report.
+static void _add_field(_parser_t *p, uint32_t flags, uint32_t offset) {
+    const _globals_t *g = &p->globals;
+    if (p->usage_count == 0 && !(p->has_min && p->has_max)) {
+        return;
+    }
+    if (p->found_count == HID_PLAN_MAX_FIELDS || offset > UINT16_MAX) {
+        return;
+    }
+    uint32_t page = _usage(p, 0) >> 16;
+    if (page != HID_PAGE_KEYBOARD && page != HID_PAGE_CONSUMER) {
+        return;
+    }
+
+    hid_field_t field = {
+        .size = g->size,
+        .count = g->count,
+        .offset = offset,
+        .logical_min = g->logical_min,
+        .logical_max = g->logical_max,
+    };
+    if (flags & HID_INPUT_VARIABLE) {
+        if (g->size != 1) {
+            return;
+        }
+        field.kind = HID_FIELD_BITS;
+        if (page == HID_PAGE_KEYBOARD && p->usage_count == 0) {
+            // A range of key codes, e.g. the modifiers or an NKRO bitmap
+            field.first = p->usage_min & 0xffff;
+            if (field.first > 0xff) {
+                return;
+            }
+            if (field.first + field.count > 256) {
+                field.count = 256 - field.first;
+            }
+        } else {
+            // Listed usages, or consumer ones: each bit gets its code
+            if (p->code_count + g->count > HID_PLAN_MAX_CODES) {
+                return;
+            }
+            field.codes = p->code_count + 1;
+            for (uint32_t i = 0; i < g->count; i++) {
+                uint32_t usage = _usage(p, i);
+                uint8_t code = KEY_NONE;
+                if (usage >> 16 == HID_PAGE_KEYBOARD && (usage & 0xffff) <= 0xff) {
+                    code = usage & 0xff;
+                } else if (usage >> 16 == HID_PAGE_CONSUMER) {
+                    code = _consumer_code(usage & 0xffff);
+                }
+                p->codes[p->code_count++] = code;
+            }
+        }
+    } else {
+        if (g->size == 0 || g->size > 16) {
+            return;
+        }
+        field.kind = page == HID_PAGE_KEYBOARD ? HID_FIELD_KEYS : HID_FIELD_CONSUMER;
+        // Slots hold indexes into the usage range
+        field.first = (p->usage_count > 0 ? p->usages[0] : p->usage_min) & 0xffff;
+    }
+
+    _found_t *found = &p->found[p->found_count++];
+    found->field = field;
+    found->id = g->id;
+    found->keyboard = page == HID_PAGE_KEYBOARD;
+}
+
+static bool _main_item(_parser_t *p, uint8_t tag, uint32_t data) {
+    switch (tag) {
+        case HID_MAIN_INPUT: {
+            uint32_t *bits = _bits_for(p, p->globals.id);
+            if (bits == NULL) {
+                return _fail(p, "too many reports");
+            }
+            // hid_plan_report_t's length is 16 bits, so a report can't be
+            // longer; any field in it ends before this too
+            uint32_t end = *bits + p->globals.size * p->globals.count;
+            if (end > HID_REPORT_MAX_BITS) {
+                return _fail(p, "report too long");
+            }
+            if (!(data & HID_INPUT_CONSTANT)) {
+                _add_field(p, data, *bits);
+            }
+            *bits = end;
+            break;
+        }
+        case HID_MAIN_COLLECTION:
+            break;
+        case HID_MAIN_END_COLLECTION:
+            break;
+        default:
+            // Output and Feature reports don't carry keys
+            break;
+    }
+    _clear_locals(p);
+    return true;
+}
+
+static bool _global_item(_parser_t *p, uint8_t tag, uint32_t data, int32_t sdata) {
+    _globals_t *g = &p->globals;
+    switch (tag) {
+        case HID_GLOBAL_USAGE_PAGE:
+            g->page = data & 0xffff;
+            break;
+        case HID_GLOBAL_LOGICAL_MIN:
+            g->logical_min = sdata;
+            break;
+        case HID_GLOBAL_LOGICAL_MAX:
+            // Often written as an unsigned byte, e.g. 25 ff for 255
+            g->logical_max = sdata < g->logical_min ? (int32_t)data : sdata;
+            break;
+        case HID_GLOBAL_REPORT_SIZE:
+            if (data > 32) {
+                return _fail(p, "report size over 32 bits");
+            }
+            g->size = data;
+            break;
+        case HID_GLOBAL_REPORT_ID:
+            if (data == 0 || data > 0xff) {
+                return _fail(p, "bad report ID");
+            }
+            g->id = data;
+            p->ids = true;
+            break;
+        case HID_GLOBAL_REPORT_COUNT:
+            if (data > 1024) {
+                return _fail(p, "report count too large");
+            }
+            g->count = data;
+            break;
+        case HID_GLOBAL_PUSH:
+            if (p->depth == HID_PARSE_STACK) {
+                return _fail(p, "push too deep");
+            }
+            p->stack[p->depth++] = *g;
+            break;
+        case HID_GLOBAL_POP:
+            if (p->depth == 0) {
+                return _fail(p, "pop without push");
+            }
+            *g = p->stack[--p->depth];
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static void _local_item(_parser_t *p, uint8_t tag, uint32_t data, uint8_t size) {
+    switch (tag) {
+        case HID_LOCAL_USAGE:
+            if (p->usage_count < HID_PARSE_USAGES) {
+                p->usages[p->usage_count] = data;
+                p->usage_has_page[p->usage_count] = size == 4;
+                p->usage_count++;
+            }
+            break;
+        case HID_LOCAL_USAGE_MIN:
+            p->usage_min = data;
+            p->min_has_page = size == 4;
+            p->has_min = true;
+            break;
+        case HID_LOCAL_USAGE_MAX:
+            p->usage_max = data;
+            p->has_max = true;
+            break;
+        default:
+            break;
+    }
+}
+
+// Groups the fields found by report and lays them out in `plan`
+static bool _build(_parser_t *p, hid_plan_t *plan) {
+    memset(plan, 0, sizeof(*plan));
+    plan->ids = p->ids;
+    for (uint32_t i = 0; i < p->id_count; i++) {
+        uint8_t id = p->ids_seen[i];
+        uint32_t first = plan->field_count;
+        bool mods = false;
+        for (uint32_t f = 0; f < p->found_count; f++) {
+            if (p->found[f].id == id) {
+                plan->fields[plan->field_count++] = p->found[f].field;
+                mods |= p->found[f].keyboard;
+            }
+        }
+        if (plan->field_count == first) {
+            continue;
+        }
+        if (plan->report_count == HID_PLAN_MAX_REPORTS) {
+            plan->field_count = first;
+            break;
+        }
+        plan->reports[plan->report_count++] = (hid_plan_report_t){
+            .id = id,
+            .mods = mods,
+            .first_field = first,
+            .field_count = plan->field_count - first,
+            .len = (p->bits[i] + 7) / 8,
+        };
+    }
+    memcpy(plan->codes, p->codes, p->code_count);
+    plan->code_count = p->code_count;
+    return plan->report_count > 0;
+}
+
+bool hid_plan_compile(hid_plan_t *plan, const uint8_t *desc, size_t len, char *err,
+                      size_t err_len) {
+    // Too big for the callback's stack
+    static _parser_t p;
+    static hid_plan_t built;
+
+    memset(&p, 0, sizeof(p));
+    p.desc = desc;
+    p.err = err;
+    p.err_len = err_len;
+    if (err_len > 0) {
+        err[0] = '\0';
+    }
+
+    while (p.pos < len) {
+        uint8_t prefix = desc[p.pos];
+        if (prefix == HID_ITEM_LONG) {
+            if (p.pos + 1 >= len) {
+                return _fail(&p, "truncated long item");
+            }
+            p.pos += 3 + desc[p.pos + 1];
+            continue;
+        }
+        uint8_t size = prefix & 3;
+        if (size == 3) {
+            size = 4;
+        }
+        if (p.pos + 1 + size > len) {
+            return _fail(&p, "truncated item");
+        }
+        const uint8_t *d = desc + p.pos + 1;
+        uint32_t data = 0;
+        int32_t sdata = 0;
+        switch (size) {
+            case 1:
+                data = d[0];
+                sdata = (int8_t)d[0];
+                break;
+            case 2:
+                data = d[0] | (uint32_t)d[1] << 8;
+                sdata = (int16_t)data;
+                break;
+            case 4:
+                data = d[0] | (uint32_t)d[1] << 8 | (uint32_t)d[2] << 16 | (uint32_t)d[3] << 24;
+                sdata = (int32_t)data;
+                break;
+        }
+
+        uint8_t tag = prefix >> 4;
+        bool ok = true;
+        switch ((prefix >> 2) & 3) {
+            case HID_ITEM_MAIN:
+                ok = _main_item(&p, tag, data);
+                break;
+            case HID_ITEM_GLOBAL:
+                ok = _global_item(&p, tag, data, sdata);
+                break;
+            case HID_ITEM_LOCAL:
+                _local_item(&p, tag, data, size);
+                break;
+            default:
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+        p.pos += 1 + size;
+    }
+
+    if (!_build(&p, &built)) {
+        return _fail(&p, "no keys");
+    }
+    *plan = built;
+    return true;
+}
+
+// Running the plan
+
+static inline uint32_t _read_bits(const uint8_t *data, uint32_t offset, uint32_t size) {
+    if (size == 8 && (offset & 7) == 0) {
+        return data[offset >> 3];
+    }
+    // At most three bytes for a 16 bit slot
+    uint32_t first = offset >> 3;
+    uint32_t last = (offset + size - 1) >> 3;
+    uint32_t value = 0;
+    for (uint32_t b = last + 1; b-- > first;) {
+        value = value << 8 | data[b];
+    }
+    return (value >> (offset & 7)) & ((1u << size) - 1);
+}
+
+static inline void _add_key(hid_keys_t *keys, uint8_t code) {
+    if (code >= KEY_LEFTCTRL && code <= KEY_RIGHTMETA) {
+        keys->mods |= 1u << (code - KEY_LEFTCTRL);
+    } else if (keys->count < HID_REPORT_MAX_KEYS) {
+        keys->keys[keys->count++] = code;
+    } else {
+        keys->rollover = true;
+    }
+}
+
+// The usage in a slot, or 0 for an empty one
+static inline uint32_t _slot_usage(const hid_field_t *field, const uint8_t *data, uint32_t i) {
+    int32_t value = _read_bits(data, field->offset + i * field->size, field->size);
+    if (field->logical_min < 0 && (value >> (field->size - 1)) & 1) {
+        value -= 1 << field->size;
+    }
+    if (value < field->logical_min || value > field->logical_max) {
+        return 0;
+    }
+    return field->first + (uint32_t)(value - field->logical_min);
+}
+
+static void _extract_field(const hid_plan_t *plan, const hid_field_t *plan_field,
+                           const uint8_t *data, hid_keys_t *keys) {
+    // A copy, as every key written to `keys` could otherwise alias it
+    const hid_field_t f = *plan_field;
+    const hid_field_t *field = &f;
+    switch (field->kind) {
+        case HID_FIELD_BITS:
+            for (uint32_t i = 0; i < field->count;) {
+                uint32_t bit = field->offset + i;
+                uint32_t down;
+                uint32_t width;
+                if ((bit & 7) == 0 && i + 8 <= field->count) {
+                    // A whole byte at a time, released keys skipped
+                    down = data[bit >> 3];
+                    width = 8;
+                } else {
+                    down = (data[bit >> 3] >> (bit & 7)) & 1;
+                    width = 1;
+                }
+                while (down) {
+                    uint32_t j = i + __builtin_ctz(down);
+                    uint8_t code = field->codes ? plan->codes[field->codes - 1 + j]
+                                                : (uint8_t)(field->first + j);
+                    if (code >= HID_FIRST_KEY) {
+                        _add_key(keys, code);
+                    }
+                    down &= down - 1;
+                }
+                i += width;
+            }
+            break;
+        case HID_FIELD_KEYS:
+            if (field->size == 8 && (field->offset & 7) == 0 && field->logical_min == 0 &&
+                field->first == 0) {
+                // Byte slots holding the key codes themselves, as boot and
+                // most 6KRO keyboards send
+                const uint8_t *slots = data + (field->offset >> 3);
+                for (uint32_t i = 0; i < field->count; i++) {
+                    uint8_t code = slots[i];
+                    if (code == KEY_NONE || code > field->logical_max) {
+                        continue;
+                    }
+                    if (code < HID_FIRST_KEY) {
+                        keys->rollover = true;
+                    } else {
+                        _add_key(keys, code);
+                    }
+                }
+                break;
+            }
+            for (uint32_t i = 0; i < field->count; i++) {
+                uint32_t usage = _slot_usage(field, data, i);
+                if (usage == KEY_NONE || usage > 0xff) {
+                    continue;
+                }
+                if (usage < HID_FIRST_KEY) {
+                    keys->rollover = true;
+                    continue;
+                }
+                _add_key(keys, usage);
+            }
+            break;
+        case HID_FIELD_CONSUMER:
+            for (uint32_t i = 0; i < field->count; i++) {
+                uint32_t usage = _slot_usage(field, data, i);
+                uint8_t code = usage ? _consumer_code(usage) : KEY_NONE;
+                if (code != KEY_NONE) {
+                    _add_key(keys, code);
+                }
+            }
+            break;
+    }
+}
+
+int hid_plan_extract(const hid_plan_t *plan, const uint8_t *data, size_t len,
+                     hid_keys_t *keys) {
+    int r = 0;
+    if (plan->ids) {
+        if (len == 0) {
+            return -1;
+        }
+        if (!plan->any_id) {
+            while (r < plan->report_count && plan->reports[r].id != data[0]) {
+                r++;
+            }
+        }
+        data++;
+        len--;
+    }
+    if (r >= plan->report_count || len != plan->reports[r].len) {
+        return -1;
+    }
+
+    const hid_plan_report_t *report = &plan->reports[r];
+    // Filled in locally so the compiler knows nothing else changes under it
+    hid_keys_t found;
+    found.mods = 0;
+    found.count = 0;
+    found.rollover = false;
+    for (uint32_t f = 0; f < report->field_count; f++) {
+        const hid_field_t *field = &plan->fields[report->first_field + f];
+        // Never past the end of the report, whatever the plan says
+        if ((uint32_t)field->offset + (uint32_t)field->size * field->count > len * 8) {
+            continue;
+        }
+        _extract_field(plan, field, data, &found);
+    }
+    keys->mods = found.mods;
+    keys->count = found.count;
+    keys->rollover = found.rollover;
+    memcpy(keys->keys, found.keys, found.count);
+    return r;
+}
@@ -0,0 +1,76 @@
+#ifndef HID_DESCRIPTOR_H
+#define HID_DESCRIPTOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hid_report.h"
+
+// Limits of what a plan can describe. Reports and fields beyond these, or
+// that don't carry keys (mice, LEDs, vendor pages), are left out.
+#define HID_PLAN_MAX_REPORTS 4
+#define HID_PLAN_MAX_FIELDS  8
+#define HID_PLAN_MAX_CODES   32
+
+typedef enum {
+    HID_FIELD_BITS,         // one bit per key, modifiers included
+    HID_FIELD_KEYS,         // Keyboard page key codes, one per slot
+    HID_FIELD_CONSUMER,     // Consumer page usages, one per slot
+} hid_field_kind_t;
+
+// Where to find keys in a report, worked out once from the descriptor
+typedef struct {
+    uint8_t kind;           // hid_field_kind_t
+    uint8_t size;           // bits per slot, 1 for HID_FIELD_BITS
+    // HID_FIELD_BITS: bit i is key code `first + i`, or with `codes` set,
+    // plan->codes[codes - 1 + i]
+    uint8_t codes;
+    uint16_t count;         // slots, or bits
+    uint16_t offset;        // in bits, from the start of the report after its ID
+    uint16_t first;         // HID_FIELD_BITS: first key code. Slots: the usage
+                            // that `logical_min` stands for.
+    int32_t logical_min;
+    int32_t logical_max;
+} hid_field_t;
+
+typedef struct {
+    uint8_t id;
+    bool mods;              // has the modifier bits; others leave them alone
+    uint8_t first_field;
+    uint8_t field_count;
+    uint16_t len;           // bytes, without the ID
+} hid_plan_report_t;
+
+// How to get keys out of one keyboard's input reports. Consumer page usages
+// (media keys) come out as the KEY_MEDIA_* codes in usb_hid_codes.h, so they
+// map and bind like any other key.
+typedef struct {
+    bool ids;               // reports start with their report ID
+    bool any_id;            // hid_plan_boot(): the one report, whatever its ID
+    uint8_t report_count;
+    uint8_t field_count;
+    uint8_t code_count;
+    hid_plan_report_t reports[HID_PLAN_MAX_REPORTS];
+    hid_field_t fields[HID_PLAN_MAX_FIELDS];
+    uint8_t codes[HID_PLAN_MAX_CODES];
+} hid_plan_t;
+
+// The layout assumed until a keyboard's descriptor is known: a report ID,
+// then a boot protocol report
+void hid_plan_boot(hid_plan_t *plan);
+
+// Builds a plan from a report descriptor, as delivered with
+// ESP_HIDH_GET_DSCP_EVT. Returns false with the reason in `err` if the
+// descriptor is malformed or describes no keys, leaving `plan` as it was.
+bool hid_plan_compile(hid_plan_t *plan, const uint8_t *desc, size_t len, char *err,
+                      size_t err_len);
+
+// Finds which of the plan's reports `data` (`len` bytes, ID included if the
+// plan has IDs) is, and reads its keys. Nothing about the descriptor is looked
+// at again. Returns the report's index in plan->reports, or -1 if it isn't
+// one of them or has the wrong length.
+int hid_plan_extract(const hid_plan_t *plan, const uint8_t *data, size_t len,
+                     hid_keys_t *keys);
+
+#endif // HID_DESCRIPTOR_H
@@ -0,0 +1,114 @@
+#include "hid_report.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "usb_hid_codes.h"
+
+// Codes below this in a key slot are error states (rollover, POST fail,
+// undefined) rather than keys
+#define HID_FIRST_KEY KEY_A
+
+static inline bool _is_down(const uint32_t *bitmap, uint8_t key) {
+    return (bitmap[key >> 5] >> (key & 31)) & 1;
+}
+
+static inline void _set_down(uint32_t *bitmap, uint8_t key) {
+    bitmap[key >> 5] |= 1u << (key & 31);
+}
+
+static inline void _emit(key_event_t *event, uint8_t key, uint8_t type, uint8_t mods,
+                         int64_t timestamp_us) {
+    event->timestamp_us = timestamp_us;
+    event->seq = 0;
+    event->tx = 0;
+    event->count = 1;
+    event->key = key;
+    event->type = type;
+    event->mods = mods;
+    event->binding = 0;
+}
+
+void hid_report_state_init(hid_report_state_t *state) {
+    memset(state, 0, sizeof(*state));
+}
+
+void hid_report_boot_keys(const uint8_t *report, hid_keys_t *keys) {
+    const uint8_t *slots = report + 2;
+    keys->mods = report[0];
+    keys->count = 0;
+    keys->rollover = false;
+    for (int i = 0; i < HID_REPORT_KEYS; i++) {
+        // Any error code in the key slots means the keyboard couldn't tell
+        // which keys are down
+        keys->rollover |= slots[i] != KEY_NONE && slots[i] < HID_FIRST_KEY;
+        if (slots[i] != KEY_NONE) {
+            keys->keys[keys->count++] = slots[i];
+        }
+    }
+}
+
+int hid_report_diff_keys(hid_report_state_t *state, const hid_keys_t *keys,
+                         int64_t timestamp_us, key_event_t *events) {
+    uint8_t mods = keys->mods;
+    int n = 0;
+
+    // Keep the last known set until the keyboard can tell again
+    uint32_t down[256 / 32] = { 0 };
+    uint8_t held[HID_REPORT_MAX_KEYS];
+    uint8_t count = 0;
+    if (keys->rollover) {
+        memcpy(down, state->down, sizeof(down));
+        memcpy(held, state->keys, sizeof(held));
+        count = state->count;
+    } else {
+        for (int i = 0; i < keys->count; i++) {
+            uint8_t key = keys->keys[i];
+            if (!_is_down(down, key)) {
+                _set_down(down, key);
+                held[count++] = key;
+            }
+        }
+    }
+
+    for (int i = 0; i < state->count; i++) {
+        uint8_t key = state->keys[i];
+        if (!_is_down(down, key)) {
+            _emit(&events[n++], key, KEY_EVENT_RELEASE, mods, timestamp_us);
+        }
+    }
+
+    // Modifier bit i corresponds to key code KEY_LEFTCTRL + i
+    uint8_t released = state->mods & ~mods;
+    uint8_t pressed = mods & ~state->mods;
+    while (released) {
+        int bit = __builtin_ctz(released);
+        _emit(&events[n++], KEY_LEFTCTRL + bit, KEY_EVENT_RELEASE, mods, timestamp_us);
+        released &= released - 1;
+    }
+    while (pressed) {
+        int bit = __builtin_ctz(pressed);
+        _emit(&events[n++], KEY_LEFTCTRL + bit, KEY_EVENT_PRESS, mods, timestamp_us);
+        pressed &= pressed - 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint8_t key = held[i];
+        if (!_is_down(state->down, key)) {
+            _emit(&events[n++], key, KEY_EVENT_PRESS, mods, timestamp_us);
+        }
+    }
+
+    state->mods = mods;
+    state->count = count;
+    memcpy(state->keys, held, count);
+    memcpy(state->down, down, sizeof(down));
+    return n;
+}
+
+int hid_report_diff(hid_report_state_t *state, const uint8_t *report,
+                    int64_t timestamp_us, key_event_t *events) {
+    hid_keys_t keys;
+    hid_report_boot_keys(report, &keys);
+    return hid_report_diff_keys(state, &keys, timestamp_us, events);
+}
@@ -0,0 +1,58 @@
+#ifndef HID_REPORT_H
+#define HID_REPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "key_event.h"
+
+// Boot protocol keyboard report, after the report ID:
+// modifier byte, reserved byte, then up to six pressed key codes
+#define HID_REPORT_LEN   8
+#define HID_REPORT_KEYS  6
+
+// Most keys one report can hold down at once, whatever its layout. A report
+// with more (an NKRO keyboard with everything pressed) counts as rollover.
+#define HID_REPORT_MAX_KEYS 16
+
+// Worst case for one report: every old key released, every modifier toggled,
+// every new key pressed
+#define HID_REPORT_MAX_EVENTS (HID_REPORT_MAX_KEYS + 8 + HID_REPORT_MAX_KEYS)
+
+// The keys one report says are down, in the order it lists them
+typedef struct {
+    uint8_t mods;
+    uint8_t count;
+    // The keyboard couldn't tell which keys are down (KEY_ERR_OVF and the
+    // like); the last known set stays
+    bool rollover;
+    uint8_t keys[HID_REPORT_MAX_KEYS];
+} hid_keys_t;
+
+// What a report had pressed as of the last time it came in. Fixed size, no
+// allocation; one per key report of each connected keyboard.
+typedef struct {
+    uint8_t mods;
+    uint8_t count;
+    uint8_t keys[HID_REPORT_MAX_KEYS];
+    uint32_t down[256 / 32];    // bitmap of `keys`
+} hid_report_state_t;
+
+void hid_report_state_init(hid_report_state_t *state);
+
+// Reads a boot protocol report (HID_REPORT_LEN bytes)
+void hid_report_boot_keys(const uint8_t *report, hid_keys_t *keys);
+
+// Compares `keys` with the previous report and writes one key event per
+// change into `events`, which must have room for HID_REPORT_MAX_EVENTS.
+// Releases are emitted before presses; modifier changes are reported as
+// KEY_LEFTCTRL..KEY_RIGHTMETA. Every event carries the new modifiers.
+// Returns the number of events.
+int hid_report_diff_keys(hid_report_state_t *state, const hid_keys_t *keys,
+                         int64_t timestamp_us, key_event_t *events);
+
+// hid_report_boot_keys() followed by hid_report_diff_keys()
+int hid_report_diff(hid_report_state_t *state, const uint8_t *report,
+                    int64_t timestamp_us, key_event_t *events);
+
+#endif // HID_REPORT_H
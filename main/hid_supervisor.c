@@ -0,0 +1,312 @@
+#include "hid_supervisor.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "esp_hidh_api.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "device_table.h"
+#include "key_stats.h"
+#include "task_stats.h"
+
+#define SUPERVISOR_TASK_STACK_SIZE 3072
+#define SUPERVISOR_QUEUE_LEN 8
+
+// A page that gets no answer fails after the controller's page timeout
+// (about 5s); this only catches an open event that never arrives
+#define SUPERVISOR_ATTEMPT_TIMEOUT_US (15 * 1000 * 1000)
+
+typedef enum {
+    SUPERVISOR_OPENED,
+    SUPERVISOR_OPEN_FAILED,
+    SUPERVISOR_CLOSED,
+} supervisor_event_type_t;
+
+typedef struct {
+    supervisor_event_type_t type;
+    int device;
+    int64_t time_us;
+} supervisor_event_t;
+
+// Only written by the supervisor task
+typedef struct {
+    bool connected;
+    int64_t down_since_us;      // when it disconnected, 0 if it hasn't since boot
+    int64_t next_attempt_us;
+    uint32_t backoff_ms;
+} supervisor_device_t;
+
+static uint8_t _events_storage[SUPERVISOR_QUEUE_LEN * sizeof(supervisor_event_t)];
+static StaticQueue_t _events_buf;
+static QueueHandle_t _events = NULL;
+static StackType_t _task_stack[SUPERVISOR_TASK_STACK_SIZE];
+static StaticTask_t _task_tcb;
+static supervisor_device_t _devices[CONFIG_KEY_MAX_DEVICES];
+static int _attempting = DEVICE_TABLE_NONE;
+static int64_t _attempt_start_us;
+
+static _Atomic uint32_t _attempts;
+static _Atomic uint32_t _attempt_failures;
+static _Atomic uint32_t _connects;
+static _Atomic uint32_t _disconnects;
+static key_hist_t _reconnect_ms;
+static key_hist_t _attempt_ms;
+
+// Single writer, like the pipeline's counters
+static inline void _bump(_Atomic uint32_t *counter) {
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+static uint32_t _elapsed_ms(int64_t start_us, int64_t end_us) {
+    int64_t ms = (end_us - start_us) / 1000;
+    return ms < 0 ? 0 : ms > UINT32_MAX ? UINT32_MAX : (uint32_t)ms;
+}
+
+// Between half and all of the backoff, so keyboards that dropped together
+// (e.g. a room losing power) don't keep paging in lockstep
+static int64_t _jittered_us(uint32_t backoff_ms) {
+    uint32_t half = backoff_ms / 2;
+    return (int64_t)(half + esp_random() % (backoff_ms - half + 1)) * 1000;
+}
+
+static void _schedule_retry(supervisor_device_t *device, int64_t now_us) {
+    device->next_attempt_us = now_us + _jittered_us(device->backoff_ms);
+    device->backoff_ms = device->backoff_ms >= CONFIG_KEY_RECONNECT_MAX_MS / 2
+                             ? CONFIG_KEY_RECONNECT_MAX_MS
+                             : device->backoff_ms * 2;
+}
+
+static void _attempt_done(int device, bool connected, int64_t now_us) {
+    if (device != _attempting) {
+        return;
+    }
+    key_hist_record(&_attempt_ms, _elapsed_ms(_attempt_start_us, now_us));
+    if (!connected) {
+        _bump(&_attempt_failures);
+        _schedule_retry(&_devices[device], now_us);
+    }
+    _attempting = DEVICE_TABLE_NONE;
+}
+
+static void _handle(const supervisor_event_t *event) {
+    const char *TAG = "hid_supervisor";
+    if (event->device < 0 || event->device >= CONFIG_KEY_MAX_DEVICES) {
+        return;
+    }
+    supervisor_device_t *device = &_devices[event->device];
+
+    switch (event->type) {
+        case SUPERVISOR_OPENED:
+            _attempt_done(event->device, true, event->time_us);
+            _bump(&_connects);
+            device->connected = true;
+            device->backoff_ms = CONFIG_KEY_RECONNECT_MIN_MS;
+            if (device->down_since_us != 0) {
+                uint32_t ms = _elapsed_ms(device->down_since_us, event->time_us);
+                key_hist_record(&_reconnect_ms, ms);
+                ESP_LOGI(TAG, "Device %d back after %u ms", event->device, ms);
+            }
+            device_table_set_last_good(event->device);
+            break;
+        case SUPERVISOR_OPEN_FAILED:
+            _attempt_done(event->device, false, event->time_us);
+            break;
+        case SUPERVISOR_CLOSED:
+            _bump(&_disconnects);
+            device->connected = false;
+            device->down_since_us = event->time_us;
+            device->backoff_ms = CONFIG_KEY_RECONNECT_MIN_MS;
+            _schedule_retry(device, event->time_us);
+            break;
+    }
+}
+
+// Next disconnected keyboard that's due, the last one to connect first
+static int _pick(int64_t now_us) {
+    int best = DEVICE_TABLE_NONE;
+    for (int i = 0; i < CONFIG_KEY_MAX_DEVICES; i++) {
+        if (device_table_get(i) == NULL || _devices[i].connected ||
+            _devices[i].next_attempt_us > now_us) {
+            continue;
+        }
+        if (i == device_table_last_good()) {
+            return i;
+        }
+        if (best == DEVICE_TABLE_NONE ||
+            _devices[i].next_attempt_us < _devices[best].next_attempt_us) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// How long the task can sleep before it next has something to do
+static TickType_t _wait(int64_t now_us) {
+    int64_t due_us = INT64_MAX;
+    if (_attempting != DEVICE_TABLE_NONE) {
+        due_us = _attempt_start_us + SUPERVISOR_ATTEMPT_TIMEOUT_US;
+    } else {
+        for (int i = 0; i < CONFIG_KEY_MAX_DEVICES; i++) {
+            if (device_table_get(i) != NULL && !_devices[i].connected &&
+                _devices[i].next_attempt_us < due_us) {
+                due_us = _devices[i].next_attempt_us;
+            }
+        }
+    }
+    if (due_us == INT64_MAX) {
+        return portMAX_DELAY;
+    }
+    return due_us <= now_us ? 0 : pdMS_TO_TICKS((due_us - now_us) / 1000) + 1;
+}
+
+static void _poll(int64_t now_us) {
+    const char *TAG = "hid_supervisor";
+
+    if (_attempting != DEVICE_TABLE_NONE &&
+        now_us - _attempt_start_us >= SUPERVISOR_ATTEMPT_TIMEOUT_US) {
+        ESP_LOGW(TAG, "Connection attempt to device %d timed out", _attempting);
+        _attempt_done(_attempting, false, now_us);
+    }
+    if (_attempting != DEVICE_TABLE_NONE) {
+        return;
+    }
+
+    int device = _pick(now_us);
+    if (device == DEVICE_TABLE_NONE) {
+        return;
+    }
+    const device_table_entry_t *entry = device_table_get(device);
+    ESP_LOGI(TAG, "Connecting to device %d (" ESP_BD_ADDR_STR ")", device,
+             ESP_BD_ADDR_HEX(entry->addr));
+    _bump(&_attempts);
+    _attempting = device;
+    _attempt_start_us = now_us;
+    esp_err_t ret = esp_bt_hid_host_connect((uint8_t *)entry->addr);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize connection attempt: %s", esp_err_to_name(ret));
+        _attempt_done(device, false, now_us);
+    }
+}
+
+static void supervisor_task(void *arg) {
+    for (;;) {
+        supervisor_event_t event;
+        if (xQueueReceive(_events, &event, _wait(esp_timer_get_time())) == pdTRUE) {
+            _handle(&event);
+        }
+        _poll(esp_timer_get_time());
+    }
+}
+
+bool hid_supervisor_start(void) {
+    const char *TAG = "hid_supervisor_start";
+
+    key_hist_init(&_reconnect_ms);
+    key_hist_init(&_attempt_ms);
+    int64_t now_us = esp_timer_get_time();
+    for (int i = 0; i < CONFIG_KEY_MAX_DEVICES; i++) {
+        _devices[i].connected = false;
+        _devices[i].down_since_us = 0;
+        _devices[i].next_attempt_us = now_us;
+        _devices[i].backoff_ms = CONFIG_KEY_RECONNECT_MIN_MS;
+    }
+
+    _events = xQueueCreateStatic(SUPERVISOR_QUEUE_LEN, sizeof(supervisor_event_t),
+                                 _events_storage, &_events_buf);
+    if (_events == NULL) {
+        ESP_LOGE(TAG, "Failed to create event queue");
+        return false;
+    }
+    if (xTaskCreateStaticPinnedToCore(supervisor_task, "hid_supervisor",
+                                      SUPERVISOR_TASK_STACK_SIZE, NULL,
+                                      CONFIG_KEY_RECONNECT_TASK_PRIORITY, _task_stack, &_task_tcb,
+                                      TASK_CORE(CONFIG_KEY_HOUSEKEEPING_CORE)) == NULL) {
+        ESP_LOGE(TAG, "Failed to create supervisor task");
+        return false;
+    }
+    return true;
+}
+
+static void _send(supervisor_event_type_t type, int device) {
+    if (_events == NULL) {
+        return;
+    }
+    supervisor_event_t event = {
+        .type = type,
+        .device = device,
+        .time_us = esp_timer_get_time(),
+    };
+    xQueueSend(_events, &event, 0);
+}
+
+void hid_supervisor_opened(int device, bool connected) {
+    _send(connected ? SUPERVISOR_OPENED : SUPERVISOR_OPEN_FAILED, device);
+}
+
+void hid_supervisor_closed(int device) {
+    _send(SUPERVISOR_CLOSED, device);
+}
+
+int hid_supervisor_format_status(char *buf, size_t len) {
+    size_t pos = 0;
+    int n = snprintf(buf, len,
+                     "{\"attempts\":%u,\"attempt_failures\":%u,\"connects\":%u,"
+                     "\"disconnects\":%u,\"devices\":[",
+                     (unsigned)atomic_load_explicit(&_attempts, memory_order_relaxed),
+                     (unsigned)atomic_load_explicit(&_attempt_failures, memory_order_relaxed),
+                     (unsigned)atomic_load_explicit(&_connects, memory_order_relaxed),
+                     (unsigned)atomic_load_explicit(&_disconnects, memory_order_relaxed));
+    if (n < 0 || (size_t)n >= len) {
+        return -1;
+    }
+    pos += n;
+
+    bool first = true;
+    for (int i = 0; i < CONFIG_KEY_MAX_DEVICES; i++) {
+        if (device_table_get(i) == NULL) {
+            continue;
+        }
+        const supervisor_device_t *device = &_devices[i];
+        n = snprintf(buf + pos, len - pos, "%s{\"connected\":%s,\"backoff_ms\":%u}",
+                     first ? "" : ",", device->connected ? "true" : "false",
+                     device->connected ? 0 : (unsigned)device->backoff_ms);
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+        first = false;
+    }
+
+    n = snprintf(buf + pos, len - pos, "],\"reconnect\":");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+    n = key_hist_format(&_reconnect_ms, "ms", buf + pos, len - pos);
+    if (n < 0) {
+        return -1;
+    }
+    pos += n;
+    n = snprintf(buf + pos, len - pos, ",\"attempt\":");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+    n = key_hist_format(&_attempt_ms, "ms", buf + pos, len - pos);
+    if (n < 0 || (size_t)n + 1 >= len - pos) {
+        return -1;
+    }
+    pos += n;
+    buf[pos++] = '}';
+    buf[pos] = '\0';
+    return pos;
+}
@@ -0,0 +1,33 @@
+#ifndef HID_SUPERVISOR_H
+#define HID_SUPERVISOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Keeps the keyboards in the device table connected. A low-priority task
+// pages each disconnected keyboard with esp_bt_hid_host_connect(), one at a
+// time and the last one that connected first, backing off exponentially
+// (with jitter) between failed attempts from KEY_RECONNECT_MIN_MS up to
+// KEY_RECONNECT_MAX_MS. Keyboards that page us first are just as welcome;
+// either way the time from a keyboard dropping to it being back is recorded.
+
+// Call once the HID host is initialized and the device table is loaded.
+bool hid_supervisor_start(void);
+
+// Called from the HID callback; never block. `device` is the keyboard's
+// device ID, or DEVICE_TABLE_NONE for a failed open from an unknown address.
+void hid_supervisor_opened(int device, bool connected);
+void hid_supervisor_closed(int device);
+
+// Any task. Writes connection counters, each keyboard's state and the
+// reconnect and attempt histograms (in milliseconds) as one JSON object:
+//
+//   {"attempts":4,"attempt_failures":3,"connects":2,"disconnects":1,
+//    "devices":[{"connected":true,"backoff_ms":0}],
+//    "reconnect":{"count":1,"max_ms":5210,...},"attempt":{...}}
+//
+// Returns the length written, or -1 if it doesn't fit.
+int hid_supervisor_format_status(char *buf, size_t len);
+
+#endif // HID_SUPERVISOR_H
@@ -0,0 +1,322 @@
+#include "hid_trace.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HID_TRACE_BLOCKS_PER_SECTOR (HID_TRACE_SECTOR_SIZE / HID_TRACE_BLOCK_SIZE)
+// Between the last record before a reboot and the first after it, on the
+// host's timeline
+#define HID_TRACE_REBOOT_GAP_US 1000000
+#define HID_TRACE_ERASED 0xff
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint32_t storage_blocks(const hid_trace_storage_t *storage) {
+    return storage->size / HID_TRACE_SECTOR_SIZE * HID_TRACE_BLOCKS_PER_SECTOR;
+}
+
+// The number of the block in `slot`, if it holds one
+static bool read_header(const hid_trace_storage_t *storage, uint32_t slot, uint32_t *seq) {
+    uint8_t header[HID_TRACE_BLOCK_HEADER];
+    if (!storage->read(storage->ctx, slot * HID_TRACE_BLOCK_SIZE, header, sizeof(header)) ||
+        get32(header) != HID_TRACE_MAGIC) {
+        return false;
+    }
+    *seq = get32(header + 4);
+    return *seq % storage_blocks(storage) == slot;
+}
+
+// The oldest and newest blocks in storage. Returns false if there are none.
+static bool block_range(const hid_trace_storage_t *storage, uint32_t *oldest,
+                        uint32_t *newest) {
+    bool any = false;
+    for (uint32_t slot = 0; slot < storage_blocks(storage); slot++) {
+        uint32_t seq;
+        if (!read_header(storage, slot, &seq)) {
+            continue;
+        }
+        if (!any || seq < *oldest) {
+            *oldest = seq;
+        }
+        if (!any || seq > *newest) {
+            *newest = seq;
+        }
+        any = true;
+    }
+    return any;
+}
+
+static void start_block(hid_trace_t *trace, hid_trace_buffer_t *buf) {
+    put32(buf->data, HID_TRACE_MAGIC);
+    put32(buf->data + 4, trace->next_seq++);
+    atomic_store_explicit(&buf->used, HID_TRACE_BLOCK_HEADER, memory_order_relaxed);
+    atomic_store_explicit(&buf->state, HID_TRACE_BUFFER_FILLING, memory_order_release);
+}
+
+bool hid_trace_init(hid_trace_t *trace, const hid_trace_storage_t *storage) {
+    if (storage->size < 2 * HID_TRACE_SECTOR_SIZE) {
+        return false;
+    }
+    trace->storage = *storage;
+    trace->blocks = storage_blocks(storage);
+    uint32_t oldest, newest;
+    trace->next_seq = block_range(storage, &oldest, &newest) ? newest + 1 : 0;
+    for (uint32_t i = 0; i < 2; i++) {
+        atomic_init(&trace->buffers[i].used, 0);
+        atomic_init(&trace->buffers[i].state, HID_TRACE_BUFFER_FREE);
+        trace->buffers[i].written = 0;
+    }
+    trace->filling = 0;
+    trace->writing = 0;
+    start_block(trace, &trace->buffers[0]);
+    atomic_init(&trace->records, 0);
+    atomic_init(&trace->dropped, 0);
+    atomic_init(&trace->blocks_written, 0);
+    atomic_init(&trace->write_failures, 0);
+    return true;
+}
+
+// Single writer, so a relaxed load and store will do
+static void count(_Atomic uint32_t *counter) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+bool hid_trace_record(hid_trace_t *trace, uint8_t type, uint8_t device, int64_t t_us,
+                      const void *payload, uint16_t len) {
+    if (len > HID_TRACE_MAX_PAYLOAD) {
+        count(&trace->dropped);
+        return false;
+    }
+    uint32_t size = HID_TRACE_RECORD_HEADER + len;
+    hid_trace_buffer_t *buf = &trace->buffers[trace->filling];
+    uint32_t used = atomic_load_explicit(&buf->used, memory_order_relaxed);
+    if (used + size > HID_TRACE_BLOCK_SIZE) {
+        // Full: on to the other block, once it's been written out
+        hid_trace_buffer_t *next = &trace->buffers[trace->filling ^ 1];
+        if (atomic_load_explicit(&next->state, memory_order_acquire) != HID_TRACE_BUFFER_FREE) {
+            count(&trace->dropped);
+            return false;
+        }
+        atomic_store_explicit(&buf->state, HID_TRACE_BUFFER_SEALED, memory_order_release);
+        trace->filling ^= 1;
+        start_block(trace, next);
+        buf = next;
+        used = HID_TRACE_BLOCK_HEADER;
+    }
+
+    uint8_t *p = buf->data + used;
+    p[0] = type;
+    p[1] = device;
+    put16(p + 2, len);
+    put32(p + 4, (uint32_t)t_us);
+    put32(p + 8, (uint32_t)((uint64_t)t_us >> 32));
+    if (len > 0) {
+        memcpy(p + HID_TRACE_RECORD_HEADER, payload, len);
+    }
+    atomic_store_explicit(&buf->used, used + size, memory_order_release);
+    count(&trace->records);
+    return true;
+}
+
+// Writes out what's been added to `buf` since last time
+static bool write_buffer(hid_trace_t *trace, hid_trace_buffer_t *buf, uint32_t used) {
+    const hid_trace_storage_t *storage = &trace->storage;
+    uint32_t offset = get32(buf->data + 4) % trace->blocks * HID_TRACE_BLOCK_SIZE;
+    bool ok = true;
+    // The first block of a sector clears the way for the rest
+    if (buf->written == 0 && offset % HID_TRACE_SECTOR_SIZE == 0) {
+        ok = storage->erase(storage->ctx, offset);
+    }
+    if (ok) {
+        ok = storage->write(storage->ctx, offset + buf->written, buf->data + buf->written,
+                            used - buf->written);
+    }
+    // Either way it's not tried again, so a bad sector costs one block
+    buf->written = used;
+    if (!ok) {
+        count(&trace->write_failures);
+    }
+    return ok;
+}
+
+bool hid_trace_write(hid_trace_t *trace) {
+    bool ok = true;
+    for (;;) {
+        hid_trace_buffer_t *buf = &trace->buffers[trace->writing];
+        // The state first: once it's sealed, `used` is final
+        uint32_t state = atomic_load_explicit(&buf->state, memory_order_acquire);
+        if (state == HID_TRACE_BUFFER_FREE) {
+            return ok;
+        }
+        uint32_t used = atomic_load_explicit(&buf->used, memory_order_acquire);
+        if (used > buf->written && !write_buffer(trace, buf, used)) {
+            ok = false;
+        }
+        if (state != HID_TRACE_BUFFER_SEALED) {
+            return ok;
+        }
+        buf->written = 0;
+        atomic_store_explicit(&buf->state, HID_TRACE_BUFFER_FREE, memory_order_release);
+        count(&trace->blocks_written);
+        trace->writing ^= 1;
+    }
+}
+
+// Reading back: one keyboard's records as replay text
+typedef struct {
+    uint8_t device;
+    bool (*out)(void *arg, const char *text, size_t len);
+    void *arg;
+    bool ok;
+    bool started;
+    bool reported;          // a report has gone out, so it's too late for a descriptor
+    int64_t base_us;        // capture time of the trace's time 0
+    int64_t last_us;        // trace time of the last record
+    char line[160];
+    size_t len;
+} trace_text_t;
+
+static void flush_text(trace_text_t *text) {
+    if (text->ok && text->len > 0) {
+        text->ok = text->out(text->arg, text->line, text->len);
+    }
+    text->len = 0;
+}
+
+static void add_text(trace_text_t *text, const char *fmt, ...) {
+    va_list args;
+    // Nothing added at once is longer than this
+    if (text->len + 80 > sizeof(text->line)) {
+        flush_text(text);
+    }
+    va_start(args, fmt);
+    int n = vsnprintf(text->line + text->len, sizeof(text->line) - text->len, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        text->len += n;
+    }
+}
+
+static void add_hex(trace_text_t *text, const uint8_t *data, uint16_t len) {
+    for (uint16_t i = 0; i < len; i++) {
+        add_text(text, " %02x", data[i]);
+    }
+}
+
+// Times count from the keyboard's first record, and go on counting up after
+// the clock starts again from a reboot
+static int64_t trace_time(trace_text_t *text, int64_t t_us) {
+    if (!text->started) {
+        text->started = true;
+        text->base_us = t_us;
+    } else if (t_us - text->base_us < text->last_us) {
+        text->base_us = t_us - text->last_us - HID_TRACE_REBOOT_GAP_US;
+    }
+    text->last_us = t_us - text->base_us;
+    return text->last_us;
+}
+
+static void format_record(trace_text_t *text, uint8_t type, uint8_t device, int64_t t_us,
+                          const uint8_t *payload, uint16_t len) {
+    if (type == HID_TRACE_BOOT) {
+        if (text->started) {
+            add_text(text, "# %-8" PRId64 " receiver restarted\n", trace_time(text, t_us));
+        }
+        return;
+    }
+    if (device != text->device) {
+        return;
+    }
+    switch (type) {
+        case HID_TRACE_OPEN:
+            add_text(text, "# %-8" PRId64 " connected", trace_time(text, t_us));
+            for (uint16_t i = 0; i < len; i++) {
+                add_text(text, "%s%02x", i ? ":" : " ", payload[i]);
+            }
+            add_text(text, "\n");
+            break;
+        case HID_TRACE_CLOSE:
+            add_text(text, "# %-8" PRId64 " disconnected\n", trace_time(text, t_us));
+            break;
+        case HID_TRACE_DESCRIPTOR:
+            // A trace has one descriptor, ahead of its reports
+            if (text->reported) {
+                add_text(text, "# %-8" PRId64 " report descriptor again, %u bytes\n",
+                         trace_time(text, t_us), len);
+                break;
+            }
+            for (uint16_t i = 0; i < len; i += 16) {
+                add_text(text, "descriptor");
+                add_hex(text, payload + i, len - i < 16 ? len - i : 16);
+                add_text(text, "\n");
+            }
+            break;
+        case HID_TRACE_REPORT:
+            add_text(text, "%-8" PRId64, trace_time(text, t_us));
+            add_hex(text, payload, len);
+            add_text(text, "\n");
+            text->reported = true;
+            break;
+    }
+}
+
+static void format_block(trace_text_t *text, const uint8_t *block) {
+    uint32_t pos = HID_TRACE_BLOCK_HEADER;
+    while (pos + HID_TRACE_RECORD_HEADER <= HID_TRACE_BLOCK_SIZE &&
+           block[pos] != HID_TRACE_ERASED && text->ok) {
+        const uint8_t *p = block + pos;
+        uint16_t len = get16(p + 2);
+        if (pos + HID_TRACE_RECORD_HEADER + len > HID_TRACE_BLOCK_SIZE) {
+            // Half written when the power went
+            return;
+        }
+        int64_t t_us = (int64_t)((uint64_t)get32(p + 8) << 32 | get32(p + 4));
+        format_record(text, p[0], p[1], t_us, p + HID_TRACE_RECORD_HEADER, len);
+        pos += HID_TRACE_RECORD_HEADER + len;
+    }
+}
+
+bool hid_trace_format(const hid_trace_storage_t *storage, uint8_t device, uint8_t *block,
+                      bool (*out)(void *arg, const char *text, size_t len), void *arg) {
+    trace_text_t text = {
+        .device = device,
+        .out = out,
+        .arg = arg,
+        .ok = true,
+    };
+    uint32_t oldest, newest;
+    if (storage->size < 2 * HID_TRACE_SECTOR_SIZE || !block_range(storage, &oldest, &newest)) {
+        return true;
+    }
+    uint32_t blocks = storage_blocks(storage);
+    for (uint32_t seq = oldest; seq <= newest && text.ok; seq++) {
+        uint32_t slot = seq % blocks;
+        if (!storage->read(storage->ctx, slot * HID_TRACE_BLOCK_SIZE, block,
+                           HID_TRACE_BLOCK_SIZE) ||
+            get32(block) != HID_TRACE_MAGIC || get32(block + 4) != seq) {
+            continue;
+        }
+        format_block(&text, block);
+    }
+    flush_text(&text);
+    return text.ok;
+}
@@ -0,0 +1,114 @@
+#ifndef HID_TRACE_H
+#define HID_TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A capture of what the keyboards actually sent: every input report as
+// delivered with ESP_HIDH_DATA_IND_EVT, with the time it arrived, plus
+// connects, disconnects and report descriptors, kept in a flash partition
+// used as a ring, so the last stretch of a real typing session can be read
+// back and replayed on the host (host/replay.h).
+//
+// The HID callback only copies each record into one of two RAM blocks and
+// never waits: when the block it's filling is full it moves on to the other
+// one, if that's been written out, or drops the record. A lower-priority
+// task writes out whatever's been added since it last looked, so at most one
+// block plus what arrived since its last call is lost if the power goes.
+//
+// Storage is a number of HID_TRACE_BLOCK_SIZE blocks, each starting with
+//
+//   0-3   HID_TRACE_MAGIC
+//   4-7   block sequence number, counting up over every block ever written
+//
+// followed by records, up to the first erased (0xff) type byte:
+//
+//   0     HID_TRACE_*
+//   1     device
+//   2-3   payload length
+//   4-11  time, microseconds since boot
+//   12-   payload: the report, report ID first; the descriptor; or the
+//         keyboard's address for HID_TRACE_OPEN
+//
+// All fields are little-endian. Block n of the sequence lives at slot
+// n % blocks, so the oldest block is the lowest number still there, and a
+// capture carries on after the newest block across reboots.
+
+#define HID_TRACE_BLOCK_SIZE 1024
+#define HID_TRACE_SECTOR_SIZE 4096
+#define HID_TRACE_MAGIC 0x43525448  // "HTRC"
+#define HID_TRACE_BLOCK_HEADER 8
+#define HID_TRACE_RECORD_HEADER 12
+// Largest payload a record can have
+#define HID_TRACE_MAX_PAYLOAD (HID_TRACE_BLOCK_SIZE - HID_TRACE_BLOCK_HEADER - HID_TRACE_RECORD_HEADER)
+
+#define HID_TRACE_BOOT       0x01   // capture started; no payload
+#define HID_TRACE_OPEN       0x02   // keyboard connected
+#define HID_TRACE_CLOSE      0x03   // keyboard disconnected
+#define HID_TRACE_DESCRIPTOR 0x04
+#define HID_TRACE_REPORT     0x05
+
+// Where the blocks go, e.g. a flash partition. Writes only ever go to bytes
+// erased since they were last written, as flash needs.
+typedef struct {
+    bool (*read)(void *ctx, uint32_t offset, void *buf, uint32_t len);
+    bool (*write)(void *ctx, uint32_t offset, const void *buf, uint32_t len);
+    // Erases the HID_TRACE_SECTOR_SIZE bytes at `offset`
+    bool (*erase)(void *ctx, uint32_t offset);
+    uint32_t size;          // bytes, a whole number of sectors
+    void *ctx;
+} hid_trace_storage_t;
+
+#define HID_TRACE_BUFFER_FREE    0  // written out; the producer may refill it
+#define HID_TRACE_BUFFER_FILLING 1  // being filled; the writer may write what's there
+#define HID_TRACE_BUFFER_SEALED  2  // full; the writer writes the rest and frees it
+
+typedef struct {
+    uint8_t data[HID_TRACE_BLOCK_SIZE];
+    _Atomic uint32_t used;  // bytes filled, header included
+    _Atomic uint32_t state; // HID_TRACE_BUFFER_*
+    uint32_t written;       // writer side: bytes already in storage
+} hid_trace_buffer_t;
+
+// One producer (the HID callback) and one writer task. The counters can be
+// read from any task.
+typedef struct {
+    hid_trace_storage_t storage;
+    uint32_t blocks;
+    hid_trace_buffer_t buffers[2];
+    uint32_t filling;       // producer side: the buffer being filled
+    uint32_t next_seq;      // producer side: the next block's number
+    uint32_t writing;       // writer side: the buffer to write out next
+    _Atomic uint32_t records;
+    _Atomic uint32_t dropped;
+    _Atomic uint32_t blocks_written;
+    _Atomic uint32_t write_failures;
+} hid_trace_t;
+
+// Finds the newest block in `storage` to carry on after. Returns false if
+// the storage is too small to hold two sectors.
+bool hid_trace_init(hid_trace_t *trace, const hid_trace_storage_t *storage);
+
+// Producer side. Adds a record; never waits. Returns false if it was dropped
+// because both blocks are full, or because the payload is too long.
+bool hid_trace_record(hid_trace_t *trace, uint8_t type, uint8_t device, int64_t t_us,
+                      const void *payload, uint16_t len);
+
+// Writer side. Writes out everything recorded since the last call, erasing
+// sectors as the ring comes round to them. Returns false if storage failed;
+// the block is then given up on.
+bool hid_trace_write(hid_trace_t *trace);
+
+// Reads a capture back from `storage`, oldest block first, and writes what
+// keyboard `device` sent as a replay trace (host/replay.h) through `out`, a
+// piece at a time: its report descriptor, if the capture has it before the
+// first report, then one line per report, with connects, disconnects and
+// reboots as comments. Times start at 0 and keep counting up over reboots.
+// `block` is HID_TRACE_BLOCK_SIZE bytes of scratch. A block overwritten while
+// it's read is skipped. Stops and returns false if `out` does.
+bool hid_trace_format(const hid_trace_storage_t *storage, uint8_t device, uint8_t *block,
+                      bool (*out)(void *arg, const char *text, size_t len), void *arg);
+
+#endif // HID_TRACE_H
@@ -0,0 +1,127 @@
+#include "http_conn.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static esp_err_t http_conn_event_handler(esp_http_client_event_t *evt) {
+    http_conn_t *conn = evt->user_data;
+    if (evt->event_id == HTTP_EVENT_ON_CONNECTED) {
+        conn->stats.connects++;
+    } else if (evt->event_id == HTTP_EVENT_DISCONNECTED) {
+        conn->open = false;
+    }
+    return ESP_OK;
+}
+
+static bool http_conn_create_client(http_conn_t *conn) {
+    const char *TAG = "http_conn_create_client";
+    esp_http_client_config_t config = {
+        .host = conn->host,
+        .path = "/",
+        .timeout_ms = CONFIG_KEY_HTTP_TIMEOUT_MS,
+        .keep_alive_enable = true,
+        .event_handler = http_conn_event_handler,
+        .user_data = conn,
+    };
+
+    conn->client = esp_http_client_init(&config);
+    if (conn->client == NULL) {
+        ESP_LOGE(TAG, "Error initializing HTTP client");
+        return false;
+    }
+    return true;
+}
+
+void http_conn_init(http_conn_t *conn, const char *host) {
+    memset(conn, 0, sizeof(*conn));
+    conn->host = host;
+}
+
+void http_conn_close(http_conn_t *conn) {
+    if (conn->client != NULL) {
+        esp_http_client_close(conn->client);
+    }
+    conn->open = false;
+}
+
+static esp_err_t http_conn_perform(http_conn_t *conn, const char *path) {
+    const char *TAG = "http_conn_perform";
+
+    // Setting the full URL with an unchanged host keeps the open socket
+    char url[HTTP_CONN_URL_LEN];
+    int len = snprintf(url, sizeof(url), "http://%s%s", conn->host, path);
+    if (len < 0 || len >= (int)sizeof(url)) {
+        ESP_LOGE(TAG, "URL too long for path %s", path);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t ret;
+    if (strcmp(url, conn->url) != 0) {
+        ret = esp_http_client_set_url(conn->client, url);
+        if (ret != ESP_OK) {
+            conn->url[0] = '\0';
+            return ret;
+        }
+        memcpy(conn->url, url, len + 1);
+    }
+
+    conn->stats.requests++;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = conn->open;
+        ret = esp_http_client_perform(conn->client);
+        if (ret == ESP_OK) {
+            conn->open = true;
+            conn->status = esp_http_client_get_status_code(conn->client);
+            if (reused) {
+                conn->stats.reuses++;
+            }
+            return ESP_OK;
+        }
+
+        // Drop the socket so the next attempt starts from a clean connection
+        http_conn_close(conn);
+        if (!reused) {
+            break;
+        }
+        // A kept-alive socket the server has since closed; retry once fresh
+        ESP_LOGD(TAG, "Reused connection failed (%s), reconnecting", esp_err_to_name(ret));
+        conn->stats.reconnects++;
+    }
+
+    conn->stats.failures++;
+    conn->status = 0;
+    return ret;
+}
+
+esp_err_t http_conn_get(http_conn_t *conn, const char *path) {
+    if (conn->client == NULL && !http_conn_create_client(conn)) {
+        conn->stats.failures++;
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_http_client_set_method(conn->client, HTTP_METHOD_GET);
+    esp_http_client_set_post_field(conn->client, NULL, 0);
+    if (conn->content_type != NULL) {
+        esp_http_client_delete_header(conn->client, "Content-Type");
+        conn->content_type = NULL;
+    }
+    return http_conn_perform(conn, path);
+}
+
+esp_err_t http_conn_post(http_conn_t *conn, const char *path, const char *content_type,
+                         const char *body, int body_len) {
+    if (conn->client == NULL && !http_conn_create_client(conn)) {
+        conn->stats.failures++;
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_http_client_set_method(conn->client, HTTP_METHOD_POST);
+    if (conn->content_type == NULL || strcmp(conn->content_type, content_type) != 0) {
+        esp_http_client_set_header(conn->client, "Content-Type", content_type);
+        conn->content_type = content_type;
+    }
+    esp_http_client_set_post_field(conn->client, body, body_len);
+    return http_conn_perform(conn, path);
+}
@@ -0,0 +1,50 @@
+#ifndef HTTP_CONN_H
+#define HTTP_CONN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+typedef struct {
+    uint32_t requests;
+    uint32_t connects;      // TCP connections opened
+    uint32_t reuses;        // requests served on an already open connection
+    uint32_t reconnects;    // retries on a fresh connection after a reused one failed
+    uint32_t failures;      // requests that failed even after retrying
+} http_conn_stats_t;
+
+// A persistent keep-alive connection to one HTTP server. The underlying client
+// is created on first use and then kept for the lifetime of the connection,
+// so steady-state requests cost a single round-trip and no heap. Not thread
+// safe: each connection is owned by one task.
+#define HTTP_CONN_URL_LEN 192
+
+typedef struct {
+    const char *host;
+    esp_http_client_handle_t client;
+    // What the client was last given: the client keeps its own copies on the
+    // heap, so they're only set again when they change
+    char url[HTTP_CONN_URL_LEN];
+    const char *content_type;
+    bool open;              // a previous request left the socket open
+    int status;             // HTTP status of the last completed request
+    http_conn_stats_t stats;
+} http_conn_t;
+
+void http_conn_init(http_conn_t *conn, const char *host);
+
+// Performs a GET on `path` (which may include a query string), reconnecting
+// once if the kept-alive socket turns out to have been closed by the server.
+esp_err_t http_conn_get(http_conn_t *conn, const char *path);
+
+// As http_conn_get, but POSTs `body` with the given content type, which is
+// remembered and so has to outlive the connection (a string literal).
+esp_err_t http_conn_post(http_conn_t *conn, const char *path, const char *content_type,
+                         const char *body, int body_len);
+
+// Closes the socket; the next request reconnects.
+void http_conn_close(http_conn_t *conn);
+
+#endif // HTTP_CONN_H
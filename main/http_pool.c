@@ -0,0 +1,93 @@
+#include "http_pool.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "task_stats.h"
+
+static void http_pool_worker(void *arg) {
+    http_pool_worker_t *worker = arg;
+    http_pool_t *pool = worker->pool;
+    http_conn_t *conn = &worker->conn;
+
+    for (;;) {
+        key_request_t *request;
+        if (xQueueReceive(pool->requests, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (request->content_type == NULL) {
+            request->ret = http_conn_get(conn, request->path);
+        } else {
+            request->ret = http_conn_post(conn, request->path, request->content_type,
+                                          request->body, request->body_len);
+        }
+        request->status = conn->status;
+        request->done(request);
+    }
+}
+
+bool http_pool_init(http_pool_t *pool, const char *host, uint32_t workers) {
+    const char *TAG = "http_pool_init";
+
+    if (workers > CONFIG_KEY_HTTP_INFLIGHT) {
+        workers = CONFIG_KEY_HTTP_INFLIGHT;
+    }
+    pool->worker_count = workers;
+    for (uint32_t i = 0; i < workers; i++) {
+        pool->workers[i].pool = pool;
+        http_conn_init(&pool->workers[i].conn, host);
+    }
+
+    pool->requests = xQueueCreateStatic(workers, sizeof(key_request_t *),
+                                        (uint8_t *)pool->request_storage, &pool->requests_buf);
+    if (pool->requests == NULL) {
+        ESP_LOGE(TAG, "Failed to create request queue");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < workers; i++) {
+        // Same footprint as the sender itself
+        if (xTaskCreateStaticPinnedToCore(http_pool_worker, "key_http",
+                                          CONFIG_KEY_SENDER_TASK_STACK_SIZE, &pool->workers[i],
+                                          CONFIG_KEY_HTTP_TASK_PRIORITY, pool->workers[i].stack,
+                                          &pool->workers[i].tcb,
+                                          TASK_CORE(CONFIG_KEY_HTTP_TASK_CORE)) == NULL) {
+            ESP_LOGE(TAG, "Failed to create worker %u", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+void http_pool_get_stats(const http_pool_t *pool, http_conn_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t i = 0; i < pool->worker_count; i++) {
+        const http_conn_stats_t *s = &pool->workers[i].conn.stats;
+        stats->requests += s->requests;
+        stats->connects += s->connects;
+        stats->reuses += s->reuses;
+        stats->reconnects += s->reconnects;
+        stats->failures += s->failures;
+    }
+}
+
+static esp_err_t transport_start(void *ctx, key_request_t *request) {
+    http_pool_t *pool = ctx;
+    // The pipeline never has more requests out than there are workers, so
+    // this doesn't wait
+    if (xQueueSend(pool->requests, &request, 0) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+key_transport_t http_pool_transport(http_pool_t *pool) {
+    key_transport_t transport = {
+        .start = transport_start,
+        .max_inflight = pool->worker_count,
+        .ctx = pool,
+    };
+    return transport;
+}
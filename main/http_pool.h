@@ -0,0 +1,45 @@
+#ifndef HTTP_POOL_H
+#define HTTP_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "http_conn.h"
+#include "key_transport.h"
+
+// Asynchronous transport for the key pipeline: a worker task per connection,
+// each blocking on its own keep-alive http_conn, taking requests from a
+// shared queue. A slow response only holds up its own worker, so requests
+// overlap instead of being capped at one per round-trip. The workers' stacks
+// and the queue are part of the pool, so a static pool needs no heap.
+typedef struct http_pool http_pool_t;
+
+typedef struct {
+    http_pool_t *pool;
+    http_conn_t conn;
+    StackType_t stack[CONFIG_KEY_SENDER_TASK_STACK_SIZE];
+    StaticTask_t tcb;
+} http_pool_worker_t;
+
+struct http_pool {
+    http_pool_worker_t workers[CONFIG_KEY_HTTP_INFLIGHT];
+    uint32_t worker_count;
+    QueueHandle_t requests;
+    key_request_t *request_storage[CONFIG_KEY_HTTP_INFLIGHT];
+    StaticQueue_t requests_buf;
+};
+
+bool http_pool_init(http_pool_t *pool, const char *host, uint32_t workers);
+
+// Sums the workers' connection counters. Read from another task, so a
+// snapshot may be off by a request.
+void http_pool_get_stats(const http_pool_t *pool, http_conn_stats_t *stats);
+
+// A transport for key_pipeline_init() that runs up to `workers` requests at once
+key_transport_t http_pool_transport(http_pool_t *pool);
+
+#endif // HTTP_POOL_H
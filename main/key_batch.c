@@ -0,0 +1,83 @@
+#include "key_batch.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+void key_batch_init(key_batch_t *batch, key_event_t *events, uint32_t capacity,
+                    uint32_t max_delay_ms) {
+    batch->events = events;
+    batch->capacity = capacity;
+    batch->count = 0;
+    batch->max_delay_us = (int64_t)max_delay_ms * 1000;
+    batch->first_us = 0;
+    // Treat the link as idle at start-up so the first key goes out at once
+    batch->last_flush_us = INT64_MIN / 2;
+}
+
+bool key_batch_add(key_batch_t *batch, const key_event_t *event, int64_t now_us) {
+    if (batch->count >= batch->capacity) {
+        return false;
+    }
+    if (batch->count == 0) {
+        batch->first_us = now_us;
+    }
+    batch->events[batch->count++] = *event;
+    return true;
+}
+
+bool key_batch_should_flush(const key_batch_t *batch, int64_t now_us, bool more_pending) {
+    if (batch->count == 0) {
+        return false;
+    }
+    if (batch->count >= batch->capacity) {
+        return true;
+    }
+    if (more_pending) {
+        return false;
+    }
+    bool idle = batch->first_us - batch->last_flush_us >= batch->max_delay_us;
+    return idle || now_us - batch->first_us >= batch->max_delay_us;
+}
+
+int64_t key_batch_due_in(const key_batch_t *batch, int64_t now_us) {
+    if (batch->count == 0) {
+        return -1;
+    }
+    int64_t due = batch->first_us + batch->max_delay_us - now_us;
+    return due > 0 ? due : 0;
+}
+
+int key_batch_format(const key_batch_t *batch, key_name_fn key_name, void *ctx, char *buf,
+                     size_t len) {
+    size_t pos = 0;
+    int n = snprintf(buf, len, "{\"events\":[");
+    if (n < 0 || (size_t)n >= len) {
+        return -1;
+    }
+    pos = n;
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const key_event_t *event = &batch->events[i];
+        const char *name = key_name(ctx, event);
+        n = snprintf(buf + pos, len - pos,
+                     "%s{\"device\":%u,\"key\":\"%s\",\"code\":%u,\"type\":\"%s\",\"mods\":%u,\"count\":%u,\"seq\":%" PRIu32 ",\"tx\":%" PRIu32 ",\"ts\":%" PRId64 "}",
+                     i ? "," : "", event->device, name ? name : "", event->key,
+                     event->type == KEY_EVENT_RELEASE ? "release" : "press",
+                     event->mods, event->count, event->seq, event->tx, event->timestamp_us);
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+    }
+
+    n = snprintf(buf + pos, len - pos, "]}");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    return pos + n;
+}
+
+void key_batch_clear(key_batch_t *batch, int64_t now_us) {
+    batch->count = 0;
+    batch->last_flush_us = now_us;
+}
@@ -0,0 +1,56 @@
+#ifndef KEY_BATCH_H
+#define KEY_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "key_event.h"
+
+// Upper bound on the JSON emitted for one event by key_batch_format(), with a
+// name of up to 40 characters
+#define KEY_BATCH_EVENT_JSON_LEN 184
+
+// Size a body buffer for `n` events
+#define KEY_BATCH_BODY_LEN(n) ((n) * KEY_BATCH_EVENT_JSON_LEN + 16)
+
+// The name an event is sent under, or NULL
+typedef const char *(*key_name_fn)(void *ctx, const key_event_t *event);
+
+// Accumulates key events so a burst can be delivered in one request.
+//
+// A batch is flushed when it is full or when its oldest event has waited
+// `max_delay_us`. An event that arrives after the link has been idle for at
+// least `max_delay_us` is flushed straight away, so isolated key presses see
+// no extra latency and only bursts are held back.
+typedef struct {
+    key_event_t *events;
+    uint32_t capacity;
+    uint32_t count;
+    int64_t max_delay_us;
+    int64_t first_us;       // when the first event of this batch was added
+    int64_t last_flush_us;
+} key_batch_t;
+
+void key_batch_init(key_batch_t *batch, key_event_t *events, uint32_t capacity,
+                    uint32_t max_delay_ms);
+
+// Returns false if the batch is already full.
+bool key_batch_add(key_batch_t *batch, const key_event_t *event, int64_t now_us);
+
+// Whether the batch should be sent now. `more_pending` says whether further
+// events are already waiting to be added, in which case a non-full batch is
+// held so they can join it.
+bool key_batch_should_flush(const key_batch_t *batch, int64_t now_us, bool more_pending);
+
+// Microseconds until the batch is due, 0 if it is overdue, or -1 if empty.
+int64_t key_batch_due_in(const key_batch_t *batch, int64_t now_us);
+
+// Writes the batch as a JSON document into `buf`. Returns the length written,
+// or -1 if it doesn't fit.
+int key_batch_format(const key_batch_t *batch, key_name_fn key_name, void *ctx, char *buf,
+                     size_t len);
+
+void key_batch_clear(key_batch_t *batch, int64_t now_us);
+
+#endif // KEY_BATCH_H
@@ -0,0 +1,462 @@
+#include "key_bindings.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "key_table.h"
+#include "usb_hid_codes.h"
+
+#define KEY_BINDING_SEQUENCE_US ((int64_t)CONFIG_KEY_BINDING_SEQUENCE_MS * 1000)
+
+static inline bool _is_modifier(uint8_t key) {
+    return key >= KEY_LEFTCTRL && key <= KEY_RIGHTMETA;
+}
+
+// Folds the right-hand modifiers onto the left-hand ones
+static inline uint8_t _fold_mods(uint8_t mods) {
+    return (mods | mods >> 4) & 0x0f;
+}
+
+static inline bool _is_down(const key_binding_state_t *state, uint8_t key) {
+    return state->down[key >> 5] & (1u << (key & 31));
+}
+
+void key_bindings_init(key_bindings_t *bindings) {
+    memset(bindings->tables, 0, sizeof(bindings->tables));
+    atomic_init(&bindings->active, 0);
+    atomic_init(&bindings->pending, false);
+    atomic_init(&bindings->switches, 0);
+    atomic_init(&bindings->matched, 0);
+}
+
+key_binding_table_t *key_bindings_edit(key_bindings_t *bindings) {
+    if (atomic_load_explicit(&bindings->pending, memory_order_acquire)) {
+        return NULL;
+    }
+    uint32_t active = atomic_load_explicit(&bindings->active, memory_order_relaxed);
+    return &bindings->tables[active ^ 1];
+}
+
+void key_bindings_publish(key_bindings_t *bindings) {
+    atomic_store_explicit(&bindings->pending, true, memory_order_release);
+}
+
+bool key_bindings_switch(key_bindings_t *bindings) {
+    if (!atomic_load_explicit(&bindings->pending, memory_order_acquire)) {
+        return false;
+    }
+    uint32_t active = atomic_load_explicit(&bindings->active, memory_order_relaxed);
+    atomic_store_explicit(&bindings->active, active ^ 1, memory_order_relaxed);
+    atomic_store_explicit(&bindings->switches,
+                          atomic_load_explicit(&bindings->switches, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    // Releases the old table to the writer
+    atomic_store_explicit(&bindings->pending, false, memory_order_release);
+    return true;
+}
+
+static bool _completes(const key_binding_t *binding, const key_binding_state_t *state,
+                       int64_t now_us) {
+    switch (binding->type) {
+        case KEY_BINDING_CHORD:
+            for (uint32_t i = 0; i < binding->count; i++) {
+                if (!_is_down(state, binding->keys[i])) {
+                    return false;
+                }
+            }
+            return true;
+        case KEY_BINDING_SEQUENCE: {
+            if (state->recent_count < binding->count) {
+                return false;
+            }
+            // The last `count` presses, each soon after the one before
+            uint32_t start = state->recent_count - binding->count;
+            int64_t next_us = now_us;
+            for (uint32_t i = binding->count; i-- > 0;) {
+                if (state->recent[start + i] != binding->keys[i] ||
+                    next_us - state->recent_us[start + i] > KEY_BINDING_SEQUENCE_US) {
+                    return false;
+                }
+                next_us = state->recent_us[start + i];
+            }
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+uint16_t key_bindings_match(key_bindings_t *bindings, key_binding_state_t *state,
+                            const key_event_t *event) {
+    uint8_t key = event->key;
+    // Modifiers only count as part of the key they're held with
+    if (_is_modifier(key)) {
+        return KEY_BINDING_NONE;
+    }
+    if (event->type == KEY_EVENT_RELEASE) {
+        state->down[key >> 5] &= ~(1u << (key & 31));
+        return KEY_BINDING_NONE;
+    }
+
+    const key_binding_table_t *table = key_bindings_active(bindings);
+    uint8_t mods = _fold_mods(event->mods);
+    uint16_t index = KEY_BINDING_NONE;
+    const key_binding_t *binding = NULL;
+    for (uint32_t i = table->first[key]; i < table->first[key + 1]; i++) {
+        if (table->entries[i].mods == mods &&
+            _completes(&table->entries[i], state, event->timestamp_us)) {
+            binding = &table->entries[i];
+            index = i + 1;
+            break;
+        }
+    }
+
+    state->down[key >> 5] |= 1u << (key & 31);
+    if (binding != NULL && binding->type == KEY_BINDING_SEQUENCE) {
+        // A finished sequence doesn't start the next one
+        state->recent_count = 0;
+    } else {
+        if (state->recent_count == KEY_BINDING_MAX_KEYS - 1) {
+            memmove(state->recent, state->recent + 1, KEY_BINDING_MAX_KEYS - 2);
+            memmove(state->recent_us, state->recent_us + 1,
+                    (KEY_BINDING_MAX_KEYS - 2) * sizeof(state->recent_us[0]));
+            state->recent_count--;
+        }
+        state->recent[state->recent_count] = key;
+        state->recent_us[state->recent_count] = event->timestamp_us;
+        state->recent_count++;
+    }
+    if (binding != NULL) {
+        atomic_store_explicit(&bindings->matched,
+                              atomic_load_explicit(&bindings->matched, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+    }
+    return index;
+}
+
+const char *key_binding_path(const key_binding_table_t *table, uint16_t index) {
+    return table->strings + table->entries[index - 1].path;
+}
+
+const char *key_binding_payload(const key_binding_table_t *table, uint16_t index) {
+    uint16_t payload = table->entries[index - 1].payload;
+    return payload == KEY_BINDING_NO_PAYLOAD ? NULL : table->strings + payload;
+}
+
+// Compiling
+
+// One line being parsed
+typedef struct {
+    const char *pos;
+    const char *end;
+    char *err;
+    size_t err_len;
+    uint32_t line;
+} _parser_t;
+
+static bool _fail(_parser_t *p, const char *what, const char *token, size_t token_len) {
+    snprintf(p->err, p->err_len, "line %u: %s%s%.*s", (unsigned)p->line, what,
+             token_len ? " " : "", (int)token_len, token);
+    return false;
+}
+
+static int _compare_name(const void *name, const void *code) {
+    return strcmp(name, ((const key_table_code_t *)code)->name);
+}
+
+static bool _parse_key(_parser_t *p, const char *token, size_t len, uint8_t *key) {
+    char name[32];
+    if (len == 0 || len >= sizeof(name)) {
+        return _fail(p, "bad key", token, len);
+    }
+    memcpy(name, token, len);
+    name[len] = '\0';
+
+    unsigned long code = 0;
+    if (len > 2 && name[0] == '0' && (name[1] == 'x' || name[1] == 'X')) {
+        char *end;
+        code = strtoul(name + 2, &end, 16);
+        if (*end != '\0' || code > 0xff) {
+            return _fail(p, "bad key code", token, len);
+        }
+    } else {
+        const key_table_code_t *found = bsearch(name, key_table_codes, key_table_code_count,
+                                                sizeof(key_table_codes[0]), _compare_name);
+        if (found == NULL) {
+            return _fail(p, "unknown key", token, len);
+        }
+        code = found->code;
+    }
+    if (code == 0 || _is_modifier(code)) {
+        return _fail(p, "can't bind", token, len);
+    }
+    *key = code;
+    return true;
+}
+
+static bool _parse_mod(const char *token, size_t len, uint8_t *mods) {
+    static const struct {
+        const char *name;
+        uint8_t mod;
+    } names[] = {
+        { "CTRL", KEY_BINDING_MOD_CTRL },
+        { "SHIFT", KEY_BINDING_MOD_SHIFT },
+        { "ALT", KEY_BINDING_MOD_ALT },
+        { "GUI", KEY_BINDING_MOD_GUI },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i].name) == len && memcmp(names[i].name, token, len) == 0) {
+            *mods |= names[i].mod;
+            return true;
+        }
+    }
+    return false;
+}
+
+// A trigger: modifiers and keys joined by '+' (a chord if there's more than
+// one key), or keys separated by ',' (a sequence; modifiers go on the last)
+static bool _parse_trigger(_parser_t *p, const char *token, size_t len, key_binding_t *binding,
+                           uint8_t *keys, uint32_t *count) {
+    const char *end = token + len;
+    bool sequence = memchr(token, ',', len) != NULL;
+    *count = 0;
+    binding->mods = 0;
+
+    uint32_t step_keys = 0;
+    while (token < end) {
+        const char *sep = token;
+        while (sep < end && *sep != '+' && *sep != ',') {
+            sep++;
+        }
+        size_t part = sep - token;
+        bool last_step = !sequence || memchr(token, ',', end - token) == NULL;
+        if (_parse_mod(token, part, &binding->mods)) {
+            if (!last_step) {
+                return _fail(p, "modifiers only go on a sequence's last key", "", 0);
+            }
+        } else {
+            if (*count == KEY_BINDING_MAX_KEYS) {
+                return _fail(p, "too many keys", "", 0);
+            }
+            if (sequence && step_keys++ > 0) {
+                return _fail(p, "one key per step in a sequence", "", 0);
+            }
+            if (!_parse_key(p, token, part, &keys[*count])) {
+                return false;
+            }
+            for (uint32_t i = 0; !sequence && i < *count; i++) {
+                if (keys[i] == keys[*count]) {
+                    return _fail(p, "key repeated in chord", token, part);
+                }
+            }
+            (*count)++;
+        }
+        if (sep < end && *sep == ',') {
+            step_keys = 0;
+        }
+        token = sep < end ? sep + 1 : end;
+    }
+    if (*count == 0) {
+        return _fail(p, "no key in trigger", "", 0);
+    }
+    binding->type = *count == 1 ? KEY_BINDING_KEY
+                    : sequence ? KEY_BINDING_SEQUENCE : KEY_BINDING_CHORD;
+    return true;
+}
+
+static bool _valid_path_char(char c) {
+    return isalnum((unsigned char)c) || c == '.' || c == '_' || c == '~' || c == '-' || c == '/';
+}
+
+static bool _add_string(key_binding_table_t *table, const char *prefix, const char *s, size_t len,
+                        uint16_t *offset) {
+    size_t prefix_len = strlen(prefix);
+    if (table->strings_len + prefix_len + len + 1 > sizeof(table->strings)) {
+        return false;
+    }
+    *offset = table->strings_len;
+    memcpy(table->strings + table->strings_len, prefix, prefix_len);
+    memcpy(table->strings + table->strings_len + prefix_len, s, len);
+    table->strings_len += prefix_len + len;
+    table->strings[table->strings_len++] = '\0';
+    return true;
+}
+
+static bool _parse_target(_parser_t *p, key_binding_table_t *table, const char *token,
+                          size_t len, key_binding_t *binding) {
+    for (size_t i = 0; i < len; i++) {
+        if (!_valid_path_char(token[i])) {
+            return _fail(p, "bad path", token, len);
+        }
+    }
+    const char *prefix = token[0] == '/' ? "" : KEY_TABLE_PATH_PREFIX;
+    if (strlen(prefix) + len > KEY_BINDING_PATH_LEN) {
+        return _fail(p, "path too long", token, len);
+    }
+    if (!_add_string(table, prefix, token, len, &binding->path)) {
+        return _fail(p, "out of room for paths and payloads", "", 0);
+    }
+    return true;
+}
+
+static bool _add_binding(_parser_t *p, key_binding_table_t *table, const key_binding_t *binding,
+                         uint8_t last, uint8_t *lasts) {
+    if (table->count == CONFIG_KEY_BINDING_MAX) {
+        return _fail(p, "more than CONFIG_KEY_BINDING_MAX bindings", "", 0);
+    }
+    // An identical trigger would never match
+    for (uint32_t i = 0; i < table->count; i++) {
+        const key_binding_t *other = &table->entries[i];
+        if (lasts[i] == last && other->type == binding->type && other->mods == binding->mods &&
+            other->count == binding->count &&
+            memcmp(other->keys, binding->keys, binding->count) == 0) {
+            return _fail(p, "already bound", "", 0);
+        }
+    }
+    lasts[table->count] = last;
+    table->entries[table->count++] = *binding;
+    return true;
+}
+
+static bool _parse_line(_parser_t *p, key_binding_table_t *table, uint8_t *lasts) {
+    const char *s = p->pos;
+    const char *end = p->end;
+    while (s < end && isspace((unsigned char)*s)) {
+        s++;
+    }
+    if (s == end || *s == '#') {
+        return true;
+    }
+
+    const char *trigger = s;
+    while (s < end && !isspace((unsigned char)*s)) {
+        s++;
+    }
+    size_t trigger_len = s - trigger;
+    while (s < end && isspace((unsigned char)*s)) {
+        s++;
+    }
+    const char *target = s;
+    while (s < end && !isspace((unsigned char)*s)) {
+        s++;
+    }
+    size_t target_len = s - target;
+    if (target_len == 0) {
+        return _fail(p, "expected \"trigger target [payload]\"", "", 0);
+    }
+    while (s < end && isspace((unsigned char)*s)) {
+        s++;
+    }
+    const char *payload = s;
+    while (end > payload && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    size_t payload_len = end - payload;
+
+    key_binding_t binding;
+    memset(&binding, 0, sizeof(binding));
+    uint8_t keys[KEY_BINDING_MAX_KEYS];
+    uint32_t count;
+    if (!_parse_trigger(p, trigger, trigger_len, &binding, keys, &count) ||
+        !_parse_target(p, table, target, target_len, &binding)) {
+        return false;
+    }
+    binding.payload = KEY_BINDING_NO_PAYLOAD;
+    if (payload_len > KEY_BINDING_PAYLOAD_LEN) {
+        return _fail(p, "payload too long", "", 0);
+    }
+    if (payload_len > 0 && !_add_string(table, "", payload, payload_len, &binding.payload)) {
+        return _fail(p, "out of room for paths and payloads", "", 0);
+    }
+
+    if (binding.type != KEY_BINDING_CHORD) {
+        binding.count = count - 1;
+        memcpy(binding.keys, keys, count - 1);
+        return _add_binding(p, table, &binding, keys[count - 1], lasts);
+    }
+    // A chord can end on any of its keys, with the others held. Kept in
+    // ascending order so the same chord written differently is caught.
+    for (uint32_t last = 0; last < count; last++) {
+        binding.count = 0;
+        for (uint8_t key = 1; key != 0; key++) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (i != last && keys[i] == key) {
+                    binding.keys[binding.count++] = key;
+                }
+            }
+        }
+        if (!_add_binding(p, table, &binding, keys[last], lasts)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Higher goes first among the bindings for a key
+static inline uint32_t _specificity(const key_binding_t *binding) {
+    return binding->count * 2 + (binding->type == KEY_BINDING_SEQUENCE);
+}
+
+bool key_binding_table_compile(key_binding_table_t *table, const char *src, size_t len,
+                               char *err, size_t err_len) {
+    uint8_t lasts[CONFIG_KEY_BINDING_MAX];
+    _parser_t p = {
+        .pos = src,
+        .err = err,
+        .err_len = err_len,
+    };
+    memset(table, 0, sizeof(*table));
+    if (err_len > 0) {
+        err[0] = '\0';
+    }
+
+    const char *end = src + len;
+    while (p.pos < end) {
+        p.line++;
+        p.end = memchr(p.pos, '\n', end - p.pos);
+        if (p.end == NULL) {
+            p.end = end;
+        }
+        if (!_parse_line(&p, table, lasts)) {
+            memset(table, 0, sizeof(*table));
+            return false;
+        }
+        p.pos = p.end + 1;
+    }
+
+    // Stable insertion sort by last key, then most specific first
+    for (uint32_t i = 1; i < table->count; i++) {
+        key_binding_t binding = table->entries[i];
+        uint8_t last = lasts[i];
+        uint32_t j = i;
+        while (j > 0 && (lasts[j - 1] > last ||
+                         (lasts[j - 1] == last &&
+                          _specificity(&table->entries[j - 1]) < _specificity(&binding)))) {
+            table->entries[j] = table->entries[j - 1];
+            lasts[j] = lasts[j - 1];
+            j--;
+        }
+        table->entries[j] = binding;
+        lasts[j] = last;
+    }
+
+    uint32_t i = 0;
+    for (uint32_t key = 0; key < 256; key++) {
+        table->first[key] = i;
+        uint32_t n = 0;
+        while (i < table->count && lasts[i] == key) {
+            i++;
+            n++;
+        }
+        if (n > KEY_BINDING_MAX_PER_KEY) {
+            snprintf(err, err_len, "more than %d bindings end on key 0x%02x",
+                     KEY_BINDING_MAX_PER_KEY, (unsigned)key);
+            memset(table, 0, sizeof(*table));
+            return false;
+        }
+    }
+    table->first[256] = i;
+    return true;
+}
@@ -0,0 +1,134 @@
+#ifndef KEY_BINDINGS_H
+#define KEY_BINDINGS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "key_event.h"
+
+// Keys in a chord or sequence, the last one included
+#define KEY_BINDING_MAX_KEYS 4
+// Bindings that can end on the same key. A lookup checks at most this many.
+#define KEY_BINDING_MAX_PER_KEY 8
+// Longest path, prefix included, and payload, without the terminator
+#define KEY_BINDING_PATH_LEN 40
+#define KEY_BINDING_PAYLOAD_LEN 64
+
+// key_event_t.binding for an event no binding matched; the key's path from
+// key_table applies
+#define KEY_BINDING_NONE 0
+
+#define KEY_BINDING_NO_PAYLOAD 0xffff
+
+// Modifiers as bindings see them: left and right count the same
+#define KEY_BINDING_MOD_CTRL  0x01
+#define KEY_BINDING_MOD_SHIFT 0x02
+#define KEY_BINDING_MOD_ALT   0x04
+#define KEY_BINDING_MOD_GUI   0x08
+
+typedef enum {
+    KEY_BINDING_KEY,        // the key, with exactly `mods` held
+    KEY_BINDING_CHORD,      // ...while `keys` are held
+    KEY_BINDING_SEQUENCE,   // ...straight after `keys` were pressed, in order
+} key_binding_type_t;
+
+typedef struct {
+    uint8_t type;           // key_binding_type_t
+    uint8_t mods;           // KEY_BINDING_MOD_* bits
+    uint8_t count;          // entries in `keys`
+    uint8_t keys[KEY_BINDING_MAX_KEYS - 1];
+    uint16_t path;          // offsets into the table's strings
+    uint16_t payload;
+} key_binding_t;
+
+// Compiled bindings. Flat, so a lookup is an index and a short scan:
+// entries[first[k]] up to entries[first[k + 1]] are the bindings that end on
+// key k, most specific first (longer sequences, then longer chords, then the
+// plain key).
+typedef struct {
+    uint16_t first[257];
+    uint16_t count;
+    key_binding_t entries[CONFIG_KEY_BINDING_MAX];
+    uint16_t strings_len;
+    char strings[CONFIG_KEY_BINDING_STRINGS];
+} key_binding_table_t;
+
+// What the consumer has seen of one keyboard, for chords and sequences
+typedef struct {
+    uint32_t down[256 / 32];    // keys held, modifiers aside
+    uint8_t recent[KEY_BINDING_MAX_KEYS - 1];   // the last presses, oldest first
+    int64_t recent_us[KEY_BINDING_MAX_KEYS - 1];
+    uint8_t recent_count;
+} key_binding_state_t;
+
+// Bindings the consumer maps key presses with, replaceable at runtime. New
+// ones are compiled into the table the consumer isn't using and switched to
+// once nothing mapped with the old ones is still waiting to be sent, so an
+// event's binding index always refers to the table that's active.
+//
+// One writer at a time (edit, compile, publish) and one consumer.
+typedef struct {
+    key_binding_table_t tables[2];
+    _Atomic uint32_t active;
+    _Atomic bool pending;           // the other table is waiting to be switched to
+    _Atomic uint32_t switches;
+    _Atomic uint32_t matched;       // presses a binding matched
+} key_bindings_t;
+
+// Starts out with no bindings
+void key_bindings_init(key_bindings_t *bindings);
+
+// Writer side. The table to compile new bindings into, or NULL while the last
+// ones published haven't been switched to yet.
+key_binding_table_t *key_bindings_edit(key_bindings_t *bindings);
+
+// Writer side. Hands the table from key_bindings_edit() to the consumer.
+void key_bindings_publish(key_bindings_t *bindings);
+
+// Consumer side. Switches to the published table, if there is one. Returns
+// whether it did.
+bool key_bindings_switch(key_bindings_t *bindings);
+
+static inline const key_binding_table_t *key_bindings_active(const key_bindings_t *bindings) {
+    return &bindings->tables[atomic_load_explicit(&bindings->active, memory_order_relaxed)];
+}
+
+static inline bool key_bindings_pending(const key_bindings_t *bindings) {
+    return atomic_load_explicit(&bindings->pending, memory_order_acquire);
+}
+
+// Consumer side. Follows `state` with `event` and returns the index of the
+// binding its press completes, or KEY_BINDING_NONE. Releases never match.
+// Bindings fire as soon as they're complete: the first G of a G,G sequence
+// goes out as G, the second as the sequence.
+uint16_t key_bindings_match(key_bindings_t *bindings, key_binding_state_t *state,
+                            const key_event_t *event);
+
+// Compiles `src` (`len` bytes, no terminator needed), one binding per line:
+//
+//   # trigger          target          payload
+//   CTRL+KEY_C         copy
+//   KEY_A+KEY_S        as                          chord, held in any order
+//   KEY_G,KEY_G        top                         sequence
+//   SHIFT+KEY_ENTER    /api/go         {"fast":1}
+//
+// Keys are usb_hid_codes.h names or hex codes (0x28); modifiers are CTRL,
+// SHIFT, ALT and GUI, and apply to the last key. A target without a leading
+// '/' goes under KEY_TABLE_PATH_PREFIX. The rest of the line, if any, is a
+// payload the press is POSTed with instead of a GET. Lines starting with '#'
+// are comments.
+//
+// Returns false with the first problem in `err`, leaving `table` empty.
+bool key_binding_table_compile(key_binding_table_t *table, const char *src, size_t len,
+                               char *err, size_t err_len);
+
+// Path and payload of binding `index` (as returned by key_bindings_match());
+// the payload is NULL if there's none
+const char *key_binding_path(const key_binding_table_t *table, uint16_t index);
+const char *key_binding_payload(const key_binding_table_t *table, uint16_t index);
+
+#endif // KEY_BINDINGS_H
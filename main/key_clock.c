@@ -0,0 +1,58 @@
+#include "key_clock.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+void key_clock_init(key_clock_t *clock, uint32_t interval_s, uint32_t pings, int64_t now_us) {
+    clock->interval_us = (int64_t)interval_s * 1000000;
+    clock->due_us = now_us;
+    clock->pings = pings > 0 ? pings : 1;
+    clock->left = clock->pings + 1;
+    clock->prev_t0_us = 0;
+    clock->prev_t3_us = 0;
+    clock->supported = interval_s > 0;
+}
+
+int64_t key_clock_due_in(const key_clock_t *clock, int64_t now_us) {
+    if (!clock->supported) {
+        return -1;
+    }
+    return clock->due_us > now_us ? clock->due_us - now_us : 0;
+}
+
+int key_clock_ping(const key_clock_t *clock, const char *path, int64_t now_us, char *buf,
+                   size_t len) {
+    int n;
+    if (clock->left == 1) {
+        // Only the last ping's times to report
+        n = snprintf(buf, len, "%s?prev_t0=%" PRId64 "&prev_t3=%" PRId64, path,
+                     clock->prev_t0_us, clock->prev_t3_us);
+    } else if (clock->prev_t0_us != 0) {
+        n = snprintf(buf, len, "%s?t0=%" PRId64 "&prev_t0=%" PRId64 "&prev_t3=%" PRId64, path,
+                     now_us, clock->prev_t0_us, clock->prev_t3_us);
+    } else {
+        n = snprintf(buf, len, "%s?t0=%" PRId64, path, now_us);
+    }
+    return n < 0 || (size_t)n >= len ? -1 : n;
+}
+
+static void end_round(key_clock_t *clock, int64_t now_us) {
+    clock->due_us = now_us + clock->interval_us;
+    clock->left = clock->pings + 1;
+    clock->prev_t0_us = 0;
+    clock->prev_t3_us = 0;
+}
+
+void key_clock_answered(key_clock_t *clock, int64_t sent_us, int64_t done_us, esp_err_t ret,
+                        int status) {
+    if (ret == ESP_OK && (status == 404 || status == 501)) {
+        clock->supported = false;
+        return;
+    }
+    if (ret != ESP_OK || status < 200 || status >= 300 || --clock->left == 0) {
+        end_round(clock, done_us);
+        return;
+    }
+    clock->prev_t0_us = sent_us;
+    clock->prev_t3_us = done_us;
+}
@@ -0,0 +1,55 @@
+#ifndef KEY_CLOCK_H
+#define KEY_CLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Clock pings, so the server can line the receiver's microsecond clock up
+// with its own and tell how long each event's `ts` took to reach it. Every so
+// often, while nothing else is being sent, the consumer GETs the clock path a
+// few times in a row:
+//
+//   /remote/clock?t0=1000
+//   /remote/clock?t0=1900&prev_t0=1000&prev_t3=1850
+//   ...
+//   /remote/clock?prev_t0=2700&prev_t3=2760
+//
+// t0 is when a ping was sent and t3 when its answer came back, both on the
+// receiver's clock, each reported with the next request. The server notes
+// when each ping arrived (t1) and was answered (t2) on its own clock, and
+// from the four works out the offset between the clocks,
+// ((t1 - t0) + (t2 - t3)) / 2, to within half the round trip; the ping with
+// the shortest round trip gives the best estimate. The receiver itself never
+// needs the answer's body, so any HTTP transport will do.
+typedef struct {
+    int64_t interval_us;
+    int64_t due_us;         // when the next round starts
+    uint32_t pings;         // per round
+    uint32_t left;          // requests left in this round, the last report included
+    int64_t prev_t0_us;     // the last ping, to report with the next request;
+    int64_t prev_t3_us;     // 0 if there's none
+    bool supported;         // cleared if the server doesn't know the path
+} key_clock_t;
+
+// The first round is due straight away. `interval_s` of 0 turns pings off.
+void key_clock_init(key_clock_t *clock, uint32_t interval_s, uint32_t pings, int64_t now_us);
+
+// Microseconds until the next ping is due, 0 if it's overdue, or -1 if
+// there won't be one
+int64_t key_clock_due_in(const key_clock_t *clock, int64_t now_us);
+
+// Writes the next ping's path, `path` with its query, as sent at `now_us`.
+// Returns the length, or -1 if it doesn't fit.
+int key_clock_ping(const key_clock_t *clock, const char *path, int64_t now_us, char *buf,
+                   size_t len);
+
+// The ping sent at `sent_us` came back at `done_us`. A failed one ends the
+// round early; a 404 or 501 means the server doesn't take pings, and they
+// stop.
+void key_clock_answered(key_clock_t *clock, int64_t sent_us, int64_t done_us, esp_err_t ret,
+                        int status);
+
+#endif // KEY_CLOCK_H
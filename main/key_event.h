@@ -0,0 +1,30 @@
+#ifndef KEY_EVENT_H
+#define KEY_EVENT_H
+
+#include <stdint.h>
+
+#define KEY_EVENT_PRESS   0x00
+#define KEY_EVENT_RELEASE 0x01
+
+// A single key event as produced by the HID callback. Kept small and
+// fixed-size so it can be copied around without allocation.
+//
+// `seq` and `tx` count per keyboard, from 1. Every event the callback queues
+// gets the next `seq`, so a jump means events that were dropped or never
+// sent (releases, unmapped keys, presses folded into another's count).
+// Every event the consumer puts in a request gets the next `tx`, which it
+// keeps if the request is retried, so the server sees a gap in `tx` only for
+// an event that's really been lost, and the same `tx` twice for a retry.
+typedef struct {
+    int64_t timestamp_us;   // time the HID report was received
+    uint32_t seq;           // 0 for a repeat, which no report stands behind
+    uint32_t tx;            // 0 until it goes into a request
+    uint16_t count;         // number of identical events merged into this one
+    uint8_t key;
+    uint8_t type;           // KEY_EVENT_PRESS or KEY_EVENT_RELEASE
+    uint8_t mods;           // KEY_MOD_* bits held when the event happened
+    uint8_t device;         // index of the keyboard in the device table
+    uint16_t binding;       // set by the consumer, see key_bindings_match()
+} key_event_t;
+
+#endif // KEY_EVENT_H
@@ -0,0 +1,131 @@
+#include "key_loadgen.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "usb_hid_codes.h"
+
+// The keypad, all of which key_mappings.txt maps
+#define KEY_LOADGEN_FIRST_KEY KEY_KPSLASH
+#define KEY_LOADGEN_KEYS      16
+
+static uint32_t _random(key_loadgen_t *gen) {
+    // xorshift32: plenty for spreading out key presses
+    uint32_t x = gen->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    gen->rng = x;
+    return x;
+}
+
+// Uniform in (0, 1]
+static float _uniform(key_loadgen_t *gen) {
+    return ((_random(gen) >> 8) + 1) / 16777216.0f;
+}
+
+// Time from one press of a source to its next
+static int64_t _gap(key_loadgen_t *gen, key_loadgen_source_t *source) {
+    switch (gen->config.dist) {
+        case KEY_LOADGEN_POISSON:
+            return (int64_t)(-logf(_uniform(gen)) * gen->interval_us);
+        case KEY_LOADGEN_BURST: {
+            // Back to back within a burst, with the pause making up the
+            // average rate
+            int64_t quick = 2 * gen->hold_us;
+            if (--source->burst_left > 0) {
+                return quick;
+            }
+            source->burst_left = gen->config.burst;
+            int64_t pause = gen->config.burst * gen->interval_us - (gen->config.burst - 1) * quick;
+            return pause > quick ? pause : quick;
+        }
+        case KEY_LOADGEN_FIXED:
+        default:
+            return gen->interval_us;
+    }
+}
+
+bool key_loadgen_init(key_loadgen_t *gen, const key_loadgen_config_t *config, int64_t now_us) {
+    if (config->sources == 0 || config->sources > KEY_LOADGEN_MAX_SOURCES ||
+        config->devices == 0 || config->devices > 256 || !(config->rate > 0)) {
+        return false;
+    }
+    memset(gen, 0, sizeof(*gen));
+    gen->config = *config;
+    if (gen->config.burst == 0) {
+        gen->config.burst = 1;
+    }
+    gen->interval_us = (int64_t)(1000000.0f / config->rate);
+    if (gen->interval_us < 1) {
+        gen->interval_us = 1;
+    }
+    gen->hold_us = (int64_t)config->hold_ms * 1000;
+    gen->rng = config->seed != 0 ? config->seed : 1;
+
+    for (uint32_t i = 0; i < config->sources; i++) {
+        key_loadgen_source_t *source = &gen->sources[i];
+        source->device = i % config->devices;
+        source->key = KEY_LOADGEN_FIRST_KEY + (i / config->devices) % KEY_LOADGEN_KEYS;
+        source->down = false;
+        source->burst_left = gen->config.burst;
+        source->press_us = now_us + _random(gen) % gen->interval_us;
+        source->next_us = source->press_us;
+    }
+    return true;
+}
+
+int64_t key_loadgen_next_us(const key_loadgen_t *gen) {
+    int64_t next = INT64_MAX;
+    for (uint32_t i = 0; i < gen->config.sources; i++) {
+        if (gen->sources[i].next_us < next) {
+            next = gen->sources[i].next_us;
+        }
+    }
+    return next;
+}
+
+int key_loadgen_next(key_loadgen_t *gen, int64_t now_us, uint8_t *report) {
+    key_loadgen_source_t *due = NULL;
+    for (uint32_t i = 0; i < gen->config.sources; i++) {
+        key_loadgen_source_t *source = &gen->sources[i];
+        if (source->next_us <= now_us && (due == NULL || source->next_us < due->next_us)) {
+            due = source;
+        }
+    }
+    if (due == NULL) {
+        return -1;
+    }
+
+    if (due->down) {
+        int64_t release_us = due->next_us;
+        due->down = false;
+        due->press_us += _gap(gen, due);
+        // A key can't go down again before it's been seen to come up
+        if (due->press_us < release_us) {
+            due->press_us = release_us;
+        }
+        due->next_us = due->press_us;
+    } else {
+        due->down = true;
+        due->next_us = due->press_us + gen->hold_us;
+        gen->presses++;
+    }
+
+    // Everything the keyboard has down now
+    memset(report, 0, 1 + HID_REPORT_LEN);
+    report[0] = 1;
+    uint8_t *slots = report + 3;
+    int held = 0;
+    for (uint32_t i = 0; i < gen->config.sources; i++) {
+        const key_loadgen_source_t *source = &gen->sources[i];
+        if (source->down && source->device == due->device) {
+            if (held == HID_REPORT_KEYS) {
+                memset(slots, KEY_ERR_OVF, HID_REPORT_KEYS);
+                break;
+            }
+            slots[held++] = source->key;
+        }
+    }
+    return due->device;
+}
@@ -0,0 +1,68 @@
+#ifndef KEY_LOADGEN_H
+#define KEY_LOADGEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hid_report.h"
+
+// Virtual keyboards for load tests: a number of sources, each pressing and
+// releasing one mapped key at a given rate, turned into boot protocol reports
+// (report ID first) as the keyboards they're spread over would send them.
+// Sources on the same keyboard use different keys, so their presses overlap
+// like fingers of a fast typist; past six held at once the report is a
+// rollover, as a real keyboard's would be.
+//
+// Fixed size, no allocation and no FreeRTOS, so the same generator drives
+// kb_load on the host and the KEY_LOADGEN_ENABLE debug build on the device.
+
+#define KEY_LOADGEN_MAX_SOURCES 64
+
+typedef enum {
+    KEY_LOADGEN_FIXED,      // evenly spaced
+    KEY_LOADGEN_POISSON,    // independent, exponentially distributed gaps
+    KEY_LOADGEN_BURST,      // `burst` presses back to back, then a pause
+} key_loadgen_dist_t;
+
+typedef struct {
+    uint32_t sources;
+    uint32_t devices;       // sources are spread over devices 0..devices-1
+    float rate;             // average presses per second, per source
+    key_loadgen_dist_t dist;
+    uint32_t burst;         // presses per burst for KEY_LOADGEN_BURST
+    uint32_t hold_ms;       // how long each key stays down
+    uint32_t seed;
+} key_loadgen_config_t;
+
+typedef struct {
+    int64_t press_us;       // when the key last went down, or next will
+    int64_t next_us;        // the next press, or the release while down
+    uint8_t key;
+    uint8_t device;
+    bool down;
+    uint16_t burst_left;
+} key_loadgen_source_t;
+
+typedef struct {
+    key_loadgen_config_t config;
+    key_loadgen_source_t sources[KEY_LOADGEN_MAX_SOURCES];
+    int64_t interval_us;    // average gap between one source's presses
+    int64_t hold_us;
+    uint32_t rng;
+    uint32_t presses;       // presses generated so far
+} key_loadgen_t;
+
+// Sources start at random points of their first interval from `now_us`.
+// Returns false if the configuration can't be generated (no sources, too
+// many, no devices or a rate that isn't positive).
+bool key_loadgen_init(key_loadgen_t *gen, const key_loadgen_config_t *config, int64_t now_us);
+
+// If a source's press or release is due by `now_us`, writes the report its
+// keyboard sends for it (1 + HID_REPORT_LEN bytes) and returns the keyboard's
+// device. Returns -1 if nothing is due yet.
+int key_loadgen_next(key_loadgen_t *gen, int64_t now_us, uint8_t *report);
+
+// When the next report is due
+int64_t key_loadgen_next_us(const key_loadgen_t *gen);
+
+#endif // KEY_LOADGEN_H
@@ -0,0 +1,247 @@
+#include "key_log.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+typedef enum {
+    KEY_LOG_TAG_HID,
+    KEY_LOG_TAG_KEY,
+    KEY_LOG_TAG_REQUEST,
+    KEY_LOG_TAG_BATCH,
+    KEY_LOG_TAG_QUEUE,
+    KEY_LOG_TAG_COUNT,
+} key_log_tag_t;
+
+// Tags match the functions that used to log these synchronously
+static const char *const _tags[KEY_LOG_TAG_COUNT] = {
+    [KEY_LOG_TAG_HID] = "esp_hidh_cb",
+    [KEY_LOG_TAG_KEY] = "key_press",
+    [KEY_LOG_TAG_REQUEST] = "send_request",
+    [KEY_LOG_TAG_BATCH] = "send_batch",
+    [KEY_LOG_TAG_QUEUE] = "key_pipeline_process",
+};
+
+typedef struct {
+    key_log_tag_t tag;
+    esp_log_level_t level;
+    bool verbose;
+    // The first argument is an esp_err_t, printed with esp_err_to_name()
+    bool err_arg;
+    const char *format;
+} key_log_message_t;
+
+static const key_log_message_t _messages[KEY_LOG_COUNT] = {
+    [KEY_LOG_HID_DATA] = {
+        KEY_LOG_TAG_HID, ESP_LOG_INFO, true, false,
+        "ESP_HIDH_DATA_IND_EVT status %u, length %u",
+    },
+    [KEY_LOG_KEY_PRESS] = {
+        KEY_LOG_TAG_KEY, ESP_LOG_INFO, true, false,
+        "Received key press: 0x%x",
+    },
+    [KEY_LOG_UNKNOWN_KEY] = {
+        KEY_LOG_TAG_KEY, ESP_LOG_WARN, false, false,
+        "Received unknown key press: 0x%x",
+    },
+    [KEY_LOG_STALE_KEY] = {
+        KEY_LOG_TAG_KEY, ESP_LOG_WARN, false, false,
+        "Dropped key press 0x%x, %u ms past its report",
+    },
+    [KEY_LOG_REQUEST_OK] = {
+        KEY_LOG_TAG_REQUEST, ESP_LOG_INFO, true, false,
+        "Request completed successfully, HTTP %u",
+    },
+    [KEY_LOG_REQUEST_FAILED] = {
+        KEY_LOG_TAG_REQUEST, ESP_LOG_ERROR, false, true,
+        "Request failed %s",
+    },
+    [KEY_LOG_BATCH_FAILED] = {
+        KEY_LOG_TAG_BATCH, ESP_LOG_ERROR, false, true,
+        "Request failed %s",
+    },
+    [KEY_LOG_BATCH_TOO_LONG] = {
+        KEY_LOG_TAG_BATCH, ESP_LOG_ERROR, false, false,
+        "Batch of %u events doesn't fit the request body",
+    },
+    [KEY_LOG_QUEUE_OVERFLOW] = {
+        KEY_LOG_TAG_QUEUE, ESP_LOG_WARN, false, false,
+        "Key queue overflowed: enqueued %u, dropped %u, coalesced %u, max depth %u",
+    },
+};
+
+// Bounded multi-producer ring in the style of Vyukov's MPMC queue: each slot
+// carries a sequence number saying whose turn it is, so producers only
+// contend on the head index and never wait for each other.
+typedef struct {
+    _Atomic uint32_t seq;
+    uint16_t id;
+    int64_t timestamp_us;
+    uint32_t args[KEY_LOG_ARGS];
+} key_log_record_t;
+
+typedef struct {
+    _Atomic uint32_t window;      // second the count applies to
+    _Atomic uint32_t count;
+    _Atomic uint32_t suppressed;
+} key_log_limit_t;
+
+static key_log_record_t _ring[CONFIG_KEY_LOG_RING_DEPTH];
+static _Atomic uint32_t _head;
+static uint32_t _tail;            // consumer only
+static _Atomic uint32_t _dropped;
+static atomic_bool _verbose;
+static key_log_limit_t _limits[KEY_LOG_TAG_COUNT];
+
+_Static_assert((CONFIG_KEY_LOG_RING_DEPTH & (CONFIG_KEY_LOG_RING_DEPTH - 1)) == 0,
+               "CONFIG_KEY_LOG_RING_DEPTH must be a power of two");
+
+#define KEY_LOG_MASK (CONFIG_KEY_LOG_RING_DEPTH - 1)
+
+void key_log_init(void) {
+    for (uint32_t i = 0; i < CONFIG_KEY_LOG_RING_DEPTH; i++) {
+        atomic_init(&_ring[i].seq, i);
+    }
+    atomic_init(&_head, 0);
+    _tail = 0;
+    atomic_init(&_dropped, 0);
+#if CONFIG_KEY_LOG_VERBOSE
+    atomic_init(&_verbose, true);
+#else
+    atomic_init(&_verbose, false);
+#endif
+    for (int t = 0; t < KEY_LOG_TAG_COUNT; t++) {
+        atomic_init(&_limits[t].window, 0);
+        atomic_init(&_limits[t].count, 0);
+        atomic_init(&_limits[t].suppressed, 0);
+    }
+}
+
+// Fixed one-second windows. Two tasks logging under the same tag at a window
+// boundary may let a message or two extra through, which is fine.
+static bool _allow(key_log_tag_t tag, int64_t now_us) {
+#if CONFIG_KEY_LOG_RATE_LIMIT > 0
+    key_log_limit_t *limit = &_limits[tag];
+    uint32_t window = (uint32_t)(now_us / 1000000);
+    if (atomic_load_explicit(&limit->window, memory_order_relaxed) != window) {
+        atomic_store_explicit(&limit->window, window, memory_order_relaxed);
+        atomic_store_explicit(&limit->count, 0, memory_order_relaxed);
+    }
+    if (atomic_fetch_add_explicit(&limit->count, 1, memory_order_relaxed) >=
+        CONFIG_KEY_LOG_RATE_LIMIT) {
+        atomic_fetch_add_explicit(&limit->suppressed, 1, memory_order_relaxed);
+        return false;
+    }
+#endif
+    return true;
+}
+
+void key_log_write(key_log_id_t id, const uint32_t args[KEY_LOG_ARGS]) {
+    const key_log_message_t *message = &_messages[id];
+    // Verbose traces are all-or-nothing: rate limiting them would defeat the
+    // point of turning them on
+    if (message->verbose && !atomic_load_explicit(&_verbose, memory_order_relaxed)) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (!message->verbose && !_allow(message->tag, now_us)) {
+        return;
+    }
+
+    key_log_record_t *record;
+    uint32_t pos = atomic_load_explicit(&_head, memory_order_relaxed);
+    for (;;) {
+        record = &_ring[pos & KEY_LOG_MASK];
+        uint32_t seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&_head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumer hasn't freed this slot yet: full
+            atomic_fetch_add_explicit(&_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&_head, memory_order_relaxed);
+        }
+    }
+
+    record->id = id;
+    record->timestamp_us = now_us;
+    for (int i = 0; i < KEY_LOG_ARGS; i++) {
+        record->args[i] = args[i];
+    }
+    atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+}
+
+static void _print(const key_log_record_t *record) {
+    const key_log_message_t *message = &_messages[record->id];
+    const uint32_t *a = record->args;
+    char text[128];
+    if (message->err_arg) {
+        snprintf(text, sizeof(text), message->format,
+                 esp_err_to_name((esp_err_t)a[0]), a[1], a[2], a[3]);
+    } else {
+        snprintf(text, sizeof(text), message->format, a[0], a[1], a[2], a[3]);
+    }
+    // The log line's own timestamp is when it was printed; keep the time it
+    // happened too
+    const char *tag = _tags[message->tag];
+    switch (message->level) {
+        case ESP_LOG_ERROR:
+            ESP_LOGE(tag, "%s [%lld ms]", text, (long long)(record->timestamp_us / 1000));
+            break;
+        case ESP_LOG_WARN:
+            ESP_LOGW(tag, "%s [%lld ms]", text, (long long)(record->timestamp_us / 1000));
+            break;
+        default:
+            ESP_LOGI(tag, "%s [%lld ms]", text, (long long)(record->timestamp_us / 1000));
+            break;
+    }
+}
+
+int key_log_drain(void) {
+    int n = 0;
+    for (;;) {
+        key_log_record_t *record = &_ring[_tail & KEY_LOG_MASK];
+        uint32_t seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        if (seq != _tail + 1) {
+            break;
+        }
+        _print(record);
+        // Hand the slot back to producers for the next lap
+        atomic_store_explicit(&record->seq, _tail + CONFIG_KEY_LOG_RING_DEPTH,
+                              memory_order_release);
+        _tail++;
+        n++;
+    }
+
+    for (int t = 0; t < KEY_LOG_TAG_COUNT; t++) {
+        uint32_t suppressed = atomic_exchange_explicit(&_limits[t].suppressed, 0,
+                                                       memory_order_relaxed);
+        if (suppressed != 0) {
+            ESP_LOGW(_tags[t], "%u messages suppressed by rate limit", suppressed);
+            n++;
+        }
+    }
+    return n;
+}
+
+void key_log_set_verbose(bool verbose) {
+    atomic_store_explicit(&_verbose, verbose, memory_order_relaxed);
+}
+
+bool key_log_verbose(void) {
+    return atomic_load_explicit(&_verbose, memory_order_relaxed);
+}
+
+uint32_t key_log_dropped(void) {
+    return atomic_load_explicit(&_dropped, memory_order_relaxed);
+}
@@ -0,0 +1,52 @@
+#ifndef KEY_LOG_H
+#define KEY_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Deferred logging for the key path. Formatting a message and writing it to
+// the UART at 115200 baud takes milliseconds, far longer than the work being
+// logged, so the HID callback and the sender only record a message ID and a
+// few integer arguments into a lock-free ring. key_log_drain(), run from a
+// low-priority task, formats them later through ESP_LOG.
+//
+// Messages marked verbose (per-report and per-request traces) are only
+// recorded while key_log_set_verbose(true). The others are rate limited per
+// tag to CONFIG_KEY_LOG_RATE_LIMIT a second; what's held back is reported as
+// a count when the ring is drained.
+
+#define KEY_LOG_ARGS 4
+
+typedef enum {
+    KEY_LOG_HID_DATA,           // verbose: report status, length
+    KEY_LOG_KEY_PRESS,          // verbose: key code
+    KEY_LOG_UNKNOWN_KEY,        // key code
+    KEY_LOG_STALE_KEY,          // key code, age in ms
+    KEY_LOG_REQUEST_OK,         // verbose: HTTP status
+    KEY_LOG_REQUEST_FAILED,     // esp_err_t
+    KEY_LOG_BATCH_FAILED,       // esp_err_t
+    KEY_LOG_BATCH_TOO_LONG,     // event count
+    KEY_LOG_QUEUE_OVERFLOW,     // enqueued, dropped, coalesced, max depth
+    KEY_LOG_COUNT,
+} key_log_id_t;
+
+void key_log_init(void);
+
+// Any task, including the Bluetooth callback. Never blocks; if the ring is
+// full the message is dropped and counted.
+void key_log_write(key_log_id_t id, const uint32_t args[KEY_LOG_ARGS]);
+
+#define KEY_LOG(id, ...) \
+    key_log_write((id), (const uint32_t[KEY_LOG_ARGS]){ __VA_ARGS__ })
+
+// One task only. Formats and writes everything recorded so far; returns the
+// number of messages written.
+int key_log_drain(void);
+
+void key_log_set_verbose(bool verbose);
+bool key_log_verbose(void);
+
+// Messages lost because the ring was full
+uint32_t key_log_dropped(void);
+
+#endif // KEY_LOG_H
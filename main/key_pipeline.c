@@ -0,0 +1,1439 @@
+#include "key_pipeline.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "key_log.h"
+#include "key_table.h"
+
+#if CONFIG_KEY_QUEUE_OVERFLOW_DROP_NEWEST
+#define KEY_QUEUE_POLICY KEY_QUEUE_DROP_NEWEST
+#elif CONFIG_KEY_QUEUE_OVERFLOW_COALESCE
+#define KEY_QUEUE_POLICY KEY_QUEUE_COALESCE
+#else
+#define KEY_QUEUE_POLICY KEY_QUEUE_DROP_OLDEST
+#endif
+
+#if CONFIG_KEY_REPEAT_ENABLE
+#define KEY_PIPELINE_REPEAT_DELAY_US ((int64_t)CONFIG_KEY_REPEAT_DELAY_MS * 1000)
+#define KEY_PIPELINE_REPEAT_INTERVAL_US ((int64_t)CONFIG_KEY_REPEAT_INTERVAL_MS * 1000)
+// Repeats that come due while the sender is busy go out together, or one at
+// a time until the key is released
+#if CONFIG_KEY_COALESCE_RUNS
+#define KEY_PIPELINE_REPEAT_MAX_COUNT UINT16_MAX
+#else
+#define KEY_PIPELINE_REPEAT_MAX_COUNT 1
+#endif
+#endif
+
+#if CONFIG_KEY_STORE_ENABLE
+#define KEY_PIPELINE_RETRY_US ((int64_t)CONFIG_KEY_STORE_RETRY_MS * 1000)
+#endif
+
+#if CONFIG_KEY_PRIORITY_ENABLE
+static const char *const _class_names[KEY_PIPELINE_LANES] = {
+    [KEY_CLASS_NORMAL] = "normal",
+    [KEY_CLASS_HIGH] = "high",
+};
+
+static const int64_t _deadlines_us[KEY_PIPELINE_LANES] = {
+    [KEY_CLASS_NORMAL] = (int64_t)CONFIG_KEY_PRIORITY_NORMAL_DEADLINE_MS * 1000,
+    [KEY_CLASS_HIGH] = (int64_t)CONFIG_KEY_PRIORITY_HIGH_DEADLINE_MS * 1000,
+};
+#endif
+
+// The queue an event goes through, which is also its priority
+static inline uint32_t event_lane(const key_event_t *event) {
+#if CONFIG_KEY_PRIORITY_ENABLE
+    return key_table_class(event->key);
+#else
+    return 0;
+#endif
+}
+
+bool key_pipeline_init(key_pipeline_t *pipeline, const key_transport_t *transport,
+                       void (*notify)(void *arg), void *notify_arg) {
+    const char *TAG = "key_pipeline_init";
+
+    for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        key_pipeline_device_t *device = &pipeline->devices[d];
+        if (!key_queue_init(&device->queues[KEY_CLASS_NORMAL], device->slots,
+                            CONFIG_KEY_QUEUE_DEPTH, KEY_QUEUE_POLICY)) {
+            ESP_LOGE(TAG, "Key queue depth %d is not a power of two", CONFIG_KEY_QUEUE_DEPTH);
+            return false;
+        }
+#if CONFIG_KEY_PRIORITY_ENABLE
+        if (!key_queue_init(&device->queues[KEY_CLASS_HIGH], device->high_slots,
+                            CONFIG_KEY_PRIORITY_QUEUE_DEPTH, KEY_QUEUE_POLICY)) {
+            ESP_LOGE(TAG, "High priority queue depth %d is not a power of two",
+                     CONFIG_KEY_PRIORITY_QUEUE_DEPTH);
+            return false;
+        }
+#endif
+        hid_plan_boot(&device->plan);
+        for (uint32_t r = 0; r < HID_PLAN_MAX_REPORTS; r++) {
+            hid_report_state_init(&device->report_states[r]);
+        }
+        device->mods = 0;
+        device->max_enqueue_us = 0;
+        device->next_seq = 0;
+        device->next_tx = 0;
+        memset(device->inflight_keys, 0, sizeof(device->inflight_keys));
+#if CONFIG_KEY_BINDINGS_ENABLE
+        memset(&device->binding_state, 0, sizeof(device->binding_state));
+#endif
+#if CONFIG_KEY_REPEAT_ENABLE
+        key_repeat_init(&device->repeat);
+#endif
+    }
+    pipeline->next_device = 0;
+    pipeline->transport = *transport;
+    pipeline->notify = notify;
+    pipeline->notify_arg = notify_arg;
+    pipeline->on_delivered = NULL;
+    pipeline->on_delivered_arg = NULL;
+    pipeline->reported_drops = 0;
+#if CONFIG_KEY_PRIORITY_ENABLE
+    for (uint32_t l = 0; l < KEY_PIPELINE_LANES; l++) {
+        atomic_init(&pipeline->stale[l], 0);
+    }
+#endif
+    key_stats_init(&pipeline->stats);
+
+    // A blocking transport runs one request at a time
+    pipeline->max_inflight = 1;
+    if (transport->start != NULL && transport->max_inflight > 1) {
+        pipeline->max_inflight = transport->max_inflight < CONFIG_KEY_HTTP_INFLIGHT
+                                     ? transport->max_inflight : CONFIG_KEY_HTTP_INFLIGHT;
+    }
+    for (uint32_t i = 0; i < CONFIG_KEY_HTTP_INFLIGHT; i++) {
+        pipeline->requests[i].pipeline = pipeline;
+        atomic_init(&pipeline->requests[i].state, KEY_PIPELINE_REQUEST_FREE);
+    }
+    pipeline->backlog_head = 0;
+    pipeline->backlog_count = 0;
+#if CONFIG_KEY_BINDINGS_ENABLE
+    key_bindings_init(&pipeline->bindings);
+#endif
+#if KEY_PIPELINE_RUN_STATS
+    key_run_stats_init(&pipeline->runs);
+#endif
+#if CONFIG_KEY_STORE_ENABLE
+    key_store_init(&pipeline->store, pipeline->store_events, CONFIG_KEY_STORE_DEPTH,
+                   CONFIG_KEY_STORE_MAX_AGE_S * 1000);
+    atomic_init(&pipeline->link_up, true);
+    pipeline->retry_us = 0;
+    pipeline->probing = false;
+    pipeline->drain_start_us = 0;
+    pipeline->drain_events = 0;
+    atomic_init(&pipeline->last_drain_events, 0);
+    atomic_init(&pipeline->last_drain_per_s, 0);
+#endif
+#if CONFIG_KEY_BATCH_ENABLE
+    key_batch_init(&pipeline->batch, pipeline->batch_events, CONFIG_KEY_BATCH_MAX_EVENTS,
+                   CONFIG_KEY_BATCH_MAX_DELAY_MS);
+    pipeline->batch_inflight = false;
+    pipeline->inflight_count = 0;
+    pipeline->batch_supported = true;
+#endif
+#if CONFIG_KEY_EVENT_TIMING
+    key_clock_init(&pipeline->clock, CONFIG_KEY_CLOCK_SYNC_INTERVAL_S,
+                   CONFIG_KEY_CLOCK_SYNC_PINGS, esp_timer_get_time());
+    pipeline->clock_sent_us = 0;
+#endif
+    return true;
+}
+
+static int enqueue_events(key_pipeline_t *pipeline, key_pipeline_device_t *device,
+                          key_event_t *events, int n, int64_t received_us, uint32_t decoded) {
+    uint8_t index = device - pipeline->devices;
+    key_stats_count(&pipeline->stats, KEY_COUNTER_EVENTS, n);
+    for (int i = 0; i < n; i++) {
+        events[i].device = index;
+        events[i].seq = ++device->next_seq;
+        key_queue_push(&device->queues[event_lane(&events[i])], &events[i]);
+    }
+    if (n > 0 && pipeline->notify != NULL) {
+        pipeline->notify(pipeline->notify_arg);
+    }
+    key_stats_record_cycles(&pipeline->stats, KEY_STAGE_ENQUEUE, decoded, key_stats_cycles());
+
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - received_us);
+    if (elapsed > device->max_enqueue_us) {
+        device->max_enqueue_us = elapsed;
+    }
+    return n;
+}
+
+int key_pipeline_report(key_pipeline_t *pipeline, uint8_t device, const uint8_t *data,
+                        uint16_t len, int64_t received_us) {
+    uint32_t start = key_stats_cycles();
+    key_stats_count(&pipeline->stats, KEY_COUNTER_REPORTS, 1);
+    if (device >= CONFIG_KEY_MAX_DEVICES) {
+        key_stats_count(&pipeline->stats, KEY_COUNTER_BAD_REPORTS, 1);
+        return 0;
+    }
+    key_pipeline_device_t *dev = &pipeline->devices[device];
+    hid_keys_t keys;
+    int r = hid_plan_extract(&dev->plan, data, len, &keys);
+    if (r < 0) {
+        key_stats_count(&pipeline->stats, KEY_COUNTER_BAD_REPORTS, 1);
+        return 0;
+    }
+    hid_report_state_t *state = &dev->report_states[r];
+    if (!dev->plan.reports[r].mods) {
+        keys.mods = dev->mods;
+    }
+    state->mods = dev->mods;
+    key_event_t events[HID_REPORT_MAX_EVENTS];
+    int n = hid_report_diff_keys(state, &keys, received_us, events);
+    dev->mods = state->mods;
+    uint32_t decoded = key_stats_cycles();
+    key_stats_record_cycles(&pipeline->stats, KEY_STAGE_DECODE, start, decoded);
+    return enqueue_events(pipeline, dev, events, n, received_us, decoded);
+}
+
+int key_pipeline_release_all(key_pipeline_t *pipeline, uint8_t device, int64_t now_us) {
+    static const hid_keys_t none = { 0 };
+    if (device >= CONFIG_KEY_MAX_DEVICES) {
+        return 0;
+    }
+    key_pipeline_device_t *dev = &pipeline->devices[device];
+    key_event_t events[HID_REPORT_MAX_EVENTS];
+    int total = 0;
+    for (uint32_t r = 0; r < dev->plan.report_count; r++) {
+        hid_report_state_t *state = &dev->report_states[r];
+        state->mods = dev->mods;
+        int n = hid_report_diff_keys(state, &none, now_us, events);
+        dev->mods = state->mods;
+        total += enqueue_events(pipeline, dev, events, n, now_us, key_stats_cycles());
+    }
+    return total;
+}
+
+bool key_pipeline_set_descriptor(key_pipeline_t *pipeline, uint8_t device, const uint8_t *desc,
+                                 uint16_t len) {
+    const char *TAG = "key_pipeline_set_descriptor";
+
+    if (device >= CONFIG_KEY_MAX_DEVICES) {
+        return false;
+    }
+    // Anything held under the old layout is released first
+    key_pipeline_release_all(pipeline, device, esp_timer_get_time());
+
+    key_pipeline_device_t *dev = &pipeline->devices[device];
+    char err[48];
+    bool ok = hid_plan_compile(&dev->plan, desc, len, err, sizeof(err));
+    if (!ok) {
+        ESP_LOGW(TAG, "Device %u: can't use report descriptor (%s), assuming boot reports",
+                 device, err);
+        hid_plan_boot(&dev->plan);
+    }
+    for (uint32_t r = 0; r < HID_PLAN_MAX_REPORTS; r++) {
+        hid_report_state_init(&dev->report_states[r]);
+    }
+    dev->mods = 0;
+
+    for (uint32_t r = 0; r < dev->plan.report_count; r++) {
+        const hid_plan_report_t *report = &dev->plan.reports[r];
+        for (uint32_t f = 0; f < report->field_count; f++) {
+            static const char *kinds[] = { "bitmap", "keys", "consumer" };
+            const hid_field_t *field = &dev->plan.fields[report->first_field + f];
+            ESP_LOGI(TAG, "Device %u: report %u, %u bytes: %s x%u at bit %u", device,
+                     report->id, report->len, kinds[field->kind], field->count,
+                     field->offset);
+        }
+    }
+    return ok;
+}
+
+// A request for a key, or a batch, that hasn't completed by now is given up
+// on. The transport's own timeout applies per attempt, and a request may be
+// retried once on a fresh connection.
+#define KEY_PIPELINE_REQUEST_DEADLINE_US (2 * (int64_t)CONFIG_KEY_HTTP_TIMEOUT_MS * 1000)
+
+static void delivered(key_pipeline_t *pipeline, const key_event_t *event, esp_err_t ret) {
+    if (ret == ESP_OK) {
+        key_stats_record_us(&pipeline->stats, KEY_STAGE_TOTAL, event->timestamp_us,
+                            esp_timer_get_time());
+    }
+    if (pipeline->on_delivered != NULL) {
+        pipeline->on_delivered(pipeline->on_delivered_arg, event, ret);
+    }
+}
+
+// An event whose request failed. With the store it's put back to go out
+// again, ahead of everything else, once the retry interval has passed.
+static void undelivered(key_pipeline_t *pipeline, const key_event_t *event, esp_err_t ret) {
+#if CONFIG_KEY_STORE_ENABLE
+    if (key_store_push_front(&pipeline->store, event)) {
+        pipeline->retry_us = esp_timer_get_time() + KEY_PIPELINE_RETRY_US;
+        pipeline->probing = true;
+        return;
+    }
+#endif
+    delivered(pipeline, event, ret);
+}
+
+static void request_done(key_pipeline_t *pipeline, int64_t sent_us, int64_t done_us,
+                         esp_err_t ret) {
+    key_stats_record_us(&pipeline->stats, KEY_STAGE_REQUEST, sent_us, done_us);
+    key_stats_count(&pipeline->stats, KEY_COUNTER_REQUESTS, 1);
+    if (ret != ESP_OK) {
+        key_stats_count(&pipeline->stats, KEY_COUNTER_REQUEST_FAILURES, 1);
+    }
+#if CONFIG_KEY_STORE_ENABLE
+    else {
+        pipeline->probing = false;
+    }
+#endif
+}
+
+static bool key_inflight(const key_pipeline_t *pipeline, const key_event_t *event) {
+    const uint32_t *keys = pipeline->devices[event->device].inflight_keys;
+    return keys[event->key >> 5] & (1u << (event->key & 31));
+}
+
+static void set_key_inflight(key_pipeline_t *pipeline, const key_event_t *event,
+                             bool inflight) {
+    uint32_t *keys = pipeline->devices[event->device].inflight_keys;
+    if (inflight) {
+        keys[event->key >> 5] |= 1u << (event->key & 31);
+    } else {
+        keys[event->key >> 5] &= ~(1u << (event->key & 31));
+    }
+}
+
+// Where a press goes: its binding's path, with the payload to POST if it has
+// one, or the key's own path
+static const char *event_path(const key_pipeline_t *pipeline, const key_event_t *event,
+                              const char **payload) {
+    *payload = NULL;
+#if CONFIG_KEY_BINDINGS_ENABLE
+    if (event->binding != KEY_BINDING_NONE) {
+        const key_binding_table_t *table = key_bindings_active(&pipeline->bindings);
+        *payload = key_binding_payload(table, event->binding);
+        return key_binding_path(table, event->binding);
+    }
+#endif
+    return key_table_path(event->key);
+}
+
+#if CONFIG_KEY_REPEAT_ENABLE
+// Follows what the keyboard holds. Pressing a key without a path stops the
+// repeat like any other key, without starting one of its own.
+static void track_repeat(key_pipeline_t *pipeline, key_pipeline_device_t *device,
+                         const key_event_t *event) {
+    const char *payload;
+    if (event->type == KEY_EVENT_PRESS && event_path(pipeline, event, &payload) == NULL) {
+        key_repeat_stop(&device->repeat);
+        return;
+    }
+    key_repeat_track(&device->repeat, event, KEY_PIPELINE_REPEAT_DELAY_US);
+}
+
+static bool take_repeat(key_pipeline_t *pipeline, key_pipeline_device_t *device,
+                        key_event_t *event) {
+    if (!key_repeat_take(&device->repeat, esp_timer_get_time(), KEY_PIPELINE_REPEAT_INTERVAL_US,
+                         KEY_PIPELINE_REPEAT_MAX_COUNT, event)) {
+        return false;
+    }
+    key_run_stats_add(&pipeline->runs.repeats[event->key], event->count);
+    key_run_stats_add(&pipeline->runs.merged[event->key], event->count - 1);
+    return true;
+}
+#endif
+
+#if CONFIG_KEY_REPEAT_ENABLE && CONFIG_KEY_BINDINGS_ENABLE
+static void stop_repeats(key_pipeline_t *pipeline) {
+    for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        key_repeat_stop(&pipeline->devices[d].repeat);
+    }
+}
+#endif
+
+// Takes the next event in `lane` from the device queues in turn, and maps it
+// while its keyboard's events are still in order. A keyboard with nothing
+// queued may have a repeat of a key in the lane due instead.
+static bool pop_lane(key_pipeline_t *pipeline, uint32_t lane, key_event_t *event) {
+    for (uint32_t i = 0; i < CONFIG_KEY_MAX_DEVICES; i++) {
+        key_pipeline_device_t *device = &pipeline->devices[pipeline->next_device];
+        pipeline->next_device = (pipeline->next_device + 1) % CONFIG_KEY_MAX_DEVICES;
+        if (key_queue_pop(&device->queues[lane], event)) {
+            key_stats_record_us(&pipeline->stats, KEY_STAGE_QUEUE, event->timestamp_us,
+                                esp_timer_get_time());
+#if CONFIG_KEY_BINDINGS_ENABLE
+            event->binding = key_bindings_match(&pipeline->bindings, &device->binding_state,
+                                                event);
+#endif
+#if CONFIG_KEY_REPEAT_ENABLE
+            track_repeat(pipeline, device, event);
+#endif
+            return true;
+        }
+#if CONFIG_KEY_REPEAT_ENABLE
+        if (event_lane(&device->repeat.event) == lane && take_repeat(pipeline, device, event)) {
+            return true;
+        }
+#endif
+    }
+    return false;
+}
+
+// The highest priority lane with anything in it goes first
+static bool pop_queued(key_pipeline_t *pipeline, key_event_t *event) {
+    for (uint32_t lane = KEY_PIPELINE_LANES; lane-- > 0;) {
+        if (pop_lane(pipeline, lane, event)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#if CONFIG_KEY_STORE_ENABLE
+static bool link_ready(const key_pipeline_t *pipeline, int64_t now_us) {
+    return atomic_load_explicit(&pipeline->link_up, memory_order_relaxed) &&
+           now_us >= pipeline->retry_us;
+}
+
+// Moves what's queued into the store while nothing can be sent, so the
+// queues don't overflow
+static void hold_queued(key_pipeline_t *pipeline) {
+    key_event_t event;
+    key_event_t dropped;
+    while (pop_queued(pipeline, &event)) {
+        if (!key_store_push(&pipeline->store, &event, &dropped)) {
+            delivered(pipeline, &dropped, ESP_ERR_NO_MEM);
+        }
+    }
+}
+
+// Takes the oldest event held in the store, failing the expired ones on the
+// way, and times the replay
+static bool replay_event(key_pipeline_t *pipeline, key_event_t *event) {
+    int64_t now = esp_timer_get_time();
+    for (;;) {
+        switch (key_store_pop(&pipeline->store, event, now)) {
+            case KEY_STORE_EVENT:
+                if (pipeline->drain_events++ == 0) {
+                    pipeline->drain_start_us = now;
+                }
+                return true;
+            case KEY_STORE_EXPIRED:
+                delivered(pipeline, event, ESP_ERR_TIMEOUT);
+                break;
+            case KEY_STORE_EMPTY:
+                if (pipeline->drain_events > 0 && now > pipeline->drain_start_us) {
+                    uint64_t per_s = (uint64_t)pipeline->drain_events * 1000000 /
+                                     (uint64_t)(now - pipeline->drain_start_us);
+                    atomic_store_explicit(&pipeline->last_drain_events,
+                                          pipeline->drain_events, memory_order_relaxed);
+                    atomic_store_explicit(&pipeline->last_drain_per_s, (uint32_t)per_s,
+                                          memory_order_relaxed);
+                    pipeline->drain_events = 0;
+                }
+                return false;
+        }
+    }
+}
+#endif
+
+// The next event to send. Events held in the store go first, so everything
+// leaves in the order it arrived.
+static bool pop_event(key_pipeline_t *pipeline, key_event_t *event) {
+#if CONFIG_KEY_STORE_ENABLE
+    if (replay_event(pipeline, event)) {
+        return true;
+    }
+#endif
+    return pop_queued(pipeline, event);
+}
+
+static bool backlog_push(key_pipeline_t *pipeline, const key_event_t *event) {
+    if (pipeline->backlog_count == KEY_PIPELINE_BACKLOG) {
+        return false;
+    }
+    uint32_t index = (pipeline->backlog_head + pipeline->backlog_count) % KEY_PIPELINE_BACKLOG;
+    pipeline->backlog[index] = *event;
+    pipeline->backlog_count++;
+    return true;
+}
+
+// Peeks at the next event to send. Events come off the queue through the
+// backlog, so one that has to wait can simply be left where it is.
+static bool next_event(key_pipeline_t *pipeline, key_event_t *event) {
+    if (pipeline->backlog_count == 0) {
+        if (!pop_event(pipeline, event)) {
+            return false;
+        }
+        backlog_push(pipeline, event);
+    }
+    *event = pipeline->backlog[pipeline->backlog_head];
+    return true;
+}
+
+static void consume_event(key_pipeline_t *pipeline) {
+    pipeline->backlog_head = (pipeline->backlog_head + 1) % KEY_PIPELINE_BACKLOG;
+    pipeline->backlog_count--;
+}
+
+#if CONFIG_KEY_PRIORITY_ENABLE
+// A press that has waited longer than its class allows is dropped rather than
+// sent late. Releases always go out, so no key is left looking held.
+static bool drop_stale(key_pipeline_t *pipeline, const key_event_t *event) {
+    uint32_t lane = event_lane(event);
+    if (event->type != KEY_EVENT_PRESS || _deadlines_us[lane] == 0) {
+        return false;
+    }
+    int64_t age = esp_timer_get_time() - event->timestamp_us;
+    if (age <= _deadlines_us[lane]) {
+        return false;
+    }
+    atomic_store_explicit(&pipeline->stale[lane],
+                          atomic_load_explicit(&pipeline->stale[lane], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    key_stats_count(&pipeline->stats, KEY_COUNTER_STALE, 1);
+    KEY_LOG(KEY_LOG_STALE_KEY, event->key, (uint32_t)(age / 1000));
+    delivered(pipeline, event, ESP_ERR_TIMEOUT);
+    return true;
+}
+
+// The press at the front of the backlog is waiting for its key's last
+// request. Moves the first high priority event in the backlog, or failing
+// that the next one queued, in front of it, so high priority keys stay in
+// order among themselves. Not while events held through an outage are
+// replayed: everything queued waits for those.
+static bool jump_backlog(key_pipeline_t *pipeline) {
+    if (key_pipeline_held(pipeline) > 0) {
+        return false;
+    }
+    uint32_t i = 0;
+    while (i < pipeline->backlog_count &&
+           event_lane(&pipeline->backlog[(pipeline->backlog_head + i) % KEY_PIPELINE_BACKLOG]) !=
+               KEY_CLASS_HIGH) {
+        i++;
+    }
+    key_event_t event;
+    if (i == 0) {
+        // The one waiting is high priority itself
+        return false;
+    }
+    if (i < pipeline->backlog_count) {
+        event = pipeline->backlog[(pipeline->backlog_head + i) % KEY_PIPELINE_BACKLOG];
+        for (; i > 0; i--) {
+            pipeline->backlog[(pipeline->backlog_head + i) % KEY_PIPELINE_BACKLOG] =
+                pipeline->backlog[(pipeline->backlog_head + i - 1) % KEY_PIPELINE_BACKLOG];
+        }
+        pipeline->backlog[pipeline->backlog_head] = event;
+        return true;
+    }
+    if (pipeline->backlog_count == KEY_PIPELINE_BACKLOG ||
+        !pop_lane(pipeline, KEY_CLASS_HIGH, &event)) {
+        return false;
+    }
+    pipeline->backlog_head = (pipeline->backlog_head + KEY_PIPELINE_BACKLOG - 1) %
+                             KEY_PIPELINE_BACKLOG;
+    pipeline->backlog[pipeline->backlog_head] = event;
+    pipeline->backlog_count++;
+    return true;
+}
+#endif
+
+static key_pipeline_request_t *free_request(key_pipeline_t *pipeline) {
+#if CONFIG_KEY_STORE_ENABLE
+    // Probing after a failure: one request at a time until one gets through
+    if (pipeline->probing) {
+        for (uint32_t i = 0; i < pipeline->max_inflight; i++) {
+            const key_pipeline_request_t *slot = &pipeline->requests[i];
+            if (atomic_load_explicit(&slot->state, memory_order_acquire) !=
+                    KEY_PIPELINE_REQUEST_FREE && !slot->abandoned) {
+                return NULL;
+            }
+        }
+    }
+#endif
+    for (uint32_t i = 0; i < pipeline->max_inflight; i++) {
+        key_pipeline_request_t *slot = &pipeline->requests[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) ==
+            KEY_PIPELINE_REQUEST_FREE) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Called by an asynchronous transport, from whichever task ran the request
+static void request_complete(key_request_t *request) {
+    key_pipeline_request_t *slot = (key_pipeline_request_t *)request;
+    key_pipeline_t *pipeline = slot->pipeline;
+    slot->done_us = esp_timer_get_time();
+    atomic_store_explicit(&slot->state, KEY_PIPELINE_REQUEST_DONE, memory_order_release);
+    if (pipeline->notify != NULL) {
+        pipeline->notify(pipeline->notify_arg);
+    }
+}
+
+// Hands `slot` to the transport. A blocking transport has finished with it by
+// the time this returns; either way the result is picked up by
+// reap_requests().
+static void start_request(key_pipeline_t *pipeline, key_pipeline_request_t *slot) {
+    key_request_t *request = &slot->request;
+    const key_transport_t *transport = &pipeline->transport;
+
+    request->status = 0;
+    slot->abandoned = false;
+    slot->sent_us = esp_timer_get_time();
+    slot->deadline_us = slot->sent_us + KEY_PIPELINE_REQUEST_DEADLINE_US;
+    atomic_store_explicit(&slot->state, KEY_PIPELINE_REQUEST_BUSY, memory_order_relaxed);
+
+    if (transport->start != NULL) {
+        request->done = request_complete;
+        request->ret = transport->start(transport->ctx, request);
+        if (request->ret == ESP_OK) {
+            return;
+        }
+    } else if (request->content_type == NULL) {
+        request->ret = transport->get(transport->ctx, request->path, &request->status);
+    } else {
+        request->ret = transport->post(transport->ctx, request->path, request->content_type,
+                                       request->body, request->body_len, &request->status);
+    }
+    slot->done_us = esp_timer_get_time();
+    atomic_store_explicit(&slot->state, KEY_PIPELINE_REQUEST_DONE, memory_order_relaxed);
+}
+
+// Numbers an event as it first goes into a request; a retry keeps its number
+static void number_event(key_pipeline_t *pipeline, key_event_t *event) {
+    if (event->tx == 0) {
+        event->tx = ++pipeline->devices[event->device].next_tx;
+    }
+}
+
+// Appends "name=value" to the query of `path`
+static void add_param(char *path, size_t len, const char *name, uint64_t value) {
+    size_t used = strlen(path);
+    snprintf(path + used, len - used, "%c%s=%" PRIu64, strchr(path, '?') ? '&' : '?', name,
+             value);
+}
+
+static void key_press(key_pipeline_t *pipeline, key_pipeline_request_t *slot,
+                      const key_event_t *event, const char *path, const char *payload) {
+    KEY_LOG(KEY_LOG_KEY_PRESS, event->key);
+    slot->batch = false;
+    slot->clock = false;
+    slot->event = *event;
+    number_event(pipeline, &slot->event);
+    event = &slot->event;
+
+    snprintf(slot->path, sizeof(slot->path), "%s", path);
+    // Presses coalesced while the queue was full go out as one request
+    if (event->count > 1) {
+        add_param(slot->path, sizeof(slot->path), "count", event->count);
+    }
+#if CONFIG_KEY_MAX_DEVICES > 1
+    add_param(slot->path, sizeof(slot->path), "device", event->device);
+#endif
+#if CONFIG_KEY_EVENT_TIMING
+    add_param(slot->path, sizeof(slot->path), "seq", event->seq);
+    add_param(slot->path, sizeof(slot->path), "tx", event->tx);
+    add_param(slot->path, sizeof(slot->path), "ts", event->timestamp_us);
+#endif
+    slot->request.path = slot->path;
+    slot->request.event = &slot->event;
+    // A binding's payload is POSTed; it stays put until the bindings switch,
+    // which waits for this request
+    if (payload != NULL) {
+        slot->request.content_type = payload[0] == '{' ? "application/json" : "text/plain";
+        slot->request.body = payload;
+        slot->request.body_len = strlen(payload);
+    } else {
+        slot->request.content_type = NULL;
+        slot->request.body = NULL;
+        slot->request.body_len = 0;
+    }
+    set_key_inflight(pipeline, event, true);
+    start_request(pipeline, slot);
+}
+
+static void key_press_failed(key_pipeline_t *pipeline, const key_event_t *event,
+                             esp_err_t ret) {
+#if CONFIG_KEY_STORE_ENABLE
+    // What's waiting in the backlog may be a later press of the same key, so
+    // it goes back behind this one
+    while (pipeline->backlog_count > 0) {
+        pipeline->backlog_count--;
+        uint32_t last = (pipeline->backlog_head + pipeline->backlog_count) % KEY_PIPELINE_BACKLOG;
+        undelivered(pipeline, &pipeline->backlog[last], ret);
+    }
+#endif
+    undelivered(pipeline, event, ret);
+}
+
+static void key_press_done(key_pipeline_t *pipeline, key_pipeline_request_t *slot) {
+    esp_err_t ret = slot->request.ret;
+    if (ret == ESP_OK) {
+        KEY_LOG(KEY_LOG_REQUEST_OK, slot->request.status);
+    } else {
+        KEY_LOG(KEY_LOG_REQUEST_FAILED, ret);
+    }
+    set_key_inflight(pipeline, &slot->event, false);
+    if (ret == ESP_OK) {
+        delivered(pipeline, &slot->event, ret);
+    } else {
+        key_press_failed(pipeline, &slot->event, ret);
+    }
+}
+
+#if CONFIG_KEY_COALESCE_RUNS
+// Whether `event` can go out with `press`, as part of its count
+static bool same_run(const key_event_t *press, const key_event_t *event) {
+    return press->type == KEY_EVENT_PRESS && event->type == KEY_EVENT_PRESS &&
+           press->key == event->key && press->device == event->device &&
+           press->mods == event->mods && press->binding == event->binding &&
+           press->count + event->count <= UINT16_MAX;
+}
+
+static void merge_press(key_pipeline_t *pipeline, key_event_t *press, const key_event_t *event) {
+    press->count += event->count;
+    key_run_stats_add(&pipeline->runs.merged[event->key], event->count);
+}
+
+// While the request for the key of the press at the front of the backlog is
+// still in flight, folds the presses of that key already waiting right behind
+// it into it, skipping the releases in between (the per-key endpoint drops
+// them anyway), until something else comes along. The press picks up more
+// each time it's looked at until the request completes. A press that can go
+// out straight away does, on its own, however many follow it.
+static void merge_run(key_pipeline_t *pipeline) {
+    key_event_t *press = &pipeline->backlog[pipeline->backlog_head];
+    key_event_t event;
+    if (!key_inflight(pipeline, press)) {
+        return;
+    }
+    while (pipeline->backlog_count == 1 && pop_event(pipeline, &event)) {
+        if (same_run(press, &event)) {
+            merge_press(pipeline, press, &event);
+        } else if (event.type != KEY_EVENT_RELEASE || event.key != press->key ||
+                   event.device != press->device) {
+            backlog_push(pipeline, &event);
+        }
+    }
+}
+#endif
+
+// One GET per key press, as many at once as there are free slots. Stops at a
+// key whose previous request is still in flight so its presses stay in order.
+static bool send_keys(key_pipeline_t *pipeline) {
+    bool progress = false;
+    key_pipeline_request_t *slot;
+    key_event_t event;
+
+    while ((slot = free_request(pipeline)) != NULL && next_event(pipeline, &event)) {
+        // The per-key endpoint only knows about presses
+        if (event.type != KEY_EVENT_PRESS) {
+            consume_event(pipeline);
+            progress = true;
+            continue;
+        }
+        const char *payload;
+        const char *path = event_path(pipeline, &event, &payload);
+        if (path == NULL) {
+            key_stats_count(&pipeline->stats, KEY_COUNTER_UNMAPPED, 1);
+            KEY_LOG(KEY_LOG_UNKNOWN_KEY, event.key);
+            consume_event(pipeline);
+            progress = true;
+            continue;
+        }
+#if CONFIG_KEY_PRIORITY_ENABLE
+        // Before anything is folded into it, so later presses aren't dropped
+        // with it
+        if (drop_stale(pipeline, &event)) {
+            consume_event(pipeline);
+            progress = true;
+            continue;
+        }
+#endif
+#if CONFIG_KEY_COALESCE_RUNS
+        merge_run(pipeline);
+        event = pipeline->backlog[pipeline->backlog_head];
+#endif
+        if (key_inflight(pipeline, &event)) {
+#if CONFIG_KEY_PRIORITY_ENABLE
+            if (jump_backlog(pipeline)) {
+                progress = true;
+                continue;
+            }
+#endif
+            break;
+        }
+        consume_event(pipeline);
+        key_press(pipeline, slot, &event, path, payload);
+        progress = true;
+    }
+    return progress;
+}
+
+#if CONFIG_KEY_BATCH_ENABLE
+// The "key" a batched event goes under: its path without
+// KEY_TABLE_PATH_PREFIX. Payloads only go with per-key requests.
+static const char *event_name(void *ctx, const key_event_t *event) {
+    const char *payload;
+    const char *path = event_path(ctx, event, &payload);
+    size_t prefix_len = sizeof(KEY_TABLE_PATH_PREFIX) - 1;
+    if (path != NULL && strncmp(path, KEY_TABLE_PATH_PREFIX, prefix_len) == 0) {
+        return path + prefix_len;
+    }
+    return path;
+}
+
+static void send_batch(key_pipeline_t *pipeline, key_pipeline_request_t *slot) {
+    key_batch_t *batch = &pipeline->batch;
+
+    int len = key_batch_format(batch, event_name, pipeline, pipeline->batch_body,
+                               sizeof(pipeline->batch_body));
+    if (len < 0) {
+        KEY_LOG(KEY_LOG_BATCH_TOO_LONG, batch->count);
+        for (uint32_t i = 0; i < batch->count; i++) {
+            delivered(pipeline, &batch->events[i], ESP_ERR_INVALID_SIZE);
+        }
+        key_batch_clear(batch, esp_timer_get_time());
+        return;
+    }
+
+    // Keep the events on the wire aside so the next batch can start filling
+    memcpy(pipeline->inflight_events, batch->events, batch->count * sizeof(key_event_t));
+    pipeline->inflight_count = batch->count;
+    pipeline->batch_inflight = true;
+    key_batch_clear(batch, esp_timer_get_time());
+
+    slot->batch = true;
+    slot->clock = false;
+    slot->request.path = CONFIG_KEY_BATCH_PATH;
+    slot->request.content_type = "application/json";
+    slot->request.event = NULL;
+    slot->request.body = pipeline->batch_body;
+    slot->request.body_len = len;
+    start_request(pipeline, slot);
+}
+
+// The batch on the wire failed. With the store, it and the batch collecting
+// behind it are put back, so both go out again in order.
+static void batch_failed(key_pipeline_t *pipeline, esp_err_t ret) {
+    KEY_LOG(KEY_LOG_BATCH_FAILED, ret);
+#if CONFIG_KEY_STORE_ENABLE
+    // Newest first, as undelivered() puts each one in front of the last
+    key_batch_t *batch = &pipeline->batch;
+    for (uint32_t i = batch->count; i-- > 0;) {
+        undelivered(pipeline, &batch->events[i], ret);
+    }
+    key_batch_clear(batch, esp_timer_get_time());
+    for (uint32_t i = pipeline->inflight_count; i-- > 0;) {
+        undelivered(pipeline, &pipeline->inflight_events[i], ret);
+    }
+#else
+    for (uint32_t i = 0; i < pipeline->inflight_count; i++) {
+        delivered(pipeline, &pipeline->inflight_events[i], ret);
+    }
+#endif
+}
+
+static void send_batch_done(key_pipeline_t *pipeline, key_pipeline_request_t *slot) {
+    const char *TAG = "send_batch";
+    esp_err_t ret = slot->request.ret;
+    int status = slot->request.status;
+
+    pipeline->batch_inflight = false;
+    if (ret == ESP_OK && (status == 404 || status == 405 || status == 501)) {
+        ESP_LOGW(TAG, "Server doesn't support %s (HTTP %d), falling back to per-key requests",
+                 CONFIG_KEY_BATCH_PATH, status);
+        pipeline->batch_supported = false;
+        // Replay this batch and the one collecting behind it as per-key
+        // requests, oldest first
+        key_batch_t *batch = &pipeline->batch;
+        for (uint32_t i = 0; i < pipeline->inflight_count; i++) {
+            backlog_push(pipeline, &pipeline->inflight_events[i]);
+        }
+        for (uint32_t i = 0; i < batch->count; i++) {
+            backlog_push(pipeline, &batch->events[i]);
+        }
+        key_batch_clear(batch, esp_timer_get_time());
+        return;
+    }
+    if (ret != ESP_OK) {
+        batch_failed(pipeline, ret);
+        return;
+    }
+    for (uint32_t i = 0; i < pipeline->inflight_count; i++) {
+        delivered(pipeline, &pipeline->inflight_events[i], ret);
+    }
+}
+
+#if CONFIG_KEY_COALESCE_RUNS
+// A press of the key the collecting batch ends with is folded into that
+// press, dropping the release in between, rather than added. Returns whether
+// it was.
+static bool merge_batched(key_pipeline_t *pipeline, const key_event_t *event) {
+    key_batch_t *batch = &pipeline->batch;
+    if (batch->count == 0) {
+        return false;
+    }
+    key_event_t *last = &batch->events[batch->count - 1];
+    if (same_run(last, event)) {
+        merge_press(pipeline, last, event);
+        return true;
+    }
+    if (batch->count >= 2 && last->type == KEY_EVENT_RELEASE && last->key == event->key &&
+        last->device == event->device && same_run(last - 1, event)) {
+        merge_press(pipeline, last - 1, event);
+        batch->count--;
+        return true;
+    }
+    return false;
+}
+#endif
+
+// Collects events into the batch and sends it when due, with one batch in
+// flight at a time
+static bool send_batched(key_pipeline_t *pipeline) {
+    key_batch_t *batch = &pipeline->batch;
+    bool progress = false;
+
+    for (;;) {
+        int64_t now = esp_timer_get_time();
+        if (!pipeline->batch_inflight &&
+            key_batch_should_flush(batch, now, key_pipeline_queued(pipeline) > 0)) {
+            key_pipeline_request_t *slot = free_request(pipeline);
+            if (slot == NULL) {
+                break;
+            }
+            send_batch(pipeline, slot);
+            progress = true;
+            continue;
+        }
+        if (batch->count == batch->capacity) {
+            break;
+        }
+
+        key_event_t event;
+        if (!pop_event(pipeline, &event)) {
+            break;
+        }
+        progress = true;
+        const char *payload;
+        if (event_path(pipeline, &event, &payload) == NULL) {
+            key_stats_count(&pipeline->stats, KEY_COUNTER_UNMAPPED, 1);
+            KEY_LOG(KEY_LOG_UNKNOWN_KEY, event.key);
+            continue;
+        }
+#if CONFIG_KEY_PRIORITY_ENABLE
+        if (drop_stale(pipeline, &event)) {
+            continue;
+        }
+#endif
+#if CONFIG_KEY_COALESCE_RUNS
+        if (merge_batched(pipeline, &event)) {
+            continue;
+        }
+#endif
+        number_event(pipeline, &event);
+        key_batch_add(batch, &event, now);
+    }
+    return progress;
+}
+#endif
+
+// The request has timed out but the transport still holds it. Report its
+// events as failed now; the slot is freed when the transport lets go.
+static void abandon_request(key_pipeline_t *pipeline, key_pipeline_request_t *slot,
+                            int64_t now_us) {
+    slot->abandoned = true;
+#if CONFIG_KEY_EVENT_TIMING
+    if (slot->clock) {
+        key_clock_answered(&pipeline->clock, pipeline->clock_sent_us, now_us, ESP_ERR_TIMEOUT,
+                           0);
+        return;
+    }
+#endif
+    request_done(pipeline, slot->sent_us, now_us, ESP_ERR_TIMEOUT);
+    key_stats_count(&pipeline->stats, KEY_COUNTER_REQUEST_TIMEOUTS, 1);
+#if CONFIG_KEY_BATCH_ENABLE
+    if (slot->batch) {
+        // The body buffer is still in use, so no new batch starts until the
+        // slot is freed
+        batch_failed(pipeline, ESP_ERR_TIMEOUT);
+        return;
+    }
+#endif
+    KEY_LOG(KEY_LOG_REQUEST_FAILED, ESP_ERR_TIMEOUT);
+    set_key_inflight(pipeline, &slot->event, false);
+    key_press_failed(pipeline, &slot->event, ESP_ERR_TIMEOUT);
+}
+
+static void reap_requests(key_pipeline_t *pipeline) {
+    int64_t now = esp_timer_get_time();
+
+    for (uint32_t i = 0; i < pipeline->max_inflight; i++) {
+        key_pipeline_request_t *slot = &pipeline->requests[i];
+        uint32_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        if (state == KEY_PIPELINE_REQUEST_BUSY) {
+            if (!slot->abandoned && now >= slot->deadline_us) {
+                abandon_request(pipeline, slot, now);
+            }
+            continue;
+        }
+        if (state != KEY_PIPELINE_REQUEST_DONE) {
+            continue;
+        }
+
+        if (slot->abandoned) {
+#if CONFIG_KEY_BATCH_ENABLE
+            if (slot->batch) {
+                pipeline->batch_inflight = false;
+            }
+#endif
+        }
+#if CONFIG_KEY_EVENT_TIMING
+        else if (slot->clock) {
+            // Not a key, so it's left out of the request stats
+            key_clock_answered(&pipeline->clock, pipeline->clock_sent_us, slot->done_us,
+                               slot->request.ret, slot->request.status);
+        }
+#endif
+        else {
+            request_done(pipeline, slot->sent_us, slot->done_us, slot->request.ret);
+#if CONFIG_KEY_BATCH_ENABLE
+            if (slot->batch) {
+                send_batch_done(pipeline, slot);
+            } else
+#endif
+            {
+                key_press_done(pipeline, slot);
+            }
+        }
+        atomic_store_explicit(&slot->state, KEY_PIPELINE_REQUEST_FREE, memory_order_relaxed);
+    }
+}
+
+bool key_pipeline_idle(const key_pipeline_t *pipeline) {
+    if (pipeline->backlog_count > 0 || key_pipeline_queued(pipeline) > 0 ||
+        key_pipeline_inflight(pipeline) > 0 || key_pipeline_held(pipeline) > 0) {
+        return false;
+    }
+#if CONFIG_KEY_BATCH_ENABLE
+    if (pipeline->batch.count > 0) {
+        return false;
+    }
+#endif
+#if CONFIG_KEY_REPEAT_ENABLE
+    for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        if (pipeline->devices[d].repeat.event.count > 0) {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+#if CONFIG_KEY_EVENT_TIMING
+// When the next clock ping is due, or -1 while anything else is waiting or on
+// the wire, so no key ever queues behind a ping and each ping's round trip is
+// the network's alone
+static int64_t clock_due_in(const key_pipeline_t *pipeline, int64_t now_us) {
+    if (!key_pipeline_idle(pipeline)) {
+        return -1;
+    }
+#if CONFIG_KEY_STORE_ENABLE
+    if (!link_ready(pipeline, now_us)) {
+        return -1;
+    }
+#endif
+    return key_clock_due_in(&pipeline->clock, now_us);
+}
+
+static bool send_clock_ping(key_pipeline_t *pipeline) {
+    int64_t now = esp_timer_get_time();
+    if (clock_due_in(pipeline, now) != 0) {
+        return false;
+    }
+    key_pipeline_request_t *slot = free_request(pipeline);
+    if (slot == NULL) {
+        return false;
+    }
+    if (key_clock_ping(&pipeline->clock, CONFIG_KEY_CLOCK_PATH, now, slot->path,
+                       sizeof(slot->path)) < 0) {
+        pipeline->clock.supported = false;
+        return false;
+    }
+    pipeline->clock_sent_us = now;
+    slot->batch = false;
+    slot->clock = true;
+    slot->request.path = slot->path;
+    slot->request.content_type = NULL;
+    slot->request.event = NULL;
+    slot->request.body = NULL;
+    slot->request.body_len = 0;
+    start_request(pipeline, slot);
+    return true;
+}
+#endif
+
+static bool send_some(key_pipeline_t *pipeline) {
+#if CONFIG_KEY_STORE_ENABLE
+    if (!link_ready(pipeline, esp_timer_get_time())) {
+        hold_queued(pipeline);
+        return false;
+    }
+#endif
+    bool progress;
+#if CONFIG_KEY_BATCH_ENABLE
+    if (pipeline->batch_supported) {
+        progress = send_batched(pipeline);
+    } else
+#endif
+    {
+        progress = send_keys(pipeline);
+    }
+#if CONFIG_KEY_EVENT_TIMING
+    if (!progress) {
+        progress = send_clock_ping(pipeline);
+    }
+#endif
+    return progress;
+}
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+// Switches to newly published bindings once no mapped event is left that
+// still refers to the old ones: nothing waiting in the backlog, a batch, the
+// store or a request
+static void switch_bindings(key_pipeline_t *pipeline) {
+    if (!key_bindings_pending(&pipeline->bindings) || pipeline->backlog_count > 0 ||
+        key_pipeline_inflight(pipeline) > 0 || key_pipeline_held(pipeline) > 0) {
+        return;
+    }
+#if CONFIG_KEY_BATCH_ENABLE
+    if (pipeline->batch.count > 0 || pipeline->batch_inflight) {
+        return;
+    }
+#endif
+    if (key_bindings_switch(&pipeline->bindings)) {
+#if CONFIG_KEY_REPEAT_ENABLE
+        // The keys being repeated were mapped with the old bindings
+        stop_repeats(pipeline);
+#endif
+    }
+}
+#endif
+
+void key_pipeline_process(key_pipeline_t *pipeline) {
+#if CONFIG_KEY_BINDINGS_ENABLE
+    switch_bindings(pipeline);
+#endif
+    do {
+        reap_requests(pipeline);
+    } while (send_some(pipeline));
+
+    key_queue_stats_t stats;
+    key_pipeline_queue_stats(pipeline, &stats);
+    if (stats.dropped != pipeline->reported_drops) {
+        KEY_LOG(KEY_LOG_QUEUE_OVERFLOW, stats.enqueued, stats.dropped, stats.coalesced,
+                stats.max_depth);
+        pipeline->reported_drops = stats.dropped;
+    }
+}
+
+int64_t key_pipeline_due_in(const key_pipeline_t *pipeline, int64_t now_us) {
+    int64_t due = -1;
+#if CONFIG_KEY_BATCH_ENABLE
+    // A batch waiting behind the one in flight goes when that completes
+    if (!pipeline->batch_inflight) {
+        due = key_batch_due_in(&pipeline->batch, now_us);
+    }
+#endif
+#if CONFIG_KEY_STORE_ENABLE
+    // Wake up to try again after a failure
+    if (pipeline->retry_us > now_us && (due < 0 || pipeline->retry_us - now_us < due)) {
+        due = pipeline->retry_us - now_us;
+    }
+#endif
+#if CONFIG_KEY_REPEAT_ENABLE
+    // Wake up to repeat held keys. One that's overdue is waiting for the
+    // sender, which is woken when a request completes.
+    for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        int64_t left = key_repeat_due_in(&pipeline->devices[d].repeat, now_us);
+        if (left > 0 && (due < 0 || left < due)) {
+            due = left;
+        }
+    }
+#endif
+#if CONFIG_KEY_EVENT_TIMING
+    // Wake up for the next clock ping
+    int64_t ping = clock_due_in(pipeline, now_us);
+    if (ping >= 0 && (due < 0 || ping < due)) {
+        due = ping;
+    }
+#endif
+    // Wake up to give up on requests that have hung
+    for (uint32_t i = 0; i < pipeline->max_inflight; i++) {
+        const key_pipeline_request_t *slot = &pipeline->requests[i];
+        if (atomic_load_explicit(&slot->state, memory_order_relaxed) ==
+                KEY_PIPELINE_REQUEST_BUSY && !slot->abandoned) {
+            int64_t left = slot->deadline_us > now_us ? slot->deadline_us - now_us : 0;
+            if (due < 0 || left < due) {
+                due = left;
+            }
+        }
+    }
+    return due;
+}
+
+void key_pipeline_set_link(key_pipeline_t *pipeline, bool up) {
+#if CONFIG_KEY_STORE_ENABLE
+    atomic_store_explicit(&pipeline->link_up, up, memory_order_relaxed);
+    // To start holding events, or replaying them
+    if (pipeline->notify != NULL) {
+        pipeline->notify(pipeline->notify_arg);
+    }
+#endif
+}
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+key_binding_table_t *key_pipeline_edit_bindings(key_pipeline_t *pipeline) {
+    return key_bindings_edit(&pipeline->bindings);
+}
+
+void key_pipeline_publish_bindings(key_pipeline_t *pipeline) {
+    key_bindings_publish(&pipeline->bindings);
+    // The consumer may be idle
+    if (pipeline->notify != NULL) {
+        pipeline->notify(pipeline->notify_arg);
+    }
+}
+#endif
+
+uint32_t key_pipeline_inflight(const key_pipeline_t *pipeline) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < pipeline->max_inflight; i++) {
+        if (atomic_load_explicit(&pipeline->requests[i].state, memory_order_relaxed) !=
+            KEY_PIPELINE_REQUEST_FREE) {
+            n++;
+        }
+    }
+    return n;
+}
+
+// Max depth is the deepest of them, not a sum
+static void add_queue_stats(key_queue_stats_t *total, const key_queue_stats_t *stats) {
+    total->enqueued += stats->enqueued;
+    total->dropped += stats->dropped;
+    total->coalesced += stats->coalesced;
+    if (stats->max_depth > total->max_depth) {
+        total->max_depth = stats->max_depth;
+    }
+}
+
+static void device_queue_stats(const key_pipeline_device_t *device, key_queue_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t l = 0; l < KEY_PIPELINE_LANES; l++) {
+        key_queue_stats_t lane;
+        key_queue_get_stats(&device->queues[l], &lane);
+        add_queue_stats(stats, &lane);
+    }
+}
+
+static uint32_t device_queued(const key_pipeline_device_t *device) {
+    uint32_t n = 0;
+    for (uint32_t l = 0; l < KEY_PIPELINE_LANES; l++) {
+        n += key_queue_depth(&device->queues[l]);
+    }
+    return n;
+}
+
+void key_pipeline_queue_stats(const key_pipeline_t *pipeline, key_queue_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        key_queue_stats_t device;
+        device_queue_stats(&pipeline->devices[d], &device);
+        add_queue_stats(stats, &device);
+    }
+}
+
+uint32_t key_pipeline_queued(const key_pipeline_t *pipeline) {
+    uint32_t n = 0;
+    for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        n += device_queued(&pipeline->devices[d]);
+    }
+    return n;
+}
+
+uint32_t key_pipeline_held(const key_pipeline_t *pipeline) {
+#if CONFIG_KEY_STORE_ENABLE
+    return key_store_count(&pipeline->store);
+#else
+    return 0;
+#endif
+}
+
+static int format_queue(char *buf, size_t len, uint32_t depth, const key_queue_stats_t *stats,
+                        uint32_t max_enqueue_us) {
+    return snprintf(buf, len,
+                    "{\"depth\":%u,\"enqueued\":%u,\"dropped\":%u,\"coalesced\":%u,"
+                    "\"max_depth\":%u,\"max_enqueue_us\":%u}",
+                    (unsigned)depth, (unsigned)stats->enqueued, (unsigned)stats->dropped,
+                    (unsigned)stats->coalesced, (unsigned)stats->max_depth,
+                    (unsigned)max_enqueue_us);
+}
+
+int key_pipeline_format_status(const key_pipeline_t *pipeline, char *buf, size_t len) {
+    size_t pos = 0;
+    int n;
+
+    uint32_t max_enqueue_us = 0;
+    for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        if (pipeline->devices[d].max_enqueue_us > max_enqueue_us) {
+            max_enqueue_us = pipeline->devices[d].max_enqueue_us;
+        }
+    }
+    key_queue_stats_t total;
+    key_pipeline_queue_stats(pipeline, &total);
+
+    n = snprintf(buf, len, "{\"uptime_us\":%lld,\"inflight\":%u,\"queue\":",
+                 (long long)esp_timer_get_time(), (unsigned)key_pipeline_inflight(pipeline));
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+    n = format_queue(buf + pos, len - pos, key_pipeline_queued(pipeline), &total,
+                     max_enqueue_us);
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+
+    for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+        const key_pipeline_device_t *device = &pipeline->devices[d];
+        key_queue_stats_t stats;
+        device_queue_stats(device, &stats);
+        n = snprintf(buf + pos, len - pos, d ? "," : ",\"devices\":[");
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+        n = format_queue(buf + pos, len - pos, device_queued(device), &stats,
+                         device->max_enqueue_us);
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+    }
+    n = snprintf(buf + pos, len - pos, "]");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+
+#if CONFIG_KEY_PRIORITY_ENABLE
+    // Each lane's queues summed over the devices
+    for (uint32_t l = 0; l < KEY_PIPELINE_LANES; l++) {
+        key_queue_stats_t stats = { 0 };
+        uint32_t depth = 0;
+        for (uint32_t d = 0; d < CONFIG_KEY_MAX_DEVICES; d++) {
+            key_queue_stats_t lane;
+            key_queue_get_stats(&pipeline->devices[d].queues[l], &lane);
+            add_queue_stats(&stats, &lane);
+            depth += key_queue_depth(&pipeline->devices[d].queues[l]);
+        }
+        n = snprintf(buf + pos, len - pos,
+                     "%s{\"class\":\"%s\",\"deadline_ms\":%u,\"stale\":%u,\"depth\":%u,"
+                     "\"enqueued\":%u,\"dropped\":%u,\"coalesced\":%u,\"max_depth\":%u}",
+                     l ? "," : ",\"lanes\":[", _class_names[l],
+                     (unsigned)(_deadlines_us[l] / 1000),
+                     (unsigned)atomic_load_explicit(&pipeline->stale[l], memory_order_relaxed),
+                     (unsigned)depth, (unsigned)stats.enqueued, (unsigned)stats.dropped,
+                     (unsigned)stats.coalesced, (unsigned)stats.max_depth);
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+    }
+    n = snprintf(buf + pos, len - pos, "]");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+#endif
+
+#if CONFIG_KEY_STORE_ENABLE
+    const key_store_t *store = &pipeline->store;
+    n = snprintf(buf + pos, len - pos,
+                 ",\"store\":{\"link\":%s,\"depth\":%u,\"max_depth\":%u,\"buffered\":%u,"
+                 "\"replayed\":%u,\"expired\":%u,\"dropped\":%u,\"spilled\":%u,"
+                 "\"drain_events\":%u,\"drain_per_s\":%u",
+                 atomic_load_explicit(&pipeline->link_up, memory_order_relaxed) ? "true" : "false",
+                 (unsigned)key_store_count(store),
+                 (unsigned)atomic_load_explicit(&store->max_depth, memory_order_relaxed),
+                 (unsigned)atomic_load_explicit(&store->buffered, memory_order_relaxed),
+                 (unsigned)atomic_load_explicit(&store->replayed, memory_order_relaxed),
+                 (unsigned)atomic_load_explicit(&store->expired, memory_order_relaxed),
+                 (unsigned)atomic_load_explicit(&store->dropped, memory_order_relaxed),
+                 (unsigned)atomic_load_explicit(&store->spilled, memory_order_relaxed),
+                 (unsigned)atomic_load_explicit(&pipeline->last_drain_events,
+                                                memory_order_relaxed),
+                 (unsigned)atomic_load_explicit(&pipeline->last_drain_per_s,
+                                                memory_order_relaxed));
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+    n = snprintf(buf + pos, len - pos, "}");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+#endif
+#if CONFIG_KEY_BINDINGS_ENABLE
+    const key_bindings_t *bindings = &pipeline->bindings;
+    n = snprintf(buf + pos, len - pos,
+                 ",\"bindings\":{\"count\":%u,\"matched\":%u,\"switches\":%u,\"pending\":%s}",
+                 (unsigned)key_bindings_active(bindings)->count,
+                 (unsigned)atomic_load_explicit(&bindings->matched, memory_order_relaxed),
+                 (unsigned)atomic_load_explicit(&bindings->switches, memory_order_relaxed),
+                 key_bindings_pending(bindings) ? "true" : "false");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+#endif
+#if KEY_PIPELINE_RUN_STATS
+    uint32_t repeats, merged;
+    key_run_stats_totals(&pipeline->runs, &repeats, &merged);
+    n = snprintf(buf + pos, len - pos, ",\"runs\":{\"repeats\":%u,\"merged\":%u}",
+                 (unsigned)repeats, (unsigned)merged);
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+#endif
+    n = snprintf(buf + pos, len - pos, ",\"stats\":");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    pos += n;
+    n = key_stats_format(&pipeline->stats, buf + pos, len - pos);
+    if (n < 0 || (size_t)n + 1 >= len - pos) {
+        return -1;
+    }
+    pos += n;
+    buf[pos++] = '}';
+    buf[pos] = '\0';
+    return pos;
+}
+
+#if KEY_PIPELINE_RUN_STATS
+int key_pipeline_format_runs(const key_pipeline_t *pipeline, char *buf, size_t len) {
+    return key_run_stats_format(&pipeline->runs, buf, len);
+}
+#endif
@@ -0,0 +1,315 @@
+#ifndef KEY_PIPELINE_H
+#define KEY_PIPELINE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "hid_descriptor.h"
+#include "hid_report.h"
+#include "key_batch.h"
+#if CONFIG_KEY_EVENT_TIMING
+#include "key_clock.h"
+#endif
+#if CONFIG_KEY_BINDINGS_ENABLE
+#include "key_bindings.h"
+#endif
+#include "key_queue.h"
+#include "key_repeat.h"
+#include "key_stats.h"
+#include "key_store.h"
+#include "key_table.h"
+#include "key_transport.h"
+
+typedef struct key_pipeline key_pipeline_t;
+
+#define KEY_PIPELINE_PATH_LEN 128
+
+// A request the consumer has handed to the transport
+typedef struct {
+    key_request_t request;      // first, so done() can find the slot
+    key_pipeline_t *pipeline;
+    _Atomic uint32_t state;     // KEY_PIPELINE_REQUEST_*
+    int64_t sent_us;
+    int64_t done_us;            // set by the transport's task before DONE
+    int64_t deadline_us;
+    // Given up on after the deadline; the slot stays busy until the
+    // transport lets go of it, but its events have been reported as failed
+    bool abandoned;
+    bool batch;
+    bool clock;                 // a clock ping, see key_clock.h
+    key_event_t event;          // per-key requests only
+    // A binding's path with the count, device and timing parameters, or a
+    // clock ping
+    char path[KEY_PIPELINE_PATH_LEN];
+} key_pipeline_request_t;
+
+#define KEY_PIPELINE_REQUEST_FREE 0
+#define KEY_PIPELINE_REQUEST_BUSY 1
+#define KEY_PIPELINE_REQUEST_DONE 2
+
+// Queues per keyboard, one for each priority class (KEY_CLASS_*, also the
+// lane's index), or one for everything
+#if CONFIG_KEY_PRIORITY_ENABLE
+#define KEY_PIPELINE_LANES KEY_CLASS_COUNT
+#else
+#define KEY_PIPELINE_LANES 1
+#endif
+
+// Events taken off the queue that have to wait, either for an earlier request
+// for the same key or, after the server rejected batches, to be replayed one
+// by one. Folding a run into the press waiting at the front takes one more,
+// for the event that ends it, and a high priority press going ahead of the
+// lot another.
+#if CONFIG_KEY_BATCH_ENABLE
+#define KEY_PIPELINE_BACKLOG_EVENTS (2 * CONFIG_KEY_BATCH_MAX_EVENTS)
+#elif CONFIG_KEY_COALESCE_RUNS
+#define KEY_PIPELINE_BACKLOG_EVENTS 2
+#else
+#define KEY_PIPELINE_BACKLOG_EVENTS 1
+#endif
+#define KEY_PIPELINE_BACKLOG (KEY_PIPELINE_BACKLOG_EVENTS + KEY_PIPELINE_LANES - 1)
+
+#if CONFIG_KEY_REPEAT_ENABLE || CONFIG_KEY_COALESCE_RUNS
+#define KEY_PIPELINE_RUN_STATS 1
+#else
+#define KEY_PIPELINE_RUN_STATS 0
+#endif
+
+// One keyboard's side of the pipeline. Each device has its own queues, so a
+// keyboard that floods them only drops its own events.
+typedef struct {
+    key_queue_t queues[KEY_PIPELINE_LANES];
+    key_queue_slot_t slots[CONFIG_KEY_QUEUE_DEPTH];
+#if CONFIG_KEY_PRIORITY_ENABLE
+    key_queue_slot_t high_slots[CONFIG_KEY_PRIORITY_QUEUE_DEPTH];
+#endif
+    // Producer side: where the keyboard's reports keep their keys, and what
+    // each report had down last time. Modifiers are shared, so a report
+    // without them (media keys) goes out with the ones already held.
+    hid_plan_t plan;
+    hid_report_state_t report_states[HID_PLAN_MAX_REPORTS];
+    uint8_t mods;
+    // Longest time from a report arriving to its last event being queued
+    uint32_t max_enqueue_us;
+    // The last `seq` given out by the producer and `tx` by the consumer
+    uint32_t next_seq;
+    uint32_t next_tx;
+    // Bitmap of keys with a per-key request in flight
+    uint32_t inflight_keys[8];
+#if CONFIG_KEY_BINDINGS_ENABLE
+    // Consumer side: the keys held and pressed last, for chords and sequences
+    key_binding_state_t binding_state;
+#endif
+#if CONFIG_KEY_REPEAT_ENABLE
+    // Consumer side: the key being repeated
+    key_repeat_t repeat;
+#endif
+} key_pipeline_device_t;
+
+// The path from a raw HID report to a request on the server, independent of
+// FreeRTOS and the Bluetooth stack:
+//
+//   key_pipeline_report()   producer: diff the report, queue the events
+//   key_pipeline_process()  consumer: drain the queues, map keys, send
+//
+// Up to CONFIG_KEY_MAX_DEVICES keyboards feed one shared consumer. The
+// producer and consumer may run concurrently in different tasks, but each
+// side, for all devices together, must only be driven by one task at a time,
+// as the HID callback does.
+//
+// With an asynchronous transport the consumer keeps up to
+// CONFIG_KEY_HTTP_INFLIGHT requests going at once. Requests for the same key
+// never overlap, so a key's presses reach the server in order, and only one
+// batch is in flight at a time while the next one fills up.
+//
+// With CONFIG_KEY_REPEAT_ENABLE the consumer repeats held keys itself, and
+// with CONFIG_KEY_COALESCE_RUNS presses of a key that pile up behind its
+// request in flight, repeats included, go out as one event with their count.
+//
+// With CONFIG_KEY_PRIORITY_ENABLE each keyboard has a queue per priority
+// class (key_table_class()), and the consumer takes from the high priority
+// queues first, then the normal ones. A press that's older than its class's
+// deadline by the time it would go into a request is dropped and counted as
+// stale, and reported through on_delivered with ESP_ERR_TIMEOUT.
+//
+// With CONFIG_KEY_BINDINGS_ENABLE the consumer maps each press through
+// `bindings` as it takes it off the queue, falling back to key_table, and
+// switches to newly published bindings only once everything it has already
+// mapped is delivered.
+//
+// With CONFIG_KEY_STORE_ENABLE nothing is lost to an outage: while the link is
+// down (key_pipeline_set_link()), or for KEY_STORE_RETRY_MS after a request
+// fails, events are moved from the queues into the store, and failed ones are
+// put back at its front. They're then replayed oldest first, one request at a
+// time until one gets through. Delivery becomes at-least-once: a request that
+// timed out may still have reached the server.
+//
+// Events are numbered as they're queued and as they first go into a request
+// (`seq` and `tx`, see key_event_t). Batches carry both with the event's
+// timestamp, and with CONFIG_KEY_EVENT_TIMING so do per-key requests, while
+// the consumer pings the server's clock whenever it's idle (key_clock.h).
+struct key_pipeline {
+    key_pipeline_device_t devices[CONFIG_KEY_MAX_DEVICES];
+    // Device the consumer takes the next event from, so one busy keyboard
+    // can't starve the others
+    uint32_t next_device;
+
+    key_transport_t transport;
+    // Called by the producer after queueing events, and by an asynchronous
+    // transport when a request completes, to wake the consumer
+    void (*notify)(void *arg);
+    void *notify_arg;
+    // Optional. Called by the consumer once the request carrying `event` has
+    // completed (ret == ESP_OK) or failed, e.g. to measure latency.
+    void (*on_delivered)(void *arg, const key_event_t *event, esp_err_t ret);
+    void *on_delivered_arg;
+    uint32_t reported_drops;
+#if CONFIG_KEY_PRIORITY_ENABLE
+    // Stale presses dropped, per class; written by the consumer only
+    _Atomic uint32_t stale[KEY_PIPELINE_LANES];
+#endif
+    // Per-stage timings and counters, cheap enough to leave on
+    key_stats_t stats;
+
+    key_pipeline_request_t requests[CONFIG_KEY_HTTP_INFLIGHT];
+    uint32_t max_inflight;
+    key_event_t backlog[KEY_PIPELINE_BACKLOG];
+    uint32_t backlog_head;
+    uint32_t backlog_count;
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+    key_bindings_t bindings;
+#endif
+#if KEY_PIPELINE_RUN_STATS
+    key_run_stats_t runs;
+#endif
+
+#if CONFIG_KEY_STORE_ENABLE
+    key_store_t store;
+    key_event_t store_events[CONFIG_KEY_STORE_DEPTH];
+    // Set from any task as the network comes and goes
+    _Atomic bool link_up;
+    // After a failure nothing is sent before this, then only one request at a
+    // time until one succeeds
+    int64_t retry_us;
+    bool probing;
+    // The replay in progress, and how fast the last one to empty the store went
+    int64_t drain_start_us;
+    uint32_t drain_events;
+    _Atomic uint32_t last_drain_events;
+    _Atomic uint32_t last_drain_per_s;
+#endif
+
+#if CONFIG_KEY_BATCH_ENABLE
+    key_batch_t batch;
+    key_event_t batch_events[CONFIG_KEY_BATCH_MAX_EVENTS];
+    // The batch on the wire, while `batch` collects the next one
+    bool batch_inflight;
+    key_event_t inflight_events[CONFIG_KEY_BATCH_MAX_EVENTS];
+    uint32_t inflight_count;
+    char batch_body[KEY_BATCH_BODY_LEN(CONFIG_KEY_BATCH_MAX_EVENTS)];
+    // Cleared if the server rejects the batch endpoint, after which we fall
+    // back to per-key requests
+    bool batch_supported;
+#endif
+
+#if CONFIG_KEY_EVENT_TIMING
+    key_clock_t clock;
+    int64_t clock_sent_us;
+#endif
+};
+
+bool key_pipeline_init(key_pipeline_t *pipeline, const key_transport_t *transport,
+                       void (*notify)(void *arg), void *notify_arg);
+
+// Producer side. Takes a keyboard input report including its report ID, as
+// delivered with ESP_HIDH_DATA_IND_EVT, from device `device`, and reads it
+// with the device's plan (boot reports until key_pipeline_set_descriptor()).
+// Returns the number of events queued.
+int key_pipeline_report(key_pipeline_t *pipeline, uint8_t device, const uint8_t *data,
+                        uint16_t len, int64_t received_us);
+
+// Producer side. Releases every key `device` still holds, e.g. when it
+// disconnects.
+int key_pipeline_release_all(key_pipeline_t *pipeline, uint8_t device, int64_t now_us);
+
+// Producer side. Compiles `device`'s report descriptor, as delivered with
+// ESP_HIDH_GET_DSCP_EVT, into the plan its reports are read with, releasing
+// whatever it held first. Falls back to boot reports and returns false if the
+// descriptor can't be used.
+bool key_pipeline_set_descriptor(key_pipeline_t *pipeline, uint8_t device, const uint8_t *desc,
+                                 uint16_t len);
+
+// Consumer side. Handles completed requests, sends everything that's queued
+// (as far as free request slots allow) and flushes a batch that has become
+// due. With a blocking transport it returns once everything queued has been
+// sent; with an asynchronous one, once the request slots are full.
+void key_pipeline_process(key_pipeline_t *pipeline);
+
+// Any task. Whether the server can be reached at all, e.g. whether Wi-Fi is
+// connected. Starts out up. Without CONFIG_KEY_STORE_ENABLE it does nothing.
+void key_pipeline_set_link(key_pipeline_t *pipeline, bool up);
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+// Any task, one at a time. The table to compile new bindings into with
+// key_binding_table_compile(), or NULL while the last ones published are
+// still waiting to take effect.
+key_binding_table_t *key_pipeline_edit_bindings(key_pipeline_t *pipeline);
+
+// Hands the table from key_pipeline_edit_bindings() to the consumer, which
+// switches to it once everything it has mapped with the current one is
+// delivered
+void key_pipeline_publish_bindings(key_pipeline_t *pipeline);
+#endif
+
+// Consumer side. Microseconds until key_pipeline_process() must run again even
+// if nothing new is queued or completed, or -1 if it can wait for the next
+// notification.
+int64_t key_pipeline_due_in(const key_pipeline_t *pipeline, int64_t now_us);
+
+// Any task. Queue counters summed over every device and lane, and the number
+// of events waiting in the queues.
+void key_pipeline_queue_stats(const key_pipeline_t *pipeline, key_queue_stats_t *stats);
+uint32_t key_pipeline_queued(const key_pipeline_t *pipeline);
+
+// Any task. Events held in the store, waiting for the link or a retry; 0
+// without CONFIG_KEY_STORE_ENABLE.
+uint32_t key_pipeline_held(const key_pipeline_t *pipeline);
+
+// Requests currently with the transport
+uint32_t key_pipeline_inflight(const key_pipeline_t *pipeline);
+
+// Consumer side. Whether every key event has been dealt with: nothing queued,
+// held, collecting in a batch, being repeated or with the transport. A clock
+// ping in flight counts as busy.
+bool key_pipeline_idle(const key_pipeline_t *pipeline);
+
+// Any task. Writes the queue counters, per device and in total, and
+// key_stats_format()'s output as one JSON object:
+//
+//   {"uptime_us":123,"inflight":0,"queue":{"depth":0,"enqueued":12,...},
+//    "devices":[{"depth":0,"enqueued":12,...}],
+//    "lanes":[{"class":"normal","deadline_ms":0,"stale":0,"depth":0,...},
+//             {"class":"high",...}],
+//    "store":{"link":true,"depth":0,"buffered":40,"replayed":38,...},
+//    "bindings":{"count":6,"matched":3,"switches":1,"pending":false},
+//    "runs":{"repeats":40,"merged":31},
+//    "stats":{...}}
+//
+// "lanes" is only there with CONFIG_KEY_PRIORITY_ENABLE, "store" with
+// CONFIG_KEY_STORE_ENABLE, "bindings" with CONFIG_KEY_BINDINGS_ENABLE, and
+// "runs" with CONFIG_KEY_REPEAT_ENABLE or CONFIG_KEY_COALESCE_RUNS.
+//
+// Returns the length written, or -1 if it doesn't fit.
+int key_pipeline_format_status(const key_pipeline_t *pipeline, char *buf, size_t len);
+
+#if KEY_PIPELINE_RUN_STATS
+// Any task. Writes "runs" per key, see key_run_stats_format().
+int key_pipeline_format_runs(const key_pipeline_t *pipeline, char *buf, size_t len);
+#endif
+
+#endif // KEY_PIPELINE_H
@@ -0,0 +1,146 @@
+#include "key_queue.h"
+
+#include <stddef.h>
+
+// Counters have a single writer, so a relaxed load/store pair is enough and
+// avoids a read-modify-write on the producer's path.
+static inline void _bump(_Atomic uint32_t *counter) {
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+static inline bool _same_event(const key_event_t *a, const key_event_t *b) {
+    return a->key == b->key && a->type == b->type && a->mods == b->mods;
+}
+
+bool key_queue_init(key_queue_t *q, key_queue_slot_t *slots, uint32_t depth,
+                    key_queue_policy_t policy) {
+    if (q == NULL || slots == NULL || depth == 0 || (depth & (depth - 1)) != 0) {
+        return false;
+    }
+    q->slots = slots;
+    q->mask = depth - 1;
+    q->policy = policy;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->enqueued, 0);
+    atomic_init(&q->dropped, 0);
+    atomic_init(&q->coalesced, 0);
+    atomic_init(&q->max_depth, 0);
+    for (uint32_t i = 0; i < depth; i++) {
+        atomic_init(&slots[i].count, 0);
+    }
+    return true;
+}
+
+// Merge `event` into the most recently queued slot. Fails if that slot holds
+// a different key or the consumer has already started taking it (count == 0).
+static bool _coalesce(key_queue_t *q, uint32_t head, const key_event_t *event) {
+    key_queue_slot_t *slot = &q->slots[(head - 1) & q->mask];
+    if (!_same_event(&slot->event, event)) {
+        return false;
+    }
+    uint32_t count = atomic_load_explicit(&slot->count, memory_order_relaxed);
+    while (count != 0 && count < UINT16_MAX) {
+        if (atomic_compare_exchange_weak_explicit(&slot->count, &count, count + 1,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool key_queue_push(key_queue_t *q, const key_event_t *event) {
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head - tail > q->mask) {
+        switch (q->policy) {
+            case KEY_QUEUE_DROP_OLDEST:
+                // If the CAS fails the consumer just freed a slot, which is
+                // just as good.
+                if (atomic_compare_exchange_strong_explicit(&q->tail, &tail, tail + 1,
+                                                            memory_order_acq_rel,
+                                                            memory_order_acquire)) {
+                    _bump(&q->dropped);
+                }
+                break;
+            case KEY_QUEUE_COALESCE:
+                if (_coalesce(q, head, event)) {
+                    _bump(&q->coalesced);
+                    return true;
+                }
+                // The consumer may be in the middle of freeing a slot; only
+                // write if it has actually moved the tail.
+                tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+                if (head - tail <= q->mask) {
+                    break;
+                }
+                _bump(&q->dropped);
+                return false;
+            case KEY_QUEUE_DROP_NEWEST:
+            default:
+                _bump(&q->dropped);
+                return false;
+        }
+    }
+
+    key_queue_slot_t *slot = &q->slots[head & q->mask];
+    slot->event = *event;
+    atomic_store_explicit(&slot->count, event->count ? event->count : 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    _bump(&q->enqueued);
+    uint32_t depth = head + 1 - atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (depth > atomic_load_explicit(&q->max_depth, memory_order_relaxed)) {
+        atomic_store_explicit(&q->max_depth, depth, memory_order_relaxed);
+    }
+    return true;
+}
+
+bool key_queue_pop(key_queue_t *q, key_event_t *event) {
+    for (;;) {
+        uint32_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        uint32_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+
+        key_queue_slot_t *slot = &q->slots[tail & q->mask];
+        *event = slot->event;
+
+        if (q->policy == KEY_QUEUE_COALESCE) {
+            // Only the consumer moves the tail under this policy. Zeroing the
+            // count first stops the producer from merging into a slot we've
+            // already read.
+            event->count = atomic_exchange_explicit(&slot->count, 0, memory_order_acq_rel);
+            atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+            return true;
+        }
+
+        // Under KEY_QUEUE_DROP_OLDEST the producer may have advanced the tail
+        // and overwritten the slot while we were copying it; if so, retry.
+        event->count = atomic_load_explicit(&slot->count, memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&q->tail, &tail, tail + 1,
+                                                    memory_order_acq_rel,
+                                                    memory_order_acquire)) {
+            return true;
+        }
+    }
+}
+
+uint32_t key_queue_depth(const key_queue_t *q) {
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    return head - tail;
+}
+
+void key_queue_get_stats(const key_queue_t *q, key_queue_stats_t *stats) {
+    stats->enqueued = atomic_load_explicit(&q->enqueued, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&q->dropped, memory_order_relaxed);
+    stats->coalesced = atomic_load_explicit(&q->coalesced, memory_order_relaxed);
+    stats->max_depth = atomic_load_explicit(&q->max_depth, memory_order_relaxed);
+}
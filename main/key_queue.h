@@ -0,0 +1,63 @@
+#ifndef KEY_QUEUE_H
+#define KEY_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "key_event.h"
+
+// What to do when the producer finds the queue full
+typedef enum {
+    KEY_QUEUE_DROP_OLDEST,  // discard the oldest queued event to make room
+    KEY_QUEUE_DROP_NEWEST,  // discard the event being pushed
+    KEY_QUEUE_COALESCE,     // merge into the newest queued event if it's the
+                            // same key, otherwise discard the new event
+} key_queue_policy_t;
+
+typedef struct {
+    key_event_t event;
+    _Atomic uint32_t count;
+} key_queue_slot_t;
+
+typedef struct {
+    uint32_t enqueued;
+    uint32_t dropped;
+    uint32_t coalesced;
+    uint32_t max_depth;
+} key_queue_stats_t;
+
+// Bounded single-producer/single-consumer ring. The producer (HID callback)
+// and the consumer (sender task) never block or take a lock. Indices are
+// free-running and masked, so the depth must be a power of two.
+typedef struct {
+    key_queue_slot_t *slots;
+    uint32_t mask;
+    key_queue_policy_t policy;
+    _Atomic uint32_t head;      // written by the producer only
+    _Atomic uint32_t tail;      // written by the consumer, and by the
+                                    // producer under KEY_QUEUE_DROP_OLDEST
+    // Counters are only written by the producer
+    _Atomic uint32_t enqueued;
+    _Atomic uint32_t dropped;
+    _Atomic uint32_t coalesced;
+    _Atomic uint32_t max_depth;
+} key_queue_t;
+
+// `slots` must point to `depth` entries that outlive the queue.
+// Returns false if depth isn't a non-zero power of two.
+bool key_queue_init(key_queue_t *q, key_queue_slot_t *slots, uint32_t depth,
+                    key_queue_policy_t policy);
+
+// Producer side. Returns true if the event was queued or coalesced, false if
+// it was dropped. Never blocks.
+bool key_queue_push(key_queue_t *q, const key_event_t *event);
+
+// Consumer side. Returns false if the queue is empty.
+bool key_queue_pop(key_queue_t *q, key_event_t *event);
+
+uint32_t key_queue_depth(const key_queue_t *q);
+
+void key_queue_get_stats(const key_queue_t *q, key_queue_stats_t *stats);
+
+#endif // KEY_QUEUE_H
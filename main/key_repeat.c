@@ -0,0 +1,112 @@
+#include "key_repeat.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "key_table.h"
+#include "usb_hid_codes.h"
+
+static inline bool _is_modifier(uint8_t key) {
+    return key >= KEY_LEFTCTRL && key <= KEY_RIGHTMETA;
+}
+
+void key_repeat_init(key_repeat_t *repeat) {
+    memset(repeat, 0, sizeof(*repeat));
+}
+
+void key_repeat_track(key_repeat_t *repeat, const key_event_t *event, int64_t delay_us) {
+    if (_is_modifier(event->key)) {
+        // The repeats would no longer match what's held
+        repeat->event.count = 0;
+    } else if (event->type == KEY_EVENT_PRESS) {
+        repeat->event = *event;
+        repeat->event.count = 1;
+        repeat->next_us = event->timestamp_us + delay_us;
+    } else if (event->key == repeat->event.key) {
+        repeat->event.count = 0;
+    }
+}
+
+void key_repeat_stop(key_repeat_t *repeat) {
+    repeat->event.count = 0;
+}
+
+int64_t key_repeat_due_in(const key_repeat_t *repeat, int64_t now_us) {
+    if (repeat->event.count == 0) {
+        return -1;
+    }
+    return repeat->next_us > now_us ? repeat->next_us - now_us : 0;
+}
+
+bool key_repeat_take(key_repeat_t *repeat, int64_t now_us, int64_t interval_us,
+                     uint16_t max_count, key_event_t *event) {
+    if (repeat->event.count == 0 || now_us < repeat->next_us) {
+        return false;
+    }
+    int64_t due = (now_us - repeat->next_us) / interval_us + 1;
+    uint16_t count = due < max_count ? (uint16_t)due : max_count;
+    *event = repeat->event;
+    event->seq = 0;
+    event->tx = 0;
+    event->count = count;
+    // Stamped with when the first of them came due, so latency counts from
+    // there
+    event->timestamp_us = repeat->next_us;
+    repeat->next_us += count * interval_us;
+    return true;
+}
+
+void key_run_stats_init(key_run_stats_t *stats) {
+    for (int k = 0; k < 256; k++) {
+        atomic_init(&stats->repeats[k], 0);
+        atomic_init(&stats->merged[k], 0);
+    }
+}
+
+void key_run_stats_totals(const key_run_stats_t *stats, uint32_t *repeats, uint32_t *merged) {
+    *repeats = 0;
+    *merged = 0;
+    for (int k = 0; k < 256; k++) {
+        *repeats += atomic_load_explicit(&stats->repeats[k], memory_order_relaxed);
+        *merged += atomic_load_explicit(&stats->merged[k], memory_order_relaxed);
+    }
+}
+
+int key_run_stats_format(const key_run_stats_t *stats, char *buf, size_t len) {
+    size_t pos = 0;
+    int n = snprintf(buf, len, "{");
+    if (n < 0 || (size_t)n >= len) {
+        return -1;
+    }
+    pos = n;
+
+    for (int k = 0; k < 256; k++) {
+        uint32_t repeats = atomic_load_explicit(&stats->repeats[k], memory_order_relaxed);
+        uint32_t merged = atomic_load_explicit(&stats->merged[k], memory_order_relaxed);
+        if (repeats == 0 && merged == 0) {
+            continue;
+        }
+        const char *name = key_table_name(k);
+        if (name != NULL) {
+            n = snprintf(buf + pos, len - pos, "%s\"%s\":", pos > 1 ? "," : "", name);
+        } else {
+            n = snprintf(buf + pos, len - pos, "%s\"0x%02x\":", pos > 1 ? "," : "", k);
+        }
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+        n = snprintf(buf + pos, len - pos, "{\"repeats\":%u,\"merged\":%u}", (unsigned)repeats,
+                     (unsigned)merged);
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+    }
+
+    n = snprintf(buf + pos, len - pos, "}");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    return pos + n;
+}
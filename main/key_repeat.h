@@ -0,0 +1,63 @@
+#ifndef KEY_REPEAT_H
+#define KEY_REPEAT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "key_event.h"
+
+// Typematic repeat for one keyboard. Keyboards only report a key going down
+// and coming back up, however long it's held, so the consumer makes up the
+// repeats a PC would: the last key pressed, `delay` after the press and then
+// every `interval`, until it's released, another key is pressed or the
+// modifiers change.
+typedef struct {
+    key_event_t event;      // the press being repeated; count is 0 while none is
+    int64_t next_us;        // when the next repeat is due
+} key_repeat_t;
+
+void key_repeat_init(key_repeat_t *repeat);
+
+// Follows an event taken off the keyboard's queue, already mapped
+void key_repeat_track(key_repeat_t *repeat, const key_event_t *event, int64_t delay_us);
+
+// Stops repeating, e.g. because the mapping the press was made with is gone
+void key_repeat_stop(key_repeat_t *repeat);
+
+// Microseconds until the next repeat is due, or -1 if no key is repeating
+int64_t key_repeat_due_in(const key_repeat_t *repeat, int64_t now_us);
+
+// Takes the repeats that have come due by `now_us`, as one press with a count
+// of up to `max_count`; any left over stay due. Returns false if none are.
+bool key_repeat_take(key_repeat_t *repeat, int64_t now_us, int64_t interval_us,
+                     uint16_t max_count, key_event_t *event);
+
+// Per-key counts of how presses were thinned out on the way to the server,
+// written by the consumer only
+typedef struct {
+    _Atomic uint32_t repeats[256];  // presses made up by key_repeat
+    _Atomic uint32_t merged[256];   // presses folded into another one's request
+} key_run_stats_t;
+
+void key_run_stats_init(key_run_stats_t *stats);
+
+// Single writer, so a relaxed load and store will do
+static inline void key_run_stats_add(_Atomic uint32_t *counter, uint32_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+// Totals over every key
+void key_run_stats_totals(const key_run_stats_t *stats, uint32_t *repeats, uint32_t *merged);
+
+// Writes the keys with anything to show as one JSON object, by name (or code,
+// for keys without a path):
+//
+//   {"plus":{"repeats":42,"merged":35},"0x2c":{"repeats":0,"merged":3}}
+//
+// Returns the length written, or -1 if it doesn't fit.
+int key_run_stats_format(const key_run_stats_t *stats, char *buf, size_t len);
+
+#endif // KEY_REPEAT_H
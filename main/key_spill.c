@@ -0,0 +1,116 @@
+#include "key_spill.h"
+
+#include "esp_log.h"
+
+#define KEY_SPILL_SECTOR 4096
+#define KEY_SPILL_RECORD sizeof(key_event_t)
+
+bool key_spill_init(key_spill_t *spill) {
+    const char *TAG = "key_spill_init";
+
+    spill->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                KEY_SPILL_PARTITION_SUBTYPE,
+                                                KEY_SPILL_PARTITION_LABEL);
+    if (spill->partition == NULL) {
+        ESP_LOGE(TAG, "No %s partition", KEY_SPILL_PARTITION_LABEL);
+        return false;
+    }
+    spill->size = spill->partition->size / KEY_SPILL_SECTOR * KEY_SPILL_SECTOR;
+    if (spill->size < 2 * KEY_SPILL_SECTOR) {
+        ESP_LOGE(TAG, "%s partition is too small", KEY_SPILL_PARTITION_LABEL);
+        return false;
+    }
+    spill->read_offset = 0;
+    spill->write_offset = 0;
+    spill->used = 0;
+    spill->dirty = false;
+    ESP_LOGI(TAG, "Spilling up to %u key events to flash",
+             (unsigned)((spill->size - KEY_SPILL_SECTOR) / KEY_SPILL_RECORD));
+    return true;
+}
+
+// All or nothing: the events only count as spilled, and the write position
+// only moves, once every byte of them is in flash, so the FIFO never holds
+// part of a record.
+static bool spill_write(void *ctx, const key_event_t *events, uint32_t count) {
+    key_spill_t *spill = ctx;
+    const uint8_t *src = (const uint8_t *)events;
+    uint32_t len = count * KEY_SPILL_RECORD;
+
+    if (spill->dirty) {
+        // Flash after the write position can't be written again until its
+        // sector is erased, which has to wait for what's before it to be read
+        if (spill->used > 0) {
+            return false;
+        }
+        uint32_t next = (spill->write_offset / KEY_SPILL_SECTOR + 1) * KEY_SPILL_SECTOR;
+        spill->write_offset = next % spill->size;
+        spill->read_offset = spill->write_offset;
+        spill->dirty = false;
+    }
+    if (spill->used + len > spill->size - KEY_SPILL_SECTOR) {
+        return false;
+    }
+    uint32_t offset = spill->write_offset;
+    uint32_t written = 0;
+    while (written < len) {
+        if (offset % KEY_SPILL_SECTOR == 0 &&
+            esp_partition_erase_range(spill->partition, offset, KEY_SPILL_SECTOR) != ESP_OK) {
+            spill->dirty = written > 0;
+            return false;
+        }
+        // Up to the end of the sector
+        uint32_t n = KEY_SPILL_SECTOR - offset % KEY_SPILL_SECTOR;
+        if (n > len - written) {
+            n = len - written;
+        }
+        if (esp_partition_write(spill->partition, offset, src + written, n) != ESP_OK) {
+            // Part of it may have been written anyway
+            spill->dirty = true;
+            return false;
+        }
+        offset = (offset + n) % spill->size;
+        written += n;
+    }
+    spill->write_offset = offset;
+    spill->used += len;
+    return true;
+}
+
+static uint32_t spill_read(void *ctx, key_event_t *events, uint32_t max) {
+    key_spill_t *spill = ctx;
+    uint32_t count = spill->used / KEY_SPILL_RECORD;
+    if (count > max) {
+        count = max;
+    }
+    uint8_t *dst = (uint8_t *)events;
+    uint32_t len = count * KEY_SPILL_RECORD;
+
+    while (len > 0) {
+        // Up to the end of the partition
+        uint32_t n = spill->size - spill->read_offset;
+        if (n > len) {
+            n = len;
+        }
+        if (esp_partition_read(spill->partition, spill->read_offset, dst, n) != ESP_OK) {
+            // Give up on everything spilled rather than replay garbage
+            spill->read_offset = spill->write_offset;
+            spill->used = 0;
+            return 0;
+        }
+        spill->read_offset = (spill->read_offset + n) % spill->size;
+        spill->used -= n;
+        dst += n;
+        len -= n;
+    }
+    return count;
+}
+
+key_store_spill_t key_spill_store(key_spill_t *spill) {
+    key_store_spill_t store_spill = {
+        .write = spill_write,
+        .read = spill_read,
+        .ctx = spill,
+    };
+    return store_spill;
+}
@@ -0,0 +1,34 @@
+#ifndef KEY_SPILL_H
+#define KEY_SPILL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_partition.h"
+
+#include "key_store.h"
+
+// Data partition the store spills to, from partitions.csv
+#define KEY_SPILL_PARTITION_LABEL "keystore"
+#define KEY_SPILL_PARTITION_SUBTYPE 0x40
+
+// A flash partition used as a FIFO of raw key_event_t records, for the key
+// store to overflow into during long outages. Sectors are erased as the
+// write position reaches them, one sector is always left free so that never
+// touches unread records, and nothing is kept across a reboot. Only used by
+// the sender task.
+typedef struct {
+    const esp_partition_t *partition;
+    uint32_t size;          // bytes used, a whole number of sectors
+    uint32_t read_offset;
+    uint32_t write_offset;
+    uint32_t used;          // bytes written and not yet read
+    bool dirty;             // a failed write left bytes after write_offset
+} key_spill_t;
+
+// Returns false if there's no usable keystore partition
+bool key_spill_init(key_spill_t *spill);
+
+key_store_spill_t key_spill_store(key_spill_t *spill);
+
+#endif // KEY_SPILL_H
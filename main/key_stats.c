@@ -0,0 +1,202 @@
+#include "key_stats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "sdkconfig.h"
+
+static const char *const _stage_names[KEY_STAGE_COUNT] = {
+    [KEY_STAGE_DECODE] = "decode",
+    [KEY_STAGE_ENQUEUE] = "enqueue",
+    [KEY_STAGE_QUEUE] = "queue",
+    [KEY_STAGE_REQUEST] = "request",
+    [KEY_STAGE_TOTAL] = "total",
+};
+
+static const char *const _counter_names[KEY_COUNTER_COUNT] = {
+    [KEY_COUNTER_REPORTS] = "reports",
+    [KEY_COUNTER_BAD_REPORTS] = "bad_reports",
+    [KEY_COUNTER_EVENTS] = "events",
+    [KEY_COUNTER_UNMAPPED] = "unmapped",
+    [KEY_COUNTER_REQUESTS] = "requests",
+    [KEY_COUNTER_REQUEST_FAILURES] = "request_failures",
+    [KEY_COUNTER_REQUEST_TIMEOUTS] = "request_timeouts",
+    [KEY_COUNTER_STALE] = "stale",
+};
+
+// Same single-writer increment as the key queue's counters
+static inline void _add(_Atomic uint32_t *counter, uint32_t n) {
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+void key_hist_init(key_hist_t *hist) {
+    atomic_init(&hist->count, 0);
+    atomic_init(&hist->max, 0);
+    for (int b = 0; b < KEY_HIST_BUCKETS; b++) {
+        atomic_init(&hist->buckets[b], 0);
+    }
+}
+
+void key_stats_init(key_stats_t *stats) {
+    for (int s = 0; s < KEY_STAGE_COUNT; s++) {
+        key_hist_init(&stats->stages[s]);
+    }
+    for (int c = 0; c < KEY_COUNTER_COUNT; c++) {
+        atomic_init(&stats->counters[c], 0);
+    }
+}
+
+void key_hist_record(key_hist_t *hist, uint32_t value) {
+    int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    if (bucket >= KEY_HIST_BUCKETS) {
+        bucket = KEY_HIST_BUCKETS - 1;
+    }
+    _add(&hist->buckets[bucket], 1);
+    _add(&hist->count, 1);
+    if (value > atomic_load_explicit(&hist->max, memory_order_relaxed)) {
+        atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+    }
+}
+
+void key_hist_since(const key_hist_t *now, const key_hist_t *before, key_hist_t *out) {
+    uint32_t count = 0;
+    int top = -1;
+    for (int b = 0; b < KEY_HIST_BUCKETS; b++) {
+        uint32_t n = atomic_load_explicit(&now->buckets[b], memory_order_relaxed) -
+                     atomic_load_explicit(&before->buckets[b], memory_order_relaxed);
+        atomic_store_explicit(&out->buckets[b], n, memory_order_relaxed);
+        count += n;
+        if (n > 0) {
+            top = b;
+        }
+    }
+    atomic_store_explicit(&out->count, count, memory_order_relaxed);
+    // Upper bound of the highest bucket used, or the overall maximum if lower
+    uint32_t max = 0;
+    if (top >= 0) {
+        uint32_t bound = top == 0 ? 0 : (uint32_t)((1ull << top) - 1);
+        uint32_t overall = atomic_load_explicit(&now->max, memory_order_relaxed);
+        max = bound < overall ? bound : overall;
+    }
+    atomic_store_explicit(&out->max, max, memory_order_relaxed);
+}
+
+void key_stats_record_cycles(key_stats_t *stats, key_stage_t stage, uint32_t start,
+                             uint32_t end) {
+    uint64_t ns = (uint64_t)(end - start) * 1000 / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+    key_hist_record(&stats->stages[stage], ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns);
+}
+
+void key_stats_record_us(key_stats_t *stats, key_stage_t stage, int64_t start_us,
+                         int64_t end_us) {
+    int64_t ns = (end_us - start_us) * 1000;
+    if (ns < 0) {
+        ns = 0;
+    } else if (ns > UINT32_MAX) {
+        ns = UINT32_MAX;
+    }
+    key_hist_record(&stats->stages[stage], (uint32_t)ns);
+}
+
+void key_stats_count(key_stats_t *stats, key_counter_t counter, uint32_t n) {
+    _add(&stats->counters[counter], n);
+}
+
+uint32_t key_stats_counter(const key_stats_t *stats, key_counter_t counter) {
+    return atomic_load_explicit(&stats->counters[counter], memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the sample at `fraction` of the way
+// through the histogram, capped at the largest sample seen
+static uint32_t _bucket_percentile(const uint32_t *buckets, uint32_t count, double fraction) {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)(fraction * count);
+    if (rank >= count) {
+        rank = count - 1;
+    }
+    uint32_t seen = 0;
+    for (int b = 0; b < KEY_HIST_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen > rank) {
+            if (b == 0) {
+                return 0;
+            }
+            // The last bucket also holds everything that was clamped
+            return b == KEY_HIST_BUCKETS - 1 ? UINT32_MAX : (1u << b) - 1;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static uint32_t _percentile(const uint32_t *buckets, uint32_t count, uint32_t max,
+                            double fraction) {
+    uint32_t bound = _bucket_percentile(buckets, count, fraction);
+    return bound < max ? bound : max;
+}
+
+// snprintf that keeps a running offset, so truncation only needs checking once
+// at the end
+static void _append(char *buf, size_t len, size_t *off, const char *fmt, ...) {
+    if (*off >= len) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + *off, len - *off, fmt, args);
+    va_end(args);
+    *off = n < 0 ? len : *off + (size_t)n;
+}
+
+static void _append_hist(char *buf, size_t len, size_t *off, const key_hist_t *hist,
+                         const char *unit) {
+    // Snapshot the buckets so the percentiles and the list agree
+    uint32_t buckets[KEY_HIST_BUCKETS];
+    uint32_t count = 0;
+    int last = -1;
+    for (int b = 0; b < KEY_HIST_BUCKETS; b++) {
+        buckets[b] = atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+        count += buckets[b];
+        if (buckets[b] != 0) {
+            last = b;
+        }
+    }
+    uint32_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    _append(buf, len, off,
+            "{\"count\":%u,\"max_%s\":%u,\"p50_%s\":%u,\"p99_%s\":%u,\"buckets\":[",
+            (unsigned)count, unit, (unsigned)max,
+            unit, (unsigned)_percentile(buckets, count, max, 0.5),
+            unit, (unsigned)_percentile(buckets, count, max, 0.99));
+    for (int b = 0; b <= last; b++) {
+        _append(buf, len, off, "%s%u", b ? "," : "", (unsigned)buckets[b]);
+    }
+    _append(buf, len, off, "]}");
+}
+
+int key_hist_format(const key_hist_t *hist, const char *unit, char *buf, size_t len) {
+    size_t off = 0;
+    _append_hist(buf, len, &off, hist, unit);
+    return off < len ? (int)off : -1;
+}
+
+int key_stats_format(const key_stats_t *stats, char *buf, size_t len) {
+    size_t off = 0;
+
+    _append(buf, len, &off, "{\"counters\":{");
+    for (int c = 0; c < KEY_COUNTER_COUNT; c++) {
+        _append(buf, len, &off, "%s\"%s\":%u", c ? "," : "", _counter_names[c],
+                (unsigned)key_stats_counter(stats, c));
+    }
+
+    _append(buf, len, &off, "},\"stages\":{");
+    for (int s = 0; s < KEY_STAGE_COUNT; s++) {
+        _append(buf, len, &off, "%s\"%s\":", s ? "," : "", _stage_names[s]);
+        _append_hist(buf, len, &off, &stats->stages[s], "ns");
+    }
+    _append(buf, len, &off, "}}");
+
+    return off < len ? (int)off : -1;
+}
@@ -0,0 +1,102 @@
+#ifndef KEY_STATS_H
+#define KEY_STATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_cpu.h"
+
+// Where a key event spends its time, from the HID report arriving to the
+// server answering the request that carries it
+typedef enum {
+    KEY_STAGE_DECODE,   // report handed to the pipeline -> events decoded
+    KEY_STAGE_ENQUEUE,  // events decoded -> queued and sender woken
+    KEY_STAGE_QUEUE,    // report received -> event taken by the sender
+    KEY_STAGE_REQUEST,  // request sent -> response received
+    KEY_STAGE_TOTAL,    // report received -> response received
+    KEY_STAGE_COUNT,
+} key_stage_t;
+
+typedef enum {
+    KEY_COUNTER_REPORTS,           // reports handed to the pipeline
+    KEY_COUNTER_BAD_REPORTS,       // reports the device's plan doesn't know
+    KEY_COUNTER_EVENTS,            // press/release events decoded
+    KEY_COUNTER_UNMAPPED,          // events for keys without a path
+    KEY_COUNTER_REQUESTS,          // requests sent
+    KEY_COUNTER_REQUEST_FAILURES,  // requests that got no response
+    KEY_COUNTER_REQUEST_TIMEOUTS,  // requests given up on while still running
+    KEY_COUNTER_STALE,             // presses dropped past their class's deadline
+    KEY_COUNTER_COUNT,
+} key_counter_t;
+
+// Bucket b holds values in [2^(b-1), 2^b); bucket 0 holds 0. The key path
+// records nanoseconds; slower things, like reconnects, use a coarser unit.
+#define KEY_HIST_BUCKETS 32
+
+typedef struct {
+    _Atomic uint32_t count;
+    _Atomic uint32_t max;
+    _Atomic uint32_t buckets[KEY_HIST_BUCKETS];
+} key_hist_t;
+
+// A histogram has a single writer; see key_stats_t
+void key_hist_init(key_hist_t *hist);
+void key_hist_record(key_hist_t *hist, uint32_t value);
+
+// What `now` recorded since `before`, a copy of the same histogram taken
+// earlier, into `out`, e.g. to report one interval at a time without
+// resetting it under its writer. The maximum is only known to the bucket.
+void key_hist_since(const key_hist_t *now, const key_hist_t *before, key_hist_t *out);
+
+// Writes one histogram as a JSON object with `unit` as the suffix of its
+// value fields, e.g. for "ms":
+//
+//   {"count":3,"max_ms":900,"p50_ms":511,"p99_ms":900,"buckets":[0,...,1,2]}
+//
+// Same rules as key_stats_format(). Returns the length written, or -1 if it
+// doesn't fit.
+int key_hist_format(const key_hist_t *hist, const char *unit, char *buf, size_t len);
+
+// Histograms and counters for the hot path. Every histogram and counter has a
+// single writer, either the producer (DECODE, ENQUEUE, REPORTS, BAD_REPORTS,
+// EVENTS) or the consumer (the rest), so recording is a handful of relaxed
+// loads and stores with no locks. Readers on other tasks may see a histogram
+// mid-update, which only skews a snapshot by one sample.
+typedef struct {
+    key_hist_t stages[KEY_STAGE_COUNT];
+    _Atomic uint32_t counters[KEY_COUNTER_COUNT];
+} key_stats_t;
+
+// Stages that stay within one call on one core are timed with the CPU cycle
+// counter, which is much cheaper than esp_timer_get_time(). It wraps every
+// ~27s at 160MHz, which only matters for differences, and it's per core, so
+// never compare readings taken on different tasks.
+static inline uint32_t key_stats_cycles(void) {
+    return esp_cpu_get_cycle_count();
+}
+
+void key_stats_init(key_stats_t *stats);
+
+void key_stats_record_cycles(key_stats_t *stats, key_stage_t stage, uint32_t start,
+                             uint32_t end);
+
+void key_stats_record_us(key_stats_t *stats, key_stage_t stage, int64_t start_us,
+                         int64_t end_us);
+
+void key_stats_count(key_stats_t *stats, key_counter_t counter, uint32_t n);
+
+uint32_t key_stats_counter(const key_stats_t *stats, key_counter_t counter);
+
+// Writes the counters and a summary of each histogram as a JSON object:
+//
+//   {"counters":{"reports":12,...},
+//    "stages":{"decode":{"count":12,"max_ns":9000,"p50_ns":4096,"p99_ns":8192,
+//                        "buckets":[0,0,...,3,9]},...}}
+//
+// Percentiles are the upper bound of the bucket they fall in, capped at the
+// maximum; bucket lists stop at the last non-empty bucket. Returns the length
+// written, or -1 if it doesn't fit.
+int key_stats_format(const key_stats_t *stats, char *buf, size_t len);
+
+#endif // KEY_STATS_H
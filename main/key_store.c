@@ -0,0 +1,127 @@
+#include "key_store.h"
+
+#include <string.h>
+
+// Single writer, like the pipeline's counters
+static inline void _add(_Atomic uint32_t *counter, uint32_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+void key_store_init(key_store_t *store, key_event_t *ring, uint32_t capacity,
+                    uint32_t max_age_ms) {
+    memset(store, 0, sizeof(*store));
+    store->ring = ring;
+    store->capacity = capacity;
+    store->max_age_us = (int64_t)max_age_ms * 1000;
+}
+
+void key_store_set_spill(key_store_t *store, const key_store_spill_t *spill) {
+    store->spill = *spill;
+}
+
+uint32_t key_store_count(const key_store_t *store) {
+    return atomic_load_explicit(&store->depth, memory_order_relaxed);
+}
+
+static void _update_depth(key_store_t *store) {
+    uint32_t depth = store->retry_count + store->unspilled_count + store->spill_count +
+                     store->count;
+    atomic_store_explicit(&store->depth, depth, memory_order_relaxed);
+    if (depth > atomic_load_explicit(&store->max_depth, memory_order_relaxed)) {
+        atomic_store_explicit(&store->max_depth, depth, memory_order_relaxed);
+    }
+}
+
+// Moves the oldest chunk of the ring to the spill area
+static bool _spill(key_store_t *store) {
+    if (store->spill.write == NULL || store->count < KEY_STORE_SPILL_CHUNK) {
+        return false;
+    }
+    key_event_t chunk[KEY_STORE_SPILL_CHUNK];
+    for (uint32_t i = 0; i < KEY_STORE_SPILL_CHUNK; i++) {
+        chunk[i] = store->ring[(store->head + i) % store->capacity];
+    }
+    if (!store->spill.write(store->spill.ctx, chunk, KEY_STORE_SPILL_CHUNK)) {
+        return false;
+    }
+    store->head = (store->head + KEY_STORE_SPILL_CHUNK) % store->capacity;
+    store->count -= KEY_STORE_SPILL_CHUNK;
+    store->spill_count += KEY_STORE_SPILL_CHUNK;
+    _add(&store->spilled, KEY_STORE_SPILL_CHUNK);
+    return true;
+}
+
+bool key_store_push(key_store_t *store, const key_event_t *event, key_event_t *dropped) {
+    bool kept = true;
+    if (store->count == store->capacity && !_spill(store)) {
+        *dropped = store->ring[store->head];
+        store->head = (store->head + 1) % store->capacity;
+        store->count--;
+        _add(&store->dropped, 1);
+        kept = false;
+    }
+    store->ring[(store->head + store->count) % store->capacity] = *event;
+    store->count++;
+    _add(&store->buffered, 1);
+    _update_depth(store);
+    return kept;
+}
+
+bool key_store_push_front(key_store_t *store, const key_event_t *event) {
+    if (store->retry_count == KEY_STORE_RETRY_DEPTH) {
+        _add(&store->dropped, 1);
+        return false;
+    }
+    store->retry[store->retry_count++] = *event;
+    _add(&store->buffered, 1);
+    _update_depth(store);
+    return true;
+}
+
+// Oldest first: retries, what came back from the spill area, the spill area,
+// then the ring
+static bool _take(key_store_t *store, key_event_t *event) {
+    if (store->retry_count > 0) {
+        *event = store->retry[--store->retry_count];
+        return true;
+    }
+    if (store->unspilled_count == 0 && store->spill_count > 0) {
+        uint32_t n = store->spill.read(store->spill.ctx, store->unspilled,
+                                       KEY_STORE_SPILL_CHUNK);
+        // Whatever the spill area can't give back is lost
+        if (n == 0) {
+            _add(&store->dropped, store->spill_count);
+            store->spill_count = 0;
+        } else {
+            store->spill_count -= n;
+        }
+        store->unspilled_head = 0;
+        store->unspilled_count = n;
+    }
+    if (store->unspilled_count > 0) {
+        *event = store->unspilled[store->unspilled_head++];
+        store->unspilled_count--;
+        return true;
+    }
+    if (store->count > 0) {
+        *event = store->ring[store->head];
+        store->head = (store->head + 1) % store->capacity;
+        store->count--;
+        return true;
+    }
+    return false;
+}
+
+key_store_result_t key_store_pop(key_store_t *store, key_event_t *event, int64_t now_us) {
+    if (!_take(store, event)) {
+        return KEY_STORE_EMPTY;
+    }
+    _update_depth(store);
+    if (now_us - event->timestamp_us > store->max_age_us) {
+        _add(&store->expired, 1);
+        return KEY_STORE_EXPIRED;
+    }
+    _add(&store->replayed, 1);
+    return KEY_STORE_EVENT;
+}
@@ -0,0 +1,99 @@
+#ifndef KEY_STORE_H
+#define KEY_STORE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "key_event.h"
+
+// Room for the events of every request that can fail at once, plus what the
+// pipeline has waiting behind them (its backlog, or the batch collecting)
+#if CONFIG_KEY_BATCH_ENABLE
+#define KEY_STORE_RETRY_DEPTH (CONFIG_KEY_HTTP_INFLIGHT + 2 * CONFIG_KEY_BATCH_MAX_EVENTS)
+#else
+#define KEY_STORE_RETRY_DEPTH (CONFIG_KEY_HTTP_INFLIGHT + 1)
+#endif
+
+// Events moved to or from the spill area at a time
+#define KEY_STORE_SPILL_CHUNK 16
+
+// Somewhere to put the oldest events when the RAM ring fills up, e.g. a flash
+// partition. Events must come back from read() in the order they were
+// written.
+typedef struct {
+    // Returns false if there's no room for all `count` events
+    bool (*write)(void *ctx, const key_event_t *events, uint32_t count);
+    // Removes and returns up to `max` of the oldest events
+    uint32_t (*read)(void *ctx, key_event_t *events, uint32_t max);
+    void *ctx;
+} key_store_spill_t;
+
+typedef enum {
+    KEY_STORE_EMPTY,
+    KEY_STORE_EVENT,        // the next event to send
+    KEY_STORE_EXPIRED,      // an event that was held too long, to be dropped
+} key_store_result_t;
+
+// Key events held by the consumer while the server can't be reached, to be
+// replayed in the order they arrived once it can. Holds, oldest first:
+//
+//   retry      events whose requests failed, put back ahead of the rest
+//   spill      with a spill area, what overflowed the RAM ring, plus a chunk
+//              read back from it
+//   ring       the newest events
+//
+// Events older than `max_age_ms` when they come up for replay are expired
+// rather than sent. With the ring full and no spill area (or a full one) the
+// oldest event is dropped to make room.
+//
+// Only the consumer changes it; the counters can be read from any task.
+typedef struct {
+    key_event_t *ring;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    key_event_t retry[KEY_STORE_RETRY_DEPTH];
+    uint32_t retry_count;   // a stack: the last one put back goes first
+
+    key_store_spill_t spill;    // write is NULL without a spill area
+    uint32_t spill_count;       // events in the spill area
+    key_event_t unspilled[KEY_STORE_SPILL_CHUNK];
+    uint32_t unspilled_head;
+    uint32_t unspilled_count;
+
+    int64_t max_age_us;
+
+    _Atomic uint32_t depth;         // events held, including spilled ones
+    _Atomic uint32_t buffered;      // events taken in, including retries
+    _Atomic uint32_t replayed;      // events handed back for sending
+    _Atomic uint32_t expired;
+    _Atomic uint32_t dropped;
+    _Atomic uint32_t spilled;       // events written to the spill area
+    _Atomic uint32_t max_depth;
+} key_store_t;
+
+// `ring` must point to `capacity` entries that outlive the store
+void key_store_init(key_store_t *store, key_event_t *ring, uint32_t capacity,
+                    uint32_t max_age_ms);
+
+// Optional; call before anything is pushed
+void key_store_set_spill(key_store_t *store, const key_store_spill_t *spill);
+
+// Adds the newest event. Returns false if the oldest had to be dropped to make
+// room, in which case it's copied to `dropped`.
+bool key_store_push(key_store_t *store, const key_event_t *event, key_event_t *dropped);
+
+// Puts back an event whose request failed so it goes out before anything
+// else. To put back several, push the newest first. Returns false if there's
+// no room, in which case the event is counted as dropped.
+bool key_store_push_front(key_store_t *store, const key_event_t *event);
+
+// Takes the oldest event
+key_store_result_t key_store_pop(key_store_t *store, key_event_t *event, int64_t now_us);
+
+uint32_t key_store_count(const key_store_t *store);
+
+#endif // KEY_STORE_H
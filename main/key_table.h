@@ -0,0 +1,45 @@
+#ifndef KEY_TABLE_H
+#define KEY_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KEY_TABLE_PATH_PREFIX "/remote/"
+
+// Full request path for every possible key code, NULL for unmapped keys.
+// Generated at build time from key_mappings.txt and kept in flash, so a
+// lookup is a single load and any uint8_t is a valid index.
+extern const char *const key_table_paths[256];
+
+static inline const char *key_table_path(uint8_t key) {
+    return key_table_paths[key];
+}
+
+// Priority classes, from the third field of key_mappings.txt
+#define KEY_CLASS_NORMAL 0
+#define KEY_CLASS_HIGH   1
+#define KEY_CLASS_COUNT  2
+
+extern const uint8_t key_table_classes[256];
+
+static inline uint8_t key_table_class(uint8_t key) {
+    return key_table_classes[key];
+}
+
+// The key's name, i.e. its path without KEY_TABLE_PATH_PREFIX
+static inline const char *key_table_name(uint8_t key) {
+    const char *path = key_table_paths[key];
+    return path != NULL ? path + sizeof(KEY_TABLE_PATH_PREFIX) - 1 : NULL;
+}
+
+// Every key name in usb_hid_codes.h (KEY_MOD_* aside) with its code, sorted
+// by name, for parsing bindings at runtime
+typedef struct {
+    const char *name;
+    uint8_t code;
+} key_table_code_t;
+
+extern const key_table_code_t key_table_codes[];
+extern const size_t key_table_code_count;
+
+#endif // KEY_TABLE_H
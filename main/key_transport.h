@@ -0,0 +1,46 @@
+#ifndef KEY_TRANSPORT_H
+#define KEY_TRANSPORT_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "key_event.h"
+
+// A request handed to an asynchronous transport. The transport fills in `ret`
+// and `status` and then calls done(), from whichever task ran the request.
+//
+// HTTP transports use the path and body. Binary ones (WebSocket, UDP) encode
+// `event` instead, and answer a batch, which has no event, with a 501 so the
+// pipeline falls back to sending each key on its own.
+typedef struct key_request key_request_t;
+struct key_request {
+    const char *path;
+    const char *content_type;   // NULL for a GET
+    const key_event_t *event;   // the press behind a per-key request, else NULL
+    const char *body;
+    int body_len;
+    esp_err_t ret;
+    int status;
+    void (*done)(key_request_t *request);
+};
+
+// How the sender reaches the server. On the device this wraps http_conn or
+// http_pool, ws_transport or key_udp depending on KEY_TRANSPORT; the host
+// build plugs in a plain socket client or key_udp.
+//
+// A blocking transport provides get() and post(), which return once the
+// response has been read and set `status` to the HTTP status code. An
+// asynchronous one provides start() instead, which queues the request and
+// returns straight away, and says how many requests it can run at once.
+typedef struct {
+    esp_err_t (*get)(void *ctx, const char *path, int *status);
+    esp_err_t (*post)(void *ctx, const char *path, const char *content_type,
+                      const char *body, int body_len, int *status);
+    // Returns ESP_OK if the request was accepted, in which case done() will
+    // be called exactly once
+    esp_err_t (*start)(void *ctx, key_request_t *request);
+    uint32_t max_inflight;
+    void *ctx;
+} key_transport_t;
+
+#endif // KEY_TRANSPORT_H
@@ -0,0 +1,189 @@
+#include "key_udp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define KEY_UDP_SLOT_FREE 0
+#define KEY_UDP_SLOT_SENT 1
+
+bool key_udp_init(key_udp_t *udp, const char *host, uint16_t port, uint32_t retransmit_ms,
+                  uint32_t max_attempts) {
+    memset(udp, 0, sizeof(*udp));
+    udp->sock = -1;
+    udp->server.sin_family = AF_INET;
+    udp->server.sin_port = htons(port);
+    udp->retransmit_us = (int64_t)retransmit_ms * 1000;
+    udp->max_attempts = max_attempts;
+    for (int i = 0; i < KEY_UDP_MAX_INFLIGHT; i++) {
+        atomic_init(&udp->slots[i].state, KEY_UDP_SLOT_FREE);
+    }
+    return inet_pton(AF_INET, host, &udp->server.sin_addr) == 1;
+}
+
+bool key_udp_open(key_udp_t *udp) {
+    const char *TAG = "key_udp_open";
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket: %d", errno);
+        return false;
+    }
+    // Connected, so only the server's datagrams come back
+    if (connect(sock, (struct sockaddr *)&udp->server, sizeof(udp->server)) != 0) {
+        ESP_LOGE(TAG, "Failed to set up socket: %d", errno);
+        close(sock);
+        return false;
+    }
+    udp->sock = sock;
+    return true;
+}
+
+void key_udp_close(key_udp_t *udp) {
+    if (udp->sock >= 0) {
+        close(udp->sock);
+        udp->sock = -1;
+    }
+}
+
+static void _finish(key_udp_slot_t *slot, esp_err_t ret, int status) {
+    key_request_t *request = slot->request;
+    request->ret = ret;
+    request->status = status;
+    atomic_store_explicit(&slot->state, KEY_UDP_SLOT_FREE, memory_order_release);
+    request->done(request);
+}
+
+static void _ack(key_udp_t *udp, uint16_t seq) {
+    for (int i = 0; i < KEY_UDP_MAX_INFLIGHT; i++) {
+        key_udp_slot_t *slot = &udp->slots[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) == KEY_UDP_SLOT_SENT &&
+            slot->seq == seq) {
+            udp->stats.acked++;
+            _finish(slot, ESP_OK, 200);
+            return;
+        }
+    }
+    // An ack for a datagram that was sent twice and already acknowledged
+}
+
+// Until the next retransmit is due. A datagram sent while waiting is due a
+// whole interval later, so waiting at most one interval never makes it late.
+static int64_t _wait_us(const key_udp_t *udp, int64_t now) {
+    int64_t wait_us = udp->retransmit_us;
+    for (int i = 0; i < KEY_UDP_MAX_INFLIGHT; i++) {
+        const key_udp_slot_t *slot = &udp->slots[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) == KEY_UDP_SLOT_SENT) {
+            int64_t due_us = slot->sent_us + udp->retransmit_us - now;
+            if (due_us < wait_us) {
+                wait_us = due_us < 0 ? 0 : due_us;
+            }
+        }
+    }
+    return wait_us;
+}
+
+void key_udp_poll(key_udp_t *udp) {
+    uint8_t buf[KEY_WIRE_EVENT_LEN];
+    uint16_t seq;
+
+    int64_t wait_us = _wait_us(udp, esp_timer_get_time());
+    struct timeval timeout = {
+        .tv_sec = wait_us / 1000000,
+        .tv_usec = wait_us % 1000000,
+    };
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(udp->sock, &fds);
+    if (select(udp->sock + 1, &fds, NULL, NULL, &timeout) > 0) {
+        ssize_t n = recv(udp->sock, buf, sizeof(buf), 0);
+        if (n > 0 && key_wire_decode_ack(buf, n, &seq)) {
+            _ack(udp, seq);
+        }
+    }
+
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < KEY_UDP_MAX_INFLIGHT; i++) {
+        key_udp_slot_t *slot = &udp->slots[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) != KEY_UDP_SLOT_SENT ||
+            now - slot->sent_us < udp->retransmit_us) {
+            continue;
+        }
+        if (slot->attempts >= udp->max_attempts) {
+            udp->stats.failures++;
+            _finish(slot, ESP_ERR_TIMEOUT, 0);
+            continue;
+        }
+        slot->attempts++;
+        slot->sent_us = now;
+        udp->stats.retransmits++;
+        send(udp->sock, slot->packet, sizeof(slot->packet), 0);
+    }
+}
+
+int key_udp_format_stats(const key_udp_t *udp, char *buf, size_t len) {
+    const key_udp_stats_t *stats = &udp->stats;
+    int n = snprintf(buf, len,
+                     "{\"sent\":%u,\"acked\":%u,\"retransmits\":%u,\"failures\":%u,"
+                     "\"bytes\":%u}",
+                     (unsigned)stats->sent, (unsigned)stats->acked,
+                     (unsigned)stats->retransmits, (unsigned)stats->failures,
+                     (unsigned)((stats->sent + stats->retransmits) * KEY_WIRE_EVENT_LEN));
+    return n < 0 || (size_t)n >= len ? -1 : n;
+}
+
+static esp_err_t transport_start(void *ctx, key_request_t *request) {
+    key_udp_t *udp = ctx;
+
+    // Batches are HTTP only; a 501 makes the pipeline send the keys one by one
+    if (request->event == NULL) {
+        request->ret = ESP_OK;
+        request->status = 501;
+        request->done(request);
+        return ESP_OK;
+    }
+    if (udp->sock < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    key_udp_slot_t *slot = NULL;
+    for (int i = 0; i < KEY_UDP_MAX_INFLIGHT; i++) {
+        if (atomic_load_explicit(&udp->slots[i].state, memory_order_acquire) ==
+            KEY_UDP_SLOT_FREE) {
+            slot = &udp->slots[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    slot->seq = udp->next_seq++;
+    slot->attempts = 1;
+    slot->request = request;
+    key_wire_encode_event(slot->packet, slot->seq, request->event);
+    slot->sent_us = esp_timer_get_time();
+    // Before sending, so an ack can't come back for a slot that isn't sent yet
+    atomic_store_explicit(&slot->state, KEY_UDP_SLOT_SENT, memory_order_release);
+    udp->stats.sent++;
+    // A datagram that doesn't go out is no different from one that got lost
+    send(udp->sock, slot->packet, sizeof(slot->packet), 0);
+    return ESP_OK;
+}
+
+key_transport_t key_udp_transport(key_udp_t *udp) {
+    key_transport_t transport = {
+        .start = transport_start,
+        .max_inflight = KEY_UDP_MAX_INFLIGHT,
+        .ctx = udp,
+    };
+    return transport;
+}
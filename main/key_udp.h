@@ -0,0 +1,73 @@
+#ifndef KEY_UDP_H
+#define KEY_UDP_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "key_transport.h"
+#include "key_wire.h"
+#include "sdkconfig.h"
+
+#define KEY_UDP_MAX_INFLIGHT CONFIG_KEY_HTTP_INFLIGHT
+
+typedef struct {
+    uint32_t sent;          // events sent, not counting retransmits
+    uint32_t acked;
+    uint32_t retransmits;
+    uint32_t failures;      // events given up on after the last attempt
+} key_udp_stats_t;
+
+typedef struct {
+    _Atomic uint32_t state;     // KEY_UDP_SLOT_*
+    uint16_t seq;
+    uint8_t attempts;
+    int64_t sent_us;            // last time the datagram went out
+    key_request_t *request;
+    uint8_t packet[KEY_WIRE_EVENT_LEN];
+} key_udp_slot_t;
+
+// Asynchronous transport that sends each key press as one key_wire datagram
+// and waits for the server's ack, sending it again every `retransmit_ms` up
+// to `max_attempts` times. Plain BSD sockets, so the same code runs on lwIP
+// and on the host.
+//
+// Two tasks share it: the sender calls start() through the transport, and a
+// task of its own calls key_udp_poll() in a loop to take acks and retransmit.
+// A slot belongs to the sender while free and to the polling task while sent.
+typedef struct {
+    int sock;
+    struct sockaddr_in server;
+    int64_t retransmit_us;
+    uint32_t max_attempts;
+    uint16_t next_seq;          // sender only
+    key_udp_slot_t slots[KEY_UDP_MAX_INFLIGHT];
+    key_udp_stats_t stats;      // each counter has a single writer
+} key_udp_t;
+
+// Returns false if `host` isn't an IPv4 address
+bool key_udp_init(key_udp_t *udp, const char *host, uint16_t port, uint32_t retransmit_ms,
+                  uint32_t max_attempts);
+
+// Creates the socket. On the device the network stack has to be up first.
+bool key_udp_open(key_udp_t *udp);
+
+// Waits for an ack until the next retransmit is due (at most one interval),
+// then resends whatever is overdue. Completed requests are handed back from
+// here.
+void key_udp_poll(key_udp_t *udp);
+
+// Once the polling task has stopped
+void key_udp_close(key_udp_t *udp);
+
+// Writes the counters as a JSON object. Returns the length written, or -1 if
+// it doesn't fit.
+int key_udp_format_stats(const key_udp_t *udp, char *buf, size_t len);
+
+// A transport for key_pipeline_init() with KEY_UDP_MAX_INFLIGHT presses in
+// flight
+key_transport_t key_udp_transport(key_udp_t *udp);
+
+#endif // KEY_UDP_H
@@ -0,0 +1,53 @@
+#include "key_wire.h"
+
+static void _put16(uint8_t *buf, uint16_t value) {
+    buf[0] = value & 0xff;
+    buf[1] = value >> 8;
+}
+
+static uint16_t _get16(const uint8_t *buf) {
+    return buf[0] | (uint16_t)buf[1] << 8;
+}
+
+void key_wire_encode_event(uint8_t *buf, uint16_t seq, const key_event_t *event) {
+    uint32_t timestamp = (uint32_t)event->timestamp_us;
+
+    buf[0] = KEY_WIRE_MAGIC;
+    buf[1] = KEY_WIRE_EVENT;
+    _put16(buf + 2, seq);
+    buf[4] = event->device;
+    buf[5] = event->key;
+    buf[6] = event->mods;
+    buf[7] = event->type;
+    _put16(buf + 8, event->count);
+    _put16(buf + 10, timestamp & 0xffff);
+    _put16(buf + 12, timestamp >> 16);
+}
+
+void key_wire_encode_ack(uint8_t *buf, uint16_t seq) {
+    buf[0] = KEY_WIRE_MAGIC;
+    buf[1] = KEY_WIRE_ACK;
+    _put16(buf + 2, seq);
+}
+
+bool key_wire_decode_event(const uint8_t *buf, size_t len, uint16_t *seq, key_event_t *event) {
+    if (len != KEY_WIRE_EVENT_LEN || buf[0] != KEY_WIRE_MAGIC || buf[1] != KEY_WIRE_EVENT) {
+        return false;
+    }
+    *seq = _get16(buf + 2);
+    event->device = buf[4];
+    event->key = buf[5];
+    event->mods = buf[6];
+    event->type = buf[7];
+    event->count = _get16(buf + 8);
+    event->timestamp_us = _get16(buf + 10) | (uint32_t)_get16(buf + 12) << 16;
+    return true;
+}
+
+bool key_wire_decode_ack(const uint8_t *buf, size_t len, uint16_t *seq) {
+    if (len != KEY_WIRE_ACK_LEN || buf[0] != KEY_WIRE_MAGIC || buf[1] != KEY_WIRE_ACK) {
+        return false;
+    }
+    *seq = _get16(buf + 2);
+    return true;
+}
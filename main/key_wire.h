@@ -0,0 +1,49 @@
+#ifndef KEY_WIRE_H
+#define KEY_WIRE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "key_event.h"
+
+// Compact binary encoding of key events, used by the WebSocket and UDP
+// transports. All fields are little-endian.
+//
+//   event (14 bytes)           ack (4 bytes, UDP only)
+//   0     'K'                  0     'K'
+//   1     KEY_WIRE_EVENT       1     KEY_WIRE_ACK
+//   2-3   sequence number      2-3   sequence number being acknowledged
+//   4     device
+//   5     keycode (USB HID usage)
+//   6     modifiers (KEY_MOD_* bits)
+//   7     KEY_EVENT_PRESS (KEY_EVENT_RELEASE is reserved)
+//   8-9   count of identical events merged into this one
+//   10-13 timestamp: low 32 bits of the receiver's microsecond clock
+//
+// Only presses are sent, as on the per-key HTTP endpoint, so byte 7 is always
+// KEY_EVENT_PRESS for now. The sequence number counts up by one per event and
+// wraps at 65536. The timestamp wraps every 71 minutes; it's for measuring
+// intervals, not for telling the time.
+
+#define KEY_WIRE_MAGIC 'K'
+#define KEY_WIRE_EVENT 0x01
+#define KEY_WIRE_ACK   0x02
+
+#define KEY_WIRE_EVENT_LEN 14
+#define KEY_WIRE_ACK_LEN   4
+
+// Writes KEY_WIRE_EVENT_LEN bytes
+void key_wire_encode_event(uint8_t *buf, uint16_t seq, const key_event_t *event);
+
+// Writes KEY_WIRE_ACK_LEN bytes
+void key_wire_encode_ack(uint8_t *buf, uint16_t seq);
+
+// Returns false if `buf` isn't an event. The decoded timestamp only has the
+// 32 bits that were sent.
+bool key_wire_decode_event(const uint8_t *buf, size_t len, uint16_t *seq, key_event_t *event);
+
+// Returns false if `buf` isn't an ack
+bool key_wire_decode_ack(const uint8_t *buf, size_t len, uint16_t *seq);
+
+#endif // KEY_WIRE_H
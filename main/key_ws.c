@@ -0,0 +1,110 @@
+#include "key_ws.h"
+
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#include "key_wire.h"
+
+#define KEY_WS_RECONNECT_MS 1000
+
+// Runs on the client's task
+static void key_ws_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    const char *TAG = "key_ws";
+    key_ws_t *ws = arg;
+
+    switch (id) {
+        case WEBSOCKET_EVENT_CONNECTED:
+            ws->stats.connects++;
+            ESP_LOGI(TAG, "Connected to %s", ws->uri);
+            break;
+        case WEBSOCKET_EVENT_DISCONNECTED:
+            ws->stats.disconnects++;
+            ESP_LOGW(TAG, "Disconnected from %s", ws->uri);
+            break;
+        default:
+            break;
+    }
+}
+
+void key_ws_init(key_ws_t *ws, const char *host) {
+    snprintf(ws->uri, sizeof(ws->uri), "ws://%s:%d%s", host, CONFIG_KEY_TRANSPORT_PORT,
+             CONFIG_KEY_WEBSOCKET_PATH);
+    ws->client = NULL;
+    ws->next_seq = 0;
+    ws->stats = (key_ws_stats_t){ 0 };
+}
+
+bool key_ws_start(key_ws_t *ws) {
+    const char *TAG = "key_ws_start";
+
+    esp_websocket_client_config_t config = {
+        .uri = ws->uri,
+        .reconnect_timeout_ms = KEY_WS_RECONNECT_MS,
+        .network_timeout_ms = CONFIG_KEY_HTTP_TIMEOUT_MS,
+    };
+    ws->client = esp_websocket_client_init(&config);
+    if (ws->client == NULL) {
+        ESP_LOGE(TAG, "Failed to create WebSocket client");
+        return false;
+    }
+    esp_websocket_register_events(ws->client, WEBSOCKET_EVENT_ANY, key_ws_event_handler, ws);
+    esp_err_t ret = esp_websocket_client_start(ws->client);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start WebSocket client: %s", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+int key_ws_format_stats(const key_ws_t *ws, char *buf, size_t len) {
+    const key_ws_stats_t *stats = &ws->stats;
+    int n = snprintf(buf, len,
+                     "{\"sent\":%u,\"failures\":%u,\"connects\":%u,\"disconnects\":%u}",
+                     (unsigned)stats->sent, (unsigned)stats->failures,
+                     (unsigned)stats->connects, (unsigned)stats->disconnects);
+    return n < 0 || (size_t)n >= len ? -1 : n;
+}
+
+// Completes before returning, so the sender never has more than one press
+// outstanding and they reach the server in order
+static esp_err_t transport_start(void *ctx, key_request_t *request) {
+    key_ws_t *ws = ctx;
+
+    // Batches are HTTP only; a 501 makes the pipeline send the keys one by one
+    if (request->event == NULL) {
+        request->ret = ESP_OK;
+        request->status = 501;
+        request->done(request);
+        return ESP_OK;
+    }
+    if (ws->client == NULL || !esp_websocket_client_is_connected(ws->client)) {
+        ws->stats.failures++;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint8_t frame[KEY_WIRE_EVENT_LEN];
+    key_wire_encode_event(frame, ws->next_seq++, request->event);
+    if (esp_websocket_client_send_bin(ws->client, (const char *)frame, sizeof(frame),
+                                      pdMS_TO_TICKS(CONFIG_KEY_HTTP_TIMEOUT_MS)) !=
+        sizeof(frame)) {
+        ws->stats.failures++;
+        return ESP_FAIL;
+    }
+    ws->stats.sent++;
+    request->ret = ESP_OK;
+    request->status = 200;
+    request->done(request);
+    return ESP_OK;
+}
+
+key_transport_t key_ws_transport(key_ws_t *ws) {
+    key_transport_t transport = {
+        .start = transport_start,
+        .max_inflight = 1,
+        .ctx = ws,
+    };
+    return transport;
+}
@@ -0,0 +1,40 @@
+#ifndef KEY_WS_H
+#define KEY_WS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_websocket_client.h"
+
+#include "key_transport.h"
+
+typedef struct {
+    uint32_t sent;
+    uint32_t failures;      // presses that couldn't be sent, e.g. while reconnecting
+    uint32_t connects;
+    uint32_t disconnects;
+} key_ws_stats_t;
+
+// Sends each key press as one binary key_wire frame over a single persistent
+// WebSocket connection to ws://host:KEY_TRANSPORT_PORT/KEY_WEBSOCKET_PATH.
+// The client reconnects by itself from its own task. Sending only queues the
+// frame on the TCP connection, so it's done from the sender task without
+// waiting for the server.
+typedef struct {
+    char uri[64];
+    esp_websocket_client_handle_t client;
+    uint16_t next_seq;
+    key_ws_stats_t stats;
+} key_ws_t;
+
+void key_ws_init(key_ws_t *ws, const char *host);
+
+// Connects; the network has to be up
+bool key_ws_start(key_ws_t *ws);
+
+int key_ws_format_stats(const key_ws_t *ws, char *buf, size_t len);
+
+key_transport_t key_ws_transport(key_ws_t *ws);
+
+#endif // KEY_WS_H
@@ -4,93 +4,322 @@
 #include "esp_bt_device.h"
 #include "esp_bt.h"
 #include "esp_err.h"
-#include "esp_http_client.h"
 #include "esp_gap_bt_api.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include <stdio.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
-
-#include "usb_hid_codes.h"
+#include "freertos/task.h"
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+#include "binding_config.h"
+#endif
+#include "boot_phase.h"
+#include "device_table.h"
+#if CONFIG_KEY_TRACE_CAPTURE
+#include "hid_capture.h"
+#endif
+#include "hid_supervisor.h"
+#include "http_conn.h"
+#include "http_pool.h"
+#if CONFIG_KEY_LOADGEN_ENABLE
+#include "esp_system.h"
+#include "key_loadgen.h"
+#endif
+#include "key_log.h"
+#include "key_pipeline.h"
+#if CONFIG_KEY_STORE_FLASH
+#include "key_spill.h"
+#endif
+#include "key_udp.h"
+#if CONFIG_KEY_TRANSPORT_WEBSOCKET
+#include "key_ws.h"
+#endif
+#include "status_server.h"
+#include "task_stats.h"
+#include "wifi_cache.h"
 #include "wifi_constants.h"
 
-// Set this to the BT MAC adress of the HID device that you're connecting to
+// Set this to the BT MAC adress of the HID device that you're connecting to.
+// It seeds the device table the first time; after that any keyboard that
+// pairs is added, up to CONFIG_KEY_MAX_DEVICES.
 static esp_bd_addr_t _peer_bd_addr = { 0xDC, 0x2C, 0x26, 0x00, 0x37, 0xA9 };
 
 #define READY_TIMEOUT (10 * 1000)
 
+// Like every long-lived object of ours, the event groups, queues and task
+// stacks are static: nothing the receiver keeps is taken from the heap, which
+// is left to the IDF's drivers. See tools/mem_report.py for the budget.
+
 // _hid_event_group
+static StaticEventGroup_t _hid_event_group_buf;
 static EventGroupHandle_t _hid_event_group = NULL;
 #define HID_RUNNING      0x01
-#define HID_CONNECTED    0x02
-#define HID_CLOSED       0x04
 
 // _wifi_event_group
+static StaticEventGroup_t _wifi_event_group_buf;
 static EventGroupHandle_t _wifi_event_group = NULL;
 #define WIFI_CONNECTED   0x01
-#define WIFI_FAIL        0x02
-
-// HTTP defs
-char *key_mappings[0x64];
-static void init_key_mappings(void) {
-    key_mappings[KEY_KP0] = "0";
-    key_mappings[KEY_KP1] = "1";
-    key_mappings[KEY_KP2] = "2";
-    key_mappings[KEY_KP3] = "3";
-    key_mappings[KEY_KP4] = "4";
-    key_mappings[KEY_KP5] = "5";
-    key_mappings[KEY_KP6] = "6";
-    key_mappings[KEY_KP7] = "7";
-    key_mappings[KEY_KP8] = "8";
-    key_mappings[KEY_KP9] = "9";
-    key_mappings[KEY_KPDOT] = "dot";
-    key_mappings[KEY_KPSLASH] = "slash";
-    key_mappings[KEY_KPASTERISK] = "asterisk";
-    key_mappings[KEY_KPMINUS] = "minus";
-    key_mappings[KEY_KPPLUS] = "plus";
-    key_mappings[KEY_KPENTER] = "enter";
-    key_mappings[KEY_ESC] = "esc";
-    key_mappings[KEY_TAB] = "tab";
-    key_mappings[KEY_BACKSPACE] = "backspace";
+
+static esp_netif_t *_sta_netif = NULL;
+// Connecting straight to the access point (and address) that worked last time,
+// and whether that hasn't got an address yet
+static bool _wifi_use_cache = false;
+static bool _wifi_cache_pending = false;
+static wifi_cache_t _wifi_cache;
+// Reconnecting after losing the access point, backing off from
+// WIFI_RETRY_MIN_MS up to KEY_WIFI_RECONNECT_MAX_MS
+#define WIFI_RETRY_MIN_MS 250
+static esp_timer_handle_t _wifi_retry_timer = NULL;
+static uint32_t _wifi_retry_ms = WIFI_RETRY_MIN_MS;
+
+// Brings Wi-Fi up alongside Bluetooth rather than after it. It's done before
+// the first key, so its stack comes from the heap and goes back there.
+#define WIFI_INIT_TASK_STACK_SIZE 4096
+#define WIFI_INIT_TASK_PRIORITY 1
+
+// Key events are handed from the HID callback to the sender task through a
+// lock-free ring so that HTTP round-trips never stall the Bluetooth stack
+static key_pipeline_t _pipeline;
+static StackType_t _sender_stack[CONFIG_KEY_SENDER_TASK_STACK_SIZE];
+static StaticTask_t _sender_tcb;
+static TaskHandle_t _sender_task = NULL;
+#if CONFIG_KEY_STORE_FLASH
+static key_spill_t _key_spill;
+#endif
+
+#if CONFIG_KEY_TRANSPORT_UDP
+// Datagrams go out from the sender task; acks come back on a task of their own
+#define UDP_TASK_STACK_SIZE 3072
+
+static key_udp_t _udp;
+static StackType_t _udp_stack[UDP_TASK_STACK_SIZE];
+static StaticTask_t _udp_tcb;
+
+static void udp_task(void *arg) {
+    for (;;) {
+        key_udp_poll(&_udp);
+    }
+}
+#elif CONFIG_KEY_TRANSPORT_WEBSOCKET
+static key_ws_t _ws;
+#elif CONFIG_KEY_HTTP_INFLIGHT > 1
+// Connections and worker tasks that let requests overlap
+static http_pool_t _http_pool;
+
+static void _get_conn_stats(http_conn_stats_t *stats) {
+    http_pool_get_stats(&_http_pool, stats);
 }
+#else
+// Owned by the sender task; reused across requests
+static http_conn_t _http_conn;
 
-static void send_request(const char *path) {
-    const char *TAG = "send_request";
-    esp_http_client_config_t config = {
-        .host = SERVER_IP,
-        .path = path,
-    };
+static void _get_conn_stats(http_conn_stats_t *stats) {
+    *stats = _http_conn.stats;
+}
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+static esp_err_t http_transport_get(void *ctx, const char *path, int *status) {
+    http_conn_t *conn = ctx;
+    esp_err_t ret = http_conn_get(conn, path);
+    *status = conn->status;
+    return ret;
+}
 
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Error initializing HTTP client");
-        return;
+static esp_err_t http_transport_post(void *ctx, const char *path, const char *content_type,
+                                     const char *body, int body_len, int *status) {
+    http_conn_t *conn = ctx;
+    esp_err_t ret = http_conn_post(conn, path, content_type, body, body_len);
+    *status = conn->status;
+    return ret;
+}
+#endif
+
+#if CONFIG_KEY_STATUS_SERVER_ENABLE
+// The transport's counters, for /status
+static int _format_connection(char *buf, size_t len) {
+#if CONFIG_KEY_TRANSPORT_UDP
+    return key_udp_format_stats(&_udp, buf, len);
+#elif CONFIG_KEY_TRANSPORT_WEBSOCKET
+    return key_ws_format_stats(&_ws, buf, len);
+#else
+    http_conn_stats_t stats;
+    _get_conn_stats(&stats);
+    int n = snprintf(buf, len,
+                     "{\"requests\":%u,\"connects\":%u,\"reuses\":%u,\"reconnects\":%u,"
+                     "\"failures\":%u}",
+                     stats.requests, stats.connects, stats.reuses, stats.reconnects,
+                     stats.failures);
+    return n < 0 || (size_t)n >= len ? -1 : n;
+#endif
+}
+#endif
+
+// Sockets can only be opened once the network is up
+static bool _start_transport(void) {
+    const char *TAG = "_start_transport";
+
+#if CONFIG_KEY_TRANSPORT_UDP
+    if (!key_udp_open(&_udp)) {
+        return false;
+    }
+    if (xTaskCreateStaticPinnedToCore(udp_task, "key_udp", UDP_TASK_STACK_SIZE, NULL,
+                                      CONFIG_KEY_HTTP_TASK_PRIORITY, _udp_stack, &_udp_tcb,
+                                      TASK_CORE(CONFIG_KEY_HTTP_TASK_CORE)) == NULL) {
+        ESP_LOGE(TAG, "Failed to create UDP task");
+        return false;
+    }
+#elif CONFIG_KEY_TRANSPORT_WEBSOCKET
+    if (!key_ws_start(&_ws)) {
+        return false;
     }
+#endif
+    ESP_LOGI(TAG, "Sending key presses to %s", SERVER_IP);
+    return true;
+}
+
+static void sender_task(void *arg) {
+#if CONFIG_KEY_TRANSPORT_HTTP
+    const char *TAG = "sender_task";
+    uint32_t reported_reconnects = 0;
+#endif
+
+    // Keys typed while Wi-Fi is still coming up wait in the queues
+    xEventGroupWaitBits(_wifi_event_group, WIFI_CONNECTED, pdFALSE, pdFALSE, portMAX_DELAY);
+    _start_transport();
+
+    for (;;) {
+        // Wake up in time to send a batch that's still waiting for company
+        TickType_t wait = portMAX_DELAY;
+        int64_t due_us = key_pipeline_due_in(&_pipeline, esp_timer_get_time());
+        if (due_us >= 0) {
+            wait = pdMS_TO_TICKS(due_us / 1000) + 1;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+        key_pipeline_process(&_pipeline);
+
+#if CONFIG_KEY_TRANSPORT_HTTP
+        http_conn_stats_t conn_stats;
+        _get_conn_stats(&conn_stats);
+        if (conn_stats.reconnects != reported_reconnects) {
+            ESP_LOGI(TAG, "HTTP connection: %u requests, %u connects, %u reuses, %u reconnects, %u failures",
+                     conn_stats.requests, conn_stats.connects, conn_stats.reuses,
+                     conn_stats.reconnects, conn_stats.failures);
+            reported_reconnects = conn_stats.reconnects;
+        }
+#endif
+    }
+}
+
+// Writes out what the HID callback and sender task have logged, at a priority
+// low enough that it only runs when they're idle
+#define LOG_TASK_STACK_SIZE 3072
+
+static StackType_t _log_stack[LOG_TASK_STACK_SIZE];
+static StaticTask_t _log_tcb;
+
+static void log_task(void *arg) {
+#if CONFIG_KEY_TASK_REPORT_INTERVAL_S
+    int64_t next_report_us = (int64_t)CONFIG_KEY_TASK_REPORT_INTERVAL_S * 1000000;
+#endif
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_KEY_LOG_INTERVAL_MS));
+        key_log_drain();
+#if CONFIG_KEY_TRACE_CAPTURE
+        hid_capture_flush();
+#endif
+        boot_phase_report();
+#if CONFIG_KEY_TASK_REPORT_INTERVAL_S
+        if (esp_timer_get_time() >= next_report_us) {
+            task_stats_log();
+            next_report_us += (int64_t)CONFIG_KEY_TASK_REPORT_INTERVAL_S * 1000000;
+        }
+#endif
+    }
+}
+
+static bool _init_log(void) {
+    const char *TAG = "_init_log";
+
+    key_log_init();
+    task_stats_init();
+    if (xTaskCreateStaticPinnedToCore(log_task, "key_log", LOG_TASK_STACK_SIZE, NULL,
+                                      CONFIG_KEY_LOG_TASK_PRIORITY, _log_stack, &_log_tcb,
+                                      TASK_CORE(CONFIG_KEY_HOUSEKEEPING_CORE)) == NULL) {
+        ESP_LOGE(TAG, "Failed to create log task");
+        return false;
+    }
+    return true;
+}
 
-    esp_err_t ret = esp_http_client_perform(client);
+// Called from the HID callback; must never block
+static void notify_sender(void *arg) {
+    xTaskNotifyGive(_sender_task);
+}
+
+// Called by the sender for every event; only the first one matters
+static void on_delivered(void *arg, const key_event_t *event, esp_err_t ret) {
     if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "Request completed successfully");
-    } else {
-        ESP_LOGE(TAG, "Request failed %s\n", esp_err_to_name(ret));
+        boot_phase_mark(BOOT_PHASE_FIRST_KEY);
     }
 }
 
+static bool _init_sender(void) {
+    const char *TAG = "_init_sender";
 
-static void key_press(uint8_t key) {
-    const char *TAG = "key_press";
-    char *key_path = key_mappings[key];
-    if (key_path != NULL) {
-        ESP_LOGI(TAG, "Received key press: 0x%x", key);
-        char path[32] = "/remote/";
-        strcat(path, key_path);
-        send_request(path);
-    } else {
-        ESP_LOGW(TAG, "Received unknown key press: 0x%x", key);
+#if CONFIG_KEY_TRANSPORT_UDP
+    if (!key_udp_init(&_udp, SERVER_IP, CONFIG_KEY_TRANSPORT_PORT, CONFIG_KEY_UDP_RETRANSMIT_MS,
+                      CONFIG_KEY_UDP_MAX_ATTEMPTS)) {
+        ESP_LOGE(TAG, "SERVER_IP isn't an IPv4 address");
+        return false;
+    }
+    key_transport_t transport = key_udp_transport(&_udp);
+#elif CONFIG_KEY_TRANSPORT_WEBSOCKET
+    key_ws_init(&_ws, SERVER_IP);
+    key_transport_t transport = key_ws_transport(&_ws);
+#elif CONFIG_KEY_HTTP_INFLIGHT > 1
+    if (!http_pool_init(&_http_pool, SERVER_IP, CONFIG_KEY_HTTP_INFLIGHT)) {
+        return false;
+    }
+    key_transport_t transport = http_pool_transport(&_http_pool);
+#else
+    http_conn_init(&_http_conn, SERVER_IP);
+    key_transport_t transport = {
+        .get = http_transport_get,
+        .post = http_transport_post,
+        .ctx = &_http_conn,
+    };
+#endif
+    if (!key_pipeline_init(&_pipeline, &transport, notify_sender, NULL)) {
+        return false;
+    }
+    _pipeline.on_delivered = on_delivered;
+#if CONFIG_KEY_BINDINGS_ENABLE
+    binding_config_init(&_pipeline);
+#endif
+#if CONFIG_KEY_STORE_FLASH
+    // Without the partition the store just stays in RAM
+    if (key_spill_init(&_key_spill)) {
+        key_store_spill_t spill = key_spill_store(&_key_spill);
+        key_store_set_spill(&_pipeline.store, &spill);
     }
+#endif
+
+    _sender_task = xTaskCreateStaticPinnedToCore(sender_task, "key_sender",
+                                                 CONFIG_KEY_SENDER_TASK_STACK_SIZE, NULL,
+                                                 CONFIG_KEY_SENDER_TASK_PRIORITY, _sender_stack,
+                                                 &_sender_tcb,
+                                                 TASK_CORE(CONFIG_KEY_SENDER_TASK_CORE));
+    if (_sender_task == NULL) {
+        ESP_LOGE(TAG, "Failed to create sender task");
+        return false;
+    }
+
+    return true;
 }
 
 static void esp_hidh_cb(esp_hidh_cb_event_t event, esp_hidh_cb_param_t *param) {
@@ -106,15 +335,35 @@ static void esp_hidh_cb(esp_hidh_cb_event_t event, esp_hidh_cb_param_t *param) {
         case ESP_HIDH_OPEN_EVT:
             ESP_LOGI(TAG, "ESP_HIDH_OPEN_EVT");
             if (param->open.conn_status == ESP_HIDH_CONN_STATE_CONNECTED) {
-                xEventGroupSetBits(_hid_event_group, HID_CONNECTED);
-                xEventGroupClearBits(_hid_event_group, HID_CLOSED);
+                int device = device_table_add(param->open.bd_addr);
+                device_table_set_handle(device, param->open.handle);
+                ESP_LOGI(TAG, "Device %d connected on handle %u", device, param->open.handle);
+#if CONFIG_KEY_TRACE_CAPTURE
+                hid_capture_record(HID_TRACE_OPEN, (uint8_t)device, esp_timer_get_time(),
+                                   param->open.bd_addr, sizeof(esp_bd_addr_t));
+#endif
+                boot_phase_mark(BOOT_PHASE_KEYBOARD);
+                hid_supervisor_opened(device, true);
+            } else if (param->open.status != ESP_HIDH_OK) {
+                hid_supervisor_opened(device_table_find(param->open.bd_addr), false);
             }
             break;
-        case ESP_HIDH_CLOSE_EVT:
+        case ESP_HIDH_CLOSE_EVT: {
             ESP_LOGI(TAG, "ESP_HIDH_CLOSE_EVT");
-            xEventGroupSetBits(_hid_event_group, HID_CLOSED);
-            xEventGroupClearBits(_hid_event_group, HID_CONNECTED);
+            int device = device_table_by_handle(param->close.handle);
+            if (device != DEVICE_TABLE_NONE) {
+#if CONFIG_KEY_TRACE_CAPTURE
+                hid_capture_record(HID_TRACE_CLOSE, (uint8_t)device, esp_timer_get_time(), NULL,
+                                   0);
+#endif
+                device_table_set_handle(device, DEVICE_TABLE_NONE);
+                // Keys still held when the keyboard goes away will never see
+                // a release report
+                key_pipeline_release_all(&_pipeline, device, esp_timer_get_time());
+                hid_supervisor_closed(device);
+            }
             break;
+        }
         case ESP_HIDH_GET_RPT_EVT:
             ESP_LOGI(TAG, "ESP_HIDH_GET_RPT_EVT");
             break;
@@ -133,9 +382,22 @@ static void esp_hidh_cb(esp_hidh_cb_event_t event, esp_hidh_cb_param_t *param) {
         case ESP_HIDH_SET_IDLE_EVT:
             ESP_LOGI(TAG, "ESP_HIDH_SET_IDLE_EVT");
             break;
-        case ESP_HIDH_GET_DSCP_EVT:
+        case ESP_HIDH_GET_DSCP_EVT: {
             ESP_LOGI(TAG, "ESP_HIDH_GET_DSCP_EVT");
+            // Comes after the open, so the handle is already in the table.
+            // Reports are read by the plan built from the descriptor from
+            // here on; until then, or if it's no use, as boot reports.
+            int device = device_table_by_handle(param->dscp.handle);
+            if (param->dscp.status == ESP_HIDH_OK && device != DEVICE_TABLE_NONE) {
+#if CONFIG_KEY_TRACE_CAPTURE
+                hid_capture_record(HID_TRACE_DESCRIPTOR, (uint8_t)device, esp_timer_get_time(),
+                                   param->dscp.dsc_list, param->dscp.dl_len);
+#endif
+                key_pipeline_set_descriptor(&_pipeline, device, param->dscp.dsc_list,
+                                            param->dscp.dl_len);
+            }
             break;
+        }
         case ESP_HIDH_ADD_DEV_EVT:
             ESP_LOGI(TAG, "ESP_HIDH_ADD_DEV_EVT");
             break;
@@ -148,19 +410,31 @@ static void esp_hidh_cb(esp_hidh_cb_event_t event, esp_hidh_cb_param_t *param) {
         case ESP_HIDH_DATA_EVT:
             ESP_LOGI(TAG, "ESP_HIDH_DATA_EVT");
             break;
-        case ESP_HIDH_DATA_IND_EVT:
-            ESP_LOGI(TAG, "ESP_HIDH_DATA_IND_EVT");
-            ESP_LOGI(TAG, "Status: %d", param->data_ind.status);
-            ESP_LOGI(TAG, "Data length: %d", param->data_ind.len);
-            // Key presses (both up and down) are 9 packets
-            // First 3 packets: 0x01 0x00 0x00
-            // Packets 4-9: keys currently pressed down
-            // To avoid maintaining some hairy state, we'll just assume we only have
-            // one key pressed down at a time so we can always read from packet 4
-            if (param->data_ind.status == ESP_HIDH_OK && param->data_ind.len == 9) {
-                key_press(param->data_ind.data[3]);
+        case ESP_HIDH_DATA_IND_EVT: {
+            int64_t received_us = esp_timer_get_time();
+            boot_phase_mark(BOOT_PHASE_FIRST_REPORT);
+            // Logged through the ring: this runs for every keystroke
+            KEY_LOG(KEY_LOG_HID_DATA, param->data_ind.status, param->data_ind.len);
+            // Each report starts with its report ID. Where the keys are after
+            // that comes from the keyboard's descriptor: for a boot keyboard,
+            // modifier bits, a reserved byte and up to six keys held down;
+            // NKRO keyboards send a bitmap, media keys a consumer report.
+            // Only changes against the previous report turn into events, so
+            // held keys don't resend and releases are reported
+            // Reports from a keyboard the device table had no room for are
+            // counted as bad reports
+            if (param->data_ind.status == ESP_HIDH_OK) {
+                int device = device_table_by_handle(param->data_ind.handle);
+#if CONFIG_KEY_TRACE_CAPTURE
+                // A copy into RAM; the log task writes it to flash
+                hid_capture_record(HID_TRACE_REPORT, (uint8_t)device, received_us,
+                                   param->data_ind.data, param->data_ind.len);
+#endif
+                key_pipeline_report(&_pipeline, (uint8_t)device, param->data_ind.data,
+                                    param->data_ind.len, received_us);
             }
             break;
+        }
         case ESP_HIDH_SET_INFO_EVT:
             ESP_LOGI(TAG, "ESP_HIDH_SET_INFO_EVT");
             break;
@@ -171,24 +445,16 @@ static bool _init_bt()
 {
     const char *TAG = "_init_bt";
     if(!_hid_event_group){
-        _hid_event_group = xEventGroupCreate();
+        _hid_event_group = xEventGroupCreateStatic(&_hid_event_group_buf);
         if(!_hid_event_group){
             ESP_LOGE(TAG, "HID Event Group Create Failed!");
             return false;
         }
         xEventGroupClearBits(_hid_event_group, 0xFFFFFF);
-        xEventGroupSetBits(_hid_event_group, HID_CLOSED);
     }
 
     esp_err_t ret;
 
-    ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK( ret );
-
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
 
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -212,6 +478,9 @@ static bool _init_bt()
         return false;
     }
 
+    // Needs NVS, and Bluedroid for the bonded devices
+    device_table_load(_peer_bd_addr);
+
     if ((ret = esp_bt_hid_host_register_callback(esp_hidh_cb)) != ESP_OK) {
         ESP_LOGE(TAG, "hidh register failed");
         return false;
@@ -235,27 +504,35 @@ static bool _init_bt()
     return true;
 }
 
-static bool try_connect_bt(int timeout) {
-    const char *TAG = "try_connect_bt";
-
-    esp_err_t initRet;
-
-    ESP_LOGI(TAG, "Connection attempt initializing...");
-    if ((initRet = esp_bt_hid_host_connect(_peer_bd_addr)) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize connection attempt: %s", esp_err_to_name(initRet));
+// Points the station at the cached access point, skipping the scan, and with
+// KEY_WIFI_CACHE_IP at the cached address, skipping DHCP. Without the cache
+// it's a normal scan and DHCP.
+static void _configure_wifi(bool use_cache) {
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = WIFI_HOSTNAME,
+            .password = WIFI_PASSWORD,
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+        },
+    };
+    if (use_cache) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, _wifi_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = _wifi_cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
     }
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
 
-    TickType_t xTicksToWait = timeout / portTICK_PERIOD_MS;
-    // wait for connected or closed
-    EventBits_t rc = xEventGroupWaitBits(_hid_event_group, HID_CONNECTED | HID_CLOSED, pdFALSE, pdFALSE, xTicksToWait);
-    if((rc & HID_CONNECTED) != 0)
-        return true;
-    else if((rc & HID_CLOSED) != 0) {
-        ESP_LOGD(TAG, "connection closed!");
-        return false;
+#if CONFIG_KEY_WIFI_CACHE_IP
+    if (use_cache) {
+        esp_netif_dhcpc_stop(_sta_netif);
+        esp_netif_set_ip_info(_sta_netif, &_wifi_cache.ip_info);
+    } else {
+        esp_netif_dhcpc_start(_sta_netif);
     }
-    ESP_LOGD(TAG, "timeout");
-    return false;
+#endif
+    _wifi_use_cache = use_cache;
+    _wifi_cache_pending = use_cache;
 }
 
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
@@ -263,29 +540,62 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
 {
     const char *TAG = "wifi_event_handler";
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        boot_phase_mark(BOOT_PHASE_WIFI_START);
         esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        boot_phase_mark(BOOT_PHASE_WIFI_CONNECT);
+        memcpy(_wifi_cache.bssid, event->bssid, sizeof(_wifi_cache.bssid));
+        _wifi_cache.channel = event->channel;
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        xEventGroupSetBits(_wifi_event_group, WIFI_FAIL);
-        ESP_LOGI(TAG, "connect to the AP fail");
+        // Keys are held by the pipeline until the link is back
+        xEventGroupClearBits(_wifi_event_group, WIFI_CONNECTED);
+        key_pipeline_set_link(&_pipeline, false);
+        if (_wifi_cache_pending) {
+            // The access point may have moved channel or been replaced
+            ESP_LOGI(TAG, "cached access point failed, scanning");
+            wifi_cache_clear();
+            _configure_wifi(false);
+            esp_wifi_connect();
+            return;
+        }
+        if (_wifi_use_cache && _wifi_retry_ms >= CONFIG_KEY_WIFI_RECONNECT_MAX_MS) {
+            // It worked, but has been gone for a while: look for it again,
+            // keeping the cache for the next boot
+            ESP_LOGI(TAG, "cached access point still gone, scanning");
+            _configure_wifi(false);
+        }
+        ESP_LOGI(TAG, "connect to the AP fail, retrying in %u ms", _wifi_retry_ms);
+        esp_timer_start_once(_wifi_retry_timer, (uint64_t)_wifi_retry_ms * 1000);
+        _wifi_retry_ms *= 2;
+        if (_wifi_retry_ms > CONFIG_KEY_WIFI_RECONNECT_MAX_MS) {
+            _wifi_retry_ms = CONFIG_KEY_WIFI_RECONNECT_MAX_MS;
+        }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+        boot_phase_mark(BOOT_PHASE_WIFI_IP);
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        _wifi_cache.ip_info = event->ip_info;
+        wifi_cache_save(&_wifi_cache);
+        _wifi_cache_pending = false;
+        _wifi_retry_ms = WIFI_RETRY_MIN_MS;
         xEventGroupSetBits(_wifi_event_group, WIFI_CONNECTED);
+        key_pipeline_set_link(&_pipeline, true);
     }
 }
 
+// Runs on the esp_timer task
+static void wifi_retry(void *arg) {
+    esp_wifi_connect();
+}
 
 static bool _init_wifi(void) {
     const char *TAG = "_init_wifi";
 
-    if (!_wifi_event_group) {
-        _wifi_event_group = xEventGroupCreate();
-    }
-
     ESP_ERROR_CHECK(esp_netif_init());
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    _sta_netif = esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -303,60 +613,235 @@ static bool _init_wifi(void) {
                                                         NULL,
                                                         &instance_got_ip));
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_HOSTNAME,
-            .password = WIFI_PASSWORD,
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-        },
+    const esp_timer_create_args_t retry_timer_args = {
+        .callback = wifi_retry,
+        .name = "wifi_retry",
     };
+    ESP_ERROR_CHECK(esp_timer_create(&retry_timer_args, &_wifi_retry_timer));
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
+    bool cached = false;
+#if CONFIG_KEY_WIFI_FAST_CONNECT
+    cached = wifi_cache_load(&_wifi_cache);
+    if (cached) {
+        ESP_LOGI(TAG, "Connecting to cached access point on channel %u", _wifi_cache.channel);
+    }
+#endif
+    _configure_wifi(cached);
     ESP_ERROR_CHECK(esp_wifi_start() );
 
     ESP_LOGI(TAG, "wifi_init_sta finished.");
 
-    /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
-    EventBits_t bits = xEventGroupWaitBits(_wifi_event_group,
-            WIFI_CONNECTED | WIFI_FAIL,
-            pdFALSE,
-            pdFALSE,
-            portMAX_DELAY);
-
-    /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-     * happened. */
-    if (bits & WIFI_CONNECTED) {
-        ESP_LOGI(TAG, "Connected to WiFi network %s successfully.", WIFI_HOSTNAME);
-        return true;
-    }
-    return false;
+    /* Waiting until the connection is established (WIFI_CONNECTED). A failed attempt is retried by
+     * wifi_event_handler() (see above) with a growing delay, for as long as it takes. */
+    xEventGroupWaitBits(_wifi_event_group, WIFI_CONNECTED, pdFALSE, pdFALSE, portMAX_DELAY);
+    ESP_LOGI(TAG, "Connected to WiFi network %s successfully.", WIFI_HOSTNAME);
+    return true;
+}
+
+static void wifi_init_task(void *arg) {
+    const char *TAG = "wifi_init_task";
+
+    if (!_init_wifi()) {
+        ESP_LOGE(TAG, "Failed to initialize WiFi.");
+    } else {
+#if CONFIG_KEY_STATUS_SERVER_ENABLE
+        // Not fatal; keys are still delivered without it
+        status_server_start(CONFIG_KEY_STATUS_SERVER_PORT, &_pipeline, _format_connection);
+#endif
+    }
+    vTaskDelete(NULL);
+}
+
+static void _init_nvs(void) {
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK( ret );
+    boot_phase_mark(BOOT_PHASE_NVS);
+}
+
+#if CONFIG_KEY_LOADGEN_ENABLE
+// Debug build: virtual keyboards stand in for Bluetooth (KEY_LOADGEN_ENABLE).
+// Like the HID callback they're the only producer, and they outrank the
+// sender.
+#define LOADGEN_TASK_STACK_SIZE 4096
+#define LOADGEN_TASK_PRIORITY (CONFIG_KEY_SENDER_TASK_PRIORITY + 1)
+
+#if CONFIG_KEY_LOADGEN_DIST_FIXED
+#define LOADGEN_DIST KEY_LOADGEN_FIXED
+#elif CONFIG_KEY_LOADGEN_DIST_BURST
+#define LOADGEN_DIST KEY_LOADGEN_BURST
+#else
+#define LOADGEN_DIST KEY_LOADGEN_POISSON
+#endif
+
+#ifndef CONFIG_KEY_LOADGEN_BURST
+#define CONFIG_KEY_LOADGEN_BURST 1
+#endif
+
+// One step: `sources` virtual keyboards typing for KEY_LOADGEN_STEP_S
+static void loadgen_step(uint32_t sources) {
+    const char *TAG = "loadgen_step";
+    static key_loadgen_t gen;
+    static key_hist_t empty, before, latency;
+    static char latency_json[320];
+
+    key_loadgen_config_t config = {
+        .sources = sources,
+        .devices = sources < CONFIG_KEY_MAX_DEVICES ? sources : CONFIG_KEY_MAX_DEVICES,
+        .rate = CONFIG_KEY_LOADGEN_RATE,
+        .dist = LOADGEN_DIST,
+        .burst = CONFIG_KEY_LOADGEN_BURST,
+        .hold_ms = CONFIG_KEY_LOADGEN_HOLD_MS,
+        .seed = sources,
+    };
+    key_queue_stats_t queue_before;
+    key_pipeline_queue_stats(&_pipeline, &queue_before);
+    key_hist_init(&empty);
+    key_hist_since(&_pipeline.stats.stages[KEY_STAGE_TOTAL], &empty, &before);
+
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + (int64_t)CONFIG_KEY_LOADGEN_STEP_S * 1000000;
+    key_loadgen_init(&gen, &config, start);
+    uint8_t report[1 + HID_REPORT_LEN];
+    for (;;) {
+        int64_t next = key_loadgen_next_us(&gen);
+        if (next >= end) {
+            break;
+        }
+        // Reports due within the same tick go out together
+        TickType_t ticks = (next - esp_timer_get_time()) / (1000 * portTICK_PERIOD_MS);
+        if (ticks > 0) {
+            vTaskDelay(ticks);
+        }
+        int64_t now = esp_timer_get_time();
+        int device;
+        while ((device = key_loadgen_next(&gen, now, report)) >= 0) {
+            key_pipeline_report(&_pipeline, device, report, sizeof(report), now);
+        }
+    }
+    for (uint32_t d = 0; d < config.devices; d++) {
+        key_pipeline_release_all(&_pipeline, d, esp_timer_get_time());
+    }
+    // Give the sender a moment to catch up before counting
+    vTaskDelay(pdMS_TO_TICKS(1000));
+
+    key_queue_stats_t queue_after;
+    key_pipeline_queue_stats(&_pipeline, &queue_after);
+    key_hist_since(&_pipeline.stats.stages[KEY_STAGE_TOTAL], &before, &latency);
+    if (key_hist_format(&latency, "ns", latency_json, sizeof(latency_json)) < 0) {
+        strcpy(latency_json, "{}");
+    }
+    ESP_LOGI(TAG, "%u sources x %d/s: offered %u/s, delivered %u, dropped %u, max depth %u, "
+             "latency %s",
+             sources, CONFIG_KEY_LOADGEN_RATE, gen.presses / CONFIG_KEY_LOADGEN_STEP_S,
+             atomic_load(&latency.count), queue_after.dropped - queue_before.dropped,
+             queue_after.max_depth, latency_json);
+}
+
+static void loadgen_task(void *arg) {
+    const char *TAG = "loadgen_task";
+
+    xEventGroupWaitBits(_wifi_event_group, WIFI_CONNECTED, pdFALSE, pdFALSE, portMAX_DELAY);
+    ESP_LOGI(TAG, "Load test: up to %d sources, %d presses/s each, %d s steps",
+             CONFIG_KEY_LOADGEN_SOURCES, CONFIG_KEY_LOADGEN_RATE, CONFIG_KEY_LOADGEN_STEP_S);
+    // Everything is set up by the end of the first step; from then on the free
+    // heap shouldn't go down
+    uint32_t heap_after_first = 0;
+    for (uint32_t sources = 1;; sources *= 2) {
+        if (sources > CONFIG_KEY_LOADGEN_SOURCES) {
+            sources = CONFIG_KEY_LOADGEN_SOURCES;
+        }
+        loadgen_step(sources);
+        uint32_t heap_free = esp_get_free_heap_size();
+        ESP_LOGI(TAG, "Heap free %u, least free %u", heap_free, esp_get_minimum_free_heap_size());
+        if (heap_after_first == 0) {
+            heap_after_first = heap_free;
+        }
+        if (sources == CONFIG_KEY_LOADGEN_SOURCES) {
+            if (heap_free < heap_after_first) {
+                ESP_LOGW(TAG, "Heap shrank by %u bytes after the first step",
+                         heap_after_first - heap_free);
+            }
+            break;
+        }
+    }
+    ESP_LOGI(TAG, "Load test done");
+    vTaskDelete(NULL);
 }
+#endif
 
 void app_main(void)
 {
     const char *TAG = "app_main";
 
-    init_key_mappings();
+    // Both radios keep settings in NVS
+    _init_nvs();
+
+#if CONFIG_KEY_TRACE_CAPTURE
+    // Before the log task starts writing it out. Without the partition the
+    // receiver runs as usual, just without a capture.
+    hid_capture_init();
+#endif
+
+    if (!_init_log()) {
+        ESP_LOGE(TAG, "Failed to start log task, exiting.");
+        return;
+    }
+
+    _wifi_event_group = xEventGroupCreateStatic(&_wifi_event_group_buf);
+    if (!_wifi_event_group) {
+        ESP_LOGE(TAG, "WiFi Event Group Create Failed!");
+        return;
+    }
+
+    // Accepts keys straight away; they're held until Wi-Fi is up
+    if (!_init_sender()) {
+        ESP_LOGE(TAG, "Failed to start sender task, exiting.");
+        return;
+    }
+
+    // Association and DHCP take far longer than bringing up Bluetooth, so
+    // they run alongside it instead of after it
+    if (xTaskCreatePinnedToCore(wifi_init_task, "wifi_init", WIFI_INIT_TASK_STACK_SIZE, NULL,
+                                WIFI_INIT_TASK_PRIORITY, NULL,
+                                TASK_CORE(CONFIG_KEY_HOUSEKEEPING_CORE)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create WiFi init task, exiting.");
+        return;
+    }
+
+#if CONFIG_KEY_LOADGEN_ENABLE
+    if (xTaskCreatePinnedToCore(loadgen_task, "loadgen", LOADGEN_TASK_STACK_SIZE, NULL,
+                                LOADGEN_TASK_PRIORITY, NULL,
+                                TASK_CORE(CONFIG_KEY_HOUSEKEEPING_CORE)) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create load generator task, exiting.");
+    }
+    return;
+#endif
 
     if (!_init_bt()) {
         ESP_LOGE(TAG, "Failed to initialize Bluetooth, exiting.");
         return;
     }
 
-    if (!_init_wifi()) {
-        ESP_LOGE(TAG, "Failed to initialize WiFi, exiting.");
+    // Before the devices have paired, connecting from our side is necessary to
+    // initiate the pairing: the device has to be in pairing mode when the host
+    // is starting up for this to succeed - what I ended up doing was putting
+    // the device in pairing mode and then hitting reset on the ESP32. Once the
+    // devices have paired, previously paired devices can connect on their own
+    // (we've set the GAP scan mode to connectable, non-discoverable), but a
+    // keyboard waking from sleep can take a long time to page us, so the
+    // supervisor keeps paging disconnected keyboards with backoff.
+    if ((xEventGroupWaitBits(_hid_event_group, HID_RUNNING, pdFALSE, pdFALSE,
+                             pdMS_TO_TICKS(READY_TIMEOUT)) & HID_RUNNING) == 0) {
+        ESP_LOGE(TAG, "HID host didn't start");
         return;
     }
-
-    // After starting up, try connecting to the device. Before the devices have
-    // paired, this step is necessary to initiate the pairing. The device has to
-    // be in pairing mode when the host is starting up for this to succeed - what
-    // I ended up doing was putting the device in pairing mode and then hitting
-    // reset on the ESP32. Once the devices have paired, this step is unnecessary
-    // as the device will attempt to connect on its own (we've set the GAP scan mode
-    // to connectable, non-discoverable which allows previously paired devices to
-    // connect).
-    try_connect_bt(READY_TIMEOUT);
+    boot_phase_mark(BOOT_PHASE_BT);
+    if (!hid_supervisor_start()) {
+        ESP_LOGE(TAG, "Failed to start reconnect supervisor");
+    }
 }
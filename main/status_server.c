@@ -0,0 +1,302 @@
+#include "status_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+#include "binding_config.h"
+#endif
+#include "boot_phase.h"
+#if CONFIG_KEY_TRACE_CAPTURE
+#include "hid_capture.h"
+#endif
+#include "hid_supervisor.h"
+#include "key_log.h"
+#include "task_stats.h"
+
+// Room for every histogram bucket being in use
+#define STATUS_BODY_LEN 4096
+
+static const key_pipeline_t *_pipeline = NULL;
+static int (*_format_connection)(char *buf, size_t len) = NULL;
+
+// The server runs handlers one at a time on its own task, so one buffer will
+// do and keeps the body off that task's stack
+static char _body[STATUS_BODY_LEN];
+
+static esp_err_t status_get_handler(httpd_req_t *req) {
+    const char *TAG = "status_get_handler";
+
+    int len = snprintf(_body, sizeof(_body), "{\"pipeline\":");
+    int pipeline_len = key_pipeline_format_status(_pipeline, _body + len, sizeof(_body) - len);
+    if (pipeline_len < 0) {
+        ESP_LOGE(TAG, "Status doesn't fit in %d bytes", STATUS_BODY_LEN);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Status too long");
+    }
+    len += pipeline_len;
+
+    int conn_len = snprintf(_body + len, sizeof(_body) - len, ",\"connection\":");
+    if (conn_len > 0 && conn_len < (int)sizeof(_body) - len) {
+        len += conn_len;
+        conn_len = _format_connection(_body + len, sizeof(_body) - len);
+    }
+    if (conn_len >= 0 && conn_len < (int)sizeof(_body) - len) {
+        len += conn_len;
+        conn_len = snprintf(_body + len, sizeof(_body) - len, ",\"bluetooth\":");
+    }
+    if (conn_len < 0 || conn_len >= (int)sizeof(_body) - len) {
+        ESP_LOGE(TAG, "Status doesn't fit in %d bytes", STATUS_BODY_LEN);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Status too long");
+    }
+    len += conn_len;
+
+    int bt_len = hid_supervisor_format_status(_body + len, sizeof(_body) - len);
+    if (bt_len < 0 || bt_len + 1 >= (int)sizeof(_body) - len) {
+        ESP_LOGE(TAG, "Status doesn't fit in %d bytes", STATUS_BODY_LEN);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Status too long");
+    }
+    len += bt_len;
+
+    int boot_len = snprintf(_body + len, sizeof(_body) - len, ",\"boot\":");
+    if (boot_len > 0 && boot_len < (int)sizeof(_body) - len) {
+        len += boot_len;
+        boot_len = boot_phase_format(_body + len, sizeof(_body) - len);
+    }
+    if (boot_len < 0 || boot_len + 1 >= (int)sizeof(_body) - len) {
+        ESP_LOGE(TAG, "Status doesn't fit in %d bytes", STATUS_BODY_LEN);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Status too long");
+    }
+    len += boot_len;
+    _body[len++] = '}';
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, _body, len);
+}
+
+// GET /log?verbose=1 turns per-event tracing on, ?verbose=0 off; either way
+// answers with the current state
+static esp_err_t log_get_handler(httpd_req_t *req) {
+    char query[32];
+    char value[4];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "verbose", value, sizeof(value)) == ESP_OK) {
+        key_log_set_verbose(value[0] == '1');
+    }
+
+    char body[64];
+    int len = snprintf(body, sizeof(body), "{\"verbose\":%s,\"dropped\":%u}",
+                       key_log_verbose() ? "true" : "false", key_log_dropped());
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, body, len);
+}
+
+// GET /tasks lists every task's core, priority, CPU time and stack use
+static esp_err_t tasks_get_handler(httpd_req_t *req) {
+    const char *TAG = "tasks_get_handler";
+
+    int len = task_stats_format(_body, sizeof(_body));
+    if (len < 0) {
+        ESP_LOGE(TAG, "Task report doesn't fit in %d bytes", STATUS_BODY_LEN);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Report too long");
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, _body, len);
+}
+
+#if KEY_PIPELINE_RUN_STATS
+// GET /keys lists, per key, the presses that were repeats and the ones that
+// went out in another press's request
+static esp_err_t keys_get_handler(httpd_req_t *req) {
+    const char *TAG = "keys_get_handler";
+
+    int len = key_pipeline_format_runs(_pipeline, _body, sizeof(_body));
+    if (len < 0) {
+        ESP_LOGE(TAG, "Key report doesn't fit in %d bytes", STATUS_BODY_LEN);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Report too long");
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, _body, len);
+}
+#endif
+
+#if CONFIG_KEY_TRACE_CAPTURE
+static bool trace_send(void *arg, const char *text, size_t len) {
+    return httpd_resp_send_chunk(arg, text, len) == ESP_OK;
+}
+
+// GET /trace?device=N streams what keyboard N (0 if not given) sent, from the
+// HID capture, as a trace for kb_replay
+static esp_err_t trace_get_handler(httpd_req_t *req) {
+    char query[32];
+    char value[4];
+    uint8_t device = 0;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "device", value, sizeof(value)) == ESP_OK) {
+        device = (uint8_t)atoi(value);
+    }
+    httpd_resp_set_type(req, "text/plain");
+    if (!hid_capture_format(device, trace_send, req)) {
+        // The client has gone
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+// GET /bindings answers with the saved binding source
+static esp_err_t bindings_get_handler(httpd_req_t *req) {
+    int len = binding_config_get(_body, sizeof(_body));
+    if (len < 0) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Bindings too long");
+    }
+    httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_send(req, _body, len);
+}
+
+// PUT /bindings replaces them with the body, an empty one removing them all
+static esp_err_t bindings_put_handler(httpd_req_t *req) {
+    char err[96];
+
+    if (req->content_len > BINDING_CONFIG_MAX_LEN) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bindings too long");
+    }
+    size_t len = 0;
+    while (len < req->content_len) {
+        int n = httpd_req_recv(req, _body + len, req->content_len - len);
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        len += n;
+    }
+
+    esp_err_t ret = binding_config_set(_body, len, err, sizeof(err));
+    if (ret == ESP_ERR_INVALID_STATE) {
+        // Everything mapped with the current bindings is still being sent
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, err, HTTPD_RESP_USE_STRLEN);
+    }
+    if (ret == ESP_ERR_INVALID_ARG) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+    }
+    if (ret != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, err);
+    }
+    return httpd_resp_send(req, NULL, 0);
+}
+#endif
+
+bool status_server_start(uint16_t port, const key_pipeline_t *pipeline,
+                         int (*format_connection)(char *buf, size_t len)) {
+    const char *TAG = "status_server_start";
+
+    _pipeline = pipeline;
+    _format_connection = format_connection;
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    // Keep the status server out of the way of the sender and the BT stack
+    config.task_priority = 1;
+    config.core_id = TASK_CORE(CONFIG_KEY_HOUSEKEEPING_CORE);
+
+    httpd_handle_t server = NULL;
+    esp_err_t ret = httpd_start(&server, &config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start status server: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    const httpd_uri_t status_uri = {
+        .uri = "/status",
+        .method = HTTP_GET,
+        .handler = status_get_handler,
+        .user_ctx = NULL,
+    };
+    ret = httpd_register_uri_handler(server, &status_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /status: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    const httpd_uri_t log_uri = {
+        .uri = "/log",
+        .method = HTTP_GET,
+        .handler = log_get_handler,
+        .user_ctx = NULL,
+    };
+    ret = httpd_register_uri_handler(server, &log_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /log: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    const httpd_uri_t tasks_uri = {
+        .uri = "/tasks",
+        .method = HTTP_GET,
+        .handler = tasks_get_handler,
+        .user_ctx = NULL,
+    };
+    ret = httpd_register_uri_handler(server, &tasks_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /tasks: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+#if KEY_PIPELINE_RUN_STATS
+    const httpd_uri_t keys_uri = {
+        .uri = "/keys",
+        .method = HTTP_GET,
+        .handler = keys_get_handler,
+        .user_ctx = NULL,
+    };
+    ret = httpd_register_uri_handler(server, &keys_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /keys: %s", esp_err_to_name(ret));
+        return false;
+    }
+#endif
+
+#if CONFIG_KEY_TRACE_CAPTURE
+    const httpd_uri_t trace_uri = {
+        .uri = "/trace",
+        .method = HTTP_GET,
+        .handler = trace_get_handler,
+        .user_ctx = NULL,
+    };
+    ret = httpd_register_uri_handler(server, &trace_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /trace: %s", esp_err_to_name(ret));
+        return false;
+    }
+#endif
+
+#if CONFIG_KEY_BINDINGS_ENABLE
+    const httpd_uri_t bindings_uris[] = {
+        {
+            .uri = "/bindings",
+            .method = HTTP_GET,
+            .handler = bindings_get_handler,
+            .user_ctx = NULL,
+        },
+        {
+            .uri = "/bindings",
+            .method = HTTP_PUT,
+            .handler = bindings_put_handler,
+            .user_ctx = NULL,
+        },
+    };
+    for (size_t i = 0; i < sizeof(bindings_uris) / sizeof(bindings_uris[0]); i++) {
+        ret = httpd_register_uri_handler(server, &bindings_uris[i]);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register /bindings: %s", esp_err_to_name(ret));
+            return false;
+        }
+    }
+#endif
+
+    ESP_LOGI(TAG, "Serving status on port %u", port);
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef STATUS_SERVER_H
+#define STATUS_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "key_pipeline.h"
+
+// Serves GET /status with the pipeline's timings and counters, the
+// transport's counters and the keyboards' connection state as JSON:
+//
+//   {"pipeline":{...key_pipeline_format_status()...},
+//    "connection":{"requests":12,"connects":1,...},
+//    "bluetooth":{...hid_supervisor_format_status()...},
+//    "boot":{...boot_phase_format()...}}
+//
+// GET /log?verbose=1 (or 0) switches per-event log tracing at runtime, and
+// GET /tasks serves task_stats_format(). With CONFIG_KEY_REPEAT_ENABLE or
+// CONFIG_KEY_COALESCE_RUNS, GET /keys serves key_pipeline_format_runs(). With
+// CONFIG_KEY_BINDINGS_ENABLE, GET /bindings returns the key bindings' source
+// and PUT /bindings replaces it (binding_config_set()). With
+// CONFIG_KEY_TRACE_CAPTURE, GET /trace?device=N serves hid_capture_format().
+//
+// Reading is lock-free, so a snapshot taken mid-update may be off by one
+// sample. `format_connection` writes the transport's counters as a JSON
+// object, totalled over however many connections the sender uses, and
+// returns the length or -1 like the other formatters. The pipeline must
+// outlive the server.
+bool status_server_start(uint16_t port, const key_pipeline_t *pipeline,
+                         int (*format_connection)(char *buf, size_t len));
+
+#endif // STATUS_SERVER_H
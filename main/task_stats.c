@@ -0,0 +1,112 @@
+#include "task_stats.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#if CONFIG_KEY_TASK_STATS
+// Bluedroid, Wi-Fi, lwIP, the IDF's own tasks and ours come to about 20
+#define TASK_STATS_MAX_TASKS 32
+
+// Too big for the callers' stacks, so shared under a lock
+static TaskStatus_t _tasks[TASK_STATS_MAX_TASKS];
+static StaticSemaphore_t _lock_buf;
+static SemaphoreHandle_t _lock = NULL;
+
+// Takes the lock and fills _tasks; returns the number of tasks
+static UBaseType_t _snapshot(uint32_t *total) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    return uxTaskGetSystemState(_tasks, TASK_STATS_MAX_TASKS, total);
+}
+
+static int _core(const TaskStatus_t *task) {
+    BaseType_t core = xTaskGetAffinity(task->xHandle);
+    return core == tskNO_AFFINITY ? -1 : (int)core;
+}
+
+// Hundredths of a percent, to keep floating point out of the log task
+static unsigned _cpu_centipct(const TaskStatus_t *task, uint32_t total) {
+    return total ? (unsigned)((uint64_t)task->ulRunTimeCounter * 10000 / total) : 0;
+}
+#endif
+
+void task_stats_init(void) {
+#if CONFIG_KEY_TASK_STATS
+    _lock = xSemaphoreCreateMutexStatic(&_lock_buf);
+#endif
+}
+
+int task_stats_format(char *buf, size_t len) {
+    size_t pos = 0;
+    int n = snprintf(buf, len, "{\"uptime_us\":%lld,\"heap_free\":%u,\"heap_min_free\":%u",
+                     (long long)esp_timer_get_time(), (unsigned)esp_get_free_heap_size(),
+                     (unsigned)esp_get_minimum_free_heap_size());
+    if (n < 0 || (size_t)n >= len) {
+        return -1;
+    }
+    pos += n;
+
+#if CONFIG_KEY_TASK_STATS
+    if (_lock == NULL) {
+        return -1;
+    }
+    uint32_t total;
+    UBaseType_t count = _snapshot(&total);
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *task = &_tasks[i];
+        unsigned cpu = _cpu_centipct(task, total);
+        n = snprintf(buf + pos, len - pos,
+                     "%s{\"name\":\"%s\",\"core\":%d,\"priority\":%u,\"cpu_us\":%u,"
+                     "\"cpu_pct\":%u.%02u,\"stack_free\":%u}",
+                     i ? "," : ",\"tasks\":[", task->pcTaskName, _core(task),
+                     (unsigned)task->uxCurrentPriority, (unsigned)task->ulRunTimeCounter,
+                     cpu / 100, cpu % 100,
+                     (unsigned)task->usStackHighWaterMark);
+        if (n < 0 || (size_t)n >= len - pos) {
+            xSemaphoreGive(_lock);
+            return -1;
+        }
+        pos += n;
+    }
+    xSemaphoreGive(_lock);
+    if (count > 0) {
+        n = snprintf(buf + pos, len - pos, "]");
+        if (n < 0 || (size_t)n >= len - pos) {
+            return -1;
+        }
+        pos += n;
+    }
+#endif
+
+    n = snprintf(buf + pos, len - pos, "}");
+    if (n < 0 || (size_t)n >= len - pos) {
+        return -1;
+    }
+    return pos + n;
+}
+
+void task_stats_log(void) {
+    const char *TAG = "task_stats";
+    ESP_LOGI(TAG, "heap free %u, least free %u", (unsigned)esp_get_free_heap_size(),
+             (unsigned)esp_get_minimum_free_heap_size());
+#if CONFIG_KEY_TASK_STATS
+    if (_lock == NULL) {
+        return;
+    }
+    uint32_t total;
+    UBaseType_t count = _snapshot(&total);
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *task = &_tasks[i];
+        unsigned cpu = _cpu_centipct(task, total);
+        ESP_LOGI(TAG, "%-16s core %2d prio %2u cpu %3u.%02u%% stack free %5u",
+                 task->pcTaskName, _core(task), (unsigned)task->uxCurrentPriority,
+                 cpu / 100, cpu % 100, (unsigned)task->usStackHighWaterMark);
+    }
+    xSemaphoreGive(_lock);
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef TASK_STATS_H
+#define TASK_STATS_H
+
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+// The receiver's tasks fall into four groups, each with its own core and
+// priority settings:
+//
+//   ingest        the HID callback, which runs on Bluedroid's task
+//                 (BT_BLUEDROID_PINNED_TO_CORE) and only decodes and queues
+//   processing    key_sender: maps, batches and hands out requests
+//                 (KEY_SENDER_TASK_CORE)
+//   network       key_http workers doing the HTTP round-trips, or key_udp
+//                 taking acks and retransmitting (KEY_HTTP_TASK_CORE)
+//   housekeeping  logging, reconnects, Wi-Fi bring-up and the status server
+//                 (KEY_HOUSEKEEPING_CORE)
+//
+// By default processing and network work run on core 1, away from the
+// Bluetooth controller and Bluedroid on core 0.
+
+// Core setting from Kconfig, where -1 means either core
+#define TASK_CORE(core) ((core) < 0 ? tskNO_AFFINITY : (core))
+
+// Sets up the lock used by task_stats_format(). Call once at startup.
+void task_stats_init(void);
+
+// Writes the free heap and every task's core, priority, CPU time and stack
+// high-water mark as JSON:
+//
+//   {"uptime_us":5000000,"heap_free":98000,"heap_min_free":96500,
+//    "tasks":[{"name":"key_sender","core":1,"priority":5,"cpu_us":1200,
+//    "cpu_pct":0.02,"stack_free":2100},...]}
+//
+// cpu_pct is the share of one core since boot; stack_free is the least free
+// stack, in bytes, the task has had. Once everything is up the heap figures
+// shouldn't move: the receiver's own tasks, queues and buffers are all
+// static. Without KEY_TASK_STATS there are no tasks. Returns the length
+// written, or -1 if it doesn't fit.
+int task_stats_format(char *buf, size_t len);
+
+// Logs the same, one line for the heap and one per task
+void task_stats_log(void);
+
+#endif // TASK_STATS_H
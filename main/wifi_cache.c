@@ -0,0 +1,62 @@
+#include "wifi_cache.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#define WIFI_CACHE_NAMESPACE "kb_wifi"
+#define WIFI_CACHE_KEY "ap"
+
+// What's in flash, to avoid rewriting the same thing on every boot
+static wifi_cache_t _stored;
+static bool _valid = false;
+
+bool wifi_cache_load(wifi_cache_t *cache) {
+    nvs_handle_t nvs;
+    size_t size = sizeof(_stored);
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    esp_err_t ret = nvs_get_blob(nvs, WIFI_CACHE_KEY, &_stored, &size);
+    nvs_close(nvs);
+    // A blob of another size was written by a different build
+    _valid = ret == ESP_OK && size == sizeof(_stored);
+    if (_valid) {
+        *cache = _stored;
+    }
+    return _valid;
+}
+
+void wifi_cache_save(const wifi_cache_t *cache) {
+    const char *TAG = "wifi_cache";
+    if (_valid && memcmp(&_stored, cache, sizeof(_stored)) == 0) {
+        return;
+    }
+
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(nvs, WIFI_CACHE_KEY, cache, sizeof(*cache));
+        if (ret == ESP_OK) {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save Wi-Fi cache: %s", esp_err_to_name(ret));
+        return;
+    }
+    _stored = *cache;
+    _valid = true;
+}
+
+void wifi_cache_clear(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, WIFI_CACHE_KEY);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    _valid = false;
+}
@@ -0,0 +1,28 @@
+#ifndef WIFI_CACHE_H
+#define WIFI_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_netif.h"
+
+// What the last successful connection found, kept in NVS so the next boot
+// can skip the scan (and, with KEY_WIFI_CACHE_IP, DHCP) and go straight to
+// the same access point.
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;   // no padding, so caches compare with memcmp
+    esp_netif_ip_info_t ip_info;
+} wifi_cache_t;
+
+// Returns false if nothing is cached
+bool wifi_cache_load(wifi_cache_t *cache);
+
+// Only writes to flash if the cache changed since it was loaded or saved
+void wifi_cache_save(const wifi_cache_t *cache);
+
+// Forgets the cache, e.g. after the cached access point couldn't be reached
+void wifi_cache_clear(void);
+
+#endif // WIFI_CACHE_H
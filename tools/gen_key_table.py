@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Generate the key code -> server path table from usb_hid_codes.h and a
+mapping file (see main/key_mappings.txt), with each key's priority class,
+plus the key name -> code table runtime bindings are parsed with."""
+
+import argparse
+import re
+import sys
+
+DEFINE_RE = re.compile(r'^\s*#define\s+(KEY_\w+)\s+(0x[0-9a-fA-F]+|\d+)\b')
+SEGMENT_RE = re.compile(r'^[A-Za-z0-9._~-]+$')
+# Names of the KEY_CLASS_* values in key_table.h
+CLASSES = {'normal': 'KEY_CLASS_NORMAL', 'high': 'KEY_CLASS_HIGH'}
+
+
+def parse_codes(path):
+    codes = {}
+    with open(path) as f:
+        for line in f:
+            m = DEFINE_RE.match(line)
+            if m:
+                codes[m.group(1)] = int(m.group(2), 0)
+    return codes
+
+
+def parse_mappings(path, codes):
+    table = {}
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+            fields = line.split()
+            where = '{}:{}'.format(path, lineno)
+            if len(fields) not in (2, 3):
+                sys.exit('{}: expected "KEY_NAME segment [class]"'.format(where))
+            name, segment = fields[:2]
+            cls = fields[2] if len(fields) == 3 else 'normal'
+            if name not in codes:
+                sys.exit('{}: unknown key {}'.format(where, name))
+            if not SEGMENT_RE.match(segment):
+                sys.exit('{}: "{}" is not a valid path segment'.format(where, segment))
+            if cls not in CLASSES:
+                sys.exit('{}: unknown class "{}", expected one of {}'.format(
+                    where, cls, ', '.join(sorted(CLASSES))))
+            code = codes[name]
+            if not 0 <= code <= 0xff:
+                sys.exit('{}: {} is out of range'.format(where, name))
+            if code in table:
+                sys.exit('{}: {} is already mapped'.format(where, name))
+            table[code] = (name, segment, cls)
+    return table
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('codes', help='usb_hid_codes.h')
+    parser.add_argument('mappings', help='mapping file')
+    parser.add_argument('output', help='generated C source')
+    args = parser.parse_args()
+
+    codes = parse_codes(args.codes)
+    table = parse_mappings(args.mappings, codes)
+
+    lines = [
+        '// Generated by tools/gen_key_table.py from key_mappings.txt. Do not edit.',
+        '',
+        '#include "key_table.h"',
+        '',
+        'const char *const key_table_paths[256] = {',
+    ]
+    for code in sorted(table):
+        name, segment, _ = table[code]
+        lines.append('    [0x{:02x}] = KEY_TABLE_PATH_PREFIX "{}", // {}'.format(code, segment, name))
+    lines.append('};')
+
+    # KEY_CLASS_NORMAL is 0, so only the others are listed
+    lines += [
+        '',
+        'const uint8_t key_table_classes[256] = {',
+    ]
+    for code in sorted(table):
+        name, _, cls = table[code]
+        if cls != 'normal':
+            lines.append('    [0x{:02x}] = {}, // {}'.format(code, CLASSES[cls], name))
+    lines.append('};')
+
+    # Sorted the way strcmp() orders them, for a binary search
+    names = sorted(name for name, code in codes.items()
+                   if not name.startswith('KEY_MOD_') and 0 <= code <= 0xff)
+    lines += [
+        '',
+        'const key_table_code_t key_table_codes[] = {',
+    ]
+    for name in names:
+        lines.append('    {{ "{}", 0x{:02x} }},'.format(name, codes[name]))
+    lines += [
+        '};',
+        '',
+        'const size_t key_table_code_count = sizeof(key_table_codes) / sizeof(key_table_codes[0]);',
+    ]
+
+    with open(args.output, 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+"""A stand-in for the server that measures what reaches it: takes per-key
+GETs, batches and clock pings from the receiver (or from kb_replay -c) and,
+from each event's seq, tx and ts, works out how long it took to get here and
+whether any were lost, sent twice or overtaken on the way. Writes one JSON
+line per event with --log, and a summary when stopped (Ctrl-C or SIGTERM).
+
+The receiver's clock is lined up with this one from the clock pings (see
+main/key_clock.h), keeping the offset from the ping with the shortest round
+trip of each round. Latencies are only known once the first ping is in, and
+are no better than half that round trip."""
+
+import argparse
+import json
+import signal
+import threading
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def now_us():
+    return time.time_ns() // 1000
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, len(values) * p // 100)]
+
+
+class Receiver:
+    """What's been seen from one receiver, by address."""
+
+    def __init__(self):
+        self.pings = {}         # t0 -> (t1, t2) for pings not yet reported back
+        self.round_best = None  # (rtt, offset) of this round so far
+        self.offset = None      # our clock minus the receiver's
+        self.rtt = None
+        self.devices = {}       # device -> {'max_tx', 'missing'}
+
+
+class Stats:
+    def __init__(self, log):
+        self.lock = threading.Lock()
+        self.log = log
+        self.receivers = {}
+        self.events = 0
+        self.lost = 0
+        self.duplicates = 0
+        self.reordered = 0
+        self.latencies = []
+
+    def receiver(self, addr):
+        return self.receivers.setdefault(addr, Receiver())
+
+    def ping(self, addr, query, t1, t2):
+        with self.lock:
+            rx = self.receiver(addr)
+            if 'prev_t0' in query and 'prev_t3' in query:
+                t0, t3 = int(query['prev_t0']), int(query['prev_t3'])
+                if t0 in rx.pings:
+                    p1, p2 = rx.pings.pop(t0)
+                    rtt = (t3 - t0) - (p2 - p1)
+                    offset = ((p1 - t0) + (p2 - t3)) // 2
+                    if rx.round_best is None or rtt < rx.round_best[0]:
+                        rx.round_best = (rtt, offset)
+                    if rx.offset is None:
+                        rx.rtt, rx.offset = rx.round_best
+            if 't0' in query:
+                rx.pings[int(query['t0'])] = (t1, t2)
+            elif rx.round_best is not None:
+                # The round's over
+                rx.rtt, rx.offset = rx.round_best
+                rx.round_best = None
+                rx.pings.clear()
+
+    def event(self, addr, arrival_us, event):
+        with self.lock:
+            rx = self.receiver(addr)
+            record = dict(event, arrival_us=arrival_us)
+            self.events += 1
+            device = rx.devices.setdefault(event.get('device', 0),
+                                           {'max_tx': 0, 'missing': set()})
+            tx = event.get('tx', 0)
+            if tx == 1 and device['max_tx'] > 1:
+                # The receiver restarted
+                self.lost += len(device['missing'])
+                device.update(max_tx=0, missing=set())
+            if tx > device['max_tx']:
+                gap = tx - device['max_tx'] - 1
+                if gap > 0:
+                    device['missing'].update(range(device['max_tx'] + 1, tx))
+                    record['gap'] = gap
+                device['max_tx'] = tx
+            elif tx in device['missing']:
+                device['missing'].discard(tx)
+                record['reordered'] = True
+                self.reordered += 1
+            elif tx > 0:
+                record['duplicate'] = True
+                self.duplicates += 1
+            if rx.offset is not None and 'ts' in event:
+                latency = arrival_us - (event['ts'] + rx.offset)
+                record['latency_us'] = latency
+                self.latencies.append(latency)
+            if self.log is not None:
+                self.log.write(json.dumps(record) + '\n')
+                self.log.flush()
+
+    def summary(self):
+        with self.lock:
+            lost = self.lost + sum(len(d['missing']) for rx in self.receivers.values()
+                                   for d in rx.devices.values())
+            print('events:     {}'.format(self.events))
+            print('lost:       {} (gaps in tx)'.format(lost))
+            print('duplicates: {}'.format(self.duplicates))
+            print('reordered:  {}'.format(self.reordered))
+            if self.latencies:
+                print('latency us: p50 {} p95 {} p99 {} max {}'.format(
+                    percentile(self.latencies, 50), percentile(self.latencies, 95),
+                    percentile(self.latencies, 99), max(self.latencies)))
+            else:
+                print('latency us: no clock pings yet')
+            for addr, rx in self.receivers.items():
+                if rx.offset is not None:
+                    print('{}: clock offset {} us, ping round trip {} us'.format(
+                        addr, rx.offset, rx.rtt))
+
+
+def make_handler(stats, args):
+    prefix = args.prefix.rstrip('/') + '/'
+
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = 'HTTP/1.1'
+
+        def log_message(self, format, *a):
+            pass
+
+        def reply(self, status):
+            self.send_response(status)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+
+        def do_GET(self):
+            arrival = now_us()
+            url = urllib.parse.urlsplit(self.path)
+            query = dict(urllib.parse.parse_qsl(url.query))
+            addr = self.client_address[0]
+            if url.path == args.clock_path:
+                t2 = now_us()
+                self.reply(200)
+                stats.ping(addr, query, arrival, t2)
+                return
+            self.reply(200)
+            if url.path.startswith(prefix):
+                event = {'key': url.path[len(prefix):], 'type': 'press'}
+                for name in ('device', 'count', 'seq', 'tx', 'ts'):
+                    if name in query:
+                        event[name] = int(query[name])
+                stats.event(addr, arrival, event)
+
+        def do_POST(self):
+            arrival = now_us()
+            body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+            url = urllib.parse.urlsplit(self.path)
+            self.reply(200)
+            if url.path == args.batch_path:
+                try:
+                    events = json.loads(body)['events']
+                except (ValueError, KeyError):
+                    return
+                for event in events:
+                    stats.event(self.client_address[0], arrival, event)
+
+        do_PUT = do_POST
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--bind', default='0.0.0.0', help='address to listen on')
+    parser.add_argument('--port', type=int, default=8080, help='port (default 8080)')
+    parser.add_argument('--prefix', default='/remote/', help='per-key path prefix')
+    parser.add_argument('--batch-path', default='/remote/batch', help='KEY_BATCH_PATH')
+    parser.add_argument('--clock-path', default='/remote/clock', help='KEY_CLOCK_PATH')
+    parser.add_argument('--log', help='write one JSON line per event to this file')
+    args = parser.parse_args()
+
+    log = open(args.log, 'a') if args.log else None
+    stats = Stats(log)
+    server = ThreadingHTTPServer((args.bind, args.port), make_handler(stats, args))
+    print('listening on {}:{}'.format(args.bind, server.server_address[1]))
+    signal.signal(signal.SIGTERM, signal.default_int_handler)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    server.server_close()
+    stats.summary()
+    if log is not None:
+        log.close()
+
+
+if __name__ == '__main__':
+    main()
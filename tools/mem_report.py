@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Report the static RAM (initialised data and bss) of a static library or
+object files, per object and by largest symbol, using nm. With --budget, fail
+if the total is over it, so the build stops when a Kconfig size pushes the
+receiver's fixed memory past what's been set aside for it."""
+
+import argparse
+import collections
+import os
+import subprocess
+import sys
+
+# nm symbol types that take RAM: data, bss, and common symbols (bss too)
+DATA_TYPES = 'dD'
+BSS_TYPES = 'bBC'
+
+
+def read_symbols(nm, paths):
+    """Yields (object, name, kind, size) for every sized RAM symbol."""
+    out = subprocess.run([nm, '-S', '-A', '--defined-only'] + paths, check=True,
+                         stdout=subprocess.PIPE, universal_newlines=True).stdout
+    for line in out.splitlines():
+        # "lib.a:obj.o:00000000 00000010 B name" or "obj.o:..." for objects
+        where, _, rest = line.rpartition(':')
+        fields = rest.split()
+        if len(fields) != 4:
+            continue
+        _, size, kind, name = fields
+        if kind not in DATA_TYPES + BSS_TYPES:
+            continue
+        obj = os.path.basename(where.split(':')[-1]) if where else '?'
+        yield obj, name, 'data' if kind in DATA_TYPES else 'bss', int(size, 16)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--nm', default='nm', help='nm for the target (default nm)')
+    parser.add_argument('--budget', type=int, default=0,
+                        help='fail if the total is over this many bytes (0: no limit)')
+    parser.add_argument('--top', type=int, default=10, help='largest symbols to list')
+    parser.add_argument('inputs', nargs='+', help='static libraries or object files')
+    args = parser.parse_args()
+
+    objects = collections.defaultdict(lambda: {'data': 0, 'bss': 0})
+    symbols = []
+    for obj, name, kind, size in read_symbols(args.nm, args.inputs):
+        objects[obj][kind] += size
+        symbols.append((size, name, obj))
+
+    total_data = sum(o['data'] for o in objects.values())
+    total_bss = sum(o['bss'] for o in objects.values())
+    total = total_data + total_bss
+    width = max([len(o) for o in objects] + [len('total')])
+
+    print('Static RAM of {}'.format(', '.join(os.path.basename(p) for p in args.inputs)))
+    print('{:<{w}}  {:>7}  {:>7}  {:>7}'.format('object', 'data', 'bss', 'total', w=width))
+    for obj, sizes in sorted(objects.items(), key=lambda o: -(o[1]['data'] + o[1]['bss'])):
+        print('{:<{w}}  {:>7}  {:>7}  {:>7}'.format(obj, sizes['data'], sizes['bss'],
+                                                    sizes['data'] + sizes['bss'], w=width))
+    print('{:<{w}}  {:>7}  {:>7}  {:>7}'.format('total', total_data, total_bss, total,
+                                                w=width))
+    print('largest:')
+    for size, name, obj in sorted(symbols, reverse=True)[:args.top]:
+        print('  {:>7}  {} ({})'.format(size, name, obj))
+
+    if args.budget > 0:
+        if total > args.budget:
+            sys.exit('static RAM {} bytes is over the budget of {} (KEY_STATIC_RAM_BUDGET)'
+                     .format(total, args.budget))
+        print('budget: {} of {} bytes ({}%)'.format(total, args.budget,
+                                                    total * 100 // args.budget))
+
+
+if __name__ == '__main__':
+    main()